@@ -38,6 +38,7 @@ CONTRIBAPPFILES=$(CONTRIBDIR)/apps/httpserver/httpserver-netconn.c \
 	$(CONTRIBDIR)/apps/udpecho_raw/udpecho_raw.c \
 	$(CONTRIBDIR)/apps/tcpecho_raw/tcpecho_raw.c \
 	$(CONTRIBDIR)/apps/netio/netio.c \
+	$(CONTRIBDIR)/apps/iperf3/iperf3.c \
 	$(CONTRIBDIR)/apps/ping/ping.c \
 	$(CONTRIBDIR)/apps/snmp_private_mib/lwip_prvmib.c \
 	$(CONTRIBDIR)/apps/snmp_v3/snmpv3_dummy.c \
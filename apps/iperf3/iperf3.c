@@ -0,0 +1,1961 @@
+/*
+ * Copyright (c) 2001-2004 Swedish Institute of Computer Science.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+ * SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ *
+ * This file is part of the lwIP TCP/IP stack.
+ *
+ */
+
+/**
+ * @file
+ * iperf3 server and client using the raw API.
+ *
+ * Speaks the control protocol of iperf3 (https://github.com/esnet/iperf):
+ * the client connects to port 5201 and sends a cookie, the test parameters
+ * are exchanged as JSON, the streams connect (TCP connections that start
+ * with the cookie, or UDP "connect" datagrams), the client ends the test
+ * and both sides exchange their results as JSON. Supported are TCP and UDP,
+ * reverse mode (-R), parallel streams (-P), omitted seconds (-O) and tests
+ * limited by time, bytes or blocks; not supported is --bidir.
+ *
+ * Data is sent without copying it, from a static buffer (TCP: tcp_write()
+ * without TCP_WRITE_FLAG_COPY, UDP: a PBUF_REF behind the iperf3 header).
+ * UDP is paced by a timer of IPERF3_UDP_TICK_MS and timestamped with
+ * sys_now(), so the jitter has millisecond resolution.
+ *
+ * Throughput is reported every IPERF3_REPORT_MS and at the end of a test
+ * to the iperf3_report_fn, or printed with LWIP_PLATFORM_DIAG. Byte counters
+ * are 64 bit (LWIP_HAVE_INT64), tests move more than 4 GiB within seconds.
+ *
+ * All functions must be called from the tcpip_thread (or with the core
+ * locked), or from the main loop with NO_SYS.
+ */
+
+#include "lwip/opt.h"
+#include "lwip/debug.h"
+#include "lwip/def.h"
+#include "lwip/mem.h"
+#include "lwip/pbuf.h"
+#include "lwip/sys.h"
+#include "lwip/tcp.h"
+#include "lwip/udp.h"
+#include "lwip/timeouts.h"
+#include "iperf3.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#if LWIP_TCP && LWIP_CALLBACK_API
+
+#if !LWIP_HAVE_INT64
+#error "iperf3 needs 64 bit integers (LWIP_HAVE_INT64)"
+#endif
+
+#ifndef U64_F
+#define U64_F PRIu64
+#endif
+
+/** Largest number of parallel streams of a test */
+#ifndef IPERF3_MAX_STREAMS
+#define IPERF3_MAX_STREAMS    8
+#endif
+
+/** Size of the static buffer data is sent from, the limit of the UDP datagram size */
+#ifndef IPERF3_BUF_SIZE
+#define IPERF3_BUF_SIZE       (16 * 1024)
+#endif
+
+/** Size of the JSON buffer of a test, longer results of the peer are not parsed */
+#ifndef IPERF3_JSON_SIZE
+#define IPERF3_JSON_SIZE      2048
+#endif
+
+/** Interval of the throughput reports while a test runs, 0 to only report results */
+#ifndef IPERF3_REPORT_MS
+#define IPERF3_REPORT_MS      1000
+#endif
+
+/** A test that does not advance (setup, results) for this long is aborted */
+#ifndef IPERF3_TIMEOUT_MS
+#define IPERF3_TIMEOUT_MS     10000
+#endif
+
+/** Pacing timer of UDP senders */
+#ifndef IPERF3_UDP_TICK_MS
+#define IPERF3_UDP_TICK_MS    1
+#endif
+
+/** Datagrams per stream and IPERF3_UDP_TICK_MS when the bandwidth is unlimited */
+#ifndef IPERF3_UDP_BURST
+#define IPERF3_UDP_BURST      16
+#endif
+
+#ifndef IPERF3_DEBUG
+#define IPERF3_DEBUG          LWIP_DBG_OFF
+#endif
+
+/* IPERF3_CPU_TIME() may be defined to return the CPU time used by the
+ * process in milliseconds (u32_t) to have it in the reports and results. */
+
+#define IPERF3_TICK_MS        (IPERF3_REPORT_MS ? IPERF3_REPORT_MS : 1000)
+
+#define IPERF3_COOKIE_SIZE    37
+#define IPERF3_MAX_JSON_LEN   (64 * 1024)
+
+#define IPERF3_DEFAULT_TCP_LEN  (128 * 1024)
+#define IPERF3_DEFAULT_UDP_LEN  1460
+
+/* Control states, sent as signed chars */
+#define IPERF3_TEST_START       1
+#define IPERF3_TEST_RUNNING     2
+#define IPERF3_TEST_END         4
+#define IPERF3_PARAM_EXCHANGE   9
+#define IPERF3_CREATE_STREAMS   10
+#define IPERF3_SERVER_TERMINATE 11
+#define IPERF3_CLIENT_TERMINATE 12
+#define IPERF3_EXCHANGE_RESULTS 13
+#define IPERF3_DISPLAY_RESULTS  14
+#define IPERF3_IPERF_DONE       16
+#define IPERF3_ACCESS_DENIED    0xff  /* -1 */
+#define IPERF3_SERVER_ERROR     0xfe  /* -2 */
+
+/* iperf3 error numbers sent after IPERF3_SERVER_ERROR */
+#define IPERF3_IENUMSTREAMS     6
+#define IPERF3_IEUNIMP          13
+#define IPERF3_IEUDPBLOCKSIZE   20
+
+/* UDP stream setup, the values are sent in the byte order of the client */
+#define IPERF3_UDP_CONNECT_MSG        0x36373839
+#define IPERF3_UDP_CONNECT_REPLY      0x39383736
+#define IPERF3_UDP_CONNECT_MSG_OLD    123456789
+#define IPERF3_UDP_CONNECT_REPLY_OLD  987654321
+
+/* What the control connection reads next */
+#define IPERF3_IN_COOKIE      0
+#define IPERF3_IN_STATE       1
+#define IPERF3_IN_JSON_LEN    2
+#define IPERF3_IN_JSON        3
+#define IPERF3_IN_ERROR       4
+
+struct iperf3_session;
+
+struct iperf3_stream {
+  struct iperf3_stream *next;
+  struct iperf3_session *s;
+  struct tcp_pcb *tcp;
+#if LWIP_UDP
+  struct udp_pcb *udp;      /* client only, the server sends through its pcb */
+  ip_addr_t remote_ip;
+  u16_t remote_port;
+#endif /* LWIP_UDP */
+  /** iperf3 stream id, 0 while connecting */
+  u8_t id;
+  /** server: bytes of the cookie received */
+  u8_t cookie_len;
+  u64_t bytes;
+  u64_t report_bytes;
+  /* UDP */
+  u64_t paced;              /* bytes sent since the pacing started */
+  u32_t packet_count;       /* sent, or highest received */
+  u32_t omit_packets;
+  u32_t lost;
+  u32_t report_packets;
+  u32_t report_lost;
+  u32_t prev_transit;
+  u32_t jitter16;           /* us, times 16 */
+  u8_t transit_valid;
+  /* results of the peer */
+  u64_t remote_bytes;
+  u32_t remote_packets;
+  u32_t remote_lost;
+  u32_t remote_jitter_us;
+};
+
+struct iperf3_session {
+  /** NULL for a client */
+  struct iperf3_server *server;
+  struct tcp_pcb *ctrl;
+  ip_addr_t remote_ip;
+  u16_t port;
+  struct iperf3_settings settings;
+  /** last control state sent or received */
+  u8_t state;
+  u8_t bidir;
+  u8_t udp64;
+  u8_t sender;
+  u8_t running;
+  u8_t omitting;
+  /** connected streams */
+  u8_t streams;
+  struct iperf3_stream *stream_list;
+  /* control input */
+  u8_t in;
+  u32_t in_len;
+  u32_t in_pos;
+  u8_t in_buf[IPERF3_COOKIE_SIZE];
+  u8_t cookie[IPERF3_COOKIE_SIZE];
+  /** bytes (or blocks * len) that end the test, 0 for none */
+  u64_t limit;
+  u64_t total;
+  /** time of the last step, for IPERF3_TIMEOUT_MS */
+  u32_t time;
+  u32_t start;
+  u32_t measure_start;
+  u32_t end;
+  u32_t cpu_start;
+  u32_t cpu_end;
+  u32_t report_time;
+  u32_t report_cpu;
+  u32_t udp_start;
+  iperf3_report_fn fn;
+  void *arg;
+  char json[IPERF3_JSON_SIZE];
+};
+
+struct iperf3_server {
+  struct tcp_pcb *listen;
+#if LWIP_UDP
+  struct udp_pcb *udp;
+#endif /* LWIP_UDP */
+  /** iperf3 runs one test at a time */
+  struct iperf3_session *session;
+  iperf3_report_fn fn;
+  void *arg;
+};
+
+static const u8_t iperf3_buf[IPERF3_BUF_SIZE] = { 0 };
+
+/** pcb aborted by iperf3_tcp_close(): the running callback of that pcb must return ERR_ABRT */
+static struct tcp_pcb *iperf3_aborted;
+
+static void iperf3_tick(void *arg);
+#if LWIP_UDP
+static void iperf3_udp_tick(void *arg);
+#endif /* LWIP_UDP */
+static err_t iperf3_client_connect_stream(struct iperf3_session *s);
+
+static void
+iperf3_put32(u8_t *b, u32_t v)
+{
+  b[0] = (u8_t)(v >> 24);
+  b[1] = (u8_t)(v >> 16);
+  b[2] = (u8_t)(v >> 8);
+  b[3] = (u8_t)v;
+}
+
+static u32_t
+iperf3_get32(const u8_t *b)
+{
+  return ((u32_t)b[0] << 24) | ((u32_t)b[1] << 16) | ((u32_t)b[2] << 8) | b[3];
+}
+
+#if LWIP_UDP
+/* The UDP connect messages are sent in the byte order of the client */
+static void
+iperf3_put32le(u8_t *b, u32_t v)
+{
+  b[0] = (u8_t)v;
+  b[1] = (u8_t)(v >> 8);
+  b[2] = (u8_t)(v >> 16);
+  b[3] = (u8_t)(v >> 24);
+}
+
+static u32_t
+iperf3_get32le(const u8_t *b)
+{
+  return ((u32_t)b[3] << 24) | ((u32_t)b[2] << 16) | ((u32_t)b[1] << 8) | b[0];
+}
+#endif /* LWIP_UDP */
+
+static u32_t
+iperf3_cpu_time(void)
+{
+#ifdef IPERF3_CPU_TIME
+  return IPERF3_CPU_TIME();
+#else
+  return 0;
+#endif
+}
+
+/*-----------------------------------------------------------------------------------*/
+/* Reports */
+
+static void
+iperf3_print(const struct iperf3_report *r)
+{
+  static const char *const types[] = { "", " total", " sum", "" };
+  u64_t kbps = r->ms ? (r->bytes / r->ms) * 8 + ((r->bytes % r->ms) * 8) / r->ms : 0;
+  char id[8];
+
+  if (r->type == IPERF3_REPORT_ABORT) {
+    LWIP_PLATFORM_DIAG(("iperf3: test aborted\n"));
+    return;
+  }
+  if (r->stream) {
+    snprintf(id, sizeof(id), "%u", r->stream);
+  } else {
+    snprintf(id, sizeof(id), "SUM");
+  }
+  if (r->udp) {
+    LWIP_PLATFORM_DIAG(("iperf3 [%s]%s %s %"U32_F".%03"U32_F" s  %"U64_F" KBytes  %"U64_F" Kbits/s  %"U32_F".%03"U32_F" ms  %"U32_F"/%"U32_F" lost\n",
+                        id, types[r->type], r->sender ? "sent" : "received", r->ms / 1000, r->ms % 1000,
+                        r->bytes / 1024, kbps, r->jitter_us / 1000, r->jitter_us % 1000, r->lost, r->packets));
+  } else {
+    LWIP_PLATFORM_DIAG(("iperf3 [%s]%s %s %"U32_F".%03"U32_F" s  %"U64_F" KBytes  %"U64_F" Kbits/s\n",
+                        id, types[r->type], r->sender ? "sent" : "received", r->ms / 1000, r->ms % 1000,
+                        r->bytes / 1024, kbps));
+  }
+}
+
+static void
+iperf3_report(struct iperf3_session *s, const struct iperf3_report *r)
+{
+  if (s->fn != NULL) {
+    s->fn(s->arg, r);
+  } else {
+    iperf3_print(r);
+  }
+}
+
+static void
+iperf3_interval_reports(struct iperf3_session *s, u32_t now)
+{
+  struct iperf3_stream *st;
+  struct iperf3_report r;
+  u32_t cpu = iperf3_cpu_time();
+
+  for (st = s->stream_list; st != NULL; st = st->next) {
+    if (st->id == 0) {
+      continue;
+    }
+    memset(&r, 0, sizeof(r));
+    r.type = IPERF3_REPORT_INTERVAL;
+    r.stream = st->id;
+    r.udp = s->settings.udp;
+    r.sender = s->sender;
+    r.ms = now - s->report_time;
+    r.bytes = st->bytes - st->report_bytes;
+    if (s->settings.udp && !s->sender) {
+      r.packets = st->packet_count - st->report_packets;
+      r.lost = (st->lost > st->report_lost) ? st->lost - st->report_lost : 0;
+      r.jitter_us = st->jitter16 >> 4;
+    } else if (s->settings.udp) {
+      r.packets = st->packet_count - st->report_packets;
+    }
+    r.cpu_ms = cpu - s->report_cpu;
+    st->report_bytes = st->bytes;
+    st->report_packets = st->packet_count;
+    st->report_lost = st->lost;
+    iperf3_report(s, &r);
+  }
+  s->report_time = now;
+  s->report_cpu = cpu;
+}
+
+/** Reports the streams and the sum after the results were exchanged */
+static void
+iperf3_final_reports(struct iperf3_session *s)
+{
+  struct iperf3_stream *st;
+  struct iperf3_report r, sum;
+  u32_t n = 0;
+
+  memset(&sum, 0, sizeof(sum));
+  sum.type = IPERF3_REPORT_END;
+  sum.udp = s->settings.udp;
+  sum.sender = s->sender;
+  sum.ms = s->end - s->measure_start;
+  sum.cpu_ms = s->cpu_end - s->cpu_start;
+
+  for (st = s->stream_list; st != NULL; st = st->next) {
+    if (st->id == 0) {
+      continue;
+    }
+    memset(&r, 0, sizeof(r));
+    r.type = IPERF3_REPORT_STREAM;
+    r.stream = st->id;
+    r.udp = sum.udp;
+    r.sender = sum.sender;
+    r.ms = sum.ms;
+    r.cpu_ms = sum.cpu_ms;
+    r.bytes = st->bytes;
+    r.remote_bytes = st->remote_bytes;
+    if (s->settings.udp) {
+      if (s->sender) {
+        r.packets = st->remote_packets;
+        r.lost = st->remote_lost;
+        r.jitter_us = st->remote_jitter_us;
+      } else {
+        r.packets = st->packet_count - st->omit_packets;
+        r.lost = st->lost;
+        r.jitter_us = st->jitter16 >> 4;
+      }
+    }
+    iperf3_report(s, &r);
+    sum.bytes += r.bytes;
+    sum.remote_bytes += r.remote_bytes;
+    sum.packets += r.packets;
+    sum.lost += r.lost;
+    sum.jitter_us += r.jitter_us;
+    n++;
+  }
+  if (n) {
+    sum.jitter_us /= n;
+  }
+  iperf3_report(s, &sum);
+}
+
+/*-----------------------------------------------------------------------------------*/
+/* JSON: just enough to read the flat parameter object and the results */
+
+typedef void (*iperf3_json_fn)(void *arg, const char *key, size_t key_len, const char *val, size_t val_len);
+
+#define IPERF3_JSON_KEY(key, key_len, name) \
+  (((key_len) == sizeof(name) - 1) && (memcmp((key), (name), sizeof(name) - 1) == 0))
+
+static int
+iperf3_json_isws(char c)
+{
+  return (c == ' ') || (c == '\t') || (c == '\r') || (c == '\n');
+}
+
+static const char *
+iperf3_json_ws(const char *p, const char *end)
+{
+  while ((p < end) && iperf3_json_isws(*p)) {
+    p++;
+  }
+  return p;
+}
+
+/** Returns the end of the value (string, number, object, ...) at p */
+static const char *
+iperf3_json_skip(const char *p, const char *end)
+{
+  int depth = 0;
+  int str = 0;
+
+  for (; p < end; p++) {
+    if (str) {
+      if ((*p == '\\') && (p + 1 < end)) {
+        p++;
+      } else if (*p == '"') {
+        str = 0;
+        if (depth == 0) {
+          return p + 1;
+        }
+      }
+    } else if (*p == '"') {
+      str = 1;
+    } else if ((*p == '{') || (*p == '[')) {
+      depth++;
+    } else if ((*p == '}') || (*p == ']')) {
+      if (depth == 0) {
+        return p;
+      }
+      if (--depth == 0) {
+        return p + 1;
+      }
+    } else if ((*p == ',') && (depth == 0)) {
+      return p;
+    }
+  }
+  return end;
+}
+
+/** Calls fn for each member of the object at p (strings without the quotes),
+ * returns the end of the object */
+static const char *
+iperf3_json_object(const char *p, const char *end, iperf3_json_fn fn, void *arg)
+{
+  p = iperf3_json_ws(p, end);
+  if ((p >= end) || (*p != '{')) {
+    return end;
+  }
+  p++;
+  for (;;) {
+    const char *key, *val, *val_end;
+    size_t key_len;
+
+    p = iperf3_json_ws(p, end);
+    if (p >= end) {
+      return end;
+    }
+    if (*p == ',') {
+      p++;
+      continue;
+    }
+    if (*p != '"') {
+      return (*p == '}') ? p + 1 : end;
+    }
+    key = ++p;
+    while ((p < end) && (*p != '"')) {
+      p++;
+    }
+    if (p >= end) {
+      return end;
+    }
+    key_len = (size_t)(p - key);
+    p = iperf3_json_ws(p + 1, end);
+    if ((p >= end) || (*p != ':')) {
+      return end;
+    }
+    val = iperf3_json_ws(p + 1, end);
+    p = val_end = iperf3_json_skip(val, end);
+    while ((val_end > val) && iperf3_json_isws(val_end[-1])) {
+      val_end--;
+    }
+    if ((val_end - val >= 2) && (*val == '"')) {
+      val++;
+      val_end--;
+    }
+    fn(arg, key, key_len, val, (size_t)(val_end - val));
+  }
+}
+
+/** Parses a non-negative number (with fraction and exponent) times 10^scale,
+ * saturating at 2^64 - 1 */
+static u64_t
+iperf3_json_num(const char *val, size_t len, int scale)
+{
+  u64_t m = 0;
+  int exp = scale;
+  size_t i = 0;
+
+  for (; (i < len) && (val[i] >= '0') && (val[i] <= '9'); i++) {
+    if (m < 1000000000000000000ULL) {
+      m = m * 10 + (u64_t)(val[i] - '0');
+    } else {
+      exp++;
+    }
+  }
+  if ((i < len) && (val[i] == '.')) {
+    for (i++; (i < len) && (val[i] >= '0') && (val[i] <= '9'); i++) {
+      if (m < 1000000000000000000ULL) {
+        m = m * 10 + (u64_t)(val[i] - '0');
+        exp--;
+      }
+    }
+  }
+  if ((i < len) && ((val[i] == 'e') || (val[i] == 'E'))) {
+    int neg = 0, e = 0;
+    i++;
+    if ((i < len) && ((val[i] == '-') || (val[i] == '+'))) {
+      neg = (val[i] == '-');
+      i++;
+    }
+    for (; (i < len) && (val[i] >= '0') && (val[i] <= '9'); i++) {
+      if (e < 100) {
+        e = e * 10 + (val[i] - '0');
+      }
+    }
+    exp += neg ? -e : e;
+  }
+  for (; (exp < 0) && (m != 0); exp++) {
+    m /= 10;
+  }
+  for (; (exp > 0) && (m != 0); exp--) {
+    if (m > 0xffffffffffffffffULL / 10) {
+      return 0xffffffffffffffffULL;
+    }
+    m *= 10;
+  }
+  return m;
+}
+
+/** iperf3_json_num() of a value that fits 32 bit, saturating at 0xffffffff */
+static u32_t
+iperf3_json_u32(const char *val, size_t len, int scale)
+{
+  u64_t v = iperf3_json_num(val, len, scale);
+  return (v > 0xffffffffUL) ? 0xffffffffUL : (u32_t)v;
+}
+
+static u8_t
+iperf3_json_bool(const char *val, size_t len)
+{
+  if ((len == 4) && (memcmp(val, "true", 4) == 0)) {
+    return 1;
+  }
+  return iperf3_json_num(val, len, 0) != 0;
+}
+
+/*-----------------------------------------------------------------------------------*/
+/* Sessions and streams */
+
+static void
+iperf3_tcp_close(struct tcp_pcb *pcb)
+{
+  tcp_arg(pcb, NULL);
+  tcp_recv(pcb, NULL);
+  tcp_sent(pcb, NULL);
+  tcp_err(pcb, NULL);
+  if (tcp_close(pcb) != ERR_OK) {
+    tcp_abort(pcb);
+    iperf3_aborted = pcb;
+  }
+}
+
+static struct iperf3_session *
+iperf3_session_new(iperf3_report_fn fn, void *arg)
+{
+  struct iperf3_session *s;
+
+  s = (struct iperf3_session *)mem_malloc(sizeof(struct iperf3_session));
+  if (s == NULL) {
+    return NULL;
+  }
+  memset(s, 0, sizeof(struct iperf3_session));
+  s->fn = fn;
+  s->arg = arg;
+  s->time = sys_now();
+  return s;
+}
+
+static void
+iperf3_stream_free(struct iperf3_stream *st)
+{
+  if (st->tcp != NULL) {
+    iperf3_tcp_close(st->tcp);
+  }
+#if LWIP_UDP
+  if (st->udp != NULL) {
+    udp_remove(st->udp);
+  }
+#endif /* LWIP_UDP */
+  mem_free(st);
+}
+
+/** Closes everything, reports IPERF3_REPORT_ABORT if the test did not finish */
+static void
+iperf3_session_free(struct iperf3_session *s, u8_t aborted)
+{
+  struct iperf3_stream *st;
+
+  LWIP_DEBUGF(IPERF3_DEBUG, ("iperf3: test %s\n", aborted ? "aborted" : "done"));
+  if (aborted) {
+    struct iperf3_report r;
+    memset(&r, 0, sizeof(r));
+    r.type = IPERF3_REPORT_ABORT;
+    r.udp = s->settings.udp;
+    r.sender = s->sender;
+    iperf3_report(s, &r);
+  }
+  sys_untimeout(iperf3_tick, s);
+#if LWIP_UDP
+  sys_untimeout(iperf3_udp_tick, s);
+#endif /* LWIP_UDP */
+  while ((st = s->stream_list) != NULL) {
+    s->stream_list = st->next;
+    iperf3_stream_free(st);
+  }
+  if (s->ctrl != NULL) {
+    iperf3_tcp_close(s->ctrl);
+  }
+  if (s->server != NULL) {
+    s->server->session = NULL;
+  }
+  mem_free(s);
+}
+
+/** Allocates a stream and appends it (iperf3 numbers the streams in order) */
+static struct iperf3_stream *
+iperf3_stream_new(struct iperf3_session *s)
+{
+  struct iperf3_stream *st, **p;
+
+  st = (struct iperf3_stream *)mem_malloc(sizeof(struct iperf3_stream));
+  if (st == NULL) {
+    return NULL;
+  }
+  memset(st, 0, sizeof(struct iperf3_stream));
+  st->s = s;
+  for (p = &s->stream_list; *p != NULL; p = &(*p)->next);
+  *p = st;
+  return st;
+}
+
+static void
+iperf3_stream_remove(struct iperf3_session *s, struct iperf3_stream *st)
+{
+  struct iperf3_stream **p;
+
+  for (p = &s->stream_list; *p != NULL; p = &(*p)->next) {
+    if (*p == st) {
+      *p = st->next;
+      break;
+    }
+  }
+  iperf3_stream_free(st);
+}
+
+static void
+iperf3_expect(struct iperf3_session *s, u8_t in, u32_t len)
+{
+  s->in = in;
+  s->in_len = len;
+  s->in_pos = 0;
+}
+
+static err_t
+iperf3_ctrl_write(struct iperf3_session *s, const void *data, u16_t len, u8_t more)
+{
+  err_t err;
+
+  if (s->ctrl == NULL) {
+    return ERR_CONN;
+  }
+  err = tcp_write(s->ctrl, data, len, (u8_t)(TCP_WRITE_FLAG_COPY | (more ? TCP_WRITE_FLAG_MORE : 0)));
+  if ((err == ERR_OK) && !more) {
+    err = tcp_output(s->ctrl);
+  }
+  return err;
+}
+
+static err_t
+iperf3_send_state(struct iperf3_session *s, u8_t state)
+{
+  LWIP_DEBUGF(IPERF3_DEBUG | LWIP_DBG_TRACE, ("iperf3: send state %d\n", (s8_t)state));
+  s->state = state;
+  return iperf3_ctrl_write(s, &state, 1, 0);
+}
+
+static err_t
+iperf3_send_json(struct iperf3_session *s, int len)
+{
+  u8_t hdr[4];
+  err_t err;
+
+  if ((len < 0) || (len >= (int)sizeof(s->json))) {
+    return ERR_MEM;
+  }
+  iperf3_put32(hdr, (u32_t)len);
+  err = iperf3_ctrl_write(s, hdr, sizeof(hdr), 1);
+  if (err == ERR_OK) {
+    err = iperf3_ctrl_write(s, s->json, (u16_t)len, 0);
+  }
+  return err;
+}
+
+static err_t
+iperf3_send_error(struct iperf3_session *s, u32_t ierrno)
+{
+  u8_t msg[9];
+
+  LWIP_DEBUGF(IPERF3_DEBUG | LWIP_DBG_LEVEL_WARNING, ("iperf3: refusing test, error %"U32_F"\n", ierrno));
+  msg[0] = IPERF3_SERVER_ERROR;
+  iperf3_put32(&msg[1], ierrno);
+  iperf3_put32(&msg[5], 0);
+  return iperf3_ctrl_write(s, msg, sizeof(msg), 0);
+}
+
+/** Sets the limits of a test once the settings are known */
+static void
+iperf3_settings_apply(struct iperf3_session *s, u8_t client)
+{
+  struct iperf3_settings *set = &s->settings;
+
+  if (set->parallel == 0) {
+    set->parallel = 1;
+  }
+  if (set->len == 0) {
+    set->len = set->udp ? IPERF3_DEFAULT_UDP_LEN : IPERF3_DEFAULT_TCP_LEN;
+  }
+  s->sender = client ? !set->reverse : set->reverse;
+  s->limit = set->bytes ? set->bytes : (u64_t)set->blocks * set->len;
+}
+
+/*-----------------------------------------------------------------------------------*/
+/* Parameters and results */
+
+static void
+iperf3_param(void *arg, const char *key, size_t key_len, const char *val, size_t val_len)
+{
+  struct iperf3_session *s = (struct iperf3_session *)arg;
+  struct iperf3_settings *set = &s->settings;
+  u64_t v = iperf3_json_num(val, val_len, 0);
+  u32_t v32 = (v > 0xffffffffUL) ? 0xffffffffUL : (u32_t)v;
+
+  if (IPERF3_JSON_KEY(key, key_len, "udp")) {
+    set->udp = iperf3_json_bool(val, val_len);
+  } else if (IPERF3_JSON_KEY(key, key_len, "reverse")) {
+    set->reverse = iperf3_json_bool(val, val_len);
+  } else if (IPERF3_JSON_KEY(key, key_len, "bidirectional")) {
+    s->bidir = iperf3_json_bool(val, val_len);
+  } else if (IPERF3_JSON_KEY(key, key_len, "udp_counters_64bit")) {
+    s->udp64 = iperf3_json_bool(val, val_len);
+  } else if (IPERF3_JSON_KEY(key, key_len, "omit")) {
+    set->omit = (u8_t)LWIP_MIN(v32, 255);
+  } else if (IPERF3_JSON_KEY(key, key_len, "time")) {
+    set->time = v32;
+  } else if (IPERF3_JSON_KEY(key, key_len, "num")) {
+    set->bytes = v;
+  } else if (IPERF3_JSON_KEY(key, key_len, "blockcount")) {
+    set->blocks = v32;
+  } else if (IPERF3_JSON_KEY(key, key_len, "parallel")) {
+    set->parallel = (u8_t)LWIP_MIN(v32, 255);
+  } else if (IPERF3_JSON_KEY(key, key_len, "len")) {
+    set->len = v32;
+  } else if (IPERF3_JSON_KEY(key, key_len, "bandwidth")) {
+    set->bandwidth = v;
+  }
+}
+
+static int
+iperf3_params_json(struct iperf3_session *s)
+{
+  const struct iperf3_settings *set = &s->settings;
+
+  return snprintf(s->json, sizeof(s->json),
+                  "{\"%s\":true,\"omit\":%u,\"time\":%"U32_F",\"num\":%"U64_F",\"blockcount\":%"U32_F","
+                  "\"parallel\":%u,\"len\":%"U32_F",\"bandwidth\":%"U64_F"%s,\"pacing_timer\":1000,"
+                  "\"client_version\":\"3.1\"}",
+                  set->udp ? "udp" : "tcp", set->omit, set->time, set->bytes, set->blocks,
+                  set->parallel, set->len, set->bandwidth, set->reverse ? ",\"reverse\":true" : "");
+}
+
+static int
+iperf3_results_json(struct iperf3_session *s)
+{
+  struct iperf3_stream *st;
+  size_t size = sizeof(s->json);
+  u32_t ms = s->end - s->measure_start;
+  u32_t cpu = ms ? (s->cpu_end - s->cpu_start) * 10000 / ms : 0;
+  int n;
+
+  n = snprintf(s->json, size,
+               "{\"cpu_util_total\":%"U32_F".%02"U32_F",\"cpu_util_user\":%"U32_F".%02"U32_F","
+               "\"cpu_util_system\":0,\"sender_has_retransmits\":%d,\"streams\":[",
+               cpu / 100, cpu % 100, cpu / 100, cpu % 100, s->sender ? 0 : -1);
+  for (st = s->stream_list; st != NULL; st = st->next) {
+    u32_t jitter = 0, errors = 0;
+    if (st->id == 0) {
+      continue;
+    }
+    if ((n < 0) || ((size_t)n >= size)) {
+      return -1;
+    }
+    if (s->settings.udp && !s->sender) {
+      jitter = st->jitter16 >> 4;
+      errors = st->lost;
+    }
+    n += snprintf(s->json + n, size - (size_t)n,
+                  "%s{\"id\":%u,\"bytes\":%"U64_F",\"retransmits\":-1,\"jitter\":%"U32_F".%06"U32_F","
+                  "\"errors\":%"U32_F",\"packets\":%"U32_F",\"start_time\":0,\"end_time\":%"U32_F".%03"U32_F"}",
+                  (st == s->stream_list) ? "" : ",", st->id, st->bytes, jitter / 1000000, jitter % 1000000,
+                  errors, st->packet_count - st->omit_packets, ms / 1000, ms % 1000);
+  }
+  if ((n < 0) || ((size_t)n >= size)) {
+    return -1;
+  }
+  n += snprintf(s->json + n, size - (size_t)n, "]}");
+  return n;
+}
+
+/** One stream of the peer's results */
+struct iperf3_result {
+  u32_t id;
+  u64_t bytes;
+  u32_t packets;
+  u32_t errors;
+  u32_t jitter_us;
+};
+
+static void
+iperf3_result_stream(void *arg, const char *key, size_t key_len, const char *val, size_t val_len)
+{
+  struct iperf3_result *r = (struct iperf3_result *)arg;
+
+  if (IPERF3_JSON_KEY(key, key_len, "id")) {
+    r->id = iperf3_json_u32(val, val_len, 0);
+  } else if (IPERF3_JSON_KEY(key, key_len, "bytes")) {
+    r->bytes = iperf3_json_num(val, val_len, 0);
+  } else if (IPERF3_JSON_KEY(key, key_len, "packets")) {
+    r->packets = iperf3_json_u32(val, val_len, 0);
+  } else if (IPERF3_JSON_KEY(key, key_len, "errors")) {
+    r->errors = iperf3_json_u32(val, val_len, 0);
+  } else if (IPERF3_JSON_KEY(key, key_len, "jitter")) {
+    r->jitter_us = iperf3_json_u32(val, val_len, 6);
+  }
+}
+
+static void
+iperf3_result(void *arg, const char *key, size_t key_len, const char *val, size_t val_len)
+{
+  struct iperf3_session *s = (struct iperf3_session *)arg;
+  const char *p = val, *end = val + val_len;
+
+  if (!IPERF3_JSON_KEY(key, key_len, "streams") || (val_len == 0) || (*p != '[')) {
+    return;
+  }
+  for (p++; p < end; ) {
+    struct iperf3_result r;
+    struct iperf3_stream *st;
+
+    p = iperf3_json_ws(p, end);
+    if ((p >= end) || (*p == ']')) {
+      break;
+    }
+    if (*p == ',') {
+      p++;
+      continue;
+    }
+    memset(&r, 0, sizeof(r));
+    p = iperf3_json_object(p, end, iperf3_result_stream, &r);
+    for (st = s->stream_list; st != NULL; st = st->next) {
+      if ((st->id != 0) && (st->id == r.id)) {
+        st->remote_bytes = r.bytes;
+        st->remote_packets = r.packets;
+        st->remote_lost = r.errors;
+        st->remote_jitter_us = r.jitter_us;
+        break;
+      }
+    }
+  }
+}
+
+/*-----------------------------------------------------------------------------------*/
+/* Data */
+
+/** Ends the test of a client (sends TEST_END), returns ERR_CLSD if the session is gone */
+static err_t
+iperf3_client_end(struct iperf3_session *s);
+
+/** Ends the test of a client when the byte or block limit is reached */
+static err_t
+iperf3_check_limit(struct iperf3_session *s)
+{
+  if (s->running && (s->server == NULL) && s->limit && (s->total >= s->limit)) {
+    return iperf3_client_end(s);
+  }
+  return ERR_OK;
+}
+
+static void
+iperf3_tcp_send(struct iperf3_stream *st)
+{
+  struct iperf3_session *s = st->s;
+  struct tcp_pcb *pcb = st->tcp;
+  err_t err = ERR_OK;
+
+  if (pcb == NULL) {
+    return;
+  }
+  while (s->running && (!s->limit || (s->total < s->limit))) {
+    u32_t len = LWIP_MIN((u32_t)tcp_sndbuf(pcb), IPERF3_BUF_SIZE);
+    if (s->limit) {
+      len = (u32_t)LWIP_MIN((u64_t)len, s->limit - s->total);
+    }
+    if (len == 0) {
+      break;
+    }
+    err = tcp_write(pcb, iperf3_buf, (u16_t)len, TCP_WRITE_FLAG_MORE);
+    if (err != ERR_OK) {
+      /* ERR_MEM: out of segments, continue when data is acked */
+      break;
+    }
+    st->bytes += len;
+    s->total += len;
+  }
+  tcp_output(pcb);
+}
+
+#if LWIP_UDP
+static err_t
+iperf3_udp_send(struct iperf3_stream *st)
+{
+  struct iperf3_session *s = st->s;
+  u16_t hdr = s->udp64 ? 16 : 12;
+  u32_t now = sys_now();
+  struct pbuf *p, *q;
+  u8_t *h;
+  err_t err;
+
+  p = pbuf_alloc(PBUF_TRANSPORT, hdr, PBUF_RAM);
+  if (p == NULL) {
+    return ERR_MEM;
+  }
+  if (s->settings.len > hdr) {
+    q = pbuf_alloc(PBUF_RAW, (u16_t)(s->settings.len - hdr), PBUF_REF);
+    if (q == NULL) {
+      pbuf_free(p);
+      return ERR_MEM;
+    }
+    q->payload = LWIP_CONST_CAST(void *, iperf3_buf);
+    pbuf_cat(p, q);
+  }
+  st->packet_count++;
+  h = (u8_t *)p->payload;
+  iperf3_put32(h, now / 1000);
+  iperf3_put32(h + 4, (now % 1000) * 1000);
+  if (s->udp64) {
+    iperf3_put32(h + 8, 0);
+  }
+  iperf3_put32(h + hdr - 4, st->packet_count);
+  if (st->udp != NULL) {
+    err = udp_send(st->udp, p);
+  } else {
+    err = udp_sendto(s->server->udp, p, &st->remote_ip, st->remote_port);
+  }
+  pbuf_free(p);
+  if (err == ERR_OK) {
+    st->bytes += s->settings.len;
+    st->paced += s->settings.len;
+    s->total += s->settings.len;
+  } else {
+    st->packet_count--;
+  }
+  return err;
+}
+
+/** Bytes a stream may have sent 'ms' after the pacing started */
+static u64_t
+iperf3_udp_allowed(u64_t bandwidth, u32_t ms)
+{
+  u64_t rate = bandwidth / 8;
+  return (rate / 1000) * ms + ((rate % 1000) * ms) / 1000;
+}
+
+/** Sends what the bandwidth allows, returns ERR_CLSD if the session is gone */
+static err_t
+iperf3_udp_pace(struct iperf3_session *s)
+{
+  struct iperf3_stream *st;
+  u64_t bandwidth = s->settings.bandwidth;
+  u64_t allowed = iperf3_udp_allowed(bandwidth, sys_now() - s->udp_start);
+  u64_t burst = LWIP_MAX((u64_t)s->settings.len, bandwidth / 8 / 100);
+
+  for (st = s->stream_list; st != NULL; st = st->next) {
+    int n = 0;
+    if (st->id == 0) {
+      continue;
+    }
+    if (bandwidth && (allowed - st->paced > burst)) {
+      /* do not catch up more than 10ms after a stall */
+      st->paced = allowed - burst;
+    }
+    while (s->running && (!s->limit || (s->total < s->limit))) {
+      if (bandwidth ? (allowed - st->paced < s->settings.len) : (n >= IPERF3_UDP_BURST)) {
+        break;
+      }
+      if (iperf3_udp_send(st) != ERR_OK) {
+        break;
+      }
+      n++;
+    }
+  }
+  return iperf3_check_limit(s);
+}
+
+static void
+iperf3_udp_tick(void *arg)
+{
+  struct iperf3_session *s = (struct iperf3_session *)arg;
+
+  if ((iperf3_udp_pace(s) == ERR_OK) && s->running) {
+    sys_timeout(IPERF3_UDP_TICK_MS, iperf3_udp_tick, s);
+  }
+}
+
+static void
+iperf3_udp_input(struct iperf3_stream *st, struct pbuf *p)
+{
+  struct iperf3_session *s = st->s;
+  u16_t hdr = s->udp64 ? 16 : 12;
+  u8_t h[16];
+  u32_t pcount, sent, transit;
+
+  st->bytes += p->tot_len;
+  s->total += p->tot_len;
+  if (pbuf_copy_partial(p, h, hdr, 0) != hdr) {
+    return;
+  }
+  sent = iperf3_get32(h) * 1000000 + iperf3_get32(h + 4);
+  pcount = iperf3_get32(h + hdr - 4);
+  if (pcount > st->packet_count) {
+    st->lost += pcount - st->packet_count - 1;
+    st->packet_count = pcount;
+  } else if (st->lost) {
+    /* out of order, was counted as lost */
+    st->lost--;
+  }
+  /* RFC 1889 jitter, in microseconds of sys_now() */
+  transit = sys_now() * 1000 - sent;
+  if (st->transit_valid) {
+    s32_t d = (s32_t)(transit - st->prev_transit);
+    if (d < 0) {
+      d = -d;
+    }
+    st->jitter16 += (u32_t)d - (st->jitter16 >> 4);
+  }
+  st->prev_transit = transit;
+  st->transit_valid = 1;
+}
+
+/** Writes the reply to a UDP connect message in the byte order of the peer */
+static void
+iperf3_udp_reply(const u8_t *msg, u8_t *reply)
+{
+  u32_t be = iperf3_get32(msg);
+
+  if ((be == IPERF3_UDP_CONNECT_MSG) || (be == IPERF3_UDP_CONNECT_MSG_OLD)) {
+    iperf3_put32(reply, (be == IPERF3_UDP_CONNECT_MSG) ? IPERF3_UDP_CONNECT_REPLY : IPERF3_UDP_CONNECT_REPLY_OLD);
+  } else {
+    iperf3_put32le(reply, (iperf3_get32le(msg) == IPERF3_UDP_CONNECT_MSG_OLD) ?
+                   IPERF3_UDP_CONNECT_REPLY_OLD : IPERF3_UDP_CONNECT_REPLY);
+  }
+}
+#endif /* LWIP_UDP */
+
+/** Starts the data transfer (after TEST_RUNNING), returns ERR_CLSD if the session is gone */
+static err_t
+iperf3_start(struct iperf3_session *s)
+{
+  struct iperf3_stream *st;
+  u32_t now = sys_now();
+
+  LWIP_DEBUGF(IPERF3_DEBUG, ("iperf3: %s %u %s streams\n", s->sender ? "sending" : "receiving",
+                             s->streams, s->settings.udp ? "UDP" : "TCP"));
+  s->running = 1;
+  s->omitting = (s->settings.omit != 0);
+  s->start = s->measure_start = s->report_time = s->time = now;
+  s->cpu_start = s->report_cpu = iperf3_cpu_time();
+  s->total = 0;
+  /* align the reports and the end of the test with the start */
+  sys_untimeout(iperf3_tick, s);
+  sys_timeout(IPERF3_TICK_MS, iperf3_tick, s);
+
+  if (!s->sender) {
+    return ERR_OK;
+  }
+#if LWIP_UDP
+  if (s->settings.udp) {
+    err_t err;
+    s->udp_start = now;
+    err = iperf3_udp_pace(s);
+    if ((err == ERR_OK) && s->running) {
+      sys_timeout(IPERF3_UDP_TICK_MS, iperf3_udp_tick, s);
+    }
+    return err;
+  }
+#endif /* LWIP_UDP */
+  for (st = s->stream_list; st != NULL; st = st->next) {
+    if (st->id != 0) {
+      iperf3_tcp_send(st);
+    }
+  }
+  return iperf3_check_limit(s);
+}
+
+static void
+iperf3_stop(struct iperf3_session *s)
+{
+  if (!s->running) {
+    return;
+  }
+  s->running = 0;
+  s->end = s->time = sys_now();
+  s->cpu_end = iperf3_cpu_time();
+  if (s->omitting) {
+    s->measure_start = s->end;
+    s->cpu_start = s->cpu_end;
+  }
+#if LWIP_UDP
+  sys_untimeout(iperf3_udp_tick, s);
+#endif /* LWIP_UDP */
+}
+
+static err_t
+iperf3_client_end(struct iperf3_session *s)
+{
+  if (!s->running) {
+    return ERR_OK;
+  }
+  iperf3_stop(s);
+  if (iperf3_send_state(s, IPERF3_TEST_END) != ERR_OK) {
+    iperf3_session_free(s, 1);
+    return ERR_CLSD;
+  }
+  return ERR_OK;
+}
+
+/** Counts after the omitted seconds only */
+static void
+iperf3_reset_stats(struct iperf3_session *s, u32_t now)
+{
+  struct iperf3_stream *st;
+
+  for (st = s->stream_list; st != NULL; st = st->next) {
+    st->bytes = st->report_bytes = 0;
+    st->omit_packets = st->report_packets = st->packet_count;
+    st->lost = st->report_lost = 0;
+  }
+  s->total = 0;
+  s->omitting = 0;
+  s->measure_start = s->report_time = now;
+  s->cpu_start = s->report_cpu = iperf3_cpu_time();
+}
+
+static void
+iperf3_tick(void *arg)
+{
+  struct iperf3_session *s = (struct iperf3_session *)arg;
+  u32_t now = sys_now();
+
+  if (s->running) {
+    u32_t duration = ((u32_t)s->settings.omit + s->settings.time) * 1000;
+    if (s->omitting) {
+      if (now - s->start >= (u32_t)s->settings.omit * 1000) {
+        iperf3_reset_stats(s, now);
+      }
+    } else if (IPERF3_REPORT_MS) {
+      iperf3_interval_reports(s, now);
+    }
+    if (s->settings.time && (now - s->start >= duration)) {
+      if (s->server == NULL) {
+        if (iperf3_client_end(s) != ERR_OK) {
+          return;
+        }
+      } else if (now - s->start >= duration + IPERF3_TIMEOUT_MS) {
+        /* the client did not end the test */
+        iperf3_session_free(s, 1);
+        return;
+      }
+    }
+  } else if (now - s->time >= IPERF3_TIMEOUT_MS) {
+    iperf3_session_free(s, 1);
+    return;
+  }
+  sys_timeout(IPERF3_TICK_MS, iperf3_tick, s);
+}
+
+/** A stream is set up, the next one is connected or the test starts.
+ * Returns ERR_CLSD if the session is gone. */
+static err_t
+iperf3_stream_connected(struct iperf3_session *s, struct iperf3_stream *st)
+{
+  err_t err;
+
+  /* iperf3 numbers the streams 1, 3, 4, 5, ... */
+  st->id = (u8_t)(s->streams ? s->streams + 2 : 1);
+  s->streams++;
+  s->time = sys_now();
+  LWIP_DEBUGF(IPERF3_DEBUG | LWIP_DBG_TRACE, ("iperf3: stream %u connected\n", st->id));
+  if (s->server == NULL) {
+    err = (s->streams < s->settings.parallel) ? iperf3_client_connect_stream(s) : ERR_OK;
+  } else if (s->streams < s->settings.parallel) {
+    err = ERR_OK;
+  } else {
+    err = iperf3_send_state(s, IPERF3_TEST_START);
+    if (err == ERR_OK) {
+      err = iperf3_send_state(s, IPERF3_TEST_RUNNING);
+    }
+    if (err == ERR_OK) {
+      return iperf3_start(s);
+    }
+  }
+  if (err != ERR_OK) {
+    iperf3_session_free(s, 1);
+    return ERR_CLSD;
+  }
+  return ERR_OK;
+}
+
+/*-----------------------------------------------------------------------------------*/
+/* TCP streams */
+
+static err_t
+iperf3_stream_recv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
+{
+  struct iperf3_stream *st = (struct iperf3_stream *)arg;
+  struct iperf3_session *s;
+  u16_t off = 0;
+
+  iperf3_aborted = NULL;
+  if ((p == NULL) || (err != ERR_OK) || (st == NULL)) {
+    if (p != NULL) {
+      tcp_recved(pcb, p->tot_len);
+      pbuf_free(p);
+    } else if (st != NULL) {
+      /* closed by the peer, keep the counters */
+      st->tcp = NULL;
+      iperf3_tcp_close(pcb);
+      if (st->id == 0) {
+        iperf3_stream_remove(st->s, st);
+      }
+    } else {
+      iperf3_tcp_close(pcb);
+    }
+    return (iperf3_aborted == pcb) ? ERR_ABRT : ERR_OK;
+  }
+
+  s = st->s;
+  tcp_recved(pcb, p->tot_len);
+  if (st->id == 0) {
+    /* server: a stream starts with the cookie of the test */
+    while ((off < p->tot_len) && (st->cookie_len < IPERF3_COOKIE_SIZE)) {
+      if (pbuf_get_at(p, off) != s->cookie[st->cookie_len]) {
+        u8_t denied = IPERF3_ACCESS_DENIED;
+        pbuf_free(p);
+        tcp_write(pcb, &denied, 1, TCP_WRITE_FLAG_COPY);
+        iperf3_stream_remove(s, st);
+        return (iperf3_aborted == pcb) ? ERR_ABRT : ERR_OK;
+      }
+      off++;
+      st->cookie_len++;
+    }
+    if (st->cookie_len < IPERF3_COOKIE_SIZE) {
+      pbuf_free(p);
+      return ERR_OK;
+    }
+    st->bytes += p->tot_len - off;
+    pbuf_free(p);
+    iperf3_stream_connected(s, st);
+    return (iperf3_aborted == pcb) ? ERR_ABRT : ERR_OK;
+  }
+  st->bytes += p->tot_len;
+  s->total += p->tot_len;
+  pbuf_free(p);
+  iperf3_check_limit(s);
+  return (iperf3_aborted == pcb) ? ERR_ABRT : ERR_OK;
+}
+
+static err_t
+iperf3_stream_sent(void *arg, struct tcp_pcb *pcb, u16_t len)
+{
+  struct iperf3_stream *st = (struct iperf3_stream *)arg;
+
+  LWIP_UNUSED_ARG(len);
+
+  iperf3_aborted = NULL;
+  if ((st != NULL) && (st->id != 0) && st->s->sender && !st->s->settings.udp) {
+    struct iperf3_session *s = st->s;
+    iperf3_tcp_send(st);
+    iperf3_check_limit(s);
+  }
+  return (iperf3_aborted == pcb) ? ERR_ABRT : ERR_OK;
+}
+
+static void
+iperf3_stream_err(void *arg, err_t err)
+{
+  struct iperf3_stream *st = (struct iperf3_stream *)arg;
+
+  LWIP_UNUSED_ARG(err);
+
+  if (st == NULL) {
+    return;
+  }
+  LWIP_DEBUGF(IPERF3_DEBUG, ("iperf3: stream %u error %d\n", st->id, (int)err));
+  st->tcp = NULL;
+  if (st->id == 0) {
+    if (st->s->server == NULL) {
+      /* the client could not connect */
+      iperf3_session_free(st->s, 1);
+    } else {
+      iperf3_stream_remove(st->s, st);
+    }
+  }
+}
+
+static void
+iperf3_stream_tcp_setup(struct iperf3_stream *st, struct tcp_pcb *pcb)
+{
+  st->tcp = pcb;
+  tcp_arg(pcb, st);
+  tcp_recv(pcb, iperf3_stream_recv);
+  tcp_sent(pcb, iperf3_stream_sent);
+  tcp_err(pcb, iperf3_stream_err);
+}
+
+static err_t
+iperf3_stream_tcp_connected(void *arg, struct tcp_pcb *pcb, err_t err)
+{
+  struct iperf3_stream *st = (struct iperf3_stream *)arg;
+  struct iperf3_session *s;
+
+  LWIP_UNUSED_ARG(err);
+
+  iperf3_aborted = NULL;
+  if (st == NULL) {
+    return ERR_OK;
+  }
+  s = st->s;
+  if ((tcp_write(pcb, s->cookie, IPERF3_COOKIE_SIZE, TCP_WRITE_FLAG_COPY) != ERR_OK) ||
+      (tcp_output(pcb) != ERR_OK)) {
+    iperf3_session_free(s, 1);
+  } else {
+    iperf3_stream_connected(s, st);
+  }
+  return (iperf3_aborted == pcb) ? ERR_ABRT : ERR_OK;
+}
+
+#if LWIP_UDP
+static void
+iperf3_client_udp_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port)
+{
+  struct iperf3_stream *st = (struct iperf3_stream *)arg;
+  struct iperf3_session *s = st->s;
+  u8_t msg[4];
+
+  LWIP_UNUSED_ARG(pcb);
+  LWIP_UNUSED_ARG(addr);
+  LWIP_UNUSED_ARG(port);
+
+  if (st->id == 0) {
+    if ((p->tot_len == sizeof(msg)) && (pbuf_copy_partial(p, msg, sizeof(msg), 0) == sizeof(msg))) {
+      u32_t be = iperf3_get32(msg), le = iperf3_get32le(msg);
+      pbuf_free(p);
+      if ((be == IPERF3_UDP_CONNECT_REPLY) || (be == IPERF3_UDP_CONNECT_REPLY_OLD) ||
+          (le == IPERF3_UDP_CONNECT_REPLY) || (le == IPERF3_UDP_CONNECT_REPLY_OLD)) {
+        iperf3_stream_connected(s, st);
+      }
+      return;
+    }
+  } else if (!s->sender) {
+    iperf3_udp_input(st, p);
+    pbuf_free(p);
+    iperf3_check_limit(s);
+    return;
+  }
+  pbuf_free(p);
+}
+#endif /* LWIP_UDP */
+
+/** Connects the next stream of a client */
+static err_t
+iperf3_client_connect_stream(struct iperf3_session *s)
+{
+  struct iperf3_stream *st;
+
+  st = iperf3_stream_new(s);
+  if (st == NULL) {
+    return ERR_MEM;
+  }
+#if LWIP_UDP
+  if (s->settings.udp) {
+    struct pbuf *p;
+    err_t err;
+
+    st->udp = udp_new_ip_type(IP_GET_TYPE(&s->remote_ip));
+    if (st->udp == NULL) {
+      return ERR_MEM;
+    }
+    udp_recv(st->udp, iperf3_client_udp_recv, st);
+    err = udp_connect(st->udp, &s->remote_ip, s->port);
+    if (err != ERR_OK) {
+      return err;
+    }
+    p = pbuf_alloc(PBUF_TRANSPORT, 4, PBUF_RAM);
+    if (p == NULL) {
+      return ERR_MEM;
+    }
+    /* little endian, like the clients on most hosts send it */
+    iperf3_put32le((u8_t *)p->payload, IPERF3_UDP_CONNECT_MSG);
+    err = udp_send(st->udp, p);
+    pbuf_free(p);
+    return err;
+  }
+#endif /* LWIP_UDP */
+  {
+    struct tcp_pcb *pcb = tcp_new_ip_type(IP_GET_TYPE(&s->remote_ip));
+    if (pcb == NULL) {
+      return ERR_MEM;
+    }
+    iperf3_stream_tcp_setup(st, pcb);
+    return tcp_connect(pcb, &s->remote_ip, s->port, iperf3_stream_tcp_connected);
+  }
+}
+
+/*-----------------------------------------------------------------------------------*/
+/* Control connection */
+
+static err_t
+iperf3_server_params(struct iperf3_session *s, u16_t len)
+{
+  struct iperf3_settings *set = &s->settings;
+  u32_t ierrno = 0;
+
+  iperf3_json_object(s->json, s->json + len, iperf3_param, s);
+  iperf3_settings_apply(s, 0);
+  if (s->bidir) {
+    ierrno = IPERF3_IEUNIMP;
+  } else if (set->parallel > IPERF3_MAX_STREAMS) {
+    ierrno = IPERF3_IENUMSTREAMS;
+  } else if (set->udp) {
+#if LWIP_UDP
+    if (s->server->udp == NULL) {
+      ierrno = IPERF3_IEUNIMP;
+    } else if (set->reverse && ((set->len < (s->udp64 ? 16U : 12U)) || (set->len > IPERF3_BUF_SIZE))) {
+      ierrno = IPERF3_IEUDPBLOCKSIZE;
+    }
+#else /* LWIP_UDP */
+    ierrno = IPERF3_IEUNIMP;
+#endif /* LWIP_UDP */
+  }
+  if (ierrno) {
+    iperf3_send_error(s, ierrno);
+    return ERR_VAL;
+  }
+  s->time = sys_now();
+  return iperf3_send_state(s, IPERF3_CREATE_STREAMS);
+}
+
+static err_t
+iperf3_ctrl_state(struct iperf3_session *s, u8_t state)
+{
+  LWIP_DEBUGF(IPERF3_DEBUG | LWIP_DBG_TRACE, ("iperf3: received state %d\n", (s8_t)state));
+  s->time = sys_now();
+  if (s->server != NULL) {
+    switch (state) {
+      case IPERF3_TEST_END:
+        iperf3_stop(s);
+        iperf3_expect(s, IPERF3_IN_JSON_LEN, 4);
+        return iperf3_send_state(s, IPERF3_EXCHANGE_RESULTS);
+      case IPERF3_IPERF_DONE:
+        iperf3_session_free(s, 0);
+        return ERR_CLSD;
+      case IPERF3_CLIENT_TERMINATE:
+        return ERR_ABRT;
+      default:
+        return ERR_OK;
+    }
+  }
+  s->state = state;
+  switch (state) {
+    case IPERF3_PARAM_EXCHANGE:
+      return iperf3_send_json(s, iperf3_params_json(s));
+    case IPERF3_CREATE_STREAMS:
+      return iperf3_client_connect_stream(s);
+    case IPERF3_TEST_RUNNING:
+      return iperf3_start(s);
+    case IPERF3_EXCHANGE_RESULTS:
+      iperf3_stop(s);
+      iperf3_expect(s, IPERF3_IN_JSON_LEN, 4);
+      return iperf3_send_json(s, iperf3_results_json(s));
+    case IPERF3_DISPLAY_RESULTS:
+      iperf3_final_reports(s);
+      iperf3_send_state(s, IPERF3_IPERF_DONE);
+      iperf3_session_free(s, 0);
+      return ERR_CLSD;
+    case IPERF3_SERVER_ERROR:
+      iperf3_expect(s, IPERF3_IN_ERROR, 8);
+      return ERR_OK;
+    case IPERF3_ACCESS_DENIED:
+    case IPERF3_SERVER_TERMINATE:
+      return ERR_ABRT;
+    default:
+      return ERR_OK;
+  }
+}
+
+/** Handles a complete control message. Returns ERR_CLSD if the session was freed,
+ * other errors to have it aborted. */
+static err_t
+iperf3_ctrl_message(struct iperf3_session *s)
+{
+  u32_t len = s->in_len;
+
+  switch (s->in) {
+    case IPERF3_IN_COOKIE:
+      MEMCPY(s->cookie, s->in_buf, IPERF3_COOKIE_SIZE);
+      iperf3_expect(s, IPERF3_IN_JSON_LEN, 4);
+      return iperf3_send_state(s, IPERF3_PARAM_EXCHANGE);
+    case IPERF3_IN_JSON_LEN:
+      len = iperf3_get32(s->in_buf);
+      if ((len == 0) || (len > IPERF3_MAX_JSON_LEN)) {
+        return ERR_VAL;
+      }
+      iperf3_expect(s, IPERF3_IN_JSON, len);
+      return ERR_OK;
+    case IPERF3_IN_JSON:
+      iperf3_expect(s, IPERF3_IN_STATE, 1);
+      if ((s->server != NULL) && (s->state == IPERF3_PARAM_EXCHANGE)) {
+        return iperf3_server_params(s, (u16_t)LWIP_MIN(len, sizeof(s->json)));
+      }
+      if (len <= sizeof(s->json)) {
+        iperf3_json_object(s->json, s->json + len, iperf3_result, s);
+      }
+      if (s->server != NULL) {
+        /* the client's results came, send ours */
+        err_t err = iperf3_send_json(s, iperf3_results_json(s));
+        if (err == ERR_OK) {
+          err = iperf3_send_state(s, IPERF3_DISPLAY_RESULTS);
+        }
+        if (err == ERR_OK) {
+          iperf3_final_reports(s);
+        }
+        return err;
+      }
+      return ERR_OK;
+    case IPERF3_IN_ERROR:
+      LWIP_DEBUGF(IPERF3_DEBUG | LWIP_DBG_LEVEL_WARNING,
+                  ("iperf3: server error %"U32_F"\n", iperf3_get32(s->in_buf)));
+      return ERR_VAL;
+    default:
+      iperf3_expect(s, IPERF3_IN_STATE, 1);
+      return iperf3_ctrl_state(s, s->in_buf[0]);
+  }
+}
+
+static void
+iperf3_ctrl_input(struct iperf3_session *s, struct pbuf *p)
+{
+  u16_t off = 0;
+
+  while (off < p->tot_len) {
+    u16_t n = (u16_t)LWIP_MIN(s->in_len - s->in_pos, (u32_t)(p->tot_len - off));
+    if (s->in == IPERF3_IN_JSON) {
+      if (s->in_pos < sizeof(s->json)) {
+        pbuf_copy_partial(p, s->json + s->in_pos, (u16_t)LWIP_MIN(n, sizeof(s->json) - s->in_pos), off);
+      }
+    } else {
+      pbuf_copy_partial(p, s->in_buf + s->in_pos, n, off);
+    }
+    off = (u16_t)(off + n);
+    s->in_pos += n;
+    if (s->in_pos == s->in_len) {
+      err_t err = iperf3_ctrl_message(s);
+      if (err != ERR_OK) {
+        if (err != ERR_CLSD) {
+          iperf3_session_free(s, 1);
+        }
+        return;
+      }
+    }
+  }
+}
+
+static err_t
+iperf3_ctrl_recv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
+{
+  struct iperf3_session *s = (struct iperf3_session *)arg;
+
+  iperf3_aborted = NULL;
+  if ((p == NULL) || (err != ERR_OK) || (s == NULL)) {
+    if (p != NULL) {
+      tcp_recved(pcb, p->tot_len);
+      pbuf_free(p);
+    } else if (s != NULL) {
+      /* closed by the peer before the test was done */
+      iperf3_session_free(s, 1);
+    } else {
+      iperf3_tcp_close(pcb);
+    }
+    return (iperf3_aborted == pcb) ? ERR_ABRT : ERR_OK;
+  }
+  tcp_recved(pcb, p->tot_len);
+  iperf3_ctrl_input(s, p);
+  pbuf_free(p);
+  return (iperf3_aborted == pcb) ? ERR_ABRT : ERR_OK;
+}
+
+static void
+iperf3_ctrl_err(void *arg, err_t err)
+{
+  struct iperf3_session *s = (struct iperf3_session *)arg;
+
+  LWIP_UNUSED_ARG(err);
+
+  if (s != NULL) {
+    LWIP_DEBUGF(IPERF3_DEBUG, ("iperf3: control connection error %d\n", (int)err));
+    s->ctrl = NULL;
+    iperf3_session_free(s, 1);
+  }
+}
+
+static err_t
+iperf3_ctrl_connected(void *arg, struct tcp_pcb *pcb, err_t err)
+{
+  struct iperf3_session *s = (struct iperf3_session *)arg;
+
+  LWIP_UNUSED_ARG(err);
+
+  iperf3_aborted = NULL;
+  if (s != NULL) {
+    s->time = sys_now();
+    iperf3_expect(s, IPERF3_IN_STATE, 1);
+    if (iperf3_ctrl_write(s, s->cookie, IPERF3_COOKIE_SIZE, 0) != ERR_OK) {
+      iperf3_session_free(s, 1);
+    }
+  }
+  return (iperf3_aborted == pcb) ? ERR_ABRT : ERR_OK;
+}
+
+/*-----------------------------------------------------------------------------------*/
+/* Server */
+
+static err_t
+iperf3_server_accept(void *arg, struct tcp_pcb *pcb, err_t err)
+{
+  struct iperf3_server *server = (struct iperf3_server *)arg;
+  struct iperf3_session *s = server->session;
+  u8_t denied = IPERF3_ACCESS_DENIED;
+
+  iperf3_aborted = NULL;
+  if ((err != ERR_OK) || (pcb == NULL)) {
+    return ERR_VAL;
+  }
+  if (s == NULL) {
+    /* a new test, this is its control connection */
+    s = iperf3_session_new(server->fn, server->arg);
+    if (s == NULL) {
+      tcp_abort(pcb);
+      return ERR_ABRT;
+    }
+    s->server = server;
+    s->ctrl = pcb;
+    server->session = s;
+    iperf3_expect(s, IPERF3_IN_COOKIE, IPERF3_COOKIE_SIZE);
+    tcp_arg(pcb, s);
+    tcp_recv(pcb, iperf3_ctrl_recv);
+    tcp_err(pcb, iperf3_ctrl_err);
+    sys_timeout(IPERF3_TICK_MS, iperf3_tick, s);
+    return ERR_OK;
+  }
+  if ((s->state == IPERF3_CREATE_STREAMS) && !s->settings.udp) {
+    struct iperf3_stream *st;
+    u8_t n = 0;
+    for (st = s->stream_list; st != NULL; st = st->next) {
+      n++;
+    }
+    /* a stream, or another client that is refused after its cookie */
+    if (n <= s->settings.parallel) {
+      st = iperf3_stream_new(s);
+      if (st != NULL) {
+        iperf3_stream_tcp_setup(st, pcb);
+        return ERR_OK;
+      }
+    }
+  }
+  /* busy with another test */
+  tcp_write(pcb, &denied, 1, TCP_WRITE_FLAG_COPY);
+  iperf3_tcp_close(pcb);
+  return (iperf3_aborted == pcb) ? ERR_ABRT : ERR_OK;
+}
+
+#if LWIP_UDP
+static void
+iperf3_server_udp_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port)
+{
+  struct iperf3_server *server = (struct iperf3_server *)arg;
+  struct iperf3_session *s = server->session;
+  struct iperf3_stream *st;
+  u8_t msg[4];
+
+  if ((s == NULL) || !s->settings.udp) {
+    pbuf_free(p);
+    return;
+  }
+  for (st = s->stream_list; st != NULL; st = st->next) {
+    if ((st->remote_port == port) && ip_addr_cmp(&st->remote_ip, addr)) {
+      if (!s->sender) {
+        iperf3_udp_input(st, p);
+      }
+      pbuf_free(p);
+      return;
+    }
+  }
+  if ((s->state == IPERF3_CREATE_STREAMS) && (s->streams < s->settings.parallel) &&
+      (p->tot_len == sizeof(msg)) && (pbuf_copy_partial(p, msg, sizeof(msg), 0) == sizeof(msg))) {
+    struct pbuf *q;
+    pbuf_free(p);
+    st = iperf3_stream_new(s);
+    q = pbuf_alloc(PBUF_TRANSPORT, sizeof(msg), PBUF_RAM);
+    if ((st == NULL) || (q == NULL)) {
+      if (q != NULL) {
+        pbuf_free(q);
+      }
+      iperf3_session_free(s, 1);
+      return;
+    }
+    ip_addr_copy(st->remote_ip, *addr);
+    st->remote_port = port;
+    iperf3_udp_reply(msg, (u8_t *)q->payload);
+    udp_sendto(pcb, q, addr, port);
+    pbuf_free(q);
+    iperf3_stream_connected(s, st);
+    return;
+  }
+  pbuf_free(p);
+}
+#endif /* LWIP_UDP */
+
+/**
+ * Starts an iperf3 server on 'port' (IPERF3_PORT), TCP and UDP.
+ * Tests are reported to 'fn', printed if it is NULL.
+ */
+struct iperf3_server *
+iperf3_server_start(u16_t port, iperf3_report_fn fn, void *arg)
+{
+  struct iperf3_server *server;
+  struct tcp_pcb *pcb;
+
+  server = (struct iperf3_server *)mem_malloc(sizeof(struct iperf3_server));
+  if (server == NULL) {
+    return NULL;
+  }
+  memset(server, 0, sizeof(struct iperf3_server));
+  server->fn = fn;
+  server->arg = arg;
+
+  pcb = tcp_new_ip_type(IPADDR_TYPE_ANY);
+  if (pcb == NULL) {
+    mem_free(server);
+    return NULL;
+  }
+  if (tcp_bind(pcb, IP_ANY_TYPE, port) != ERR_OK) {
+    tcp_close(pcb);
+    mem_free(server);
+    return NULL;
+  }
+  server->listen = tcp_listen(pcb);
+  if (server->listen == NULL) {
+    tcp_close(pcb);
+    mem_free(server);
+    return NULL;
+  }
+  tcp_arg(server->listen, server);
+  tcp_accept(server->listen, iperf3_server_accept);
+
+#if LWIP_UDP
+  server->udp = udp_new_ip_type(IPADDR_TYPE_ANY);
+  if ((server->udp != NULL) && (udp_bind(server->udp, IP_ANY_TYPE, port) != ERR_OK)) {
+    udp_remove(server->udp);
+    server->udp = NULL;
+  }
+  if (server->udp != NULL) {
+    udp_recv(server->udp, iperf3_server_udp_recv, server);
+  } else {
+    LWIP_DEBUGF(IPERF3_DEBUG | LWIP_DBG_LEVEL_WARNING, ("iperf3: no UDP on port %u\n", port));
+  }
+#endif /* LWIP_UDP */
+  return server;
+}
+
+/** Stops a server, aborting its test */
+void
+iperf3_server_stop(struct iperf3_server *server)
+{
+  if (server->session != NULL) {
+    iperf3_session_free(server->session, 1);
+  }
+  tcp_arg(server->listen, NULL);
+  tcp_close(server->listen);
+#if LWIP_UDP
+  if (server->udp != NULL) {
+    udp_remove(server->udp);
+  }
+#endif /* LWIP_UDP */
+  mem_free(server);
+}
+
+/*-----------------------------------------------------------------------------------*/
+/* Client */
+
+/** Defaults of "iperf3 -c": TCP, 10 seconds, one stream, UDP at 1 Mbit/s */
+void
+iperf3_settings_init(struct iperf3_settings *settings)
+{
+  memset(settings, 0, sizeof(struct iperf3_settings));
+  settings->time = 10;
+  settings->parallel = 1;
+  settings->bandwidth = 1024 * 1024;
+}
+
+/**
+ * Runs a test against the iperf3 server at addr:port.
+ * The session is valid until IPERF3_REPORT_END or IPERF3_REPORT_ABORT was
+ * reported (to 'fn', printed if it is NULL).
+ */
+struct iperf3_session *
+iperf3_client_start(const ip_addr_t *addr, u16_t port, const struct iperf3_settings *settings,
+                    iperf3_report_fn fn, void *arg)
+{
+  static const char chars[] = "abcdefghijklmnopqrstuvwxyz234567";
+  struct iperf3_session *s;
+  struct tcp_pcb *pcb;
+  int i;
+
+  LWIP_ERROR("iperf3_client_start: invalid arguments", (addr != NULL) && (settings != NULL), return NULL;);
+
+  s = iperf3_session_new(fn, arg);
+  if (s == NULL) {
+    return NULL;
+  }
+  s->settings = *settings;
+  iperf3_settings_apply(s, 1);
+  if ((s->settings.parallel > IPERF3_MAX_STREAMS) ||
+#if LWIP_UDP
+      (s->settings.udp && !s->settings.reverse &&
+       ((s->settings.len < 12) || (s->settings.len > IPERF3_BUF_SIZE))) ||
+#else /* LWIP_UDP */
+      s->settings.udp ||
+#endif /* LWIP_UDP */
+      (!s->settings.time && !s->limit)) {
+    mem_free(s);
+    return NULL;
+  }
+  ip_addr_copy(s->remote_ip, *addr);
+  s->port = port;
+  for (i = 0; i < IPERF3_COOKIE_SIZE - 1; i++) {
+#ifdef LWIP_RAND
+    s->cookie[i] = (u8_t)chars[LWIP_RAND() % 32];
+#else
+    s->cookie[i] = (u8_t)chars[(sys_now() + i * 7) % 32];
+#endif
+  }
+
+  pcb = tcp_new_ip_type(IP_GET_TYPE(addr));
+  if (pcb == NULL) {
+    mem_free(s);
+    return NULL;
+  }
+  tcp_arg(pcb, s);
+  tcp_recv(pcb, iperf3_ctrl_recv);
+  tcp_err(pcb, iperf3_ctrl_err);
+  if (tcp_connect(pcb, addr, port, iperf3_ctrl_connected) != ERR_OK) {
+    tcp_arg(pcb, NULL);
+    tcp_close(pcb);
+    mem_free(s);
+    return NULL;
+  }
+  s->ctrl = pcb;
+  sys_timeout(IPERF3_TICK_MS, iperf3_tick, s);
+  return s;
+}
+
+/** Aborts a test started with iperf3_client_start() */
+void
+iperf3_client_abort(struct iperf3_session *session)
+{
+  if (session->ctrl != NULL) {
+    u8_t state = IPERF3_CLIENT_TERMINATE;
+    iperf3_ctrl_write(session, &state, 1, 0);
+  }
+  iperf3_session_free(session, 1);
+}
+
+#endif /* LWIP_TCP && LWIP_CALLBACK_API */
@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2001-2004 Swedish Institute of Computer Science.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+ * SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ *
+ * This file is part of the lwIP TCP/IP stack.
+ *
+ */
+#ifndef LWIP_IPERF3_H
+#define LWIP_IPERF3_H
+
+#include "lwip/opt.h"
+#include "lwip/ip_addr.h"
+
+#define IPERF3_PORT 5201
+
+/** Parameters of a test started by iperf3_client_start() */
+struct iperf3_settings {
+  /** 1 for UDP streams, 0 for TCP */
+  u8_t udp;
+  /** 1 to have the server send ("iperf3 -R") */
+  u8_t reverse;
+  /** number of streams, 1..IPERF3_MAX_STREAMS */
+  u8_t parallel;
+  /** seconds at the start that are not counted */
+  u8_t omit;
+  /** test duration in seconds, 0 if 'bytes' or 'blocks' end the test */
+  u32_t time;
+  u64_t bytes;
+  u32_t blocks;
+  /** TCP block or UDP datagram size, 0 for the iperf3 default */
+  u32_t len;
+  /** UDP bits per second per stream, 0 for unlimited */
+  u64_t bandwidth;
+};
+
+enum iperf3_report_type {
+  /** throughput of one stream in the last IPERF3_REPORT_MS */
+  IPERF3_REPORT_INTERVAL,
+  /** one stream, whole test (after the results were exchanged) */
+  IPERF3_REPORT_STREAM,
+  /** sum of all streams, the test is done */
+  IPERF3_REPORT_END,
+  /** the test failed or was aborted */
+  IPERF3_REPORT_ABORT
+};
+
+/** Throughput passed to the iperf3_report_fn */
+struct iperf3_report {
+  enum iperf3_report_type type;
+  /** iperf3 stream id, 0 for IPERF3_REPORT_END and IPERF3_REPORT_ABORT */
+  u8_t stream;
+  u8_t udp;
+  /** 1 if this side sent the data */
+  u8_t sender;
+  /** length of the interval or test */
+  u32_t ms;
+  /** bytes sent or received by this side */
+  u64_t bytes;
+  /** bytes received or sent by the peer (not for intervals) */
+  u64_t remote_bytes;
+  /** UDP, as seen by the receiving side: datagrams, lost datagrams, jitter */
+  u32_t packets;
+  u32_t lost;
+  u32_t jitter_us;
+  /** CPU time used by the process meanwhile (if IPERF3_CPU_TIME() is defined) */
+  u32_t cpu_ms;
+};
+
+typedef void (*iperf3_report_fn)(void *arg, const struct iperf3_report *report);
+
+struct iperf3_server;
+struct iperf3_session;
+
+struct iperf3_server *iperf3_server_start(u16_t port, iperf3_report_fn fn, void *arg);
+void iperf3_server_stop(struct iperf3_server *server);
+
+void iperf3_settings_init(struct iperf3_settings *settings);
+struct iperf3_session *iperf3_client_start(const ip_addr_t *addr, u16_t port,
+                                           const struct iperf3_settings *settings,
+                                           iperf3_report_fn fn, void *arg);
+void iperf3_client_abort(struct iperf3_session *session);
+
+#endif /* LWIP_IPERF3_H */
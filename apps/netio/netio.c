@@ -2,54 +2,520 @@
 
 #include "lwip/opt.h"
 #include "lwip/tcp.h"
+#include "lwip/mem.h"
+#include "lwip/def.h"
+#include "lwip/sys.h"
+#include "lwip/timeouts.h"
+#include "lwip/debug.h"
+
+#include <string.h>
 
 /* See http://www.nwlab.net/art/netio/netio.html to get the netio tool */
 
+/*
+ * NETIO benchmark server. The client opens one connection per stream and
+ * sends 8 byte control messages { u32_t cmd; u32_t data; } (network order):
+ *
+ * - NETIO_CMD_C2S: the client sends blocks of 'data' bytes, the last one
+ *   (first byte 1) ends the test.
+ * - NETIO_CMD_S2C: the server sends blocks of 'data' bytes for
+ *   NETIO_INTERVAL_MS, then a last block.
+ * - NETIO_CMD_QUIT: the server closes the connection.
+ *
+ * Blocks are sent without copying them (tcp_write() without
+ * TCP_WRITE_FLAG_COPY) from a static zero buffer. The throughput of every
+ * stream is reported every NETIO_REPORT_MS and at the end of each test, to
+ * the function set with netio_set_report_fn() or with LWIP_PLATFORM_DIAG.
+ * Byte counters are 64 bit (LWIP_HAVE_INT64), a test moves more than 4 GiB
+ * within seconds.
+ */
+
 #if LWIP_TCP && LWIP_CALLBACK_API
-static err_t
-netio_recv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
+
+#if !LWIP_HAVE_INT64
+#error "netio needs 64 bit integers (LWIP_HAVE_INT64)"
+#endif
+
+#ifndef U64_F
+#define U64_F PRIu64
+#endif
+
+#ifndef NETIO_PORT
+#define NETIO_PORT          18767
+#endif
+
+/** Duration of a NETIO_CMD_S2C test */
+#ifndef NETIO_INTERVAL_MS
+#define NETIO_INTERVAL_MS   6000
+#endif
+
+/** Interval of the throughput reports while a test runs, 0 to only report results */
+#ifndef NETIO_REPORT_MS
+#define NETIO_REPORT_MS     1000
+#endif
+
+/** Maximum number of concurrent connections, more are aborted */
+#ifndef NETIO_MAX_STREAMS
+#define NETIO_MAX_STREAMS   8
+#endif
+
+/** Largest block size accepted from a client */
+#ifndef NETIO_MAX_BLOCK
+#define NETIO_MAX_BLOCK     (64 * 1024)
+#endif
+
+/** Size of the static buffer blocks are sent from (without copying) */
+#ifndef NETIO_BUF_SIZE
+#define NETIO_BUF_SIZE      (16 * 1024)
+#endif
+
+#ifndef NETIO_DEBUG
+#define NETIO_DEBUG         LWIP_DBG_OFF
+#endif
+
+/* NETIO_CPU_TIME() may be defined to return the CPU time used by the
+ * process in milliseconds (u32_t) to have it in the reports. */
+
+#define NETIO_CTL_SIZE      8
+
+#define NETIO_STATE_CMD     0   /* waiting for a control message */
+#define NETIO_STATE_RECV    1   /* NETIO_CMD_C2S running */
+#define NETIO_STATE_SEND    2   /* NETIO_CMD_S2C running */
+
+struct netio_state {
+  struct netio_state *next;
+  struct tcp_pcb *pcb;
+  u8_t state;
+  u8_t stream;
+  u8_t last;      /* the current block is the last one */
+  u8_t draining;  /* S2C: last block written, waiting for the acks */
+  u8_t ctl_len;
+  u8_t ctl[NETIO_CTL_SIZE];
+  u8_t cmd;
+  u32_t block_size;
+  u32_t block_pos;
+  /* test running (or draining) */
+  u32_t start;
+  u32_t cpu_start;
+  u64_t bytes;    /* received, or sent and acknowledged */
+  u64_t queued;   /* sent */
+  /* since the last interval report */
+  u32_t report_time;
+  u32_t report_cpu;
+  u64_t report_bytes;
+};
+
+static const u8_t netio_buf[NETIO_BUF_SIZE] = { 0 };
+static const u8_t netio_last = 1;
+
+static struct netio_state *netio_streams;
+static u8_t netio_stream_count;
+static u8_t netio_next_stream;
+static netio_report_fn netio_report_cb;
+static void *netio_report_arg;
+#if NETIO_REPORT_MS
+static u8_t netio_timer_active;
+#endif
+
+static u32_t
+netio_cpu_time(void)
+{
+#ifdef NETIO_CPU_TIME
+  return NETIO_CPU_TIME();
+#else
+  return 0;
+#endif
+}
+
+static u8_t
+netio_running(void)
+{
+  struct netio_state *ns;
+  u8_t n = 0;
+
+  for (ns = netio_streams; ns != NULL; ns = ns->next) {
+    if ((ns->state != NETIO_STATE_CMD) || ns->draining) {
+      n++;
+    }
+  }
+  return n;
+}
+
+static void
+netio_print(void *arg, const struct netio_report *r)
+{
+  u64_t kbps = r->ms ? (r->bytes / 1024) * 1000 / r->ms : 0;
+
+  LWIP_UNUSED_ARG(arg);
+#ifdef NETIO_CPU_TIME
+  LWIP_PLATFORM_DIAG(("netio %u/%u %s %s %"U32_F": %"U64_F" KiB in %"U32_F" ms, %"U64_F" KiB/s, cpu %"U32_F"%%\n",
+                      r->stream, r->streams, r->type == NETIO_REPORT_RESULT ? "result" : "interval",
+                      r->cmd == NETIO_CMD_C2S ? "rx" : "tx", r->block_size, r->bytes / 1024, r->ms, kbps,
+                      r->ms ? r->cpu_ms * 100 / r->ms : 0));
+#else
+  LWIP_PLATFORM_DIAG(("netio %u/%u %s %s %"U32_F": %"U64_F" KiB in %"U32_F" ms, %"U64_F" KiB/s\n",
+                      r->stream, r->streams, r->type == NETIO_REPORT_RESULT ? "result" : "interval",
+                      r->cmd == NETIO_CMD_C2S ? "rx" : "tx", r->block_size, r->bytes / 1024, r->ms, kbps));
+#endif
+}
+
+static void
+netio_report(struct netio_state *ns, u8_t type, u64_t bytes, u32_t ms, u32_t cpu_ms)
+{
+  struct netio_report r;
+
+  r.type = type;
+  r.cmd = ns->cmd;
+  r.stream = ns->stream;
+  r.streams = netio_running();
+  r.block_size = ns->block_size;
+  r.bytes = bytes;
+  r.ms = ms;
+  r.cpu_ms = cpu_ms;
+  if (netio_report_cb != NULL) {
+    netio_report_cb(netio_report_arg, &r);
+  } else {
+    netio_print(NULL, &r);
+  }
+}
+
+/** Reports the result of a test and ends it */
+static void
+netio_result(struct netio_state *ns)
+{
+  netio_report(ns, NETIO_REPORT_RESULT, ns->bytes, sys_now() - ns->start,
+               netio_cpu_time() - ns->cpu_start);
+  ns->state = NETIO_STATE_CMD;
+  ns->draining = 0;
+}
+
+#if NETIO_REPORT_MS
+static void
+netio_timer(void *arg)
 {
+  struct netio_state *ns;
+  u32_t now = sys_now();
+  u32_t cpu = netio_cpu_time();
+
   LWIP_UNUSED_ARG(arg);
 
-  if (err == ERR_OK && p != NULL) {
-    tcp_recved(pcb, p->tot_len);
-    pbuf_free(p);
+  for (ns = netio_streams; ns != NULL; ns = ns->next) {
+    if ((ns->state != NETIO_STATE_CMD) || ns->draining) {
+      netio_report(ns, NETIO_REPORT_INTERVAL, ns->bytes - ns->report_bytes,
+                   now - ns->report_time, cpu - ns->report_cpu);
+      ns->report_time = now;
+      ns->report_cpu = cpu;
+      ns->report_bytes = ns->bytes;
+    }
+  }
+  if (netio_running()) {
+    sys_timeout(NETIO_REPORT_MS, netio_timer, NULL);
   } else {
-    pbuf_free(p);
+    netio_timer_active = 0;
   }
+}
+#endif /* NETIO_REPORT_MS */
 
-  if (err == ERR_OK && p == NULL) {
-    tcp_arg(pcb, NULL);
-    tcp_sent(pcb, NULL);
-    tcp_recv(pcb, NULL);
-    tcp_close(pcb);
+static void
+netio_start(struct netio_state *ns, u8_t cmd, u32_t block_size)
+{
+  if (ns->draining) {
+    /* the client started the next test before all acks came in */
+    netio_result(ns);
+  }
+  ns->cmd = cmd;
+  ns->state = (cmd == NETIO_CMD_C2S) ? NETIO_STATE_RECV : NETIO_STATE_SEND;
+  ns->block_size = block_size;
+  ns->block_pos = 0;
+  ns->last = 0;
+  ns->bytes = 0;
+  ns->queued = 0;
+  ns->start = ns->report_time = sys_now();
+  ns->cpu_start = ns->report_cpu = netio_cpu_time();
+  ns->report_bytes = 0;
+#if NETIO_REPORT_MS
+  if (!netio_timer_active) {
+    netio_timer_active = 1;
+    sys_timeout(NETIO_REPORT_MS, netio_timer, NULL);
+  }
+#endif
+}
+
+static void
+netio_free(struct netio_state *ns)
+{
+  struct netio_state **p;
+
+  for (p = &netio_streams; *p != NULL; p = &(*p)->next) {
+    if (*p == ns) {
+      *p = ns->next;
+      break;
+    }
+  }
+  netio_stream_count--;
+  mem_free(ns);
+}
+
+static err_t
+netio_close(struct netio_state *ns)
+{
+  struct tcp_pcb *pcb = ns->pcb;
+
+  tcp_arg(pcb, NULL);
+  tcp_sent(pcb, NULL);
+  tcp_recv(pcb, NULL);
+  tcp_err(pcb, NULL);
+  netio_free(ns);
+  if (tcp_close(pcb) != ERR_OK) {
+    tcp_abort(pcb);
+    return ERR_ABRT;
+  }
+  return ERR_OK;
+}
+
+/** Writes as much of the S2C blocks as fits into the send buffer */
+static err_t
+netio_send(struct netio_state *ns)
+{
+  struct tcp_pcb *pcb = ns->pcb;
+  err_t err = ERR_OK;
+
+  while (ns->state == NETIO_STATE_SEND) {
+    const void *data;
+    u16_t len = tcp_sndbuf(pcb);
+
+    if (len == 0) {
+      break;
+    }
+    if ((ns->block_pos == 0) && !ns->last &&
+        ((u32_t)(sys_now() - ns->start) >= NETIO_INTERVAL_MS)) {
+      ns->last = 1;
+    }
+    if ((ns->block_pos == 0) && ns->last) {
+      data = &netio_last;
+      len = 1;
+    } else {
+      data = netio_buf;
+      len = (u16_t)LWIP_MIN(len, LWIP_MIN(ns->block_size - ns->block_pos, NETIO_BUF_SIZE));
+    }
+    err = tcp_write(pcb, data, len, (ns->block_pos + len < ns->block_size) ? TCP_WRITE_FLAG_MORE : 0);
+    if (err == ERR_MEM) {
+      /* out of pbufs or segments, continue when data is acked */
+      err = ERR_OK;
+      break;
+    } else if (err != ERR_OK) {
+      break;
+    }
+    ns->queued += len;
+    ns->block_pos += len;
+    if (ns->block_pos == ns->block_size) {
+      ns->block_pos = 0;
+      if (ns->last) {
+        /* the result is reported when everything is acked */
+        ns->state = NETIO_STATE_CMD;
+        ns->draining = 1;
+      }
+    }
+  }
+  if (err == ERR_OK) {
+    err = tcp_output(pcb);
+  }
+  return err;
+}
+
+/** Handles a control message, returns ERR_CLSD to close the connection */
+static err_t
+netio_command(struct netio_state *ns)
+{
+  u32_t cmd, data;
+
+  cmd = ((u32_t)ns->ctl[0] << 24) | ((u32_t)ns->ctl[1] << 16) |
+        ((u32_t)ns->ctl[2] << 8) | ns->ctl[3];
+  data = ((u32_t)ns->ctl[4] << 24) | ((u32_t)ns->ctl[5] << 16) |
+         ((u32_t)ns->ctl[6] << 8) | ns->ctl[7];
+  LWIP_DEBUGF(NETIO_DEBUG, ("netio %u: cmd %"U32_F" data %"U32_F"\n", ns->stream, cmd, data));
+
+  switch (cmd) {
+    case NETIO_CMD_QUIT:
+      return ERR_CLSD;
+    case NETIO_CMD_C2S:
+    case NETIO_CMD_S2C:
+      if ((data == 0) || (data > NETIO_MAX_BLOCK)) {
+        LWIP_DEBUGF(NETIO_DEBUG | LWIP_DBG_LEVEL_WARNING,
+                    ("netio %u: bad block size %"U32_F"\n", ns->stream, data));
+        return ERR_CLSD;
+      }
+      netio_start(ns, (u8_t)cmd, data);
+      if (cmd == NETIO_CMD_S2C) {
+        return netio_send(ns);
+      }
+      return ERR_OK;
+    default:
+      /* NETIO_CMD_RES and unknown commands */
+      return ERR_OK;
+  }
+}
+
+/** Consumes control messages and C2S blocks */
+static err_t
+netio_input(struct netio_state *ns, struct pbuf *p)
+{
+  struct pbuf *q;
+
+  for (q = p; q != NULL; q = q->next) {
+    const u8_t *data = (const u8_t *)q->payload;
+    u16_t off = 0;
+
+    while (off < q->len) {
+      if (ns->state == NETIO_STATE_RECV) {
+        u32_t n = LWIP_MIN((u32_t)(q->len - off), ns->block_size - ns->block_pos);
+        if (ns->block_pos == 0) {
+          ns->last = (data[off] != 0);
+        }
+        off = (u16_t)(off + n);
+        ns->block_pos += n;
+        ns->bytes += n;
+        if (ns->block_pos == ns->block_size) {
+          ns->block_pos = 0;
+          if (ns->last) {
+            netio_result(ns);
+          }
+        }
+      } else {
+        ns->ctl[ns->ctl_len++] = data[off++];
+        if (ns->ctl_len == NETIO_CTL_SIZE) {
+          err_t err;
+          ns->ctl_len = 0;
+          err = netio_command(ns);
+          if (err != ERR_OK) {
+            return err;
+          }
+        }
+      }
+    }
+  }
+  return ERR_OK;
+}
+
+static err_t
+netio_recv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
+{
+  struct netio_state *ns = (struct netio_state *)arg;
+
+  if ((err != ERR_OK) || (p == NULL) || (ns == NULL)) {
+    if (p != NULL) {
+      pbuf_free(p);
+    }
+    if (p == NULL) {
+      /* remote host closed the connection */
+      if (ns != NULL) {
+        return netio_close(ns);
+      }
+      tcp_close(pcb);
+    }
+    return ERR_OK;
+  }
+
+  tcp_recved(pcb, p->tot_len);
+  err = netio_input(ns, p);
+  pbuf_free(p);
+  if (err != ERR_OK) {
+    return netio_close(ns);
   }
+  return ERR_OK;
+}
+
+static err_t
+netio_sent(void *arg, struct tcp_pcb *pcb, u16_t len)
+{
+  struct netio_state *ns = (struct netio_state *)arg;
+
+  LWIP_UNUSED_ARG(pcb);
 
+  if (ns == NULL) {
+    return ERR_OK;
+  }
+  ns->bytes += len;
+  if (ns->draining && (ns->bytes >= ns->queued)) {
+    netio_result(ns);
+  }
+  if ((ns->state == NETIO_STATE_SEND) && (netio_send(ns) != ERR_OK)) {
+    return netio_close(ns);
+  }
   return ERR_OK;
 }
 
+static void
+netio_err(void *arg, err_t err)
+{
+  struct netio_state *ns = (struct netio_state *)arg;
+
+  LWIP_UNUSED_ARG(err);
+
+  if (ns != NULL) {
+    LWIP_DEBUGF(NETIO_DEBUG, ("netio %u: error %d\n", ns->stream, (int)err));
+    netio_free(ns);
+  }
+}
+
 static err_t
 netio_accept(void *arg, struct tcp_pcb *pcb, err_t err)
 {
+  struct netio_state *ns;
+
   LWIP_UNUSED_ARG(arg);
-  LWIP_UNUSED_ARG(err);
 
-  if (pcb != NULL) {
-    tcp_arg(pcb, NULL);
-    tcp_sent(pcb, NULL);
-    tcp_recv(pcb, netio_recv);
+  if ((err != ERR_OK) || (pcb == NULL)) {
+    return ERR_VAL;
+  }
+  if (netio_stream_count >= NETIO_MAX_STREAMS) {
+    LWIP_DEBUGF(NETIO_DEBUG | LWIP_DBG_LEVEL_WARNING, ("netio: too many streams\n"));
+    tcp_abort(pcb);
+    return ERR_ABRT;
   }
+  ns = (struct netio_state *)mem_malloc(sizeof(struct netio_state));
+  if (ns == NULL) {
+    tcp_abort(pcb);
+    return ERR_ABRT;
+  }
+  memset(ns, 0, sizeof(struct netio_state));
+  ns->pcb = pcb;
+  ns->stream = netio_next_stream++;
+  ns->next = netio_streams;
+  netio_streams = ns;
+  netio_stream_count++;
+
+  tcp_arg(pcb, ns);
+  tcp_recv(pcb, netio_recv);
+  tcp_sent(pcb, netio_sent);
+  tcp_err(pcb, netio_err);
   return ERR_OK;
 }
 
+/** Sets the function the throughput is reported to (NULL to print it) */
+void
+netio_set_report_fn(netio_report_fn fn, void *arg)
+{
+  netio_report_arg = arg;
+  netio_report_cb = fn;
+}
+
 void
 netio_init(void)
 {
   struct tcp_pcb *pcb;
 
   pcb = tcp_new_ip_type(IPADDR_TYPE_ANY);
-  tcp_bind(pcb, IP_ANY_TYPE, 18767);
+  if (pcb == NULL) {
+    return;
+  }
+  if (tcp_bind(pcb, IP_ANY_TYPE, NETIO_PORT) != ERR_OK) {
+    tcp_close(pcb);
+    return;
+  }
   pcb = tcp_listen(pcb);
-  tcp_accept(pcb, netio_accept);
+  if (pcb != NULL) {
+    tcp_accept(pcb, netio_accept);
+  }
 }
 #endif /* LWIP_TCP && LWIP_CALLBACK_API */
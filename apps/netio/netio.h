@@ -1,6 +1,39 @@
 #ifndef LWIP_NETIO_H
 #define LWIP_NETIO_H
 
+#include "lwip/arch.h"
+
+/* NETIO control commands (the 'cmd' of struct netio_report) */
+#define NETIO_CMD_QUIT 0
+#define NETIO_CMD_C2S  1   /* client sends, server receives */
+#define NETIO_CMD_S2C  2   /* server sends, client receives */
+#define NETIO_CMD_RES  3
+
+/* Types of struct netio_report */
+#define NETIO_REPORT_INTERVAL 0   /* throughput of the last NETIO_REPORT_MS */
+#define NETIO_REPORT_RESULT   1   /* throughput of a whole test */
+
+/** Throughput of one stream, passed to the netio_report_fn */
+struct netio_report {
+  /** NETIO_REPORT_INTERVAL or NETIO_REPORT_RESULT */
+  u8_t type;
+  /** NETIO_CMD_C2S (bytes received) or NETIO_CMD_S2C (bytes sent and acknowledged) */
+  u8_t cmd;
+  /** number of the stream (connection) and of all streams running a test */
+  u8_t stream;
+  u8_t streams;
+  /** block size requested by the client */
+  u32_t block_size;
+  /** bytes transferred in 'ms' milliseconds */
+  u64_t bytes;
+  u32_t ms;
+  /** CPU time used by the process meanwhile (if NETIO_CPU_TIME() is defined) */
+  u32_t cpu_ms;
+};
+
+typedef void (*netio_report_fn)(void *arg, const struct netio_report *report);
+
 void netio_init(void);
+void netio_set_report_fn(netio_report_fn fn, void *arg);
 
 #endif /* LWIP_NETIO_H */
@@ -86,6 +86,12 @@ struct command {
 #define NCONNS 10
 static struct netconn *conns[NCONNS];
 
+/** Number of functions that can be added to the stat command */
+#ifndef SHELL_STAT_HOOKS
+#define SHELL_STAT_HOOKS 4
+#endif
+static shell_stat_fn stat_hooks[SHELL_STAT_HOOKS];
+
 /* help_msg is split into 2 strings to prevent exceeding the C89 maximum length of 509 per string */
 static char help_msg1[] = "Available commands:"NEWLINE"\
 open [IP address] [TCP port]: opens a TCP connection to the specified address."NEWLINE"\
@@ -396,6 +402,11 @@ com_acpt(struct command *com)
 /*-----------------------------------------------------------------------------------*/
 #if LWIP_STATS
 static void
+com_stat_write_str(void *ctx, const char *str)
+{
+  netconn_write((struct netconn *)ctx, str, strlen(str), NETCONN_COPY);
+}
+static void
 com_stat_write_mem(struct netconn *conn, struct stats_mem *elem, int i)
 {
   u16_t len;
@@ -448,9 +459,7 @@ com_stat_write_sys(struct netconn *conn, struct stats_syselem *elem, const char
 static s8_t
 com_stat(struct command *com)
 {
-#if PROTOCOL_STATS || MEMP_STATS
   size_t i;
-#endif /* PROTOCOL_STATS || MEMP_STATS */
 #if PROTOCOL_STATS
   size_t k;
   char buf[100];
@@ -481,6 +490,9 @@ com_stat(struct command *com)
   com_stat_write_sys(com->conn, &lwip_stats.sys.mutex, "MUTEX     ");
   com_stat_write_sys(com->conn, &lwip_stats.sys.mbox,  "MBOX      ");
 #endif /* SYS_STATS */
+  for(i = 0; (i < SHELL_STAT_HOOKS) && (stat_hooks[i] != NULL); i++) {
+    stat_hooks[i](com_stat_write_str, com->conn);
+  }
 
   return ESUCCESS;
 }
@@ -1237,5 +1249,21 @@ shell_init(void)
 {
   sys_thread_new("shell_thread", shell_thread, NULL, DEFAULT_THREAD_STACKSIZE, DEFAULT_THREAD_PRIO);
 }
+/*-----------------------------------------------------------------------------------*/
+/** Let the "stat" command also print what fn writes (e.g. statistics of
+    a port or an application); call before shell_init() */
+void
+shell_add_stat(shell_stat_fn fn)
+{
+  size_t i;
+
+  for(i = 0; i < SHELL_STAT_HOOKS; i++) {
+    if (stat_hooks[i] == NULL) {
+      stat_hooks[i] = fn;
+      return;
+    }
+  }
+  LWIP_ASSERT("shell_add_stat: increase SHELL_STAT_HOOKS", 0);
+}
 
 #endif /* LWIP_NETCONN && LWIP_TCP */
@@ -32,6 +32,12 @@
 #ifndef LWIP_SHELL_H
 #define LWIP_SHELL_H
 
+/** Writes str to the client of the shell (ctx) */
+typedef void (*shell_write_fn)(void *ctx, const char *str);
+/** Adds lines to the output of the "stat" command */
+typedef void (*shell_stat_fn)(shell_write_fn write, void *ctx);
+
 void shell_init(void);
+void shell_add_stat(shell_stat_fn fn);
 
 #endif /* LWIP_SHELL_H */
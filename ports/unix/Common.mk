@@ -32,10 +32,12 @@
 # Architecture specific files.
 LWIPARCH?=$(CONTRIBDIR)/ports/unix/port
 SYSARCH?=$(LWIPARCH)/sys_arch.c
-ARCHFILES=$(LWIPARCH)/perf.c $(SYSARCH) $(LWIPARCH)/netif/tapif.c $(LWIPARCH)/netif/tunif.c \
+ARCHFILES=$(LWIPARCH)/opts.c $(LWIPARCH)/perf.c $(LWIPARCH)/trace.c $(LWIPARCH)/evloop.c $(SYSARCH) $(LWIPARCH)/netif/tapif.c $(LWIPARCH)/netif/tunif.c \
 	$(LWIPARCH)/netif/unixif.c $(LWIPARCH)/netif/list.c $(LWIPARCH)/netif/tcpdump.c \
-	$(LWIPARCH)/netif/delif.c $(LWIPARCH)/netif/sio.c $(LWIPARCH)/netif/fifo.c
+	$(LWIPARCH)/netif/delif.c $(LWIPARCH)/netif/sio.c $(LWIPARCH)/netif/fifo.c \
+	$(LWIPARCH)/netif/iouring.c $(LWIPARCH)/netif/pktif.c \
+	$(LWIPARCH)/netif/xdpif.c $(LWIPARCH)/netif/shaper.c $(LWIPARCH)/netif/pcapif.c
 
 include ../../Common.allports.mk
 
-LDFLAGS+=-pthread -lutil -lrt
+LDFLAGS+=-pthread -lutil -lrt -lm
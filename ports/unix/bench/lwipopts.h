@@ -0,0 +1,77 @@
+/**
+ * @file
+ *
+ * lwIP Options Configuration
+ */
+
+/*
+ * Copyright (c) 2001-2004 Swedish Institute of Computer Science.
+ * All rights reserved. 
+ * 
+ * Redistribution and use in source and binary forms, with or without modification, 
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED 
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF 
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT 
+ * SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT 
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING 
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY 
+ * OF SUCH DAMAGE.
+ *
+ * This file is part of the lwIP TCP/IP stack.
+ *
+ */
+#ifndef LWIP_LWIPOPTS_H
+#define LWIP_LWIPOPTS_H
+
+/* Options shared by the benchmarks: lwprot_bench only uses memp and pbuf
+   (from many threads at once, without the tcpip thread), tapif_bench runs
+   bulk TCP over tapif */
+
+#define NO_SYS                     0
+#define SYS_LIGHTWEIGHT_PROT       1
+
+#define LWIP_NETCONN               0
+#define LWIP_SOCKET                0
+
+/* enough for 16 threads holding LWPROT_BENCH_BATCH objects each, and for
+   the TCP send queue of tapif_bench (data is sent by reference) */
+#define MEMP_NUM_PBUF              512
+/* room for a full receive window of 64KB GSO frames */
+#define PBUF_POOL_SIZE             1024
+#define PBUF_POOL_BUFSIZE          1536
+#define MEM_SIZE                   (256 * 1024)
+
+/* ---------- TCP options ---------- */
+#define LWIP_TCP                   1
+#define TCP_MSS                    1460
+#define LWIP_WND_SCALE             1
+#define TCP_RCV_SCALE              2
+#define TCP_WND                    (128 * 1024)
+#define TCP_SND_BUF                (128 * 1024)
+#define TCP_SND_QUEUELEN           512
+#define MEMP_NUM_TCP_SEG           512
+
+/* ---------- tapif options ---------- */
+/* TAPIF_OFFLOAD merges the segments of a TX burst into GSO frames; the
+   netif's checksum flags are set by tapif according to TAPIF_OFFLOAD */
+#define TAPIF_TX_BATCH             1
+#define LWIP_CHECKSUM_CTRL_PER_NETIF 1
+#define TCPIP_MBOX_SIZE            512
+
+/* statistics would add work inside the protected regions */
+#define LWIP_STATS                 0
+
+#endif /* LWIP_LWIPOPTS_H */
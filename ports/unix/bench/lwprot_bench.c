@@ -0,0 +1,189 @@
+/**
+ * @file
+ *
+ * Microbenchmark for SYS_LIGHTWEIGHT_PROT: memp and pbuf throughput with
+ * 1..16 threads allocating and freeing concurrently.
+ */
+
+/*
+ * Copyright (c) 2001-2004 Swedish Institute of Computer Science.
+ * All rights reserved. 
+ * 
+ * Redistribution and use in source and binary forms, with or without modification, 
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED 
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF 
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT 
+ * SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT 
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING 
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY 
+ * OF SUCH DAMAGE.
+ *
+ * This file is part of the lwIP TCP/IP stack.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "lwip/init.h"
+#include "lwip/memp.h"
+#include "lwip/pbuf.h"
+
+/** number of objects each thread allocates before freeing them again */
+#ifndef LWPROT_BENCH_BATCH
+#define LWPROT_BENCH_BATCH 4
+#endif
+
+#define LWPROT_BENCH_MAX_THREADS 16
+
+#define LWPROT_BENCH_MEMP 0
+#define LWPROT_BENCH_PBUF 1
+
+struct bench_thread {
+  pthread_t thread;
+  int test;
+  unsigned long ops;
+  unsigned long failed;
+};
+
+static int bench_state; /* 0: wait, 1: run, 2: stop */
+
+static void *
+bench_thread_fn(void *arg)
+{
+  struct bench_thread *t = (struct bench_thread *)arg;
+  void *objs[LWPROT_BENCH_BATCH];
+  int i;
+
+  while (__atomic_load_n(&bench_state, __ATOMIC_ACQUIRE) == 0) {
+    sched_yield();
+  }
+  while (__atomic_load_n(&bench_state, __ATOMIC_RELAXED) == 1) {
+    for (i = 0; i < LWPROT_BENCH_BATCH; i++) {
+      if (t->test == LWPROT_BENCH_MEMP) {
+        objs[i] = memp_malloc(MEMP_PBUF);
+      } else {
+        objs[i] = pbuf_alloc(PBUF_RAW, PBUF_POOL_BUFSIZE, PBUF_POOL);
+      }
+    }
+    for (i = 0; i < LWPROT_BENCH_BATCH; i++) {
+      if (objs[i] == NULL) {
+        t->failed++;
+        continue;
+      }
+      if (t->test == LWPROT_BENCH_MEMP) {
+        memp_free(MEMP_PBUF, objs[i]);
+      } else {
+        pbuf_free((struct pbuf *)objs[i]);
+      }
+      t->ops++;
+    }
+  }
+  return NULL;
+}
+
+/* Run one test with 'nthreads' threads, returns alloc/free pairs per second */
+static double
+bench_run(int test, int nthreads, unsigned int msecs, unsigned long *failed)
+{
+  struct bench_thread threads[LWPROT_BENCH_MAX_THREADS];
+  struct timespec start, end;
+  unsigned long ops = 0;
+  double secs;
+  int i;
+
+  *failed = 0;
+  bench_state = 0;
+  for (i = 0; i < nthreads; i++) {
+    threads[i].test = test;
+    threads[i].ops = 0;
+    threads[i].failed = 0;
+    if (pthread_create(&threads[i].thread, NULL, bench_thread_fn, &threads[i]) != 0) {
+      perror("pthread_create");
+      exit(1);
+    }
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  __atomic_store_n(&bench_state, 1, __ATOMIC_RELEASE);
+  usleep(msecs * 1000);
+  __atomic_store_n(&bench_state, 2, __ATOMIC_RELEASE);
+
+  for (i = 0; i < nthreads; i++) {
+    pthread_join(threads[i].thread, NULL);
+    ops += threads[i].ops;
+    *failed += threads[i].failed;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  secs = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+  return (double)ops / secs;
+}
+
+static void
+usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [-t msecs per run] [-n max threads (1..%d)]\n",
+          name, LWPROT_BENCH_MAX_THREADS);
+}
+
+int
+main(int argc, char **argv)
+{
+  unsigned int msecs = 1000;
+  int max_threads = LWPROT_BENCH_MAX_THREADS;
+  int nthreads;
+  int ch;
+
+  while ((ch = getopt(argc, argv, "t:n:h")) != -1) {
+    switch (ch) {
+      case 't':
+        msecs = (unsigned int)atoi(optarg);
+        break;
+      case 'n':
+        max_threads = atoi(optarg);
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+  if ((max_threads < 1) || (max_threads > LWPROT_BENCH_MAX_THREADS) || (msecs == 0)) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  lwip_init();
+
+  printf("%s: alloc/free pairs per second, %u ms per run\n", argv[0], msecs);
+  printf("%8s %16s %16s\n", "threads", "memp", "pbuf(POOL)");
+  for (nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+    unsigned long failed_memp, failed_pbuf;
+    double memp_rate = bench_run(LWPROT_BENCH_MEMP, nthreads, msecs, &failed_memp);
+    double pbuf_rate = bench_run(LWPROT_BENCH_PBUF, nthreads, msecs, &failed_pbuf);
+    printf("%8d %16.0f %16.0f", nthreads, memp_rate, pbuf_rate);
+    if (failed_memp || failed_pbuf) {
+      printf("  (%lu/%lu allocations failed)", failed_memp, failed_pbuf);
+    }
+    printf("\n");
+  }
+  return 0;
+}
@@ -0,0 +1,295 @@
+/**
+ * @file
+ *
+ * Bulk TCP throughput between the host and lwIP over tapif, for comparing
+ * TAPIF_OFFLOAD=0 and TAPIF_OFFLOAD=1 (see the README).
+ */
+
+/*
+ * Copyright (c) 2001-2004 Swedish Institute of Computer Science.
+ * All rights reserved. 
+ * 
+ * Redistribution and use in source and binary forms, with or without modification, 
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED 
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF 
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT 
+ * SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT 
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING 
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY 
+ * OF SUCH DAMAGE.
+ *
+ * This file is part of the lwIP TCP/IP stack.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "lwip/tcpip.h"
+#include "lwip/tcp.h"
+#include "lwip/netif.h"
+#include "lwip/ip4_addr.h"
+#include "netif/tapif.h"
+
+/* lwIP discards what it receives on this port... */
+#define TAPIF_BENCH_SINK_PORT   5001
+/* ...and sends until the peer closes on this one */
+#define TAPIF_BENCH_SOURCE_PORT 5002
+
+/* sent by reference, never changed */
+static u8_t bench_data[16 * TCP_MSS];
+
+static err_t
+sink_recv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
+{
+  LWIP_UNUSED_ARG(arg);
+  LWIP_UNUSED_ARG(err);
+
+  if (p == NULL) {
+    tcp_close(pcb);
+    return ERR_OK;
+  }
+  tcp_recved(pcb, p->tot_len);
+  pbuf_free(p);
+  return ERR_OK;
+}
+
+static err_t
+sink_accept(void *arg, struct tcp_pcb *pcb, err_t err)
+{
+  LWIP_UNUSED_ARG(arg);
+  LWIP_UNUSED_ARG(err);
+
+  tcp_recv(pcb, sink_recv);
+  return ERR_OK;
+}
+
+static void
+source_send(struct tcp_pcb *pcb)
+{
+  u16_t len;
+
+  do {
+    len = (u16_t)LWIP_MIN(tcp_sndbuf(pcb), sizeof(bench_data));
+  } while ((len > 0) && (tcp_write(pcb, bench_data, len, 0) == ERR_OK));
+  tcp_output(pcb);
+}
+
+static err_t
+source_sent(void *arg, struct tcp_pcb *pcb, u16_t len)
+{
+  LWIP_UNUSED_ARG(arg);
+  LWIP_UNUSED_ARG(len);
+
+  source_send(pcb);
+  return ERR_OK;
+}
+
+static err_t
+source_recv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
+{
+  LWIP_UNUSED_ARG(arg);
+  LWIP_UNUSED_ARG(err);
+
+  if (p == NULL) {
+    tcp_sent(pcb, NULL);
+    tcp_close(pcb);
+    return ERR_OK;
+  }
+  tcp_recved(pcb, p->tot_len);
+  pbuf_free(p);
+  return ERR_OK;
+}
+
+static err_t
+source_accept(void *arg, struct tcp_pcb *pcb, err_t err)
+{
+  LWIP_UNUSED_ARG(arg);
+  LWIP_UNUSED_ARG(err);
+
+  tcp_recv(pcb, source_recv);
+  tcp_sent(pcb, source_sent);
+  source_send(pcb);
+  return ERR_OK;
+}
+
+static void
+bench_listen(u16_t port, tcp_accept_fn accept)
+{
+  struct tcp_pcb *pcb = tcp_new();
+
+  if ((pcb == NULL) || (tcp_bind(pcb, IP_ADDR_ANY, port) != ERR_OK)) {
+    fprintf(stderr, "cannot listen on port %d\n", port);
+    exit(1);
+  }
+  pcb = tcp_listen(pcb);
+  tcp_accept(pcb, accept);
+}
+
+static double
+bench_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* Connect to lwIP with a socket of the host stack */
+static int
+bench_connect(const ip4_addr_t *addr, u16_t port)
+{
+  struct sockaddr_in sin;
+  int s = socket(AF_INET, SOCK_STREAM, 0);
+
+  memset(&sin, 0, sizeof(sin));
+  sin.sin_family = AF_INET;
+  sin.sin_port = lwip_htons(port);
+  sin.sin_addr.s_addr = ip4_addr_get_u32(addr);
+  if ((s < 0) || (connect(s, (struct sockaddr *)&sin, sizeof(sin)) < 0)) {
+    perror("tapif_bench: connect");
+    exit(1);
+  }
+  return s;
+}
+
+/* host -> lwIP: send for 'secs' seconds, returns Mbit/s. Timing stops when
+   lwIP closes after having received everything. */
+static double
+bench_to_lwip(const ip4_addr_t *addr, unsigned int secs)
+{
+  static char buf[65536];
+  double start, end;
+  unsigned long bytes = 0;
+  int s = bench_connect(addr, TAPIF_BENCH_SINK_PORT);
+
+  start = bench_now();
+  end = start + secs;
+  while (bench_now() < end) {
+    ssize_t n = write(s, buf, sizeof(buf));
+    if (n <= 0) {
+      perror("tapif_bench: write");
+      break;
+    }
+    bytes += (unsigned long)n;
+  }
+  shutdown(s, SHUT_WR);
+  while (read(s, buf, sizeof(buf)) > 0);
+  end = bench_now();
+  close(s);
+  return (double)bytes * 8 / (end - start) / 1e6;
+}
+
+/* lwIP -> host: receive for 'secs' seconds, returns Mbit/s */
+static double
+bench_from_lwip(const ip4_addr_t *addr, unsigned int secs)
+{
+  static char buf[65536];
+  double start, now, end;
+  unsigned long bytes = 0;
+  int s = bench_connect(addr, TAPIF_BENCH_SOURCE_PORT);
+
+  start = now = bench_now();
+  end = start + secs;
+  while (now < end) {
+    ssize_t n = read(s, buf, sizeof(buf));
+    if (n <= 0) {
+      perror("tapif_bench: read");
+      break;
+    }
+    bytes += (unsigned long)n;
+    now = bench_now();
+  }
+  close(s);
+  return (double)bytes * 8 / (now - start) / 1e6;
+}
+
+static void
+usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [-t secs per direction] [-i lwIP address] [-g tap address]\n", name);
+}
+
+int
+main(int argc, char **argv)
+{
+  struct netif netif;
+  ip4_addr_t ipaddr, netmask, gw;
+  struct tapif_batch_stats s0, s1, s2;
+  const char *offload = getenv("TAPIF_OFFLOAD");
+  unsigned int secs = 5;
+  double rate;
+  int ch;
+
+  IP4_ADDR(&gw, 192,168,0,1);
+  IP4_ADDR(&ipaddr, 192,168,0,2);
+  IP4_ADDR(&netmask, 255,255,255,0);
+
+  while ((ch = getopt(argc, argv, "t:i:g:h")) != -1) {
+    switch (ch) {
+      case 't':
+        secs = (unsigned int)atoi(optarg);
+        break;
+      case 'i':
+        ip4addr_aton(optarg, &ipaddr);
+        break;
+      case 'g':
+        ip4addr_aton(optarg, &gw);
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+  if (secs == 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  tcpip_init(NULL, NULL);
+
+  LOCK_TCPIP_CORE();
+  netif_add(&netif, &ipaddr, &netmask, &gw, NULL, tapif_init, tcpip_input);
+  netif_set_default(&netif);
+  netif_set_up(&netif);
+  bench_listen(TAPIF_BENCH_SINK_PORT, sink_accept);
+  bench_listen(TAPIF_BENCH_SOURCE_PORT, source_accept);
+  UNLOCK_TCPIP_CORE();
+
+  printf("%s: bulk TCP over tapif, offload %s, %u s per direction\n", argv[0],
+         ((offload != NULL) && (atoi(offload) != 0)) ? "on" : "off", secs);
+
+  /* let the host finish setting up the interface */
+  sleep(1);
+
+  tapif_get_batch_stats(&netif, &s0);
+  rate = bench_to_lwip(&ipaddr, secs);
+  tapif_get_batch_stats(&netif, &s1);
+  printf("host -> lwIP %10.1f Mbit/s  %8lu frames in (%lu GSO)\n", rate,
+         (unsigned long)(s1.rx_frames - s0.rx_frames), (unsigned long)(s1.rx_gso - s0.rx_gso));
+
+  rate = bench_from_lwip(&ipaddr, secs);
+  tapif_get_batch_stats(&netif, &s2);
+  printf("lwIP -> host %10.1f Mbit/s  %8lu frames out (%lu GSO)\n", rate,
+         (unsigned long)(s2.tx_frames - s1.tx_frames), (unsigned long)(s2.tx_gso - s1.tx_gso));
+  return 0;
+}
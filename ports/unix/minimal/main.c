@@ -50,7 +50,10 @@
 #include "lwip/udp.h"
 #include "lwip/tcp.h"
 #include "netif/tapif.h"
+#include "netif/pktif.h"
+#include "netif/xdpif.h"
 #include "netif/etharp.h"
+#include "arch/evloop.h"
 
 #include "lwip/apps/snmp.h"
 #include "lwip/apps/snmp_mib2.h"
@@ -58,6 +61,7 @@
 #include "apps/snmp_private_mib/private_mib.h"
 #include "apps/udpecho_raw/udpecho_raw.h"
 #include "apps/tcpecho_raw/tcpecho_raw.h"
+#include "apps/iperf3/iperf3.h"
 
 /* (manual) host IP configuration */
 static ip4_addr_t ipaddr, netmask, gw;
@@ -76,6 +80,12 @@ static const struct snmp_mib *mibs[] = {
 /* nonstatic debug cmd option, exported in lwipopts.h */
 unsigned char debug_flags;
 
+/* netif cmd option: tap interface, AF_PACKET or AF_XDP socket */
+static netif_init_fn netif_init_func = tapif_init;
+#ifdef LWIP_UNIX_LINUX
+static err_t (*netif_evloop_add_func)(struct netif *netif) = tapif_evloop_add;
+#endif /* LWIP_UNIX_LINUX */
+
 #if LWIP_SNMP
 /* enable == 1, disable == 2 */
 u8_t snmpauthentraps_set = 2;
@@ -94,6 +104,11 @@ static struct option longopts[] = {
   {"netmask", required_argument, NULL, 'm'},
   /* ping destination */
   {"trap_destination", required_argument, NULL, 't'},
+#ifdef LWIP_UNIX_LINUX
+  /* "tap" (default), "pkt" (AF_PACKET on PKTIF_IFNAME) or "xdp" (AF_XDP on
+     XDPIF_IFNAME) */
+  {"netif", required_argument, NULL, 'n'},
+#endif /* LWIP_UNIX_LINUX */
   /* new command line options go here! */
   {NULL,   0,                 NULL,  0}
 };
@@ -128,7 +143,7 @@ main(int argc, char **argv)
   /* use debug flags defined by debug.h */
   debug_flags = LWIP_DBG_OFF;
 
-  while ((ch = getopt_long(argc, argv, "dhg:i:m:t:", longopts, NULL)) != -1) {
+  while ((ch = getopt_long(argc, argv, "dhg:i:m:n:t:", longopts, NULL)) != -1) {
     switch (ch) {
       case 'd':
         debug_flags |= (LWIP_DBG_ON|LWIP_DBG_TRACE|LWIP_DBG_STATE|LWIP_DBG_FRESH|LWIP_DBG_HALT);
@@ -146,6 +161,20 @@ main(int argc, char **argv)
       case 'm':
         ip4addr_aton(optarg, &netmask);
         break;
+#ifdef LWIP_UNIX_LINUX
+      case 'n':
+        if (strcmp(optarg, "pkt") == 0) {
+          netif_init_func = pktif_init;
+          netif_evloop_add_func = pktif_evloop_add;
+        } else if (strcmp(optarg, "xdp") == 0) {
+          netif_init_func = xdpif_init;
+          netif_evloop_add_func = xdpif_evloop_add;
+        } else if (strcmp(optarg, "tap") != 0) {
+          usage();
+          exit(1);
+        }
+        break;
+#endif /* LWIP_UNIX_LINUX */
       case 't':
 #if LWIP_SNMP
         trap_flag = !0;
@@ -179,7 +208,7 @@ main(int argc, char **argv)
 
   printf("TCP/IP initialized.\n");
 
-  netif_add(&netif, &ipaddr, &netmask, &gw, NULL, tapif_init, ethernet_input);
+  netif_add(&netif, &ipaddr, &netmask, &gw, NULL, netif_init_func, ethernet_input);
   netif_set_default(&netif);
   netif_set_up(&netif);
 #if LWIP_IPV6
@@ -209,16 +238,25 @@ main(int argc, char **argv)
 
   udpecho_raw_init();
   tcpecho_raw_init();
+  iperf3_server_start(IPERF3_PORT, NULL, NULL);
 
   printf("Applications started.\n");
     
 
+#ifdef LWIP_UNIX_LINUX
+  /* sleep until the netif has frames or a timeout is due */
+  if ((evloop_init() != ERR_OK) || (netif_evloop_add_func(&netif) != ERR_OK)) {
+    exit(1);
+  }
+  evloop_run();
+#else /* LWIP_UNIX_LINUX */
   while (1) {
     /* poll netif, pass packet to lwIP */
     tapif_select(&netif);
 
     sys_check_timeouts();
   }
+#endif /* LWIP_UNIX_LINUX */
   
   return 0;
 }
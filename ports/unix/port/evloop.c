@@ -0,0 +1,284 @@
+/*
+ * Copyright (c) 2001-2003 Swedish Institute of Computer Science.
+ * All rights reserved. 
+ * 
+ * Redistribution and use in source and binary forms, with or without modification, 
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED 
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF 
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT 
+ * SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT 
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING 
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY 
+ * OF SUCH DAMAGE.
+ *
+ * This file is part of the lwIP TCP/IP stack.
+ *
+ */
+
+/*
+ * NO_SYS main loop on epoll, see arch/evloop.h.
+ *
+ * All descriptors are level triggered: an input function only handles one
+ * batch per iteration, so a busy netif cannot starve the others or the
+ * timeouts, and what it left is reported again by the next epoll_wait().
+ */
+
+#include "lwip/opt.h"
+
+#if NO_SYS
+
+#include "arch/evloop.h"
+
+#ifdef LWIP_UNIX_LINUX
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include "lwip/debug.h"
+#include "lwip/def.h"
+#include "lwip/timeouts.h"
+
+#ifndef EVLOOP_DEBUG
+#define EVLOOP_DEBUG LWIP_DBG_OFF
+#endif
+
+/** Maximum number of registered descriptors */
+#ifndef EVLOOP_MAX_SOURCES
+#define EVLOOP_MAX_SOURCES 16
+#endif
+
+/* epoll data of the timerfd */
+#define EVLOOP_TIMER 0xffffffffUL
+
+struct evloop_source {
+  int fd;
+  evloop_input_fn input;
+  evloop_flush_fn flush;
+  void *arg;
+};
+
+static int epfd = -1;
+static int timerfd = -1;
+/* millisecond (of CLOCK_MONOTONIC, like sys_now()) the timerfd expires at,
+   0 if disarmed */
+static u64_t timer_due;
+static struct evloop_source sources[EVLOOP_MAX_SOURCES];
+static struct evloop_stats stats;
+
+/*-----------------------------------------------------------------------------------*/
+static u64_t
+evloop_now_us(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (u64_t)ts.tv_sec * 1000000 + (u64_t)ts.tv_nsec / 1000;
+}
+
+static void
+evloop_hist_add(u32_t *hist, u64_t us)
+{
+  int i = 0;
+
+  while ((i < EVLOOP_HIST_BUCKETS - 1) && (us >= ((u64_t)1 << i))) {
+    i++;
+  }
+  hist[i]++;
+}
+
+/* Arm the timerfd for the next lwIP timeout, returns the epoll_wait() timeout */
+static int
+evloop_arm_timer(u64_t now_us)
+{
+  struct itimerspec its;
+  u32_t msecs = sys_timeouts_sleeptime();
+  u64_t due;
+
+  if (msecs == 0) {
+    return 0;
+  }
+  if (msecs == SYS_TIMEOUTS_SLEEPTIME_INFINITE) {
+    due = 0;
+  } else {
+    /* sys_now() truncates to the millisecond: the timeout is due when the
+       clock reaches the start of millisecond now + msecs */
+    due = now_us / 1000 + msecs;
+  }
+  if (due != timer_due) {
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = (time_t)(due / 1000);
+    its.it_value.tv_nsec = (long)(due % 1000) * 1000000L;
+    if (timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+      perror("evloop: timerfd_settime");
+      return (int)LWIP_MIN(msecs, 1000);
+    }
+    timer_due = due;
+  }
+  return -1;
+}
+
+/*-----------------------------------------------------------------------------------*/
+err_t
+evloop_init(void)
+{
+  struct epoll_event ev;
+  int i;
+
+  for (i = 0; i < EVLOOP_MAX_SOURCES; i++) {
+    sources[i].fd = -1;
+  }
+  epfd = epoll_create1(EPOLL_CLOEXEC);
+  timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if ((epfd < 0) || (timerfd < 0)) {
+    perror("evloop_init");
+    return ERR_IF;
+  }
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.u32 = EVLOOP_TIMER;
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, timerfd, &ev) < 0) {
+    perror("evloop_init: epoll_ctl");
+    return ERR_IF;
+  }
+  timer_due = 0;
+  memset(&stats, 0, sizeof(stats));
+  return ERR_OK;
+}
+
+/* Register 'fd': input(arg) is called whenever it is readable, flush(arg) (if
+   not NULL) before every sleep */
+err_t
+evloop_add(int fd, evloop_input_fn input, evloop_flush_fn flush, void *arg)
+{
+  struct epoll_event ev;
+  u32_t i;
+
+  LWIP_ASSERT("evloop_init() not called", epfd >= 0);
+  for (i = 0; i < EVLOOP_MAX_SOURCES; i++) {
+    if (sources[i].fd < 0) {
+      break;
+    }
+  }
+  if (i == EVLOOP_MAX_SOURCES) {
+    LWIP_DEBUGF(EVLOOP_DEBUG, ("evloop_add: no room for fd %d\n", fd));
+    return ERR_MEM;
+  }
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.u32 = i;
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+    perror("evloop_add: epoll_ctl");
+    return ERR_ARG;
+  }
+  sources[i].fd = fd;
+  sources[i].input = input;
+  sources[i].flush = flush;
+  sources[i].arg = arg;
+  LWIP_DEBUGF(EVLOOP_DEBUG, ("evloop_add: fd %d\n", fd));
+  return ERR_OK;
+}
+
+void
+evloop_remove(int fd)
+{
+  int i;
+
+  for (i = 0; i < EVLOOP_MAX_SOURCES; i++) {
+    if (sources[i].fd == fd) {
+      epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+      sources[i].fd = -1;
+    }
+  }
+}
+
+/* Wait for the next event and handle everything that is ready, returns the
+   number of frames passed up */
+int
+evloop_run_once(void)
+{
+  struct epoll_event events[EVLOOP_MAX_SOURCES + 1];
+  u64_t now, start;
+  u64_t expirations;
+  int i, n, timeout;
+  int frames = 0;
+
+  for (i = 0; i < EVLOOP_MAX_SOURCES; i++) {
+    if ((sources[i].fd >= 0) && (sources[i].flush != NULL)) {
+      sources[i].flush(sources[i].arg);
+    }
+  }
+
+  timeout = evloop_arm_timer(evloop_now_us());
+  n = epoll_wait(epfd, events, LWIP_ARRAYSIZE(events), timeout);
+  if ((n < 0) && (errno != EINTR)) {
+    perror("evloop: epoll_wait");
+  }
+  start = evloop_now_us();
+
+  for (i = 0; i < n; i++) {
+    u32_t index = events[i].data.u32;
+
+    if (index == EVLOOP_TIMER) {
+      if (read(timerfd, &expirations, sizeof(expirations)) > 0) {
+        stats.timer_wakeups++;
+        evloop_hist_add(stats.timer_late_us, start - LWIP_MIN(start, timer_due * 1000));
+      }
+      /* expired, it is armed again before the next sleep */
+      timer_due = 0;
+    } else if (sources[index].fd >= 0) {
+      int ret = sources[index].input(sources[index].arg);
+      stats.inputs++;
+      if (ret > 0) {
+        frames += ret;
+      }
+    }
+  }
+
+  sys_check_timeouts();
+
+  now = evloop_now_us();
+  stats.iterations++;
+  stats.frames += (u32_t)frames;
+  evloop_hist_add(stats.busy_us, now - start);
+  return frames;
+}
+
+void
+evloop_run(void)
+{
+  while (1) {
+    evloop_run_once();
+  }
+}
+
+/* Copy the statistics to 'stats_out', and clear them if 'reset' is set */
+void
+evloop_get_stats(struct evloop_stats *stats_out, u8_t reset)
+{
+  *stats_out = stats;
+  if (reset) {
+    memset(&stats, 0, sizeof(stats));
+  }
+}
+
+#endif /* LWIP_UNIX_LINUX */
+
+#endif /* NO_SYS */
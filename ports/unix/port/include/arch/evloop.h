@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2001-2003 Swedish Institute of Computer Science.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+ * SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ *
+ * This file is part of the lwIP TCP/IP stack.
+ *
+ */
+#ifndef LWIP_ARCH_EVLOOP_H
+#define LWIP_ARCH_EVLOOP_H
+
+#include "lwip/opt.h"
+
+#if NO_SYS
+
+#include "lwip/err.h"
+
+/*
+ * evloop: main loop for NO_SYS programs (Linux only, built on epoll). Any
+ * number of file descriptors (netifs, sockets) are registered with it; the
+ * loop sleeps until one of them is readable or the next lwIP timeout is due
+ * (armed on a timerfd, so it is not late by the millisecond rounding of
+ * poll()), calls the input function of each ready descriptor and then
+ * sys_check_timeouts().
+ *
+ *   evloop_init();
+ *   tapif_evloop_add(&netif);
+ *   evloop_run();
+ */
+
+/** Number of buckets of the histograms in struct evloop_stats: bucket i counts
+ * values below 2^i microseconds (and at least 2^(i-1)), the last one
+ * everything bigger */
+#ifndef EVLOOP_HIST_BUCKETS
+#define EVLOOP_HIST_BUCKETS 20
+#endif
+
+/** Called when the descriptor is readable: handle at most one bounded batch
+ * without blocking (the loop comes back if more is pending, after serving the
+ * other descriptors), return the number of frames handled */
+typedef int (*evloop_input_fn)(void *arg);
+/** Called before the loop goes to sleep, e.g. to push out frames queued for
+ * sending during the iteration */
+typedef void (*evloop_flush_fn)(void *arg);
+
+/** Statistics of the loop, see evloop_get_stats() */
+struct evloop_stats {
+  /** number of iterations (wakeups) */
+  u32_t iterations;
+  /** number of input function calls */
+  u32_t inputs;
+  /** number of frames returned by the input functions */
+  u32_t frames;
+  /** number of wakeups because a timeout was due */
+  u32_t timer_wakeups;
+  /** time spent from wakeup until going to sleep again */
+  u32_t busy_us[EVLOOP_HIST_BUCKETS];
+  /** delay between a timeout being due and sys_check_timeouts() running */
+  u32_t timer_late_us[EVLOOP_HIST_BUCKETS];
+};
+
+err_t evloop_init(void);
+err_t evloop_add(int fd, evloop_input_fn input, evloop_flush_fn flush, void *arg);
+void  evloop_remove(int fd);
+int   evloop_run_once(void);
+void  evloop_run(void);
+void  evloop_get_stats(struct evloop_stats *stats, u8_t reset);
+
+#endif /* NO_SYS */
+
+#endif /* LWIP_ARCH_EVLOOP_H */
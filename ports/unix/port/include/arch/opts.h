@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2001-2003 Swedish Institute of Computer Science.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+ * SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ *
+ * This file is part of the lwIP TCP/IP stack.
+ *
+ */
+#ifndef LWIP_ARCH_OPTS_H
+#define LWIP_ARCH_OPTS_H
+
+#include "lwip/arch.h"
+
+/*
+ * Option strings of the Unix port: the configuration of drivers and tools
+ * given in the environment, e.g. DELIF_OUTPUT="delay=40ms,rate=10M" or
+ * PERF="off,interval=1000", is a list of key=value items (or plain keys)
+ * separated by commas or spaces.
+ */
+
+/** Called for each item of an option string. 'value' is NULL for an item
+ * without '=', else it points into a copy of the string that may be
+ * changed. Returns 0 if the item was taken, anything else to have it
+ * reported as invalid. */
+typedef int (*port_opt_fn)(void *arg, const char *key, char *value);
+
+int port_parse_opts(const char *who, const char *str, port_opt_fn fn, void *arg);
+int port_parse_size(const char *value, double *n);
+
+#endif /* LWIP_ARCH_OPTS_H */
@@ -32,32 +32,68 @@
 #ifndef LWIP_ARCH_PERF_H
 #define LWIP_ARCH_PERF_H
 
-#include <sys/times.h>
-
-#ifdef PERF
-#define PERF_START  { \
-                         unsigned long __c1l, __c1h, __c2l, __c2h; \
-                         __asm__(".byte 0x0f, 0x31" : "=a" (__c1l), "=d" (__c1h))
-#define PERF_STOP(x)   __asm__(".byte 0x0f, 0x31" : "=a" (__c2l), "=d" (__c2h)); \
-                       perf_print(__c1l, __c1h, __c2l, __c2h, x);}
-
-/*#define PERF_START do { \
-                     struct tms __perf_start, __perf_end; \
-                     times(&__perf_start)
-#define PERF_STOP(x) times(&__perf_end); \
-                     perf_print_times(&__perf_start, &__perf_end, x);\
-                     } while(0)*/
+#include <stdio.h>
+
+#include "lwip/arch.h"
+
+/*
+ * Probe points: the time between PERF_START and PERF_STOP("name") (in the
+ * same block) is added to a histogram of that name. Each thread records
+ * into its own histograms without locks; perf_dump() merges them. Probes
+ * are compiled in with PERF defined (or LWIP_PERF set, which also enables
+ * the probes in the lwIP core, e.g. "tcp_input"). They record nothing
+ * until perf_init() and while perf_enable(0), at the cost of one load and
+ * branch.
+ */
+
+/* Time sources, the value of perf_enabled while enabled */
+#define PERF_OFF   0
+#define PERF_CLOCK 1   /* clock_gettime(CLOCK_MONOTONIC) */
+#define PERF_TSC   2   /* calibrated invariant TSC (x86) */
+
+extern u8_t perf_enabled;
+
+struct perf_probe;
+
+struct perf_summary {
+  const char *name;
+  u64_t count;
+  u64_t sum_ns;
+  u64_t min_ns;
+  u64_t max_ns;
+  u64_t p50_ns;
+  u64_t p90_ns;
+  u64_t p99_ns;
+  u64_t p999_ns;
+};
+
+u64_t perf_clock(void);
+struct perf_probe *perf_probe_get(const char *name);
+void perf_record(struct perf_probe *probe, u64_t ns);
+void perf_stop(struct perf_probe **probe, const char *name, u64_t start);
+int perf_summary(const char *name, struct perf_summary *summary);
+void perf_dump(FILE *f);
+void perf_enable(u8_t enable);
+void perf_init(const char *fname);
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PERF_TICKS(on) (((on) == PERF_TSC) ? (u64_t)__builtin_ia32_rdtsc() : perf_clock())
+#else
+#define PERF_TICKS(on) perf_clock()
+#endif
+
+#if defined(PERF) || (defined(LWIP_PERF) && LWIP_PERF)
+#define PERF_START   { \
+                       u8_t __perf_on = __atomic_load_n(&perf_enabled, __ATOMIC_RELAXED); \
+                       u64_t __perf_start = __perf_on ? PERF_TICKS(__perf_on) : 0
+#define PERF_STOP(x)   if (__perf_start != 0) { \
+                         static struct perf_probe *__perf_probe; \
+                         perf_stop(&__perf_probe, x, __perf_start); \
+                       } \
+                     }
 #else /* PERF */
 #define PERF_START    /* null definition */
 #define PERF_STOP(x)  /* null definition */
 #endif /* PERF */
 
-void perf_print(unsigned long c1l, unsigned long c1h,
-		unsigned long c2l, unsigned long c2h,
-		char *key);
-
-void perf_print_times(struct tms *start, struct tms *end, char *key);
-
-void perf_init(char *fname);
-
 #endif /* LWIP_ARCH_PERF_H */
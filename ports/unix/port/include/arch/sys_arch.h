@@ -52,8 +52,151 @@ typedef struct sys_mbox * sys_mbox_t;
 #define sys_mbox_valid(mbox)       sys_sem_valid(mbox)
 #define sys_mbox_set_invalid(mbox) sys_sem_set_invalid(mbox)
 
+/** Define SYS_ARCH_TELEMETRY to 1 to have the mailboxes, semaphores and
+ * mutexes keep counters and histograms of the time spent waiting for them,
+ * per object and per thread: the depth of mailboxes and the time messages
+ * spend in them, blocked posters and readers, semaphore waits and contended
+ * mutexes. Query them with sys_telemetry_foreach() or print them with
+ * sys_telemetry_print() (e.g. from the shell's stat command).
+ */
+#ifndef SYS_ARCH_TELEMETRY
+#define SYS_ARCH_TELEMETRY 0
+#endif
+
+/** Number of buckets of the SYS_ARCH_TELEMETRY histograms: bucket i counts
+ * times below 2^i microseconds (and at least 2^(i-1)), the last one
+ * everything bigger */
+#ifndef SYS_HIST_BUCKETS
+#define SYS_HIST_BUCKETS 24
+#endif
+
+/** Per-mailbox statistics, see sys_mbox_get_stats() */
+struct sys_mbox_stats {
+  /** number of messages the mailbox can hold */
+  u32_t size;
+  /** highest number of queued messages seen (SYS_STATS only) */
+  u32_t max;
+  /** number of posts that found the mailbox full (SYS_STATS only) */
+  u32_t overflow;
+#if SYS_ARCH_TELEMETRY
+  /** number of messages posted and fetched */
+  u32_t posts;
+  u32_t fetches;
+  /** number of messages queued now */
+  u32_t depth;
+  /** sum of the number of queued messages after each post
+      (depth_sum / posts is the average depth) */
+  u64_t depth_sum;
+  /** time from post to fetch of each message */
+  u32_t latency_us[SYS_HIST_BUCKETS];
+  /** time posters were blocked because the mailbox was full */
+  u32_t post_wait_us[SYS_HIST_BUCKETS];
+  /** time sys_arch_mbox_fetch() was blocked because it was empty */
+  u32_t fetch_wait_us[SYS_HIST_BUCKETS];
+#endif /* SYS_ARCH_TELEMETRY */
+};
+void sys_mbox_get_stats(sys_mbox_t *mbox, struct sys_mbox_stats *stats);
+
+/** Occupancy of one of the object pools sys_arch.c allocates semaphores,
+ * mutexes, mailboxes, their rings and thread records from (SYS_ARCH_POOLS),
+ * see sys_pool_get_stats() */
+struct sys_pool_stats {
+  /** "sem", "mutex", "mbox", "thread" or "ring<n>" (rings of n messages) */
+  char name[16];
+  /** size of the objects in bytes */
+  u32_t size;
+  /** objects in use now and at most (SYS_STATS only) */
+  u32_t used;
+  u32_t max;
+  /** objects on the shared free list, not counting those cached by threads */
+  u32_t free;
+};
+
+/** Writes str for sys_pool_stats_print() and sys_telemetry_print() */
+typedef void (*sys_write_fn)(void *ctx, const char *str);
+
+int  sys_pool_get_stats(int index, struct sys_pool_stats *stats);
+void sys_pool_stats_print(sys_write_fn write, void *ctx);
+
 struct sys_thread;
 typedef struct sys_thread * sys_thread_t;
 
+#if SYS_ARCH_TELEMETRY
+
+/** Length of the thread names kept for telemetry (Linux allows 15 characters) */
+#define SYS_TELEMETRY_NAME_LEN 16
+
+/** Per-semaphore statistics, see sys_sem_get_stats() */
+struct sys_sem_stats {
+  /** number of sys_arch_sem_wait() calls and how many of them timed out */
+  u32_t waits;
+  u32_t timeouts;
+  /** time spent in sys_arch_sem_wait() */
+  u32_t wait_us[SYS_HIST_BUCKETS];
+};
+
+/** Per-mutex statistics, see sys_mutex_get_stats() */
+struct sys_mutex_stats {
+  /** number of sys_mutex_lock() calls and how many of them had to wait */
+  u32_t locks;
+  u32_t contended;
+  /** time spent waiting for the mutex by contended locks */
+  u32_t wait_us[SYS_HIST_BUCKETS];
+};
+
+/** Per-thread statistics, kept for every running thread that used a mailbox,
+ * semaphore or mutex. Threads that exited are summed up in one record named
+ * "(exited)" whose lifetime_us is the sum of their lifetimes. */
+struct sys_thread_stats {
+  char name[SYS_TELEMETRY_NAME_LEN];
+  /** 1 while the thread is running */
+  u8_t alive;
+  /** number of messages posted and fetched */
+  u32_t posts;
+  u32_t fetches;
+  /** time since the thread's first use of sys_arch */
+  u64_t lifetime_us;
+  /** total time spent waiting for messages (sys_arch_mbox_fetch()) */
+  u64_t idle_us;
+  /** total time spent blocked on full mailboxes, semaphores and mutexes */
+  u64_t blocked_us;
+  u32_t fetch_wait_us[SYS_HIST_BUCKETS];
+  u32_t post_wait_us[SYS_HIST_BUCKETS];
+  u32_t sem_wait_us[SYS_HIST_BUCKETS];
+  u32_t mutex_wait_us[SYS_HIST_BUCKETS];
+};
+
+#define SYS_TELEMETRY_MBOX   1
+#define SYS_TELEMETRY_SEM    2
+#define SYS_TELEMETRY_MUTEX  3
+#define SYS_TELEMETRY_THREAD 4
+
+/** One object reported by sys_telemetry_foreach() */
+struct sys_telemetry {
+  /** SYS_TELEMETRY_MBOX, _SEM, _MUTEX or _THREAD */
+  u8_t type;
+  /** the mailbox, semaphore or mutex (sys_mbox_t etc.), NULL for threads */
+  void *obj;
+  /** name of the thread that created the object */
+  char owner[SYS_TELEMETRY_NAME_LEN];
+  union {
+    struct sys_mbox_stats mbox;
+    struct sys_sem_stats sem;
+    struct sys_mutex_stats mutex;
+    struct sys_thread_stats thread;
+  } stats;
+};
+
+/** Called for each object; must not create or free mailboxes, semaphores
+ * or mutexes */
+typedef void (*sys_telemetry_fn)(void *arg, const struct sys_telemetry *t);
+
+void sys_sem_get_stats(sys_sem_t *sem, struct sys_sem_stats *stats);
+void sys_mutex_get_stats(sys_mutex_t *mutex, struct sys_mutex_stats *stats);
+void sys_telemetry_foreach(sys_telemetry_fn fn, void *arg);
+void sys_telemetry_print(sys_write_fn write, void *ctx);
+
+#endif /* SYS_ARCH_TELEMETRY */
+
 #endif /* LWIP_ARCH_SYS_ARCH_H */
 
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2001-2003 Swedish Institute of Computer Science.
+ * All rights reserved. 
+ * 
+ * Redistribution and use in source and binary forms, with or without modification, 
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED 
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF 
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT 
+ * SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT 
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING 
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY 
+ * OF SUCH DAMAGE.
+ *
+ * This file is part of the lwIP TCP/IP stack.
+ * 
+ * Author: Adam Dunkels <adam@sics.se>
+ *
+ */
+#ifndef LWIP_ARCH_TRACE_H
+#define LWIP_ARCH_TRACE_H
+
+#include "lwip/arch.h"
+
+/*
+ * Packet latency tracing: 1 in N received frames is followed from the
+ * driver read (TRACE_RX) to the start of its processing in tcpip_thread
+ * (TRACE_INPUT, or trace_ip_input() as LWIP_HOOK_IP4_INPUT /
+ * LWIP_HOOK_IP6_INPUT), to its delivery to a recvmbox (the pbuf posted to
+ * a mailbox) and to the application fetching it. Sent frames are followed
+ * from the netif's linkoutput (TRACE_TX) to the write (TRACE_TX_DONE), and
+ * 1 in N mailbox messages from post to fetch. Compiled in with
+ * TRACE_PACKETS set to 1; costs a load and branch per hook while not
+ * sampling.
+ */
+#ifndef TRACE_PACKETS
+#define TRACE_PACKETS 0
+#endif
+
+struct pbuf;
+struct netif;
+
+typedef void (*trace_write_fn)(void *ctx, const char *str);
+
+#if TRACE_PACKETS
+
+extern u32_t trace_sample;
+extern u32_t trace_inflight;
+
+void trace_init(void);
+void trace_set_sample(u32_t n);
+void trace_rx(struct pbuf *p);
+void trace_input(struct pbuf *p);
+int trace_ip_input(struct pbuf *p, struct netif *inp);
+void trace_tx(struct pbuf *p);
+void trace_tx_done(struct pbuf *p);
+void trace_mbox_post(void *msg);
+void trace_mbox_fetch(void *msg);
+void trace_print(trace_write_fn write, void *ctx);
+
+#define TRACE_ON()            (__atomic_load_n(&trace_sample, __ATOMIC_RELAXED) != 0)
+#define TRACE_BUSY()          (__atomic_load_n(&trace_inflight, __ATOMIC_RELAXED) != 0)
+#define TRACE_RX(p)           do { if (TRACE_ON() || TRACE_BUSY()) { trace_rx(p); } } while (0)
+#define TRACE_INPUT(p)        do { if (TRACE_BUSY()) { trace_input(p); } } while (0)
+#define TRACE_TX(p)           do { if (TRACE_ON()) { trace_tx(p); } } while (0)
+#define TRACE_TX_DONE(p)      do { if (TRACE_BUSY()) { trace_tx_done(p); } } while (0)
+#define TRACE_MBOX_POST(m)    do { if (TRACE_ON() || TRACE_BUSY()) { trace_mbox_post(m); } } while (0)
+#define TRACE_MBOX_FETCH(m)   do { if (TRACE_BUSY()) { trace_mbox_fetch(m); } } while (0)
+
+#else /* TRACE_PACKETS */
+
+#define TRACE_RX(p)
+#define TRACE_INPUT(p)
+#define TRACE_TX(p)
+#define TRACE_TX_DONE(p)
+#define TRACE_MBOX_POST(m)
+#define TRACE_MBOX_FETCH(m)
+
+#endif /* TRACE_PACKETS */
+
+#endif /* LWIP_ARCH_TRACE_H */
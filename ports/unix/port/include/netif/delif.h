@@ -36,7 +36,75 @@
 
 #include "lwip/pbuf.h"
 
+/*
+ * delif: network emulator netif (like Linux netem). It drives a tapif (tunif
+ * on other systems) and impairs the traffic in each direction according to a
+ * struct delif_config: delay with jitter, Gilbert-Elliott loss, duplication,
+ * reordering and rate limiting. The configuration is taken from the
+ * environment variables DELIF_INPUT and DELIF_OUTPUT when the netif is added
+ * (see delif_config_parse()), e.g.
+ *
+ *   DELIF_OUTPUT="delay=40ms,jitter=5ms,dist=normal,loss=0.5%,rate=10M"
+ *
+ * and can be changed at runtime with delif_set_config() from tcpip_thread.
+ */
+
+/** Directions for delif_set_config() and delif_get_stats() */
+#define DELIF_DIR_INPUT  0
+#define DELIF_DIR_OUTPUT 1
+
+/** Distribution of the jitter around the delay */
+enum delif_dist {
+  /** between delay - jitter and delay + jitter */
+  DELIF_DIST_UNIFORM,
+  /** normal with a standard deviation of jitter */
+  DELIF_DIST_NORMAL,
+  /** heavy tailed (Pareto, shape 3) with a mean of jitter, shifted to keep
+   * the mean delay */
+  DELIF_DIST_PARETO
+};
+
+/** Impairments of one direction */
+struct delif_config {
+  u32_t delay_us;
+  u32_t jitter_us;
+  enum delif_dist dist;
+  /** Gilbert-Elliott loss: probability to go from the good to the bad state
+   * (p) and back (r) per packet, and loss probability in each state. Plain
+   * random loss is loss_good with p = 0. */
+  double loss_p;
+  double loss_r;
+  double loss_bad;
+  double loss_good;
+  /** probability that a packet is sent twice */
+  double duplicate;
+  /** probability that a packet is sent without the delay, overtaking the
+   * delayed ones */
+  double reorder;
+  /** link rate in bits per second, 0 for no limit; packets are paced with
+   * a token bucket of the shaper (netif/shaper.h) that has no burst */
+  u32_t rate;
+  /** packets that may be delayed at a time, more are dropped */
+  u32_t limit;
+};
+
+struct delif_stats {
+  u32_t packets;
+  u32_t lost;
+  u32_t duplicated;
+  u32_t reordered;
+  /** dropped because the limit was reached */
+  u32_t overflows;
+  u32_t backlog;
+  u32_t max_backlog;
+};
+
 err_t delif_init(struct netif *netif);
 err_t delif_init_thread(struct netif *netif);
 
+void  delif_config_init(struct delif_config *config);
+int   delif_config_parse(struct delif_config *config, const char *str);
+err_t delif_set_config(struct netif *netif, u8_t dir, const struct delif_config *config);
+void  delif_get_stats(struct netif *netif, u8_t dir, struct delif_stats *stats, u8_t reset);
+
 #endif /* LWIP_DELIF_H */
@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2001-2003 Swedish Institute of Computer Science.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+ * SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ *
+ * This file is part of the lwIP TCP/IP stack.
+ *
+ */
+#ifndef LWIP_IOURING_H
+#define LWIP_IOURING_H
+
+#include "lwip/opt.h"
+#include "lwip/pbuf.h"
+
+/*
+ * io_uring I/O engine for the file descriptor based netifs (Linux only).
+ *
+ * A ring keeps a pool of receive buffers posted as reads on one descriptor
+ * and queues writes of pbuf chains, which are held until the kernel is done
+ * with them. Everything queued is submitted, and all completions are reaped,
+ * with one io_uring_enter() call in iouring_wait() or iouring_submit().
+ * A ring that only writes is not waited for: its owner has to call
+ * iouring_submit() again while iouring_tx_pending() is not 0, or the pbufs
+ * of the last writes stay referenced.
+ *
+ * A ring is not thread-safe: it must only be used by one thread at a time
+ * (e.g. the RX thread of a netif, or tcpip_thread for sending). Only pbufs
+ * passed up by iouring_wait() may be freed from any thread.
+ *
+ * iouring_new() returns NULL if the kernel lacks io_uring (or
+ * IORING_FEAT_EXT_ARG, i.e. is older than 5.11), if it is disabled, or if the
+ * environment variable LWIP_IOURING is set to 0. Drivers then fall back to
+ * read()/write().
+ */
+
+/** Passed to iouring_wait() to wait without a timeout */
+#define IOURING_WAIT_FOREVER 0xffffffffUL
+
+struct iouring;
+
+/** Called from iouring_wait() for every frame read: 'p' starts 'headroom'
+ * bytes before the frame and belongs to the callee, 'prefix' points to the
+ * 'prefix_len' bytes read before the frame (only valid during the call).
+ * After the last frame of a batch, it is called once more with p == NULL. */
+typedef void (*iouring_input_fn)(void *arg, struct pbuf *p, const void *prefix);
+
+struct iouring *iouring_new(u16_t rx_bufs, u16_t tx_slots);
+void iouring_free(struct iouring *ring);
+err_t iouring_rx_start(struct iouring *ring, int fd, u16_t frame_size, u16_t prefix_len,
+                       u16_t headroom, iouring_input_fn input, void *arg);
+err_t iouring_send(struct iouring *ring, int fd, const void *prefix, u16_t prefix_len, struct pbuf *p);
+void iouring_submit(struct iouring *ring);
+int iouring_wait(struct iouring *ring, u32_t msecs);
+u16_t iouring_tx_pending(struct iouring *ring);
+int iouring_fd(struct iouring *ring);
+
+#endif /* LWIP_IOURING_H */
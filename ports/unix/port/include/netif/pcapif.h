@@ -34,6 +34,22 @@
 
 #include "lwip/netif.h"
 
+struct pcapif_run {
+  u32_t packets;   /* passed to the stack */
+  u32_t drops;     /* not taken by the stack (no pbuf, input error) */
+  u64_t bytes;
+  u64_t usecs;
+};
+
+struct pcapif_stats {
+  u32_t runs;      /* completed replays of the file */
+  u32_t skipped;   /* packets of the file that are not replayed */
+  u32_t tx;        /* packets sent out (and discarded) */
+  struct pcapif_run last;
+  struct pcapif_run total;
+};
+
 err_t pcapif_init(struct netif *netif);
+void pcapif_get_stats(struct netif *netif, struct pcapif_stats *stats);
 
 #endif /* LWIP_PCAPIF_H */
@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2001-2003 Swedish Institute of Computer Science.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+ * SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ *
+ * This file is part of the lwIP TCP/IP stack.
+ *
+ */
+#ifndef LWIP_SHAPER_H
+#define LWIP_SHAPER_H
+
+#include "lwip/opt.h"
+
+#if !NO_SYS
+
+#include "lwip/netif.h"
+#include "lwip/pbuf.h"
+
+/*
+ * shaper: emulates an output link of a given rate for a netif. Packets are
+ * classified by DSCP into up to SHAPER_MAX_QUEUES queues, served by strict
+ * priority or deficit round robin, and sent by a thread of the shaper when a
+ * token bucket (rate in bits/s, burst in bytes, accounted in microseconds)
+ * allows. The time each packet spent queued is recorded.
+ *
+ *   struct shaper_config config;
+ *   shaper_config_init(&config);
+ *   shaper_config_parse(&config, "rate=10M,burst=3028,queues=4,mode=drr");
+ *   shaper = shaper_new(&config, my_send, netif);
+ *   ...
+ *   in netif->output/linkoutput: return shaper_output(shaper, p);
+ *
+ * The output function is called from the shaper thread, it must not be
+ * called from anywhere else then.
+ */
+
+/** Maximum number of queues of a shaper */
+#ifndef SHAPER_MAX_QUEUES
+#define SHAPER_MAX_QUEUES 8
+#endif
+
+/** Number of buckets of the queueing delay histograms: bucket i counts
+ * delays below 2^i microseconds (and at least 2^(i-1)), the last one
+ * everything bigger */
+#ifndef SHAPER_HIST_BUCKETS
+#define SHAPER_HIST_BUCKETS 24
+#endif
+
+/** Sends a packet at the time the shaper releases it */
+typedef err_t (*shaper_output_fn)(struct netif *netif, struct pbuf *p);
+
+enum shaper_mode {
+  /** the lowest numbered non-empty queue is served first */
+  SHAPER_PRIO,
+  /** queues share the link by weight (deficit round robin) */
+  SHAPER_DRR
+};
+
+struct shaper_config {
+  /** link rate in bits per second, 0 for no limit */
+  u32_t rate;
+  /** bucket size in bytes: how much may be sent back to back after the link
+   * was idle */
+  u32_t burst;
+  /** bytes added to every packet for the rate accounting (e.g. 24 for the
+   * preamble, FCS and gap of Ethernet) */
+  u16_t overhead;
+  /** offset of the IP header in the packets (14 for Ethernet) */
+  u16_t ip_offset;
+  enum shaper_mode mode;
+  /** number of queues used */
+  u8_t queues;
+  /** drop the oldest packet instead of the new one if a queue is full */
+  u8_t drop_head;
+  /** packets each queue holds */
+  u16_t limit;
+  /** bytes a DRR queue may send per round and unit of weight */
+  u16_t quantum;
+  u8_t weight[SHAPER_MAX_QUEUES];
+  /** queue of each DSCP value */
+  u8_t dscp_map[64];
+};
+
+struct shaper_queue_stats {
+  u32_t enqueued;
+  u32_t sent;
+  u32_t dropped;
+  u64_t bytes;
+  /** packets queued now and at most */
+  u32_t backlog;
+  u32_t max_backlog;
+  /** time from shaper_output() until the packet was passed to the output
+   * function */
+  u32_t delay_us[SHAPER_HIST_BUCKETS];
+  u64_t delay_sum_us;
+  u32_t delay_max_us;
+};
+
+struct shaper_stats {
+  u8_t queues;
+  struct shaper_queue_stats queue[SHAPER_MAX_QUEUES];
+};
+
+/** Token bucket of a shaper, also used on its own to pace packets: a
+ * packet may be sent when the bucket is not negative (shaper_bucket_wait()
+ * returns 0), its cost is then taken (shaper_bucket_take()) even if that
+ * makes the bucket negative. Counted in micro-bits, see shaper.c. */
+struct shaper_bucket {
+  /** bits per second, 0 for no limit */
+  u32_t rate;
+  s64_t tokens;
+  s64_t tokens_max;
+  u64_t last_us;
+};
+
+struct shaper;
+
+void  shaper_bucket_init(struct shaper_bucket *bucket, u32_t rate, u32_t burst);
+u64_t shaper_bucket_wait(struct shaper_bucket *bucket, u64_t now);
+void  shaper_bucket_take(struct shaper_bucket *bucket, u32_t bytes);
+int   shaper_parse_rate(const char *value, u32_t *rate);
+
+void  shaper_config_init(struct shaper_config *config);
+int   shaper_config_parse(struct shaper_config *config, const char *str);
+struct shaper *shaper_new(const struct shaper_config *config, shaper_output_fn output, struct netif *netif);
+err_t shaper_output(struct shaper *shaper, struct pbuf *p);
+void  shaper_get_stats(struct shaper *shaper, struct shaper_stats *stats, u8_t reset);
+
+#endif /* !NO_SYS */
+
+#endif /* LWIP_SHAPER_H */
@@ -34,9 +34,27 @@
 
 #include "lwip/netif.h"
 
+/** Batching statistics of a tapif, see tapif_get_batch_stats() */
+struct tapif_batch_stats {
+  /** number of wakeups that read at least one frame */
+  u32_t rx_bursts;
+  /** number of frames read */
+  u32_t rx_frames;
+  /** number of bursts written (by the TX thread with TAPIF_TX_BATCH) */
+  u32_t tx_bursts;
+  /** number of frames written */
+  u32_t tx_frames;
+  /** number of frames read that were bigger than the MTU (TAPIF_OFFLOAD) */
+  u32_t rx_gso;
+  /** number of GSO frames written, each made of several of tx_frames */
+  u32_t tx_gso;
+};
+
 err_t tapif_init(struct netif *netif);
+void tapif_get_batch_stats(struct netif *netif, struct tapif_batch_stats *stats);
 #if NO_SYS
 int tapif_select(struct netif *netif);
+err_t tapif_evloop_add(struct netif *netif);
 #endif /* NO_SYS */
 
 #endif /* LWIP_TAPIF_H */
@@ -32,10 +32,32 @@
 #ifndef LWIP_NETIF_TCPDUMP_H
 #define LWIP_NETIF_TCPDUMP_H
 
+#include "lwip/err.h"
+
 struct pbuf;
 struct netif;
 
+/** Direction of a captured packet (pcapng epb_flags) */
+#define TCPDUMP_DIR_UNKNOWN 0
+#define TCPDUMP_DIR_IN      1
+#define TCPDUMP_DIR_OUT     2
+
+struct tcpdump_stats {
+  u32_t captured;   /* records written to the file */
+  u32_t filtered;   /* packets rejected by the filter */
+  u32_t dropped;    /* records lost because a thread's ring was full */
+  u32_t files;      /* files opened (1 + rotations) */
+  u64_t bytes;      /* bytes written to all files */
+};
+
 void tcpdump_init(void);
 void tcpdump(struct pbuf *p, struct netif *netif);
+void tcpdump_packet(struct pbuf *p, struct netif *netif, u8_t dir);
+err_t tcpdump_attach(struct netif *netif);
+void tcpdump_enable(u8_t enable);
+int tcpdump_set_filter(const char *expr);
+void tcpdump_set_snaplen(u32_t snaplen);
+void tcpdump_flush(void);
+void tcpdump_get_stats(struct tcpdump_stats *stats);
 
 #endif /* LWIP_NETIF_TCPDUMP_H */
@@ -37,5 +37,9 @@
 #include "lwip/pbuf.h"
 
 err_t tunif_init(struct netif *netif);
+#if NO_SYS
+int tunif_select(struct netif *netif);
+err_t tunif_evloop_add(struct netif *netif);
+#endif /* NO_SYS */
 
 #endif /* LWIP_TUNIF_H */
@@ -34,7 +34,10 @@
 
 #include "lwip/netif.h"
 
+struct shaper;
+
 err_t unixif_init_server(struct netif *netif);
 err_t unixif_init_client(struct netif *netif);
+struct shaper *unixif_get_shaper(struct netif *netif);
 
 #endif /* LWIP_UNIXIF_H */
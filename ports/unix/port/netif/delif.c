@@ -30,6 +30,20 @@
  *
  */
 
+/*
+ * delif: the netif passed to delif_init() is what the stack uses, the driver
+ * netif (tapif/tunif) is kept inside struct delif and never added to the
+ * netif list. With an Ethernet driver the impairments apply to frames
+ * (delif_linkoutput() and the frames the driver receives), otherwise to IP
+ * packets (delif_output4/6()).
+ *
+ * Packets waiting in a direction are kept in a binary heap ordered by the
+ * time they are due (then by arrival), a single sys_timeout() per direction
+ * is armed for the first one. Everything except the driver's receive path
+ * runs in tcpip_thread: received packets are moved there with
+ * tcpip_inpkt() before they are looked at.
+ */
+
 #include "lwip/opt.h"
 #include "lwip/pbuf.h"
 
@@ -37,10 +51,19 @@
 
 #include "lwip/debug.h"
 
+#include <math.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include "lwip/def.h"
+#include "lwip/ip_addr.h"
+#include "lwip/tcpip.h"
 #include "netif/delif.h"
+#include "netif/etharp.h"
+#include "netif/shaper.h"
+#include "lwip/ethip6.h"
 
 #ifdef LWIP_UNIX_LINUX
 #include "netif/tapif.h"
@@ -51,169 +74,495 @@
 #include "lwip/sys.h"
 #include "lwip/timeouts.h"
 
+#include "arch/opts.h"
+
 #ifndef DELIF_DEBUG
 #define DELIF_DEBUG    LWIP_DBG_OFF
 #endif
 
+/* Defaults if DELIF_INPUT/DELIF_OUTPUT are not set */
+#ifndef DELIF_INPUT_DROPRATE
 #define DELIF_INPUT_DROPRATE 0.1
+#endif
+#ifndef DELIF_OUTPUT_DROPRATE
 #define DELIF_OUTPUT_DROPRATE 0.1
+#endif
 
+#ifndef DELIF_INPUT_DELAY
 #define DELIF_INPUT_DELAY  500      /* Miliseconds. */
+#endif
+#ifndef DELIF_OUTPUT_DELAY
 #define DELIF_OUTPUT_DELAY 500      /* Miliseconds. */
+#endif
 
-#define DELIF_TIMEOUT 10
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
 
-struct delif {
-  err_t (* input)(struct pbuf *p, struct netif *inp);
-  struct netif *netif;
-};
+/** Default of delif_config.limit */
+#ifndef DELIF_LIMIT
+#define DELIF_LIMIT 1000
+#endif
 
-struct delif_pbuf {
-  struct delif_pbuf *next;
+struct delif_pkt {
+  u64_t due;
+  u32_t seq;
   struct pbuf *p;
-  ip_addr_t ipaddr;
-  unsigned int time;
+  /* next hop, for IP level output */
+  ip_addr_t addr;
+};
+
+/* One direction */
+struct delif_dir {
+  struct delif *delif;
+  struct delif_config config;
+  /* binary heap of 'count' packets, room for 'size' */
+  struct delif_pkt *heap;
+  u32_t count;
+  u32_t size;
+  u32_t seq;
+  /* paces the packets at config.rate */
+  struct shaper_bucket bucket;
+  /* Gilbert-Elliott state */
+  u8_t bad;
+  u8_t timer_armed;
+  u64_t timer_due;
+  struct delif_stats stats;
 };
 
-static struct delif_pbuf *input_list = NULL;
-static struct delif_pbuf *output_list = NULL;
+struct delif {
+  /* the driver netif, first so that it can be cast to its delif */
+  struct netif netif;
+  /* the netif the stack uses */
+  struct netif *outer;
+  /* impair frames (Ethernet driver) instead of IP packets */
+  u8_t link_level;
+  u64_t rand_state;
+  struct delif_dir dir[2];
+};
+
+static void delif_timeout(void *arg);
+
 /*-----------------------------------------------------------------------------------*/
-static void
-delif_input_timeout(void *arg)
+static u64_t
+delif_now_us(void)
 {
-  struct netif *netif;
-  struct delif *delif;
-  struct delif_pbuf *dp;
-  unsigned int timeout, now;
+  struct timespec ts;
 
-  timeout = DELIF_TIMEOUT;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (u64_t)ts.tv_sec * 1000000 + (u64_t)ts.tv_nsec / 1000;
+}
 
-  netif = (struct netif*)arg;
-  delif = (struct delif*)netif->state;
+/* xorshift64*, uniform in [0, 1) */
+static double
+delif_random(struct delif *del)
+{
+  u64_t x = del->rand_state;
 
-  /* Check if there is anything on the input list. */
-  dp = input_list;
-  while (dp != NULL) {
-    now = sys_now();
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  del->rand_state = x;
+  return (double)((x * 0x2545F4914F6CDD1DULL) >> 11) / 9007199254740992.0;
+}
 
-    if (dp->time <= now) {
-      delif->input(dp->p, netif);
-      if (dp->next != NULL) {
-        if (dp->next->time > now) {
-          timeout = dp->next->time - now;
-        } else {
-          timeout = 0;
-        }
-        LWIP_DEBUGF(DELIF_DEBUG, ("delif_output_timeout: timeout %u.\n", timeout));
+static int
+delif_chance(struct delif *del, double probability)
+{
+  return (probability > 0) && (delif_random(del) < probability);
+}
+/*-----------------------------------------------------------------------------------*/
+/** Set up a configuration without impairments */
+void
+delif_config_init(struct delif_config *config)
+{
+  memset(config, 0, sizeof(struct delif_config));
+  config->dist = DELIF_DIST_UNIFORM;
+  config->loss_r = 1;
+  config->loss_bad = 1;
+  config->limit = DELIF_LIMIT;
+}
 
-      }
-      input_list = dp->next;
-      free(dp);
-      dp = input_list;
+/* "<n>%" or "<n>" (0..1) */
+static int
+delif_parse_prob(const char *str, char **end, double *prob)
+{
+  *prob = strtod(str, end);
+  if (*end == str) {
+    return -1;
+  }
+  if (**end == '%') {
+    *prob /= 100;
+    (*end)++;
+  }
+  return ((*prob < 0) || (*prob > 1)) ? -1 : 0;
+}
+
+/* "<n>us", "<n>ms" or "<n>s", milliseconds without unit */
+static int
+delif_parse_time(const char *str, u32_t *us)
+{
+  char *end;
+  double t = strtod(str, &end);
+
+  if ((end == str) || (t < 0)) {
+    return -1;
+  }
+  if (!strcmp(end, "us")) {
+    /* already microseconds */
+  } else if (!strcmp(end, "ms") || (*end == 0)) {
+    t *= 1e3;
+  } else if (!strcmp(end, "s")) {
+    t *= 1e6;
+  } else {
+    return -1;
+  }
+  if (t > 0xffffffffUL) {
+    return -1;
+  }
+  *us = (u32_t)t;
+  return 0;
+}
+
+/* Take one key=value item of an option string */
+static int
+delif_config_item(void *arg, const char *key, char *value)
+{
+  struct delif_config *config = (struct delif_config *)arg;
+  char *end;
+  double prob[4];
+  unsigned long limit;
+  int i;
+
+  if (value == NULL) {
+    return -1;
+  }
+  if (!strcmp(key, "delay")) {
+    return delif_parse_time(value, &config->delay_us);
+  }
+  if (!strcmp(key, "jitter")) {
+    return delif_parse_time(value, &config->jitter_us);
+  }
+  if (!strcmp(key, "dist")) {
+    if (!strcmp(value, "uniform")) {
+      config->dist = DELIF_DIST_UNIFORM;
+    } else if (!strcmp(value, "normal")) {
+      config->dist = DELIF_DIST_NORMAL;
+    } else if (!strcmp(value, "pareto")) {
+      config->dist = DELIF_DIST_PARETO;
     } else {
-      dp = dp->next;	
+      return -1;
+    }
+  } else if (!strcmp(key, "loss")) {
+    if ((delif_parse_prob(value, &end, &config->loss_good) != 0) || (*end != 0)) {
+      return -1;
+    }
+    config->loss_p = 0;
+  } else if (!strcmp(key, "ge")) {
+    prob[2] = 1;
+    prob[3] = 0;
+    end = value;
+    for (i = 0; i < 4; i++) {
+      if (delif_parse_prob(end, &end, &prob[i]) != 0) {
+        return -1;
+      }
+      if (*end != ':') {
+        break;
+      }
+      end++;
+    }
+    if ((i < 1) || (*end != 0)) {
+      return -1;
+    }
+    config->loss_p = prob[0];
+    config->loss_r = prob[1];
+    config->loss_bad = prob[2];
+    config->loss_good = prob[3];
+  } else if (!strcmp(key, "dup")) {
+    if ((delif_parse_prob(value, &end, &config->duplicate) != 0) || (*end != 0)) {
+      return -1;
+    }
+  } else if (!strcmp(key, "reorder")) {
+    if ((delif_parse_prob(value, &end, &config->reorder) != 0) || (*end != 0)) {
+      return -1;
     }
+  } else if (!strcmp(key, "rate")) {
+    return shaper_parse_rate(value, &config->rate);
+  } else if (!strcmp(key, "limit")) {
+    limit = strtoul(value, &end, 0);
+    if ((end == value) || (*end != 0) || (limit < 1) || (limit > 0xffffffUL)) {
+      return -1;
+    }
+    config->limit = (u32_t)limit;
+  } else {
+    return -1;
   }
-  
-  sys_timeout(timeout, delif_input_timeout, arg);
+  return 0;
+}
+
+/**
+ * Change 'config' according to a string of comma separated key=value items:
+ *
+ * - delay=<time>, jitter=<time>: us, ms (default) or s
+ * - dist=uniform|normal|pareto
+ * - loss=<prob>: random loss; probabilities are given as 0..1 or in %
+ * - ge=<p>:<r>[:<loss bad>[:<loss good>]]: Gilbert-Elliott loss, the loss
+ *   probabilities default to 100% and 0%
+ * - dup=<prob>, reorder=<prob>
+ * - rate=<bits/s>, with an optional k, M or G suffix (1000 based)
+ * - limit=<packets>
+ *
+ * Returns 0 on success, -1 (leaving 'config' partly changed) on errors.
+ */
+int
+delif_config_parse(struct delif_config *config, const char *str)
+{
+  return port_parse_opts("delif", str, delif_config_item, config);
+}
+/*-----------------------------------------------------------------------------------*/
+/* Delay of the next packet in microseconds */
+static u64_t
+delif_delay(struct delif *del, const struct delif_config *config)
+{
+  double delay = config->delay_us;
+  double jitter = config->jitter_us;
+  double u;
+
+  if (jitter > 0) {
+    switch (config->dist) {
+      case DELIF_DIST_NORMAL:
+        /* Box-Muller */
+        u = delif_random(del);
+        delay += jitter * sqrt(-2 * log(1 - u)) * cos(2 * M_PI * delif_random(del));
+        break;
+      case DELIF_DIST_PARETO:
+        /* scale 2/3 jitter gives a mean of jitter for shape 3 */
+        u = delif_random(del);
+        delay += (2 * jitter / 3) / cbrt(1 - u) - jitter;
+        break;
+      case DELIF_DIST_UNIFORM:
+      default:
+        delay += jitter * (2 * delif_random(del) - 1);
+        break;
+    }
+  }
+  return (delay > 0) ? (u64_t)delay : 0;
+}
+
+/* Gilbert-Elliott: move to the next state, then decide if the packet is lost */
+static int
+delif_lost(struct delif *del, struct delif_dir *dir)
+{
+  if (dir->bad) {
+    if (delif_chance(del, dir->config.loss_r)) {
+      dir->bad = 0;
+    }
+  } else if (delif_chance(del, dir->config.loss_p)) {
+    dir->bad = 1;
+  }
+  return delif_chance(del, dir->bad ? dir->config.loss_bad : dir->config.loss_good);
 }
 /*-----------------------------------------------------------------------------------*/
+static int
+delif_pkt_before(const struct delif_pkt *a, const struct delif_pkt *b)
+{
+  return (a->due < b->due) || ((a->due == b->due) && ((s32_t)(a->seq - b->seq) < 0));
+}
+
 static void
-delif_output_timeout(void *arg)
+delif_heap_push(struct delif_dir *dir, const struct delif_pkt *pkt)
 {
-  struct netif *netif;
-  struct delif *delif;
-  struct delif_pbuf *dp;
-  unsigned int timeout, now;
+  u32_t i = dir->count++;
 
-  timeout = DELIF_TIMEOUT;
+  while (i > 0) {
+    u32_t parent = (i - 1) / 2;
+    if (!delif_pkt_before(pkt, &dir->heap[parent])) {
+      break;
+    }
+    dir->heap[i] = dir->heap[parent];
+    i = parent;
+  }
+  dir->heap[i] = *pkt;
+}
 
-  netif = (struct netif*)arg;
-  delif = (struct delif*)netif->state;
+static struct delif_pkt
+delif_heap_pop(struct delif_dir *dir)
+{
+  struct delif_pkt top = dir->heap[0];
+  struct delif_pkt last = dir->heap[--dir->count];
+  u32_t i = 0, child;
 
-  /* Check if there is anything on the output list. */
-  dp = output_list;
-  while (dp != NULL) {
-    now = sys_now();
-    if (dp->time <= now) {
-      LWIP_DEBUGF(DELIF_DEBUG, ("delif_output_timeout: now %u dp->time %u\n",
-        now, dp->time));
+  while ((child = 2 * i + 1) < dir->count) {
+    if ((child + 1 < dir->count) && delif_pkt_before(&dir->heap[child + 1], &dir->heap[child])) {
+      child++;
+    }
+    if (!delif_pkt_before(&dir->heap[child], &last)) {
+      break;
+    }
+    dir->heap[i] = dir->heap[child];
+    i = child;
+  }
+  dir->heap[i] = last;
+  return top;
+}
+/*-----------------------------------------------------------------------------------*/
+/* Hand a packet that is due to the stack or the driver, consumes 'pkt->p' */
+static void
+delif_deliver(struct delif_dir *dir, struct delif_pkt *pkt)
+{
+  struct delif *del = dir->delif;
 
+  if (dir == &del->dir[DELIF_DIR_INPUT]) {
+    if (del->outer->input(pkt->p, del->outer) != ERR_OK) {
+      pbuf_free(pkt->p);
+    }
+    return;
+  }
+  if (del->link_level) {
+    del->netif.linkoutput(&del->netif, pkt->p);
+  }
 #if LWIP_IPV4
-      if(!IP_IS_V6_VAL(dp->ipaddr)) {
-        delif->netif->output(delif->netif, dp->p, ip_2_ip4(&dp->ipaddr));
-      }
+  else if (!IP_IS_V6_VAL(pkt->addr)) {
+    del->netif.output(&del->netif, pkt->p, ip_2_ip4(&pkt->addr));
+  }
 #endif /* LWIP_IPV4 */
-
 #if LWIP_IPV6
-      if(IP_IS_V6_VAL(dp->ipaddr)) {
-        delif->netif->output_ip6(delif->netif, dp->p, ip_2_ip6(&dp->ipaddr));
-      }
+  else if (IP_IS_V6_VAL(pkt->addr)) {
+    del->netif.output_ip6(&del->netif, pkt->p, ip_2_ip6(&pkt->addr));
+  }
 #endif /* LWIP_IPV6 */
+  pbuf_free(pkt->p);
+}
 
-      if (dp->next != NULL) {
-        if (dp->next->time > now) {
-          timeout = dp->next->time - now;
-        } else {
-          timeout = 0;
-        }
-        LWIP_DEBUGF(DELIF_DEBUG, ("delif_output_timeout: timeout %u.\n", timeout));
-
-      }
-      pbuf_free(dp->p);
+/* Arm the timeout of 'dir' for its first packet */
+static void
+delif_arm(struct delif_dir *dir, u64_t now)
+{
+  u64_t due;
 
-      output_list = dp->next;
-      free(dp);
-      dp = output_list;
-    } else {
-      dp = dp->next;	
+  if (dir->count == 0) {
+    return;
+  }
+  due = dir->heap[0].due;
+  if (dir->timer_armed) {
+    if (dir->timer_due <= due) {
+      return;
     }
+    sys_untimeout(delif_timeout, dir);
   }
+  dir->timer_armed = 1;
+  dir->timer_due = due;
+  sys_timeout((u32_t)((due > now) ? (due - now + 999) / 1000 : 0), delif_timeout, dir);
+}
 
-  sys_timeout(timeout, delif_output_timeout, arg);
+static void
+delif_timeout(void *arg)
+{
+  struct delif_dir *dir = (struct delif_dir *)arg;
+  struct delif_pkt pkt;
+  u64_t now = delif_now_us();
+
+  dir->timer_armed = 0;
+  while ((dir->count > 0) && (dir->heap[0].due <= now)) {
+    pkt = delif_heap_pop(dir);
+    dir->stats.backlog--;
+    delif_deliver(dir, &pkt);
+  }
+  delif_arm(dir, now);
 }
-/*-----------------------------------------------------------------------------------*/
-static err_t
-delif_output(struct netif *netif, struct pbuf *p, const ip_addr_t *ipaddr)
+
+/* Apply the impairments of 'dir' to 'p' (which is consumed) */
+static void
+delif_enqueue(struct delif_dir *dir, struct pbuf *p, const ip_addr_t *addr)
 {
-  struct delif_pbuf *dp, *np;
-  char *data;
+  struct delif *del = dir->delif;
+  struct delif_config *config = &dir->config;
+  struct delif_pkt pkt;
+  struct pbuf *copy[2];
+  u64_t now, ready;
+  int copies, i;
+
+  dir->stats.packets++;
+  if (delif_lost(del, dir)) {
+    LWIP_DEBUGF(DELIF_DEBUG, ("delif: packet lost\n"));
+    dir->stats.lost++;
+    pbuf_free(p);
+    return;
+  }
+  /* duplicate while 'p' is still ours: delivering or dropping consumes it */
+  copy[0] = p;
+  copies = 1;
+  if (delif_chance(del, config->duplicate)) {
+    copy[1] = pbuf_clone(PBUF_RAW, PBUF_RAM, p);
+    if (copy[1] != NULL) {
+      dir->stats.duplicated++;
+      copies = 2;
+    }
+  }
 
-  LWIP_UNUSED_ARG(netif);
+  now = delif_now_us();
+  for (i = 0; i < copies; i++) {
+    p = copy[i];
+    /* paced to the link rate without burst, then the delay */
+    ready = now + shaper_bucket_wait(&dir->bucket, now);
+    shaper_bucket_take(&dir->bucket, p->tot_len);
+    if (delif_chance(del, config->reorder)) {
+      dir->stats.reordered++;
+    } else {
+      ready += delif_delay(del, config);
+    }
 
-  LWIP_DEBUGF(DELIF_DEBUG, ("delif_output\n"));
+    pkt.p = p;
+    pkt.due = ready;
+    pkt.seq = dir->seq++;
+    if (addr != NULL) {
+      ip_addr_copy(pkt.addr, *addr);
+    } else {
+      ip_addr_set_zero(&pkt.addr);
+    }
 
-#ifdef DELIF_OUTPUT_DROPRATE
-  if (((double)rand()/(double)RAND_MAX) < DELIF_OUTPUT_DROPRATE) {
-    LWIP_DEBUGF(DELIF_DEBUG, ("delif_output: Packet dropped\n"));
-    return ERR_BUF;
+    if ((ready <= now) && (dir->count == 0)) {
+      /* nothing to wait for */
+      delif_deliver(dir, &pkt);
+      continue;
+    }
+    if (dir->count >= dir->config.limit) {
+      /* the limit may have been lowered below the backlog */
+      dir->stats.overflows++;
+      pbuf_free(p);
+      continue;
+    }
+    delif_heap_push(dir, &pkt);
+    if (++dir->stats.backlog > dir->stats.max_backlog) {
+      dir->stats.max_backlog = dir->stats.backlog;
+    }
   }
-#endif /* DELIF_OUTPUT_DROPRATE */
+  delif_arm(dir, now);
+}
+/*-----------------------------------------------------------------------------------*/
+static err_t
+delif_output(struct netif *netif, struct pbuf *p, const ip_addr_t *ipaddr)
+{
+  struct delif *del = (struct delif *)netif->state;
+  struct pbuf *q;
 
   LWIP_DEBUGF(DELIF_DEBUG, ("delif_output\n"));
 
-  dp = (struct delif_pbuf*)malloc(sizeof(struct delif_pbuf));
-  data = (char*)malloc(p->tot_len);
-
-  pbuf_copy_partial(p, data, p->tot_len, 0);
-
-  dp->p = pbuf_alloc(PBUF_LINK, 0, PBUF_ROM);
-  dp->p->payload = data;
-  dp->p->len = p->tot_len;
-  dp->p->tot_len = p->tot_len;
-  dp->ipaddr = *ipaddr;
-  dp->time = sys_now() + DELIF_OUTPUT_DELAY;
-  dp->next = NULL;
-  if (output_list == NULL) {
-    output_list = dp;
-  } else {
-    for(np = output_list; np->next != NULL; np = np->next);
-    np->next = dp;
+  /* the stack may change or resend 'p' once this returns */
+  q = pbuf_clone(PBUF_RAW, PBUF_RAM, p);
+  if (q == NULL) {
+    return ERR_MEM;
   }
-
+  delif_enqueue(&del->dir[DELIF_DIR_OUTPUT], q, ipaddr);
   return ERR_OK;
 }
 
+static err_t
+delif_linkoutput(struct netif *netif, struct pbuf *p)
+{
+  return delif_output(netif, p, NULL);
+}
+
 #if LWIP_IPV4
 static err_t
 delif_output4(struct netif *netif, struct pbuf *p, const ip4_addr_t *ipaddr)
@@ -242,141 +591,241 @@ delif_output6(struct netif *netif, struct pbuf *p, const ip6_addr_t *ipaddr)
 }
 #endif /* LWIP_IPV6 */
 /*-----------------------------------------------------------------------------------*/
+/* Runs in tcpip_thread for every packet the driver received */
 static err_t
 delif_input(struct pbuf *p, struct netif *inp)
 {
-  struct delif_pbuf *dp, *np;
-
-  LWIP_UNUSED_ARG(inp);
+  struct delif *del = (struct delif *)inp;
 
   LWIP_DEBUGF(DELIF_DEBUG, ("delif_input\n"));
-#ifdef DELIF_INPUT_DROPRATE
-  if (((double)rand()/(double)RAND_MAX) < DELIF_INPUT_DROPRATE) {
-    LWIP_DEBUGF(DELIF_DEBUG, ("delif_input: Packet dropped\n"));
-    pbuf_free(p);
-    return ERR_OK;
-  }
-#endif /* DELIF_INPUT_DROPRATE */
-
-  dp = (struct delif_pbuf*)malloc(sizeof(struct delif_pbuf));
-  dp->p = p;
-  dp->time = sys_now() + DELIF_INPUT_DELAY;
-  dp->next = NULL;
+  delif_enqueue(&del->dir[DELIF_DIR_INPUT], p, NULL);
+  return ERR_OK;
+}
 
-  if (input_list == NULL) {
-    input_list = dp;
-  } else {
-    for(np = input_list; np->next != NULL; np = np->next);
-    np->next = dp;
+/* netif->input of the driver netif, called in the driver's thread */
+static err_t
+delif_driver_input(struct pbuf *p, struct netif *inp)
+{
+  return tcpip_inpkt(p, inp, delif_input);
+}
+/*-----------------------------------------------------------------------------------*/
+/**
+ * Change the impairments of one direction (DELIF_DIR_INPUT or
+ * DELIF_DIR_OUTPUT) of a delif netif. Must be called from tcpip_thread.
+ */
+err_t
+delif_set_config(struct netif *netif, u8_t dir_index, const struct delif_config *config)
+{
+  struct delif *del = (struct delif *)netif->state;
+  struct delif_dir *dir;
+  struct delif_pkt *heap;
+
+  LWIP_ASSERT("invalid direction", dir_index <= DELIF_DIR_OUTPUT);
+  dir = &del->dir[dir_index];
+  if (config->limit > dir->size) {
+    heap = (struct delif_pkt *)realloc(dir->heap, config->limit * sizeof(struct delif_pkt));
+    if (heap == NULL) {
+      return ERR_MEM;
+    }
+    dir->heap = heap;
+    dir->size = config->limit;
   }
-
+  if (config->rate != dir->config.rate) {
+    shaper_bucket_init(&dir->bucket, config->rate, 0);
+  }
+  dir->config = *config;
+  dir->bad = 0;
   return ERR_OK;
 }
+
+/** Copy the statistics of one direction to 'stats', then zero them if 'reset'
+ * is set. Must be called from tcpip_thread. */
+void
+delif_get_stats(struct netif *netif, u8_t dir_index, struct delif_stats *stats, u8_t reset)
+{
+  struct delif *del = (struct delif *)netif->state;
+  struct delif_dir *dir;
+
+  LWIP_ASSERT("invalid direction", dir_index <= DELIF_DIR_OUTPUT);
+  dir = &del->dir[dir_index];
+  *stats = dir->stats;
+  if (reset) {
+    memset(&dir->stats, 0, sizeof(struct delif_stats));
+    dir->stats.backlog = dir->count;
+    dir->stats.max_backlog = dir->count;
+  }
+}
 /*-----------------------------------------------------------------------------------*/
-err_t
-delif_init(struct netif *netif)
+/* Set up the directions from the environment */
+static err_t
+delif_configure(struct delif *del)
+{
+  static const char *const env[2] = { "DELIF_INPUT", "DELIF_OUTPUT" };
+  struct delif_config config;
+  const char *str;
+  int i;
+
+  for (i = DELIF_DIR_INPUT; i <= DELIF_DIR_OUTPUT; i++) {
+    del->dir[i].delif = del;
+    delif_config_init(&config);
+    str = getenv(env[i]);
+    if (str != NULL) {
+      if (delif_config_parse(&config, str) != 0) {
+        fprintf(stderr, "delif_init: invalid %s\n", env[i]);
+        return ERR_ARG;
+      }
+    } else {
+      config.delay_us = 1000 * ((i == DELIF_DIR_INPUT) ? DELIF_INPUT_DELAY : DELIF_OUTPUT_DELAY);
+      config.loss_good = (i == DELIF_DIR_INPUT) ? DELIF_INPUT_DROPRATE : DELIF_OUTPUT_DROPRATE;
+    }
+    if (delif_set_config(del->outer, (u8_t)i, &config) != ERR_OK) {
+      return ERR_MEM;
+    }
+  }
+  str = getenv("DELIF_SEED");
+  del->rand_state = (str != NULL) ? strtoull(str, NULL, 0) : 1;
+  if (del->rand_state == 0) {
+    del->rand_state = 1;
+  }
+  return ERR_OK;
+}
+
+static void
+delif_free(struct netif *netif, struct delif *del)
+{
+  netif->state = NULL;
+  free(del->dir[DELIF_DIR_INPUT].heap);
+  free(del->dir[DELIF_DIR_OUTPUT].heap);
+  free(del);
+}
+
+static struct delif *
+delif_new(struct netif *netif)
 {
   struct delif *del;
 
-  del = (struct delif*)malloc(sizeof(struct delif));
+  del = (struct delif*)calloc(1, sizeof(struct delif));
   if (!del) {
-    return ERR_MEM;
+    return NULL;
   }
   netif->state = del;
   netif->name[0] = 'd';
   netif->name[1] = 'e';
+  del->outer = netif;
 
 #if LWIP_IPV4
-  netif->output     = delif_output4;
+  netif_set_addr(&del->netif, netif_ip4_addr(netif), netif_ip4_netmask(netif), netif_ip4_gw(netif));
 #endif /* LWIP_IPV4 */
 #if LWIP_IPV6
-  netif->output_ip6 = delif_output6;
+  {
+    int i;
+    for(i=0; i < LWIP_IPV6_NUM_ADDRESSES; i++) {
+      netif_ip6_addr_set(&del->netif, i, netif_ip6_addr(netif, i));
+    }
+  }
 #endif /* LWIP_IPV6 */
+  del->netif.input = delif_driver_input;
 
-  del->netif = (struct netif*)malloc(sizeof(struct netif));
-  if (!del->netif) {
-    free(del);
-    return ERR_MEM;
+  if (delif_configure(del) != ERR_OK) {
+    delif_free(netif, del);
+    return NULL;
   }
+  return del;
+}
 
+/* Take over the link properties of the driver netif once it is initialized */
+static void
+delif_attach(struct netif *netif, struct delif *del)
+{
+  netif->mtu = del->netif.mtu;
+  netif->flags = del->netif.flags;
+  if (del->netif.flags & NETIF_FLAG_ETHARP) {
+    /* impair frames, ARP and neighbor discovery run on the outer netif */
+    del->link_level = 1;
+    netif->hwaddr_len = del->netif.hwaddr_len;
+    memcpy(netif->hwaddr, del->netif.hwaddr, del->netif.hwaddr_len);
+    netif->linkoutput = delif_linkoutput;
+#if LWIP_IPV4
+    netif->output = etharp_output;
+#endif /* LWIP_IPV4 */
+#if LWIP_IPV6
+    netif->output_ip6 = ethip6_output;
+#endif /* LWIP_IPV6 */
+  } else {
+#if LWIP_IPV4
+    netif->output = delif_output4;
+#endif /* LWIP_IPV4 */
+#if LWIP_IPV6
+    netif->output_ip6 = delif_output6;
+#endif /* LWIP_IPV6 */
+  }
+}
+
+static err_t
+delif_driver_init(struct netif *netif)
+{
 #ifdef LWIP_UNIX_LINUX
-  tapif_init(del->netif);
+  return tapif_init(netif);
 #else /* LWIP_UNIX_LINUX */
-  tunif_init(del->netif);
+  return tunif_init(netif);
 #endif /* LWIP_UNIX_LINUX */
+}
+/*-----------------------------------------------------------------------------------*/
+err_t
+delif_init(struct netif *netif)
+{
+  struct delif *del;
 
-  del->input        = netif->input;
-  del->netif->input = delif_input;
-
-  sys_timeout(DELIF_TIMEOUT, delif_input_timeout,  netif);
-  sys_timeout(DELIF_TIMEOUT, delif_output_timeout, netif);
+  del = delif_new(netif);
+  if (!del) {
+    return ERR_MEM;
+  }
+  if (delif_driver_init(&del->netif) != ERR_OK) {
+    delif_free(netif, del);
+    return ERR_IF;
+  }
+  delif_attach(netif, del);
   return ERR_OK;
 }
 /*-----------------------------------------------------------------------------------*/
-static void 
-delif_thread(void *arg)
-{
-  struct netif *netif = (struct netif*)arg;
+struct delif_thread_arg {
   struct delif *del;
   sys_sem_t sem;
+  err_t err;
+};
 
-  del = (struct delif*)netif->state;
-#ifdef LWIP_UNIX_LINUX
-  tapif_init(del->netif);
-#else /* LWIP_UNIX_LINUX */
-  tunif_init(del->netif);
-#endif /* LWIP_UNIX_LINUX */
-
-  sys_timeout(DELIF_TIMEOUT, delif_input_timeout,  netif);
-  sys_timeout(DELIF_TIMEOUT, delif_output_timeout, netif);
+static void
+delif_thread(void *arg)
+{
+  struct delif_thread_arg *init = (struct delif_thread_arg *)arg;
 
-  if(sys_sem_new(&sem, 0) != ERR_OK) {
-    LWIP_ASSERT("Failed to create semaphore", 0);
-  }
-  sys_sem_wait(&sem);
+  init->err = delif_driver_init(&init->del->netif);
+  sys_sem_signal(&init->sem);
 }
 /*-----------------------------------------------------------------------------------*/
+/** Like delif_init(), but the driver is initialized in a thread of its own */
 err_t
 delif_init_thread(struct netif *netif)
 {
-  struct delif *del;
+  struct delif_thread_arg init;
 
   LWIP_DEBUGF(DELIF_DEBUG, ("delif_init_thread\n"));
 
-  del = (struct delif*)malloc(sizeof(struct delif));
-  if (!del) {
+  init.del = delif_new(netif);
+  if (!init.del) {
     return ERR_MEM;
   }
-
-  netif->state = del;
-  netif->name[0] = 'd';
-  netif->name[1] = 'e';
-
-  del->netif = (struct netif*)malloc(sizeof(struct netif));
-  if (!del->netif) {
-    free(del);
-    return ERR_MEM;
+  if(sys_sem_new(&init.sem, 0) != ERR_OK) {
+    LWIP_ASSERT("Failed to create semaphore", 0);
   }
-
-#if LWIP_IPV4
-  netif->output = delif_output4;
-  netif_set_addr(del->netif, netif_ip4_addr(netif), netif_ip4_netmask(netif), netif_ip4_gw(netif));
-#endif /* LWIP_IPV4 */
-
-#if LWIP_IPV6
-  {
-    int i;
-    netif->output_ip6 = delif_output6;
-    for(i=0; i < LWIP_IPV6_NUM_ADDRESSES; i++) {
-      netif_ip6_addr_set(del->netif, i, netif_ip6_addr(netif, i));
-    }
+  sys_thread_new("delif_thread", delif_thread, &init, DEFAULT_THREAD_STACKSIZE, DEFAULT_THREAD_PRIO);
+  sys_sem_wait(&init.sem);
+  sys_sem_free(&init.sem);
+  if (init.err != ERR_OK) {
+    delif_free(netif, init.del);
+    return ERR_IF;
   }
-#endif /* LWIP_IPV6 */
-
-  del->input = netif->input;
-  del->netif->input = delif_input;
-
-  sys_thread_new("delif_thread", delif_thread, netif, DEFAULT_THREAD_STACKSIZE, DEFAULT_THREAD_PRIO);
+  delif_attach(netif, init.del);
   return ERR_OK;
 }
 /*-----------------------------------------------------------------------------------*/
@@ -0,0 +1,703 @@
+/*
+ * Copyright (c) 2001-2003 Swedish Institute of Computer Science.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+ * SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ *
+ * This file is part of the lwIP TCP/IP stack.
+ *
+ */
+/*
+ * io_uring I/O engine shared by the netifs reading and writing frames from a
+ * file descriptor (tapif, tunif), see netif/iouring.h.
+ *
+ * The system calls are used directly, so liburing is not needed.
+ *
+ * Receive buffers are carved out of one region registered with the ring
+ * (IORING_REGISTER_BUFFERS), each of them always has a read posted until a
+ * frame arrives in it. The frame is passed up in a custom pbuf pointing into
+ * the buffer, which is posted again once the stack frees the pbuf. At most
+ * half of the buffers are lent to the stack this way: beyond that, frames
+ * are copied into PBUF_POOL pbufs and the buffer is posted again right away,
+ * so reads are always pending.
+ */
+
+#include "lwip/opt.h"
+
+#ifdef LWIP_UNIX_LINUX
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#include "lwip/debug.h"
+#include "lwip/def.h"
+#include "lwip/pbuf.h"
+#include "lwip/sys.h"
+
+#include "netif/iouring.h"
+
+#ifndef IOURING_DEBUG
+#define IOURING_DEBUG LWIP_DBG_OFF
+#endif
+
+/** Maximum number of pbufs of a chain written by one request, longer chains
+ * are refused by iouring_send() */
+#ifndef IOURING_MAX_IOV
+#define IOURING_MAX_IOV 16
+#endif
+
+/** Biggest prefix written in front of a frame by iouring_send() */
+#define IOURING_MAX_PREFIX 16
+
+/* user_data of a request: what it is and which buffer or slot it uses */
+#define IOURING_RX 1
+#define IOURING_TX 2
+#define IOURING_DATA(kind, index) (((u64_t)(kind) << 32) | (index))
+
+/* end of the free lists */
+#define IOURING_NONE 0xffff
+
+/* A receive buffer */
+struct iouring_rx_buf {
+#if LWIP_SUPPORT_CUSTOM_PBUF
+  /* must be first: the frame lent to the stack */
+  struct pbuf_custom pc;
+#endif /* LWIP_SUPPORT_CUSTOM_PBUF */
+  struct iouring *ring;
+  u16_t index;
+  u16_t next;
+};
+
+/* A write in flight */
+struct iouring_tx_slot {
+  /* referenced until the write completes */
+  struct pbuf *p;
+  u16_t next;
+  u8_t prefix[IOURING_MAX_PREFIX];
+  struct iovec iov[1 + IOURING_MAX_IOV];
+};
+
+struct iouring {
+  int fd;
+  /* submission queue, shared with the kernel */
+  u32_t *sq_head;
+  u32_t *sq_tail;
+  u32_t sq_mask;
+  u32_t sq_entries;
+  struct io_uring_sqe *sqes;
+  /* completion queue, shared with the kernel */
+  u32_t *cq_head;
+  u32_t *cq_tail;
+  u32_t cq_mask;
+  struct io_uring_cqe *cqes;
+  void *sq_ring;
+  size_t sq_ring_size;
+  void *cq_ring;
+  size_t cq_ring_size;
+  size_t sqes_size;
+  /* completions are being handled */
+  u8_t busy;
+
+  /* receive side */
+  int rx_fd;
+  u8_t *rx_mem;
+  size_t rx_stride;
+  u16_t rx_nbufs;
+  u16_t rx_offset;    /* of the frame in a buffer */
+  u16_t rx_prefix;
+  u16_t rx_headroom;
+  u32_t rx_len;       /* bytes read into a buffer */
+  u8_t rx_fixed;      /* the buffers are registered */
+  struct iouring_rx_buf *rx_bufs;
+  iouring_input_fn input;
+  void *input_arg;
+  /* protected by SYS_ARCH_PROTECT, pbufs are freed by any thread */
+  u16_t rx_returned;  /* buffers to post again */
+  u16_t rx_held;      /* buffers lent to the stack */
+
+  /* transmit side */
+  struct iouring_tx_slot *tx_slots;
+  u16_t tx_free;
+  u16_t tx_pending;   /* writes not reaped yet */
+};
+
+/*-----------------------------------------------------------------------------------*/
+/* Submit the queued requests. If 'min_complete' is not 0, wait until that
+   many completions are pending or 'ts' (if not NULL) expires. */
+static void
+iouring_enter(struct iouring *ring, u32_t min_complete, struct __kernel_timespec *ts)
+{
+  struct io_uring_getevents_arg arg;
+  u32_t to_submit = *ring->sq_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+  u32_t flags = 0;
+  void *argp = NULL;
+  size_t argsz = 0;
+
+  if (min_complete > 0) {
+    flags = IORING_ENTER_GETEVENTS;
+    if (ts != NULL) {
+      memset(&arg, 0, sizeof(arg));
+      arg.ts = (u64_t)(uintptr_t)ts;
+      flags |= IORING_ENTER_EXT_ARG;
+      argp = &arg;
+      argsz = sizeof(arg);
+    }
+  } else if (to_submit == 0) {
+    return;
+  }
+  if (syscall(__NR_io_uring_enter, ring->fd, to_submit, min_complete, flags, argp, argsz) < 0) {
+    if ((errno != EINTR) && (errno != ETIME) && (errno != EAGAIN) && (errno != EBUSY)) {
+      perror("iouring: io_uring_enter");
+    }
+  }
+}
+
+/* Get a cleared submission queue entry, NULL if the queue is full. It is
+   passed to the kernel by iouring_queue(). */
+static struct io_uring_sqe *
+iouring_get_sqe(struct iouring *ring)
+{
+  u32_t tail = *ring->sq_tail;
+  struct io_uring_sqe *sqe;
+
+  if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries) {
+    /* submit what is queued to make room */
+    iouring_enter(ring, 0, NULL);
+    if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries) {
+      return NULL;
+    }
+  }
+  sqe = &ring->sqes[tail & ring->sq_mask];
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+static void
+iouring_queue(struct iouring *ring)
+{
+  __atomic_store_n(ring->sq_tail, *ring->sq_tail + 1, __ATOMIC_RELEASE);
+}
+
+/*-----------------------------------------------------------------------------------*/
+/* Post a read into the receive buffer 'index' */
+static void
+iouring_rx_post(struct iouring *ring, u16_t index)
+{
+  struct io_uring_sqe *sqe = iouring_get_sqe(ring);
+
+  if (sqe == NULL) {
+    /* cannot happen as the queue has an entry for every buffer, but
+       try again next time */
+    SYS_ARCH_DECL_PROTECT(lev);
+    SYS_ARCH_PROTECT(lev);
+    ring->rx_bufs[index].next = ring->rx_returned;
+    ring->rx_returned = index;
+    SYS_ARCH_UNPROTECT(lev);
+    return;
+  }
+  sqe->opcode = ring->rx_fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+  sqe->fd = ring->rx_fd;
+  sqe->addr = (u64_t)(uintptr_t)(ring->rx_mem + (size_t)index * ring->rx_stride +
+                                 ring->rx_offset - ring->rx_prefix);
+  sqe->len = ring->rx_len;
+  sqe->buf_index = 0;
+  sqe->user_data = IOURING_DATA(IOURING_RX, index);
+  iouring_queue(ring);
+}
+
+/* Post the buffers freed by the stack again */
+static void
+iouring_rx_repost(struct iouring *ring)
+{
+  u16_t index, next;
+  SYS_ARCH_DECL_PROTECT(lev);
+
+  SYS_ARCH_PROTECT(lev);
+  index = ring->rx_returned;
+  ring->rx_returned = IOURING_NONE;
+  SYS_ARCH_UNPROTECT(lev);
+
+  while (index != IOURING_NONE) {
+    next = ring->rx_bufs[index].next;
+    iouring_rx_post(ring, index);
+    index = next;
+  }
+}
+
+#if LWIP_SUPPORT_CUSTOM_PBUF
+/* Custom free function of the pbufs lent to the stack, called by any thread */
+static void
+iouring_rx_free(struct pbuf *p)
+{
+  struct iouring_rx_buf *buf = (struct iouring_rx_buf *)p;
+  struct iouring *ring = buf->ring;
+  SYS_ARCH_DECL_PROTECT(lev);
+
+  SYS_ARCH_PROTECT(lev);
+  buf->next = ring->rx_returned;
+  ring->rx_returned = buf->index;
+  ring->rx_held--;
+  SYS_ARCH_UNPROTECT(lev);
+}
+#endif /* LWIP_SUPPORT_CUSTOM_PBUF */
+
+/* A read completed with 'res', returns 1 if a frame was passed up */
+static int
+iouring_rx_done(struct iouring *ring, u16_t index, s32_t res)
+{
+  u8_t *mem = ring->rx_mem + (size_t)index * ring->rx_stride;
+  struct pbuf *p = NULL;
+  u16_t len;
+#if LWIP_SUPPORT_CUSTOM_PBUF
+  u8_t lend = 0;
+  SYS_ARCH_DECL_PROTECT(lev);
+#endif /* LWIP_SUPPORT_CUSTOM_PBUF */
+
+  if (res < (s32_t)ring->rx_prefix) {
+    if ((res < 0) && (res != -EINTR) && (res != -EAGAIN)) {
+      errno = -res;
+      perror("iouring: read");
+    }
+    iouring_rx_post(ring, index);
+    return 0;
+  }
+  len = (u16_t)(res - ring->rx_prefix + ring->rx_headroom);
+
+#if LWIP_SUPPORT_CUSTOM_PBUF
+  SYS_ARCH_PROTECT(lev);
+  if (ring->rx_held < ring->rx_nbufs / 2) {
+    ring->rx_held++;
+    lend = 1;
+  }
+  SYS_ARCH_UNPROTECT(lev);
+  if (lend) {
+    p = pbuf_alloced_custom(PBUF_RAW, len, PBUF_REF, &ring->rx_bufs[index].pc,
+                            mem + ring->rx_offset - ring->rx_headroom, len);
+  }
+#endif /* LWIP_SUPPORT_CUSTOM_PBUF */
+  if (p == NULL) {
+    p = pbuf_alloc(PBUF_RAW, len, PBUF_POOL);
+    if (p == NULL) {
+      LWIP_DEBUGF(IOURING_DEBUG, ("iouring: could not allocate pbuf\n"));
+      iouring_rx_post(ring, index);
+      return 0;
+    }
+    pbuf_take(p, mem + ring->rx_offset - ring->rx_headroom, len);
+    /* the buffer is posted again after the input function used the prefix */
+    ring->input(ring->input_arg, p, mem + ring->rx_offset - ring->rx_prefix);
+    iouring_rx_post(ring, index);
+    return 1;
+  }
+  ring->input(ring->input_arg, p, mem + ring->rx_offset - ring->rx_prefix);
+  return 1;
+}
+
+/* A write completed with 'res' */
+static void
+iouring_tx_done(struct iouring *ring, u16_t index, s32_t res)
+{
+  struct iouring_tx_slot *slot = &ring->tx_slots[index];
+
+  if (res < 0) {
+    errno = -res;
+    perror("iouring: write");
+  }
+  pbuf_free(slot->p);
+  slot->p = NULL;
+  slot->next = ring->tx_free;
+  ring->tx_free = index;
+  ring->tx_pending--;
+}
+
+/* Handle all pending completions, returns the number of frames passed up */
+static int
+iouring_complete(struct iouring *ring)
+{
+  u32_t head = *ring->cq_head;
+  struct io_uring_cqe *cqe;
+  u64_t data;
+  s32_t res;
+  int frames = 0;
+
+  ring->busy = 1;
+  while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+    cqe = &ring->cqes[head & ring->cq_mask];
+    data = cqe->user_data;
+    res = cqe->res;
+    __atomic_store_n(ring->cq_head, ++head, __ATOMIC_RELEASE);
+
+    if ((data >> 32) == IOURING_RX) {
+      frames += iouring_rx_done(ring, (u16_t)data, res);
+    } else if ((data >> 32) == IOURING_TX) {
+      iouring_tx_done(ring, (u16_t)data, res);
+    }
+  }
+  if (frames > 0) {
+    /* end of the batch */
+    ring->input(ring->input_arg, NULL, NULL);
+  }
+  ring->busy = 0;
+  return frames;
+}
+
+/*-----------------------------------------------------------------------------------*/
+/*
+ * iouring_new():
+ *
+ * Create a ring for 'rx_bufs' receive buffers (set up by iouring_rx_start())
+ * and 'tx_slots' writes in flight. Returns NULL if io_uring is not available.
+ *
+ */
+/*-----------------------------------------------------------------------------------*/
+struct iouring *
+iouring_new(u16_t rx_bufs, u16_t tx_slots)
+{
+  struct io_uring_params params;
+  struct iouring *ring;
+  const char *env = getenv("LWIP_IOURING");
+  u32_t entries = 1;
+  u32_t i;
+
+  if ((env != NULL) && (atoi(env) == 0)) {
+    return NULL;
+  }
+  /* room to post every buffer and slot between two submissions */
+  while (entries < (u32_t)rx_bufs + tx_slots) {
+    entries <<= 1;
+  }
+
+  ring = (struct iouring *)calloc(1, sizeof(struct iouring));
+  if (ring == NULL) {
+    return NULL;
+  }
+  ring->rx_fd = -1;
+  ring->rx_returned = IOURING_NONE;
+  ring->tx_free = IOURING_NONE;
+
+  memset(&params, 0, sizeof(params));
+  ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+  if (ring->fd < 0) {
+    LWIP_DEBUGF(IOURING_DEBUG, ("iouring_new: io_uring_setup failed (%d)\n", errno));
+    free(ring);
+    return NULL;
+  }
+  if (!(params.features & IORING_FEAT_EXT_ARG)) {
+    /* needed to wait with a timeout (Linux 5.11) */
+    LWIP_DEBUGF(IOURING_DEBUG, ("iouring_new: kernel too old\n"));
+    iouring_free(ring);
+    return NULL;
+  }
+
+  ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(u32_t);
+  ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    ring->sq_ring_size = LWIP_MAX(ring->sq_ring_size, ring->cq_ring_size);
+  }
+  ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if (ring->sq_ring == MAP_FAILED) {
+    ring->sq_ring = NULL;
+    iouring_free(ring);
+    return NULL;
+  }
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    ring->cq_ring = ring->sq_ring;
+  } else {
+    ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    if (ring->cq_ring == MAP_FAILED) {
+      ring->cq_ring = NULL;
+      iouring_free(ring);
+      return NULL;
+    }
+  }
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = (struct io_uring_sqe *)mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                                           MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED) {
+    ring->sqes = NULL;
+    iouring_free(ring);
+    return NULL;
+  }
+
+  ring->sq_head = (u32_t *)((u8_t *)ring->sq_ring + params.sq_off.head);
+  ring->sq_tail = (u32_t *)((u8_t *)ring->sq_ring + params.sq_off.tail);
+  ring->sq_mask = *(u32_t *)((u8_t *)ring->sq_ring + params.sq_off.ring_mask);
+  ring->sq_entries = params.sq_entries;
+  ring->cq_head = (u32_t *)((u8_t *)ring->cq_ring + params.cq_off.head);
+  ring->cq_tail = (u32_t *)((u8_t *)ring->cq_ring + params.cq_off.tail);
+  ring->cq_mask = *(u32_t *)((u8_t *)ring->cq_ring + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)((u8_t *)ring->cq_ring + params.cq_off.cqes);
+  /* entries are submitted in order */
+  for (i = 0; i < params.sq_entries; i++) {
+    ((u32_t *)((u8_t *)ring->sq_ring + params.sq_off.array))[i] = i;
+  }
+
+  if (tx_slots > 0) {
+    ring->tx_slots = (struct iouring_tx_slot *)calloc(tx_slots, sizeof(struct iouring_tx_slot));
+    if (ring->tx_slots == NULL) {
+      iouring_free(ring);
+      return NULL;
+    }
+    for (i = tx_slots; i > 0; i--) {
+      ring->tx_slots[i - 1].next = ring->tx_free;
+      ring->tx_free = (u16_t)(i - 1);
+    }
+  }
+  ring->rx_nbufs = rx_bufs;
+
+  LWIP_DEBUGF(IOURING_DEBUG, ("iouring_new: %"U32_F" entries\n", (u32_t)params.sq_entries));
+  return ring;
+}
+
+/*-----------------------------------------------------------------------------------*/
+/*
+ * iouring_free():
+ *
+ * Destroy a ring that has no frames lent to the stack and no writes in
+ * flight, e.g. after iouring_rx_start() failed.
+ *
+ */
+/*-----------------------------------------------------------------------------------*/
+void
+iouring_free(struct iouring *ring)
+{
+  if (ring->sqes != NULL) {
+    munmap(ring->sqes, ring->sqes_size);
+  }
+  if ((ring->cq_ring != NULL) && (ring->cq_ring != ring->sq_ring)) {
+    munmap(ring->cq_ring, ring->cq_ring_size);
+  }
+  if (ring->sq_ring != NULL) {
+    munmap(ring->sq_ring, ring->sq_ring_size);
+  }
+  close(ring->fd);
+  if (ring->rx_mem != NULL) {
+    munmap(ring->rx_mem, ring->rx_nbufs * ring->rx_stride);
+  }
+  free(ring->rx_bufs);
+  free(ring->tx_slots);
+  free(ring);
+}
+
+/*-----------------------------------------------------------------------------------*/
+/*
+ * iouring_rx_start():
+ *
+ * Start reading frames of up to 'frame_size' bytes from the blocking file
+ * descriptor 'fd' (io_uring fails reads of O_NONBLOCK descriptors with
+ * EAGAIN instead of waiting), each preceded by a 'prefix_len' byte header.
+ * Frames are passed to 'input' by iouring_wait() with 'headroom' bytes (e.g.
+ * ETH_PAD_SIZE) in front of them; the payload is aligned like that of a
+ * PBUF_POOL pbuf.
+ *
+ */
+/*-----------------------------------------------------------------------------------*/
+err_t
+iouring_rx_start(struct iouring *ring, int fd, u16_t frame_size, u16_t prefix_len,
+                 u16_t headroom, iouring_input_fn input, void *arg)
+{
+  struct iovec iov;
+  u16_t i;
+
+  if ((ring->rx_nbufs == 0) || ((u32_t)frame_size + headroom > 0xffff)) {
+    return ERR_ARG;
+  }
+  ring->rx_fd = fd;
+  ring->rx_prefix = prefix_len;
+  ring->rx_headroom = headroom;
+  /* the prefix is read in front of the frame, the headroom may overlap it */
+  ring->rx_offset = (u16_t)(headroom + LWIP_MEM_ALIGN_SIZE(prefix_len));
+  ring->rx_len = (u32_t)prefix_len + frame_size;
+  ring->rx_stride = ((size_t)ring->rx_offset + frame_size + 63) & ~(size_t)63;
+  ring->input = input;
+  ring->input_arg = arg;
+
+  ring->rx_mem = (u8_t *)mmap(NULL, ring->rx_nbufs * ring->rx_stride, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ring->rx_mem == MAP_FAILED) {
+    ring->rx_mem = NULL;
+    return ERR_MEM;
+  }
+  ring->rx_bufs = (struct iouring_rx_buf *)calloc(ring->rx_nbufs, sizeof(struct iouring_rx_buf));
+  if (ring->rx_bufs == NULL) {
+    return ERR_MEM;
+  }
+
+  /* registered buffers are pinned once instead of for every read; this is
+     limited by RLIMIT_MEMLOCK, plain reads are used if it fails */
+  iov.iov_base = ring->rx_mem;
+  iov.iov_len = ring->rx_nbufs * ring->rx_stride;
+  ring->rx_fixed = (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, &iov, 1) == 0);
+  if (!ring->rx_fixed) {
+    LWIP_DEBUGF(IOURING_DEBUG, ("iouring_rx_start: cannot register buffers (%d)\n", errno));
+  }
+
+  for (i = 0; i < ring->rx_nbufs; i++) {
+    ring->rx_bufs[i].ring = ring;
+    ring->rx_bufs[i].index = i;
+#if LWIP_SUPPORT_CUSTOM_PBUF
+    ring->rx_bufs[i].pc.custom_free_function = iouring_rx_free;
+#endif /* LWIP_SUPPORT_CUSTOM_PBUF */
+    iouring_rx_post(ring, i);
+  }
+  iouring_enter(ring, 0, NULL);
+  return ERR_OK;
+}
+
+/*-----------------------------------------------------------------------------------*/
+/*
+ * iouring_send():
+ *
+ * Queue writing 'prefix' (copied) followed by the chain 'p' to 'fd'. 'p' is
+ * referenced until the write completes, its payload must not change until
+ * then. The write is started by the next iouring_submit() or iouring_wait().
+ * Returns ERR_MEM if all slots are in use and ERR_BUF if the chain is too
+ * long, the caller then has to write the frame itself.
+ *
+ */
+/*-----------------------------------------------------------------------------------*/
+err_t
+iouring_send(struct iouring *ring, int fd, const void *prefix, u16_t prefix_len, struct pbuf *p)
+{
+  struct iouring_tx_slot *slot;
+  struct io_uring_sqe *sqe;
+  struct pbuf *q;
+  u16_t index = ring->tx_free;
+  int n = 0;
+
+  if (index == IOURING_NONE) {
+    return ERR_MEM;
+  }
+  LWIP_ASSERT("iouring_send: prefix too long", prefix_len <= IOURING_MAX_PREFIX);
+  slot = &ring->tx_slots[index];
+
+  if (prefix_len > 0) {
+    memcpy(slot->prefix, prefix, prefix_len);
+    slot->iov[0].iov_base = slot->prefix;
+    slot->iov[0].iov_len = prefix_len;
+    n = 1;
+  }
+  for (q = p; q != NULL; q = q->next) {
+    if (q->len == 0) {
+      continue;
+    }
+    if (n == LWIP_ARRAYSIZE(slot->iov)) {
+      return ERR_BUF;
+    }
+    slot->iov[n].iov_base = q->payload;
+    slot->iov[n].iov_len = q->len;
+    n++;
+  }
+
+  sqe = iouring_get_sqe(ring);
+  if (sqe == NULL) {
+    return ERR_MEM;
+  }
+  sqe->opcode = IORING_OP_WRITEV;
+  sqe->fd = fd;
+  sqe->addr = (u64_t)(uintptr_t)slot->iov;
+  sqe->len = (u32_t)n;
+  sqe->user_data = IOURING_DATA(IOURING_TX, index);
+  iouring_queue(ring);
+
+  ring->tx_free = slot->next;
+  ring->tx_pending++;
+  pbuf_ref(p);
+  slot->p = p;
+  return ERR_OK;
+}
+
+/*-----------------------------------------------------------------------------------*/
+/*
+ * iouring_submit():
+ *
+ * Start the queued writes (and reads of the buffers freed by the stack, if
+ * called by the thread receiving with the ring) and handle the completions
+ * that are pending, without waiting.
+ *
+ */
+/*-----------------------------------------------------------------------------------*/
+void
+iouring_submit(struct iouring *ring)
+{
+  if (ring->rx_nbufs > 0) {
+    iouring_rx_repost(ring);
+  }
+  iouring_enter(ring, 0, NULL);
+  if (!ring->busy) {
+    iouring_complete(ring);
+  }
+}
+
+/*-----------------------------------------------------------------------------------*/
+/*
+ * iouring_wait():
+ *
+ * Start the queued requests and wait until something completes or 'msecs'
+ * (IOURING_WAIT_FOREVER for no timeout) pass, all with one system call. Then
+ * handle the completions, returns the number of frames passed up.
+ *
+ */
+/*-----------------------------------------------------------------------------------*/
+int
+iouring_wait(struct iouring *ring, u32_t msecs)
+{
+  struct __kernel_timespec ts;
+
+  if (ring->rx_nbufs > 0) {
+    iouring_rx_repost(ring);
+  }
+  if (msecs == IOURING_WAIT_FOREVER) {
+    iouring_enter(ring, 1, NULL);
+  } else {
+    ts.tv_sec = msecs / 1000;
+    ts.tv_nsec = (long long)(msecs % 1000) * 1000000;
+    iouring_enter(ring, 1, &ts);
+  }
+  return iouring_complete(ring);
+}
+
+/* The number of writes whose completion was not handled yet (their pbufs
+   are still referenced) */
+u16_t
+iouring_tx_pending(struct iouring *ring)
+{
+  return ring->tx_pending;
+}
+
+/* The descriptor of the ring, readable when completions are pending */
+int
+iouring_fd(struct iouring *ring)
+{
+  return ring->fd;
+}
+
+#endif /* LWIP_UNIX_LINUX */
@@ -30,187 +30,568 @@
  *
  */
 
-#ifndef linux  /* Apparently, this doesn't work under Linux. */
+/*
+ * pcapif: Network interface that replays the packets of a pcap or pcapng
+ * file, for reproducible load tests of the stack without a network.
+ *
+ * The file is memory mapped and indexed when the netif is initialized, the
+ * replay thread copies each packet once into a pbuf and passes it to
+ * netif->input. Packets sent out from the netif are discarded.
+ *
+ * Configured with PCAPIF in the environment, e.g.
+ * "file=capture.pcapng,speed=10,loops=5":
+ *  file=NAME   file to replay (default "pcapdump")
+ *  speed=X     1 replays at the original timing, X at X times the rate,
+ *              0 (or "max") as fast as the stack takes the packets
+ *  loops=N     replay the file N times (0: forever)
+ *  delay=MS    wait before the first run (default 1000)
+ *
+ * At the original or a multiplied rate, packets the stack cannot take
+ * (no pbuf, tcpip mbox full) are dropped to keep the timing. At full speed
+ * the replay waits for the stack instead. Each run reports its throughput
+ * and drops (pcapif_get_stats()).
+ */
 
-#include "lwip/debug.h"
+#include "lwip/opt.h"
+
+#if !NO_SYS
 
+#include <errno.h>
 #include <fcntl.h>
-#include <stdlib.h>
+#include <math.h>
+#include <sched.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
-#include <sys/types.h>
-#include <sys/uio.h>
-#include <sys/socket.h>
-#include <sys/un.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
-
-#include <pcap.h>
-
-#include "netif/etharp.h"
-
-#include "lwip/stats.h"
 
+#include "lwip/debug.h"
 #include "lwip/def.h"
 #include "lwip/mem.h"
 #include "lwip/pbuf.h"
-#include "netif/unixif.h"
+#include "lwip/stats.h"
+#include "lwip/snmp.h"
 #include "lwip/sys.h"
+#include "netif/etharp.h"
+#include "lwip/ethip6.h"
 
-#include "lwip/ip.h"
+#include "netif/pcapif.h"
+#include "netif/tcpdump.h"
 
+#include "arch/opts.h"
 
-#if defined(LWIP_DEBUG) && defined(LWIP_TCPDUMP)
-#include "netif/tcpdump.h"
-#endif /* LWIP_DEBUG && LWIP_TCPDUMP */
+#ifndef PCAPIF_DEBUG
+#define PCAPIF_DEBUG LWIP_DBG_OFF
+#endif
 
-struct pcapif {
-  pcap_t *pd;
-  sys_sem_t sem;
-  u8_t pkt[2048];
+/** File replayed when PCAPIF does not name one */
+#ifndef PCAPIF_FILE
+#define PCAPIF_FILE "pcapdump"
+#endif
+
+/** Wait before the first run (ms), gives the application time to set up */
+#ifndef PCAPIF_DELAY
+#define PCAPIF_DELAY 1000
+#endif
+
+/* Define those to better describe your network interface. */
+#define IFNAME0 'p'
+#define IFNAME1 'c'
+
+#define PCAPIF_LINKTYPE_ETHERNET 1
+#define PCAPIF_LINKTYPE_RAW      101
+#define PCAPIF_LINKTYPE_IPV4     228
+#define PCAPIF_LINKTYPE_IPV6     229
+
+#define PCAPIF_PCAPNG_MAX_IFS 32
+
+struct pcapif_pkt {
+  const u8_t *data;
   u32_t len;
-  u32_t lasttime;
-  struct pbuf *p;
-  struct eth_addr *ethaddr;
+  u64_t ts_ns;     /* relative to the first packet */
+};
+
+struct pcapif {
+  u8_t *map;
+  size_t map_len;
+  struct pcapif_pkt *pkts;
+  u32_t num_pkts;
+  u32_t max_pkts;
+  u16_t linktype;
+  double speed;
+  u32_t loops;
+  u32_t delay;
+  struct pcapif_stats stats;
 };
 
-static char errbuf[PCAP_ERRBUF_SIZE];
+static char pcapif_file[256] = PCAPIF_FILE;
 
 /*-----------------------------------------------------------------------------------*/
-static err_t
-pcapif_output(struct netif *netif, struct pbuf *p,
-	      ip_addr_t *ipaddr)
+static u32_t
+pcapif_u32(const u8_t *d, int swap)
 {
-  return ERR_OK;
+  u32_t v;
+  memcpy(&v, d, sizeof(v));
+  return swap ? __builtin_bswap32(v) : v;
+}
+/*-----------------------------------------------------------------------------------*/
+static u16_t
+pcapif_u16(const u8_t *d, int swap)
+{
+  u16_t v;
+  memcpy(&v, d, sizeof(v));
+  return swap ? __builtin_bswap16(v) : v;
 }
 /*-----------------------------------------------------------------------------------*/
+static u64_t
+pcapif_now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (u64_t)ts.tv_sec * 1000000000ULL + (u64_t)ts.tv_nsec;
+}
+/*-----------------------------------------------------------------------------------*/
+/* Add a packet to the index. The first link type seen is the one of the
+   netif, packets of other link types are skipped. */
 static void
-timeout(void *arg)
+pcapif_add_pkt(struct pcapif *pcapif, u16_t linktype, const u8_t *data, u32_t len, u64_t ts_ns)
 {
-  struct netif *netif;
-  struct pcapif *pcapif;
-  struct pbuf *p;
-  struct eth_hdr *ethhdr;
-  
-  netif = (struct netif *)arg;
-  pcapif = netif->state;
-  ethhdr = (struct eth_hdr *)pcapif->pkt;
-
-  
-  if (lwip_htons(ethhdr->type) != ETHTYPE_IP ||
-     ip_lookup(pcapif->pkt + 14, netif)) {
-    
-    /* We allocate a pbuf chain of pbufs from the pool. */
-    p = pbuf_alloc(PBUF_LINK, pcapif->len, PBUF_POOL);
-    
-    if (p != NULL) {
-      pbuf_take(p, pcapif->pkt, pcapif->len);
-
-#if defined(LWIP_DEBUG) && defined(LWIP_TCPDUMP)
-      tcpdump(p, netif);
-#endif /* LWIP_DEBUG && LWIP_TCPDUMP */
-
-      ethhdr = p->payload;
-      switch (lwip_htons(ethhdr->type)) {
-      /* IP or ARP packet? */
-      case ETHTYPE_IP:
-      case ETHTYPE_ARP:
-#if PPPOE_SUPPORT
-      /* PPPoE packet? */
-      case ETHTYPE_PPPOEDISC:
-      case ETHTYPE_PPPOE:
-#endif /* PPPOE_SUPPORT */
-        /* full packet send to tcpip_thread to process */
-        if (netif->input(p, netif) != ERR_OK) {
-          LWIP_DEBUGF(NETIF_DEBUG, ("ethernetif_input: IP input error\n"));
-          pbuf_free(p);
-          p = NULL;
+  struct pcapif_pkt *pkts;
+
+  if (pcapif->num_pkts == 0) {
+    pcapif->linktype = linktype;
+  }
+  if ((linktype != pcapif->linktype) || (len == 0) || (len > 0xffff)) {
+    pcapif->stats.skipped++;
+    return;
+  }
+  if (pcapif->num_pkts == pcapif->max_pkts) {
+    pcapif->max_pkts = pcapif->max_pkts ? pcapif->max_pkts * 2 : 1024;
+    pkts = (struct pcapif_pkt *)realloc(pcapif->pkts, pcapif->max_pkts * sizeof(struct pcapif_pkt));
+    if (pkts == NULL) {
+      pcapif->max_pkts = pcapif->num_pkts;
+      pcapif->stats.skipped++;
+      return;
+    }
+    pcapif->pkts = pkts;
+  }
+  pcapif->pkts[pcapif->num_pkts].data = data;
+  pcapif->pkts[pcapif->num_pkts].len = len;
+  pcapif->pkts[pcapif->num_pkts].ts_ns = ts_ns;
+  pcapif->num_pkts++;
+}
+/*-----------------------------------------------------------------------------------*/
+/* Classic pcap: microsecond (a1b2c3d4) or nanosecond (a1b23c4d) timestamps,
+   either byte order */
+static int
+pcapif_index_pcap(struct pcapif *pcapif, const u8_t *d, size_t size)
+{
+  u32_t magic = pcapif_u32(d, 0);
+  int swap = (magic == 0xd4c3b2a1UL) || (magic == 0x4d3cb2a1UL);
+  u32_t tsmul = ((magic == 0xa1b23c4dUL) || (magic == 0x4d3cb2a1UL)) ? 1 : 1000;
+  u16_t linktype;
+  size_t off = 24;
+  u32_t caplen;
+  u64_t ts;
+
+  if (size < 24) {
+    return -1;
+  }
+  linktype = (u16_t)pcapif_u32(d + 20, swap);
+  while (off + 16 <= size) {
+    caplen = pcapif_u32(d + off + 8, swap);
+    if (caplen > size - off - 16) {
+      break;
+    }
+    ts = (u64_t)pcapif_u32(d + off, swap) * 1000000000ULL + (u64_t)pcapif_u32(d + off + 4, swap) * tsmul;
+    pcapif_add_pkt(pcapif, linktype, d + off + 16, caplen, ts);
+    off += 16 + caplen;
+  }
+  return 0;
+}
+/*-----------------------------------------------------------------------------------*/
+/* pcapng: enhanced and simple packet blocks, link type and timestamp
+   resolution (if_tsresol) of each interface, any number of sections */
+static int
+pcapif_index_pcapng(struct pcapif *pcapif, const u8_t *d, size_t size)
+{
+  u16_t linktype[PCAPIF_PCAPNG_MAX_IFS];
+  double tsscale[PCAPIF_PCAPNG_MAX_IFS];
+  u32_t ifs = 0, type, len, ifid, caplen;
+  size_t off = 0, opt;
+  u64_t ts = 0;
+  int swap = 0;
+
+  while (off + 12 <= size) {
+    type = pcapif_u32(d + off, swap);
+    if (type == 0x0A0D0D0AUL) {
+      /* section header: the byte order magic tells the byte order */
+      if (off + 28 > size) {
+        break;
+      }
+      swap = (pcapif_u32(d + off + 8, 0) != 0x1A2B3C4DUL);
+      ifs = 0;
+    }
+    len = pcapif_u32(d + off + 4, swap);
+    if ((len < 12) || (len & 3) || (len > size - off)) {
+      break;
+    }
+    switch (type) {
+      case 1: /* interface description */
+        if ((ifs < PCAPIF_PCAPNG_MAX_IFS) && (len >= 20)) {
+          linktype[ifs] = pcapif_u16(d + off + 8, swap);
+          tsscale[ifs] = 1000.0;
+          for (opt = off + 16; opt + 4 <= off + len - 4; ) {
+            u16_t code = pcapif_u16(d + opt, swap);
+            u16_t olen = pcapif_u16(d + opt + 2, swap);
+            if (code == 0) {
+              break;
+            }
+            if ((code == 9) && (olen == 1)) {
+              /* if_tsresol: 10^-n seconds, 2^-n if the MSB is set */
+              u8_t res = d[opt + 4];
+              if (res & 0x80) {
+                tsscale[ifs] = ldexp(1e9, -(int)(res & 0x7f));
+              } else {
+                tsscale[ifs] = 1e9;
+                for (; res > 0; res--) {
+                  tsscale[ifs] /= 10.0;
+                }
+              }
+            }
+            opt += 4 + (((size_t)olen + 3) & ~(size_t)3);
+          }
+          ifs++;
+        }
+        break;
+      case 6: /* enhanced packet */
+        if (len < 32) {
+          break;
+        }
+        ifid = pcapif_u32(d + off + 8, swap);
+        caplen = pcapif_u32(d + off + 20, swap);
+        if ((ifid >= ifs) || (caplen > len - 32)) {
+          pcapif->stats.skipped++;
+          break;
         }
+        ts = ((u64_t)pcapif_u32(d + off + 12, swap) << 32) | pcapif_u32(d + off + 16, swap);
+        pcapif_add_pkt(pcapif, linktype[ifid], d + off + 28, caplen, (u64_t)((double)ts * tsscale[ifid]));
+        break;
+      case 3: /* simple packet: interface 0, no timestamp */
+        if ((ifs == 0) || (len < 16)) {
+          break;
+        }
+        caplen = LWIP_MIN(pcapif_u32(d + off + 8, swap), len - 16);
+        pcapif_add_pkt(pcapif, linktype[0], d + off + 12, caplen,
+                       pcapif->num_pkts ? pcapif->pkts[pcapif->num_pkts - 1].ts_ns : 0);
         break;
       default:
-        pbuf_free(p);
         break;
-      }
     }
+    off += len;
+  }
+  return 0;
+}
+/*-----------------------------------------------------------------------------------*/
+static int
+pcapif_open(struct pcapif *pcapif, const char *name)
+{
+  struct stat st;
+  u32_t magic, i;
+  u64_t ts0;
+  int fd, ret;
+
+  fd = open(name, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "pcapif: cannot open \"%s\": %s\n", name, strerror(errno));
+    return -1;
+  }
+  if ((fstat(fd, &st) < 0) || (st.st_size < 24)) {
+    fprintf(stderr, "pcapif: \"%s\" is not a capture file\n", name);
+    close(fd);
+    return -1;
+  }
+  pcapif->map_len = (size_t)st.st_size;
+  pcapif->map = (u8_t *)mmap(NULL, pcapif->map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (pcapif->map == MAP_FAILED) {
+    perror("pcapif: mmap");
+    pcapif->map = NULL;
+    return -1;
+  }
+  madvise(pcapif->map, pcapif->map_len, MADV_WILLNEED);
+
+  magic = pcapif_u32(pcapif->map, 0);
+  if (magic == 0x0A0D0D0AUL) {
+    ret = pcapif_index_pcapng(pcapif, pcapif->map, pcapif->map_len);
+  } else if ((magic == 0xa1b2c3d4UL) || (magic == 0xd4c3b2a1UL) ||
+             (magic == 0xa1b23c4dUL) || (magic == 0x4d3cb2a1UL)) {
+    ret = pcapif_index_pcap(pcapif, pcapif->map, pcapif->map_len);
   } else {
-    printf("ip_lookup dropped\n");
+    fprintf(stderr, "pcapif: \"%s\" is not a pcap or pcapng file\n", name);
+    ret = -1;
+  }
+  if ((ret == 0) && (pcapif->num_pkts == 0)) {
+    fprintf(stderr, "pcapif: no packets in \"%s\"\n", name);
+    ret = -1;
+  }
+  if ((ret == 0) && (pcapif->linktype != PCAPIF_LINKTYPE_ETHERNET) &&
+      (pcapif->linktype != PCAPIF_LINKTYPE_RAW) && (pcapif->linktype != PCAPIF_LINKTYPE_IPV4) &&
+      (pcapif->linktype != PCAPIF_LINKTYPE_IPV6)) {
+    fprintf(stderr, "pcapif: unsupported link type %u in \"%s\"\n", pcapif->linktype, name);
+    ret = -1;
+  }
+  if (ret != 0) {
+    munmap(pcapif->map, pcapif->map_len);
+    pcapif->map = NULL;
+    return -1;
   }
 
-  sys_sem_signal(&pcapif->sem);
+  /* relative timestamps, packets out of order are replayed without gap */
+  ts0 = pcapif->pkts[0].ts_ns;
+  for (i = 0; i < pcapif->num_pkts; i++) {
+    pcapif->pkts[i].ts_ns = (pcapif->pkts[i].ts_ns > ts0) ? pcapif->pkts[i].ts_ns - ts0 : 0;
+    if ((i > 0) && (pcapif->pkts[i].ts_ns < pcapif->pkts[i - 1].ts_ns)) {
+      pcapif->pkts[i].ts_ns = pcapif->pkts[i - 1].ts_ns;
+    }
+  }
+  LWIP_DEBUGF(PCAPIF_DEBUG, ("pcapif: %"U32_F" packets (link type %"U16_F") in %s\n",
+                             pcapif->num_pkts, pcapif->linktype, name));
+  return 0;
 }
 /*-----------------------------------------------------------------------------------*/
-static void
-callback(u_char *arg, const struct pcap_pkthdr *hdr, const u_char *pkt)
+static int
+pcapif_config_item(void *arg, const char *key, char *value)
 {
-  struct netif *netif;
-  struct pcapif *pcapif;
-  u32_t time, lasttime;
-  
-  netif = (struct netif *)arg;
-  pcapif = netif->state;
+  struct pcapif *pcapif = (struct pcapif *)arg;
+  double n;
 
-  pcapif->len = hdr->len;
-  
-  bcopy(pkt, pcapif->pkt, hdr->len);
+  if (value == NULL) {
+    return -1;
+  }
+  if (!strcmp(key, "file")) {
+    snprintf(pcapif_file, sizeof(pcapif_file), "%s", value);
+    return 0;
+  }
+  if (!strcmp(key, "speed") && !strcmp(value, "max")) {
+    pcapif->speed = 0;
+    return 0;
+  }
+  if ((port_parse_size(value, &n) != 0) || (n > 0xffffffffUL)) {
+    return -1;
+  }
+  if (!strcmp(key, "speed")) {
+    pcapif->speed = n;
+  } else if (!strcmp(key, "loops")) {
+    pcapif->loops = (u32_t)n;
+  } else if (!strcmp(key, "delay")) {
+    pcapif->delay = (u32_t)n;
+  } else {
+    return -1;
+  }
+  return 0;
+}
 
-  time = hdr->ts.tv_sec * 1000 + hdr->ts.tv_usec / 1000;
+static int
+pcapif_config(struct pcapif *pcapif, const char *str)
+{
+  return port_parse_opts("pcapif", str, pcapif_config_item, pcapif);
+}
+/*-----------------------------------------------------------------------------------*/
+static err_t
+pcapif_linkoutput(struct netif *netif, struct pbuf *p)
+{
+  struct pcapif *pcapif = (struct pcapif *)netif->state;
+  SYS_ARCH_DECL_PROTECT(lev);
 
-  lasttime = pcapif->lasttime;
-  pcapif->lasttime = time;
-  
+  tcpdump_packet(p, netif, TCPDUMP_DIR_OUT);
+  SYS_ARCH_PROTECT(lev);
+  pcapif->stats.tx++;
+  SYS_ARCH_UNPROTECT(lev);
+  LINK_STATS_INC(link.xmit);
+  return ERR_OK;
+}
+/*-----------------------------------------------------------------------------------*/
+#if LWIP_IPV4
+static err_t
+pcapif_output(struct netif *netif, struct pbuf *p, const ip4_addr_t *ipaddr)
+{
+  LWIP_UNUSED_ARG(ipaddr);
+  return pcapif_linkoutput(netif, p);
+}
+#endif /* LWIP_IPV4 */
+/*-----------------------------------------------------------------------------------*/
+#if LWIP_IPV6
+static err_t
+pcapif_output_ip6(struct netif *netif, struct pbuf *p, const ip6_addr_t *ipaddr)
+{
+  LWIP_UNUSED_ARG(ipaddr);
+  return pcapif_linkoutput(netif, p);
+}
+#endif /* LWIP_IPV6 */
+/*-----------------------------------------------------------------------------------*/
+/* Pass one packet to the stack. At full speed, wait until the stack takes
+   it; else drop it. Returns 1 if the packet was dropped. */
+static int
+pcapif_inject(struct netif *netif, const struct pcapif_pkt *pkt, int wait)
+{
+  struct pbuf *p;
+  err_t err;
 
-  if (lasttime == 0) {
-    sys_timeout(1000, timeout, netif);
-  } else {
-    sys_timeout(time - lasttime, timeout, netif);
+  while ((p = pbuf_alloc(PBUF_RAW, (u16_t)pkt->len, PBUF_POOL)) == NULL) {
+    if (!wait) {
+      LINK_STATS_INC(link.memerr);
+      LINK_STATS_INC(link.drop);
+      return 1;
+    }
+    sched_yield();
+  }
+  pbuf_take(p, pkt->data, (u16_t)pkt->len);
+  tcpdump_packet(p, netif, TCPDUMP_DIR_IN);
+  LINK_STATS_INC(link.recv);
+
+  while ((err = netif->input(p, netif)) != ERR_OK) {
+    if (!wait || (err != ERR_MEM)) {
+      LWIP_DEBUGF(PCAPIF_DEBUG, ("pcapif_inject: input error %d\n", err));
+      pbuf_free(p);
+      LINK_STATS_INC(link.drop);
+      return 1;
+    }
+    sched_yield();
   }
+  return 0;
 }
 /*-----------------------------------------------------------------------------------*/
 static void
 pcapif_thread(void *arg)
 {
-  struct netif *netif;
-  struct pcapif *pcapif;
-  netif = arg;
-  pcapif = netif->state;
-
-  while (1) {
-    pcap_loop(pcapif->pd, 1, callback, (u_char *)netif);
-    sys_sem_wait(&pcapif->sem);
-    if (pcapif->p != NULL) {
-      netif->input(pcapif->p, netif);
+  struct netif *netif = (struct netif *)arg;
+  struct pcapif *pcapif = (struct pcapif *)netif->state;
+  struct pcapif_run run;
+  struct timespec ts;
+  u64_t start, due, now;
+  u32_t i, loop;
+  double secs;
+  SYS_ARCH_DECL_PROTECT(lev);
+
+  if (pcapif->delay > 0) {
+    ts.tv_sec = pcapif->delay / 1000;
+    ts.tv_nsec = (long)(pcapif->delay % 1000) * 1000000L;
+    nanosleep(&ts, NULL);
+  }
+
+  for (loop = 0; (pcapif->loops == 0) || (loop < pcapif->loops); loop++) {
+    memset(&run, 0, sizeof(run));
+    start = pcapif_now_ns();
+    for (i = 0; i < pcapif->num_pkts; i++) {
+      const struct pcapif_pkt *pkt = &pcapif->pkts[i];
+
+      if (pcapif->speed > 0) {
+        due = start + (u64_t)((double)pkt->ts_ns / pcapif->speed);
+        if (due > pcapif_now_ns()) {
+          ts.tv_sec = (time_t)(due / 1000000000ULL);
+          ts.tv_nsec = (long)(due % 1000000000ULL);
+          while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+        }
+      }
+      if (pcapif_inject(netif, pkt, pcapif->speed == 0)) {
+        run.drops++;
+      } else {
+        run.packets++;
+        run.bytes += pkt->len;
+      }
     }
+    now = pcapif_now_ns();
+    run.usecs = (now - start) / 1000;
+
+    SYS_ARCH_PROTECT(lev);
+    pcapif->stats.runs++;
+    pcapif->stats.last = run;
+    pcapif->stats.total.packets += run.packets;
+    pcapif->stats.total.drops += run.drops;
+    pcapif->stats.total.bytes += run.bytes;
+    pcapif->stats.total.usecs += run.usecs;
+    SYS_ARCH_UNPROTECT(lev);
+
+    secs = (run.usecs > 0) ? (double)run.usecs / 1e6 : 1e-6;
+    printf("pcapif: run %"U32_F": %"U32_F" packets, %"U32_F" dropped in %.3f s, %.0f pps, %.1f Mbit/s\n",
+           loop + 1, run.packets, run.drops, secs, run.packets / secs, run.bytes * 8 / secs / 1e6);
   }
 }
 /*-----------------------------------------------------------------------------------*/
+/** Replay statistics: the last and all completed runs */
+void
+pcapif_get_stats(struct netif *netif, struct pcapif_stats *stats)
+{
+  struct pcapif *pcapif = (struct pcapif *)netif->state;
+  SYS_ARCH_DECL_PROTECT(lev);
+
+  SYS_ARCH_PROTECT(lev);
+  *stats = pcapif->stats;
+  SYS_ARCH_UNPROTECT(lev);
+}
+/*-----------------------------------------------------------------------------------*/
 err_t
 pcapif_init(struct netif *netif)
 {
-  struct pcapif *p;
-    
-  p = malloc(sizeof(struct pcapif));
-  if (p == NULL)
-      return ERR_MEM;
-  netif->state = p;
-  netif->name[0] = 'p';
-  netif->name[1] = 'c';
-  netif->output = pcapif_output;
-
-  p->pd = pcap_open_offline("pcapdump", errbuf);
-  if (p->pd == NULL) {
-    printf("pcapif_init: failed %s\n", errbuf);
+  struct pcapif *pcapif;
+  const char *env;
+
+  pcapif = (struct pcapif *)mem_malloc(sizeof(struct pcapif));
+  if (pcapif == NULL) {
+    LWIP_DEBUGF(NETIF_DEBUG, ("pcapif_init: out of memory for pcapif\n"));
+    return ERR_MEM;
+  }
+  memset(pcapif, 0, sizeof(struct pcapif));
+  pcapif->speed = 1;
+  pcapif->loops = 1;
+  pcapif->delay = PCAPIF_DELAY;
+
+  env = getenv("PCAPIF");
+  if (((env != NULL) && (pcapif_config(pcapif, env) != 0)) ||
+      (pcapif_open(pcapif, pcapif_file) != 0)) {
+    free(pcapif->pkts);
+    mem_free(pcapif);
     return ERR_IF;
   }
+  netif->state = pcapif;
+  netif->name[0] = IFNAME0;
+  netif->name[1] = IFNAME1;
+  netif->mtu = 1500;
+  netif->linkoutput = pcapif_linkoutput;
 
-  if(sys_sem_new(&p->sem, 0) != ERR_OK) {
-    LWIP_ASSERT("Failed to create semaphore", 0);
+  if (pcapif->linktype == PCAPIF_LINKTYPE_ETHERNET) {
+    MIB2_INIT_NETIF(netif, snmp_ifType_ethernet_csmacd, 0);
+#if LWIP_IPV4
+    netif->output = etharp_output;
+#endif /* LWIP_IPV4 */
+#if LWIP_IPV6
+    netif->output_ip6 = ethip6_output;
+#endif /* LWIP_IPV6 */
+    netif->hwaddr[0] = 0x02;
+    netif->hwaddr[1] = 0x12;
+    netif->hwaddr[2] = 0x34;
+    netif->hwaddr[3] = 0x56;
+    netif->hwaddr[4] = 0x78;
+    netif->hwaddr[5] = 0xad;
+    netif->hwaddr_len = 6;
+    netif->flags = NETIF_FLAG_BROADCAST | NETIF_FLAG_ETHARP | NETIF_FLAG_IGMP;
+  } else {
+    MIB2_INIT_NETIF(netif, snmp_ifType_other, 0);
+#if LWIP_IPV4
+    netif->output = pcapif_output;
+#endif /* LWIP_IPV4 */
+#if LWIP_IPV6
+    netif->output_ip6 = pcapif_output_ip6;
+#endif /* LWIP_IPV6 */
   }
-  p->p = NULL;
-  p->lasttime = 0; 
-  
+  netif_set_link_up(netif);
+
   sys_thread_new("pcapif_thread", pcapif_thread, netif, DEFAULT_THREAD_STACKSIZE, DEFAULT_THREAD_PRIO);
   return ERR_OK;
 }
 /*-----------------------------------------------------------------------------------*/
-#endif /* linux */
+#endif /* !NO_SYS */
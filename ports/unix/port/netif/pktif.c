@@ -0,0 +1,662 @@
+/*
+ * Copyright (c) 2001-2003 Swedish Institute of Computer Science.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+ * SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ *
+ * This file is part of the lwIP TCP/IP stack.
+ *
+ */
+
+/*
+ * pktif: Ethernet netif on top of an AF_PACKET socket bound to a host
+ * interface, with memory mapped RX and TX rings (TPACKET_V3):
+ *
+ * - The kernel fills the RX ring block by block and hands a block over once it
+ *   is full or PKTIF_RX_TIMEOUT ms passed. All frames of a block are then
+ *   copied into pbufs and passed up without a system call per frame, and the
+ *   block is given back.
+ * - Sent frames are copied into the TX ring, which is flushed with one
+ *   send() for all frames sent during one iteration of tcpip_thread (with
+ *   NO_SYS, by the next pktif_select()).
+ *
+ * lwIP has its own MAC address, the interface is put into promiscuous mode to
+ * receive its frames. To test against a veth pair in a network namespace, see
+ * setup-pktif.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include "lwip/opt.h"
+
+#include "lwip/debug.h"
+#include "lwip/def.h"
+#include "lwip/mem.h"
+#include "lwip/stats.h"
+#include "lwip/snmp.h"
+#include "lwip/pbuf.h"
+#include "lwip/sys.h"
+#include "lwip/timeouts.h"
+#include "netif/etharp.h"
+#include "lwip/ethip6.h"
+#if !NO_SYS
+#include "lwip/tcpip.h"
+#endif /* !NO_SYS */
+
+#include "netif/pktif.h"
+#if NO_SYS
+#include "arch/evloop.h"
+#endif /* NO_SYS */
+
+#ifdef LWIP_UNIX_LINUX
+
+#include <net/if.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+
+/* Define those to better describe your network interface. */
+#define IFNAME0 'p'
+#define IFNAME1 'k'
+
+#ifndef PKTIF_DEBUG
+#define PKTIF_DEBUG LWIP_DBG_OFF
+#endif
+
+/** Host interface used if PKTIF_IFNAME is not set */
+#ifndef PKTIF_DEFAULT_IF
+#define PKTIF_DEFAULT_IF "veth0"
+#endif
+
+/** Size and number of the blocks of the RX ring */
+#ifndef PKTIF_RX_BLOCK_SIZE
+#define PKTIF_RX_BLOCK_SIZE (1 << 17)
+#endif
+#ifndef PKTIF_RX_BLOCKS
+#define PKTIF_RX_BLOCKS 16
+#endif
+/** Milliseconds after which the kernel hands over a block that is not full */
+#ifndef PKTIF_RX_TIMEOUT
+#define PKTIF_RX_TIMEOUT 1
+#endif
+
+/** Size of a frame slot of the TX ring, and number of slots */
+#ifndef PKTIF_TX_FRAME_SIZE
+#define PKTIF_TX_FRAME_SIZE 2048
+#endif
+#ifndef PKTIF_TX_FRAMES
+#define PKTIF_TX_FRAMES 256
+#endif
+#define PKTIF_TX_BLOCK_SIZE (1 << 16)
+
+/** Maximum number of frames passed to tcpip_thread with one message, if
+ * netif->input is tcpip_input */
+#ifndef PKTIF_RX_BATCH
+#define PKTIF_RX_BATCH 64
+#endif
+
+/* Offset of the frame in a TX slot: the kernel expects it right after the
+   header, without the struct sockaddr_ll */
+#define PKTIF_TX_DATA (TPACKET3_HDRLEN - sizeof(struct sockaddr_ll))
+
+#if PKTIF_TX_BLOCK_SIZE % PKTIF_TX_FRAME_SIZE
+#error "PKTIF_TX_FRAME_SIZE must divide the block size"
+#endif
+
+struct pktif {
+  int fd;
+  /* RX ring followed by the TX ring */
+  u8_t *ring;
+  size_t ring_size;
+  u8_t *tx_ring;
+  /* next RX block to look at */
+  u16_t rx_block;
+  /* next TX slot to fill */
+  u16_t tx_frame;
+  /* frames filled in since the last flush */
+  u16_t tx_pending;
+#if !NO_SYS
+  /* a callback to flush the TX ring is pending in tcpip_thread */
+  u8_t tx_flush_posted;
+#if PKTIF_RX_BATCH > 1
+  /* frames read but not yet passed to tcpip_thread */
+  struct pktif_rx_batch *batch;
+#endif /* PKTIF_RX_BATCH > 1 */
+#endif /* !NO_SYS */
+};
+
+#if !NO_SYS && (PKTIF_RX_BATCH > 1)
+/* A burst of frames passed to tcpip_thread with one message */
+struct pktif_rx_batch {
+  struct netif *netif;
+  u16_t count;
+  struct pbuf *p[PKTIF_RX_BATCH];
+};
+#endif /* !NO_SYS && (PKTIF_RX_BATCH > 1) */
+
+/* Forward declarations. */
+#if !NO_SYS
+static void pktif_thread(void *arg);
+#endif /* !NO_SYS */
+
+/*-----------------------------------------------------------------------------------*/
+static void
+low_level_init(struct netif *netif)
+{
+  struct pktif *pktif = (struct pktif *)netif->state;
+  const char *ifname = getenv("PKTIF_IFNAME");
+  struct tpacket_req3 req;
+  struct sockaddr_ll sll;
+  struct packet_mreq mreq;
+  struct ifreq ifr;
+  size_t rx_size;
+  int version = TPACKET_V3;
+  int ifindex;
+
+  if (ifname == NULL) {
+    ifname = PKTIF_DEFAULT_IF;
+  }
+
+  /* Obtain MAC address from network interface. */
+
+  /* (We just fake an address...) */
+  netif->hwaddr[0] = 0x02;
+  netif->hwaddr[1] = 0x12;
+  netif->hwaddr[2] = 0x34;
+  netif->hwaddr[3] = 0x56;
+  netif->hwaddr[4] = 0x78;
+  netif->hwaddr[5] = 0xac;
+  netif->hwaddr_len = 6;
+
+  /* device capabilities */
+  netif->flags = NETIF_FLAG_BROADCAST | NETIF_FLAG_ETHARP | NETIF_FLAG_IGMP;
+
+  pktif->fd = socket(AF_PACKET, SOCK_RAW, lwip_htons(ETH_P_ALL));
+  LWIP_DEBUGF(PKTIF_DEBUG, ("pktif_init: fd %d\n", pktif->fd));
+  if (pktif->fd == -1) {
+    perror("pktif_init: socket (CAP_NET_RAW is needed)");
+    exit(1);
+  }
+  ifindex = (int)if_nametoindex(ifname);
+  if (ifindex == 0) {
+    fprintf(stderr, "pktif_init: no interface %s\n", ifname);
+    exit(1);
+  }
+  memset(&ifr, 0, sizeof(ifr));
+  strncpy(ifr.ifr_name, ifname, sizeof(ifr.ifr_name) - 1);
+  if (ioctl(pktif->fd, SIOCGIFMTU, &ifr) == 0) {
+    netif->mtu = (u16_t)LWIP_MIN(ifr.ifr_mtu, 1500);
+  }
+
+  /* the rings, mapped as one */
+  if (setsockopt(pktif->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+    perror("pktif_init: PACKET_VERSION");
+    exit(1);
+  }
+  memset(&req, 0, sizeof(req));
+  req.tp_block_size = PKTIF_RX_BLOCK_SIZE;
+  req.tp_block_nr = PKTIF_RX_BLOCKS;
+  req.tp_frame_size = PKTIF_TX_FRAME_SIZE;
+  req.tp_frame_nr = (PKTIF_RX_BLOCK_SIZE / PKTIF_TX_FRAME_SIZE) * PKTIF_RX_BLOCKS;
+  req.tp_retire_blk_tov = PKTIF_RX_TIMEOUT;
+  if (setsockopt(pktif->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+    perror("pktif_init: PACKET_RX_RING");
+    exit(1);
+  }
+  rx_size = (size_t)PKTIF_RX_BLOCK_SIZE * PKTIF_RX_BLOCKS;
+  memset(&req, 0, sizeof(req));
+  req.tp_block_size = PKTIF_TX_BLOCK_SIZE;
+  req.tp_block_nr = (PKTIF_TX_FRAMES * PKTIF_TX_FRAME_SIZE + PKTIF_TX_BLOCK_SIZE - 1) / PKTIF_TX_BLOCK_SIZE;
+  req.tp_frame_size = PKTIF_TX_FRAME_SIZE;
+  req.tp_frame_nr = PKTIF_TX_FRAMES;
+  if (setsockopt(pktif->fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) < 0) {
+    perror("pktif_init: PACKET_TX_RING");
+    exit(1);
+  }
+  pktif->ring_size = rx_size + (size_t)req.tp_block_size * req.tp_block_nr;
+  pktif->ring = (u8_t *)mmap(NULL, pktif->ring_size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, pktif->fd, 0);
+  if (pktif->ring == MAP_FAILED) {
+    perror("pktif_init: mmap");
+    exit(1);
+  }
+  pktif->tx_ring = pktif->ring + rx_size;
+
+#ifdef PACKET_IGNORE_OUTGOING
+  {
+    /* we don't want to see what the host (or we) send (Linux 4.20) */
+    int one = 1;
+    setsockopt(pktif->fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one));
+  }
+#endif /* PACKET_IGNORE_OUTGOING */
+
+  memset(&sll, 0, sizeof(sll));
+  sll.sll_family = AF_PACKET;
+  sll.sll_protocol = lwip_htons(ETH_P_ALL);
+  sll.sll_ifindex = ifindex;
+  if (bind(pktif->fd, (struct sockaddr *)&sll, sizeof(sll)) < 0) {
+    perror("pktif_init: bind");
+    exit(1);
+  }
+  memset(&mreq, 0, sizeof(mreq));
+  mreq.mr_ifindex = ifindex;
+  mreq.mr_type = PACKET_MR_PROMISC;
+  if (setsockopt(pktif->fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+    perror("pktif_init: PACKET_MR_PROMISC");
+  }
+
+  netif_set_link_up(netif);
+
+#if !NO_SYS
+  sys_thread_new("pktif_thread", pktif_thread, netif, DEFAULT_THREAD_STACKSIZE, DEFAULT_THREAD_PRIO);
+#endif /* !NO_SYS */
+}
+/*-----------------------------------------------------------------------------------*/
+/*
+ * low_level_output():
+ *
+ * Should do the actual transmission of the packet. The packet is
+ * contained in the pbuf that is passed to the function. This pbuf
+ * might be chained.
+ *
+ */
+/*-----------------------------------------------------------------------------------*/
+
+/* Make the kernel send the frames filled into the TX ring */
+static void
+pktif_tx_flush(struct pktif *pktif)
+{
+  if (pktif->tx_pending == 0) {
+    return;
+  }
+  pktif->tx_pending = 0;
+  if ((send(pktif->fd, NULL, 0, MSG_DONTWAIT) == -1) && (errno != EAGAIN) && (errno != ENOBUFS)) {
+    perror("pktif: send");
+  }
+}
+
+#if !NO_SYS
+/* Called in tcpip_thread after the messages that were queued before the first
+   frame of the burst: flush the whole burst */
+static void
+pktif_tx_kick(void *arg)
+{
+  struct netif *netif = (struct netif *)arg;
+  struct pktif *pktif = (struct pktif *)netif->state;
+
+  pktif->tx_flush_posted = 0;
+  pktif_tx_flush(pktif);
+}
+#endif /* !NO_SYS */
+
+static err_t
+low_level_output(struct netif *netif, struct pbuf *p)
+{
+  struct pktif *pktif = (struct pktif *)netif->state;
+  struct tpacket3_hdr *hdr;
+  u16_t len = (u16_t)(p->tot_len - ETH_PAD_SIZE);
+
+  if (len > PKTIF_TX_FRAME_SIZE - PKTIF_TX_DATA) {
+    MIB2_STATS_NETIF_INC(netif, ifoutdiscards);
+    LWIP_DEBUGF(PKTIF_DEBUG, ("pktif: frame of %d bytes too long\n", len));
+    return ERR_BUF;
+  }
+
+  hdr = (struct tpacket3_hdr *)(pktif->tx_ring + (size_t)pktif->tx_frame * PKTIF_TX_FRAME_SIZE);
+  if (__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE) != TP_STATUS_AVAILABLE) {
+    /* ring full: send what is queued and look again */
+    pktif_tx_flush(pktif);
+    if (__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE) != TP_STATUS_AVAILABLE) {
+      MIB2_STATS_NETIF_INC(netif, ifoutdiscards);
+      LWIP_DEBUGF(PKTIF_DEBUG, ("pktif: TX ring full\n"));
+      return ERR_MEM;
+    }
+  }
+
+  /* initiate transfer(); */
+  pbuf_copy_partial(p, (u8_t *)hdr + PKTIF_TX_DATA, len, ETH_PAD_SIZE);
+  hdr->tp_len = len;
+  hdr->tp_snaplen = len;
+  hdr->tp_next_offset = 0;
+  __atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+  pktif->tx_frame = (u16_t)((pktif->tx_frame + 1) % PKTIF_TX_FRAMES);
+  pktif->tx_pending++;
+  MIB2_STATS_NETIF_ADD(netif, ifoutoctets, len);
+
+  /* signal that packet should be sent(); */
+#if !NO_SYS
+  if (!pktif->tx_flush_posted) {
+    pktif->tx_flush_posted = 1;
+    if (tcpip_try_callback(pktif_tx_kick, netif) != ERR_OK) {
+      /* tcpip_thread's mailbox is full: flush right away */
+      pktif_tx_kick(netif);
+    }
+  }
+#endif /* !NO_SYS */
+  return ERR_OK;
+}
+/*-----------------------------------------------------------------------------------*/
+/*
+ * low_level_input():
+ *
+ * Should allocate a pbuf and transfer the bytes of the incoming
+ * packet from the interface into the pbuf.
+ *
+ */
+/*-----------------------------------------------------------------------------------*/
+static struct pbuf *
+low_level_input(struct netif *netif, const struct tpacket3_hdr *hdr)
+{
+  const u8_t *frame = (const u8_t *)hdr + hdr->tp_mac;
+  const struct sockaddr_ll *sll = (const struct sockaddr_ll *)
+    ((const u8_t *)hdr + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+  u16_t len = (u16_t)hdr->tp_snaplen;
+  u16_t tag = 0;
+  struct pbuf *p;
+
+  if (sll->sll_pkttype == PACKET_OUTGOING) {
+    /* sent by the host */
+    return NULL;
+  }
+  if ((hdr->tp_snaplen != hdr->tp_len) || (len < SIZEOF_ETH_HDR - ETH_PAD_SIZE)) {
+    MIB2_STATS_NETIF_INC(netif, ifinerrors);
+    return NULL;
+  }
+  if (hdr->tp_status & TP_STATUS_VLAN_VALID) {
+    /* the kernel took the VLAN tag out, put it back */
+    tag = SIZEOF_VLAN_HDR;
+  }
+
+  /* We allocate a pbuf chain of pbufs from the pool. */
+  p = pbuf_alloc(PBUF_RAW, (u16_t)(ETH_PAD_SIZE + len + tag), PBUF_POOL);
+  if (p == NULL) {
+    MIB2_STATS_NETIF_INC(netif, ifindiscards);
+    LWIP_DEBUGF(NETIF_DEBUG, ("pktif_input: could not allocate pbuf\n"));
+    return NULL;
+  }
+  if (tag) {
+    u8_t vlan[SIZEOF_VLAN_HDR];
+    u16_t tpid = (hdr->tp_status & TP_STATUS_VLAN_TPID_VALID) ? hdr->hv1.tp_vlan_tpid : ETHTYPE_VLAN;
+    vlan[0] = (u8_t)(tpid >> 8);
+    vlan[1] = (u8_t)tpid;
+    vlan[2] = (u8_t)(hdr->hv1.tp_vlan_tci >> 8);
+    vlan[3] = (u8_t)hdr->hv1.tp_vlan_tci;
+    pbuf_take_at(p, frame, 2 * ETH_HWADDR_LEN, ETH_PAD_SIZE);
+    pbuf_take_at(p, vlan, sizeof(vlan), ETH_PAD_SIZE + 2 * ETH_HWADDR_LEN);
+    pbuf_take_at(p, frame + 2 * ETH_HWADDR_LEN, (u16_t)(len - 2 * ETH_HWADDR_LEN),
+                 ETH_PAD_SIZE + 2 * ETH_HWADDR_LEN + SIZEOF_VLAN_HDR);
+  } else {
+    pbuf_take_at(p, frame, len, ETH_PAD_SIZE);
+  }
+  MIB2_STATS_NETIF_ADD(netif, ifinoctets, len + tag);
+  return p;
+}
+
+/*-----------------------------------------------------------------------------------*/
+/*
+ * pktif_input():
+ *
+ * This function should be called when a packet is ready to be read
+ * from the interface. It uses the function low_level_input() that
+ * should handle the actual reception of bytes from the network
+ * interface.
+ *
+ */
+/*-----------------------------------------------------------------------------------*/
+#if !NO_SYS && (PKTIF_RX_BATCH > 1)
+/* Runs in tcpip_thread: pass a burst of frames to the stack */
+static void
+pktif_input_batch(void *arg)
+{
+  struct pktif_rx_batch *batch = (struct pktif_rx_batch *)arg;
+  u16_t i;
+
+  for (i = 0; i < batch->count; i++) {
+    if (ethernet_input(batch->p[i], batch->netif) != ERR_OK) {
+      LWIP_DEBUGF(NETIF_DEBUG, ("pktif_input: netif input error\n"));
+      pbuf_free(batch->p[i]);
+    }
+  }
+  mem_free(batch);
+}
+#endif /* !NO_SYS && (PKTIF_RX_BATCH > 1) */
+
+/* Pass up the frames collected by pktif_input_frame() */
+static void
+pktif_input_flush(struct netif *netif)
+{
+#if !NO_SYS && (PKTIF_RX_BATCH > 1)
+  struct pktif *pktif = (struct pktif *)netif->state;
+  struct pktif_rx_batch *batch = pktif->batch;
+
+  if (batch == NULL) {
+    return;
+  }
+  pktif->batch = NULL;
+  if (tcpip_try_callback(pktif_input_batch, batch) != ERR_OK) {
+    LWIP_DEBUGF(NETIF_DEBUG, ("pktif_input: tcpip mbox full, dropping %d frames\n", batch->count));
+    while (batch->count > 0) {
+      pbuf_free(batch->p[--batch->count]);
+      MIB2_STATS_NETIF_INC(netif, ifindiscards);
+    }
+    mem_free(batch);
+  }
+#else /* !NO_SYS && (PKTIF_RX_BATCH > 1) */
+  LWIP_UNUSED_ARG(netif);
+#endif /* !NO_SYS && (PKTIF_RX_BATCH > 1) */
+}
+
+static void
+pktif_input_frame(struct netif *netif, struct pbuf *p)
+{
+#if !NO_SYS && (PKTIF_RX_BATCH > 1)
+  struct pktif *pktif = (struct pktif *)netif->state;
+
+  if (netif->input == tcpip_input) {
+    /* ethernet_input() is what tcpip_input() would call for this netif,
+       call it for the whole burst from a single tcpip_thread message */
+    if (pktif->batch == NULL) {
+      pktif->batch = (struct pktif_rx_batch *)mem_malloc(sizeof(struct pktif_rx_batch));
+      if (pktif->batch != NULL) {
+        pktif->batch->netif = netif;
+        pktif->batch->count = 0;
+      }
+    }
+    if (pktif->batch != NULL) {
+      pktif->batch->p[pktif->batch->count++] = p;
+      if (pktif->batch->count == PKTIF_RX_BATCH) {
+        pktif_input_flush(netif);
+      }
+      return;
+    }
+  }
+#endif /* !NO_SYS && (PKTIF_RX_BATCH > 1) */
+
+  if (netif->input(p, netif) != ERR_OK) {
+    LWIP_DEBUGF(NETIF_DEBUG, ("pktif_input: netif input error\n"));
+    pbuf_free(p);
+  }
+}
+
+/* Pass up the frames of all blocks the kernel handed over and give the blocks
+   back, returns the number of frames */
+static int
+pktif_input(struct netif *netif)
+{
+  struct pktif *pktif = (struct pktif *)netif->state;
+  struct tpacket_block_desc *bd;
+  const struct tpacket3_hdr *hdr;
+  struct pbuf *p;
+  u32_t i;
+  int count = 0;
+
+  while (1) {
+    bd = (struct tpacket_block_desc *)(pktif->ring + (size_t)pktif->rx_block * PKTIF_RX_BLOCK_SIZE);
+    if (!(__atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)) {
+      break;
+    }
+    hdr = (const struct tpacket3_hdr *)((u8_t *)bd + bd->hdr.bh1.offset_to_first_pkt);
+    for (i = 0; i < bd->hdr.bh1.num_pkts; i++) {
+      p = low_level_input(netif, hdr);
+      if (p != NULL) {
+        pktif_input_frame(netif, p);
+        count++;
+      }
+      hdr = (const struct tpacket3_hdr *)((const u8_t *)hdr + hdr->tp_next_offset);
+    }
+    /* acknowledge that the packets have been read(); */
+    __atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+    pktif->rx_block = (u16_t)((pktif->rx_block + 1) % PKTIF_RX_BLOCKS);
+  }
+  pktif_input_flush(netif);
+
+  if (count == 0) {
+    LWIP_DEBUGF(PKTIF_DEBUG, ("pktif_input: no frames\n"));
+  }
+  return count;
+}
+/*-----------------------------------------------------------------------------------*/
+/*
+ * pktif_init():
+ *
+ * Should be called at the beginning of the program to set up the
+ * network interface. It calls the function low_level_init() to do the
+ * actual setup of the hardware.
+ *
+ */
+/*-----------------------------------------------------------------------------------*/
+err_t
+pktif_init(struct netif *netif)
+{
+  struct pktif *pktif = (struct pktif *)mem_malloc(sizeof(struct pktif));
+
+  if (pktif == NULL) {
+    LWIP_DEBUGF(NETIF_DEBUG, ("pktif_init: out of memory for pktif\n"));
+    return ERR_MEM;
+  }
+  memset(pktif, 0, sizeof(struct pktif));
+  netif->state = pktif;
+  MIB2_INIT_NETIF(netif, snmp_ifType_ethernet_csmacd, 100000000);
+
+  netif->name[0] = IFNAME0;
+  netif->name[1] = IFNAME1;
+#if LWIP_IPV4
+  netif->output = etharp_output;
+#endif /* LWIP_IPV4 */
+#if LWIP_IPV6
+  netif->output_ip6 = ethip6_output;
+#endif /* LWIP_IPV6 */
+  netif->linkoutput = low_level_output;
+  netif->mtu = 1500;
+
+  low_level_init(netif);
+
+  return ERR_OK;
+}
+
+/*-----------------------------------------------------------------------------------*/
+#if NO_SYS
+
+int
+pktif_select(struct netif *netif)
+{
+  struct pktif *pktif = (struct pktif *)netif->state;
+  struct pollfd pfd;
+  u32_t msecs = sys_timeouts_sleeptime();
+  int ret;
+
+  /* frames sent since the last call */
+  pktif_tx_flush(pktif);
+
+  ret = pktif_input(netif);
+  if (ret == 0) {
+    pfd.fd = pktif->fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, (int)LWIP_MIN(msecs, INT_MAX)) > 0) {
+      ret = pktif_input(netif);
+    }
+  }
+  /* replies to what was read */
+  pktif_tx_flush(pktif);
+  return ret;
+}
+
+/* evloop input and flush functions */
+static int
+pktif_evloop_input(void *arg)
+{
+  return pktif_input((struct netif *)arg);
+}
+
+static void
+pktif_evloop_flush(void *arg)
+{
+  struct netif *netif = (struct netif *)arg;
+  struct pktif *pktif = (struct pktif *)netif->state;
+
+  pktif_tx_flush(pktif);
+}
+
+/* Let evloop_run() serve 'netif' instead of pktif_select() */
+err_t
+pktif_evloop_add(struct netif *netif)
+{
+  struct pktif *pktif = (struct pktif *)netif->state;
+
+  return evloop_add(pktif->fd, pktif_evloop_input, pktif_evloop_flush, netif);
+}
+
+#else /* NO_SYS */
+
+static void
+pktif_thread(void *arg)
+{
+  struct netif *netif = (struct netif *)arg;
+  struct pktif *pktif = (struct pktif *)netif->state;
+  struct pollfd pfd;
+
+  while (1) {
+    if (pktif_input(netif) == 0) {
+      /* Wait for a block to be handed over. */
+      pfd.fd = pktif->fd;
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+      if ((poll(&pfd, 1, -1) == -1) && (errno != EINTR)) {
+        perror("pktif_thread: poll");
+      }
+    }
+  }
+}
+
+#endif /* NO_SYS */
+
+#endif /* LWIP_UNIX_LINUX */
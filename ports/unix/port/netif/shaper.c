@@ -0,0 +1,550 @@
+/*
+ * Copyright (c) 2001-2003 Swedish Institute of Computer Science.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+ * SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ *
+ * This file is part of the lwIP TCP/IP stack.
+ *
+ */
+
+/*
+ * shaper: link rate emulation for Unix netifs, see netif/shaper.h.
+ *
+ * Packets are kept (referenced, not copied) in a fixed size ring per queue.
+ * The token bucket counts in micro-bits: every microsecond adds 'rate' of
+ * them, a packet costs (length + overhead) * 8 * 1000000. In the shaper it
+ * goes negative by at most one packet, the shaper thread then sleeps until
+ * it is back at zero (pthread_cond_timedwait() on CLOCK_MONOTONIC, so
+ * release times are not rounded to lwIP's millisecond timeouts). delif
+ * paces its packets with the same bucket (shaper_bucket_*()).
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lwip/opt.h"
+
+#include "lwip/debug.h"
+#include "lwip/def.h"
+#include "lwip/stats.h"
+#include "lwip/pbuf.h"
+#include "lwip/sys.h"
+
+#include "arch/opts.h"
+#include "netif/shaper.h"
+
+#if !NO_SYS
+
+#ifndef SHAPER_DEBUG
+#define SHAPER_DEBUG LWIP_DBG_OFF
+#endif
+
+struct shaper_pkt {
+  struct pbuf *p;
+  u64_t queued_us;
+};
+
+struct shaper_queue {
+  /* ring of config.limit packets */
+  struct shaper_pkt *pkt;
+  u16_t first;
+  u16_t count;
+  /* DRR: bytes this queue may still send in the current round */
+  s32_t deficit;
+};
+
+struct shaper {
+  struct shaper_config config;
+  shaper_output_fn output;
+  struct netif *netif;
+  /* protects everything below */
+  pthread_mutex_t lock;
+  /* signalled when the first packet is queued */
+  pthread_cond_t cond;
+  struct shaper_bucket bucket;
+  /* packets in all queues */
+  u32_t backlog;
+  /* DRR: queue being served */
+  u8_t drr_next;
+  struct shaper_queue queue[SHAPER_MAX_QUEUES];
+  struct shaper_stats stats;
+};
+
+/*-----------------------------------------------------------------------------------*/
+static u64_t
+shaper_now_us(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (u64_t)ts.tv_sec * 1000000 + (u64_t)ts.tv_nsec / 1000;
+}
+
+static void
+shaper_hist_add(u32_t *hist, u64_t us)
+{
+  int i = 0;
+
+  while ((i < SHAPER_HIST_BUCKETS - 1) && (us >= ((u64_t)1 << i))) {
+    i++;
+  }
+  hist[i]++;
+}
+
+/* Spread the class selectors over the queues, higher classes to lower
+   numbered (with SHAPER_PRIO: more important) queues */
+static void
+shaper_default_map(struct shaper_config *config)
+{
+  int dscp;
+
+  for (dscp = 0; dscp < 64; dscp++) {
+    config->dscp_map[dscp] = (u8_t)((7 - (dscp >> 3)) * config->queues / 8);
+  }
+}
+/*-----------------------------------------------------------------------------------*/
+/** Start a bucket full, 'rate' in bits/s (0: no limit), 'burst' in bytes */
+void
+shaper_bucket_init(struct shaper_bucket *bucket, u32_t rate, u32_t burst)
+{
+  bucket->rate = rate;
+  bucket->tokens_max = (s64_t)burst * 8 * 1000000;
+  bucket->tokens = bucket->tokens_max;
+  bucket->last_us = shaper_now_us();
+}
+
+/** Add the tokens earned until 'now' (CLOCK_MONOTONIC in microseconds) and
+ * return the microseconds until the next packet may be sent */
+u64_t
+shaper_bucket_wait(struct shaper_bucket *bucket, u64_t now)
+{
+  u64_t elapsed;
+
+  if (bucket->rate == 0) {
+    return 0;
+  }
+  if (now > bucket->last_us) {
+    elapsed = now - bucket->last_us;
+    bucket->last_us = now;
+    if (elapsed >= (u64_t)(bucket->tokens_max - bucket->tokens) / bucket->rate) {
+      bucket->tokens = bucket->tokens_max;
+    } else {
+      bucket->tokens += (s64_t)(elapsed * bucket->rate);
+    }
+  }
+  if (bucket->tokens >= 0) {
+    return 0;
+  }
+  return ((u64_t)-bucket->tokens + bucket->rate - 1) / bucket->rate;
+}
+
+/** Charge a packet of 'bytes' that is sent now */
+void
+shaper_bucket_take(struct shaper_bucket *bucket, u32_t bytes)
+{
+  if (bucket->rate != 0) {
+    bucket->tokens -= (s64_t)bytes * 8 * 1000000;
+  }
+}
+
+/** Parse a rate in bits/s with an optional k, M or G suffix (1000 based),
+ * returns 0 on success */
+int
+shaper_parse_rate(const char *value, u32_t *rate)
+{
+  double n;
+
+  if ((port_parse_size(value, &n) != 0) || (n > 0xffffffffUL)) {
+    return -1;
+  }
+  *rate = (u32_t)n;
+  return 0;
+}
+/*-----------------------------------------------------------------------------------*/
+/** Set up a configuration with one queue and no rate limit */
+void
+shaper_config_init(struct shaper_config *config)
+{
+  int i;
+
+  memset(config, 0, sizeof(struct shaper_config));
+  config->burst = 1514;
+  config->mode = SHAPER_PRIO;
+  config->queues = 1;
+  config->limit = 64;
+  config->quantum = 1514;
+  for (i = 0; i < SHAPER_MAX_QUEUES; i++) {
+    config->weight[i] = 1;
+  }
+  shaper_default_map(config);
+}
+
+/* Parse "<n>" or "<n>:<m>", returns the number of values or 0 */
+static int
+shaper_parse_pair(const char *value, unsigned long *n, unsigned long *m)
+{
+  char *end;
+
+  *n = strtoul(value, &end, 0);
+  if (end == value) {
+    return 0;
+  }
+  if (*end == ':') {
+    value = end + 1;
+    *m = strtoul(value, &end, 0);
+    if (end == value) {
+      return 0;
+    }
+    return (*end == 0) ? 2 : 0;
+  }
+  return (*end == 0) ? 1 : 0;
+}
+
+/* Take one key=value item of an option string */
+static int
+shaper_config_item(void *arg, const char *key, char *value)
+{
+  struct shaper_config *config = (struct shaper_config *)arg;
+  unsigned long n, m;
+  int values;
+
+  if (value == NULL) {
+    return -1;
+  }
+  if (!strcmp(key, "mode")) {
+    if (!strcmp(value, "prio")) {
+      config->mode = SHAPER_PRIO;
+    } else if (!strcmp(value, "drr")) {
+      config->mode = SHAPER_DRR;
+    } else {
+      return -1;
+    }
+    return 0;
+  }
+  if (!strcmp(key, "drop")) {
+    if (strcmp(value, "tail") && strcmp(value, "head")) {
+      return -1;
+    }
+    config->drop_head = (value[0] == 'h');
+    return 0;
+  }
+  if (!strcmp(key, "rate")) {
+    return shaper_parse_rate(value, &config->rate);
+  }
+
+  values = shaper_parse_pair(value, &n, &m);
+  if (!strcmp(key, "burst") && (values == 1)) {
+    config->burst = (u32_t)n;
+  } else if (!strcmp(key, "overhead") && (values == 1) && (n <= 0xffff)) {
+    config->overhead = (u16_t)n;
+  } else if (!strcmp(key, "offset") && (values == 1) && (n <= 0xffff)) {
+    config->ip_offset = (u16_t)n;
+  } else if (!strcmp(key, "queues") && (values == 1) && (n >= 1) && (n <= SHAPER_MAX_QUEUES)) {
+    config->queues = (u8_t)n;
+    shaper_default_map(config);
+  } else if (!strcmp(key, "limit") && (values == 1) && (n >= 1) && (n <= 0xffff)) {
+    config->limit = (u16_t)n;
+  } else if (!strcmp(key, "quantum") && (values == 1) && (n >= 1) && (n <= 0xffff)) {
+    config->quantum = (u16_t)n;
+  } else if (!strcmp(key, "weight") && (values == 2) && (n < SHAPER_MAX_QUEUES) && (m >= 1) && (m <= 0xff)) {
+    config->weight[n] = (u8_t)m;
+  } else if (!strcmp(key, "dscp") && (values == 2) && (n < 64) && (m < SHAPER_MAX_QUEUES)) {
+    config->dscp_map[n] = (u8_t)m;
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Change 'config' according to a string of comma separated key=value items:
+ *
+ * - rate=<bits/s>, with an optional k, M or G suffix (1000 based)
+ * - burst=<bytes>, overhead=<bytes>, offset=<IP header offset>
+ * - queues=<n> (resets the DSCP map), limit=<packets>, quantum=<bytes>
+ * - mode=prio|drr, drop=tail|head
+ * - weight=<queue>:<weight>, dscp=<dscp>:<queue>
+ *
+ * Returns 0 on success, -1 (leaving 'config' partly changed) on errors.
+ */
+int
+shaper_config_parse(struct shaper_config *config, const char *str)
+{
+  return port_parse_opts("shaper", str, shaper_config_item, config);
+}
+/*-----------------------------------------------------------------------------------*/
+/* Queue a packet is sent on */
+static struct shaper_queue *
+shaper_classify(struct shaper *shaper, struct pbuf *p, u8_t *index)
+{
+  u16_t off = shaper->config.ip_offset;
+  u8_t dscp = 0;
+  u8_t b0, b1;
+
+  if (p->tot_len >= off + 2) {
+    b0 = pbuf_get_at(p, off);
+    b1 = pbuf_get_at(p, (u16_t)(off + 1));
+    if ((b0 >> 4) == 4) {
+      dscp = (u8_t)(b1 >> 2);
+    } else if ((b0 >> 4) == 6) {
+      dscp = (u8_t)(((b0 & 0x0f) << 2) | (b1 >> 6));
+    }
+  }
+  *index = shaper->config.dscp_map[dscp];
+  return &shaper->queue[*index];
+}
+
+/* Length the rate is accounted for */
+static u32_t
+shaper_cost(struct shaper *shaper, struct pbuf *p)
+{
+  return (u32_t)p->tot_len + shaper->config.overhead;
+}
+
+/* Queue the next packet is taken from, NULL if all are empty */
+static struct shaper_queue *
+shaper_select(struct shaper *shaper, u8_t *index)
+{
+  struct shaper_queue *q;
+  u8_t i;
+
+  if (shaper->backlog == 0) {
+    return NULL;
+  }
+  if (shaper->config.mode == SHAPER_PRIO) {
+    for (i = 0; i < shaper->config.queues; i++) {
+      if (shaper->queue[i].count > 0) {
+        *index = i;
+        return &shaper->queue[i];
+      }
+    }
+    return NULL;
+  }
+
+  /* deficit round robin: a queue sends while its deficit covers the head
+     packet, then the next one gets its quantum */
+  while (1) {
+    q = &shaper->queue[shaper->drr_next];
+    if (q->count > 0) {
+      s32_t cost = (s32_t)shaper_cost(shaper, q->pkt[q->first].p);
+      if (q->deficit >= cost) {
+        q->deficit -= cost;
+        *index = shaper->drr_next;
+        return q;
+      }
+    } else {
+      q->deficit = 0;
+    }
+    shaper->drr_next = (u8_t)((shaper->drr_next + 1) % shaper->config.queues);
+    shaper->queue[shaper->drr_next].deficit +=
+      (s32_t)shaper->config.quantum * shaper->config.weight[shaper->drr_next];
+  }
+}
+
+static struct shaper_pkt
+shaper_dequeue(struct shaper *shaper, struct shaper_queue *q, u8_t index)
+{
+  struct shaper_pkt pkt = q->pkt[q->first];
+
+  q->first = (u16_t)((q->first + 1) % shaper->config.limit);
+  q->count--;
+  shaper->backlog--;
+  shaper->stats.queue[index].backlog--;
+  return pkt;
+}
+/*-----------------------------------------------------------------------------------*/
+static void
+shaper_thread(void *arg)
+{
+  struct shaper *shaper = (struct shaper *)arg;
+  struct shaper_queue *q;
+  struct shaper_queue_stats *stats;
+  struct shaper_pkt pkt;
+  struct timespec ts;
+  u64_t now, due, delay;
+  u8_t index;
+
+  pthread_mutex_lock(&shaper->lock);
+  while (1) {
+    if (shaper->backlog == 0) {
+      pthread_cond_wait(&shaper->cond, &shaper->lock);
+      continue;
+    }
+    now = shaper_now_us();
+    delay = shaper_bucket_wait(&shaper->bucket, now);
+    if (delay > 0) {
+      /* sleep until the bucket is back at zero */
+      due = now + delay;
+      ts.tv_sec = (time_t)(due / 1000000);
+      ts.tv_nsec = (long)(due % 1000000) * 1000;
+      pthread_cond_timedwait(&shaper->cond, &shaper->lock, &ts);
+      continue;
+    }
+
+    q = shaper_select(shaper, &index);
+    LWIP_ASSERT("backlog but no packet", q != NULL);
+    pkt = shaper_dequeue(shaper, q, index);
+    shaper_bucket_take(&shaper->bucket, shaper_cost(shaper, pkt.p));
+
+    delay = now - pkt.queued_us;
+    stats = &shaper->stats.queue[index];
+    stats->sent++;
+    stats->bytes += pkt.p->tot_len;
+    stats->delay_sum_us += delay;
+    if (delay > stats->delay_max_us) {
+      stats->delay_max_us = (u32_t)LWIP_MIN(delay, 0xffffffffUL);
+    }
+    shaper_hist_add(stats->delay_us, delay);
+
+    pthread_mutex_unlock(&shaper->lock);
+    LWIP_DEBUGF(SHAPER_DEBUG, ("shaper: queue %d sends %d bytes after %d us\n",
+                               index, pkt.p->tot_len, (int)delay));
+    shaper->output(shaper->netif, pkt.p);
+    pbuf_free(pkt.p);
+    pthread_mutex_lock(&shaper->lock);
+  }
+}
+/*-----------------------------------------------------------------------------------*/
+/**
+ * Create a shaper sending through 'output' (with 'netif' as its first
+ * argument) and start its thread. Returns NULL if out of memory.
+ */
+struct shaper *
+shaper_new(const struct shaper_config *config, shaper_output_fn output, struct netif *netif)
+{
+  struct shaper *shaper;
+  pthread_condattr_t attr;
+  int i;
+
+  LWIP_ASSERT("invalid config", (config->queues >= 1) && (config->queues <= SHAPER_MAX_QUEUES) &&
+              (config->limit >= 1));
+
+  shaper = (struct shaper *)calloc(1, sizeof(struct shaper));
+  if (shaper == NULL) {
+    return NULL;
+  }
+  shaper->config = *config;
+  for (i = 0; i < 64; i++) {
+    if (shaper->config.dscp_map[i] >= config->queues) {
+      shaper->config.dscp_map[i] = (u8_t)(config->queues - 1);
+    }
+  }
+  for (i = 0; i < config->queues; i++) {
+    shaper->queue[i].pkt = (struct shaper_pkt *)calloc(config->limit, sizeof(struct shaper_pkt));
+    if (shaper->queue[i].pkt == NULL) {
+      while (i-- > 0) {
+        free(shaper->queue[i].pkt);
+      }
+      free(shaper);
+      return NULL;
+    }
+  }
+  shaper->queue[0].deficit = (s32_t)config->quantum * config->weight[0];
+  shaper->stats.queues = config->queues;
+  shaper->output = output;
+  shaper->netif = netif;
+  shaper_bucket_init(&shaper->bucket, config->rate, config->burst);
+
+  pthread_mutex_init(&shaper->lock, NULL);
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&shaper->cond, &attr);
+  pthread_condattr_destroy(&attr);
+
+  LWIP_DEBUGF(SHAPER_DEBUG, ("shaper: %u bit/s, burst %u, %d queues (%s) of %d packets\n",
+                             (unsigned)config->rate, (unsigned)config->burst, config->queues,
+                             (config->mode == SHAPER_DRR) ? "drr" : "prio", config->limit));
+  sys_thread_new("shaper_thread", shaper_thread, shaper, DEFAULT_THREAD_STACKSIZE, DEFAULT_THREAD_PRIO);
+  return shaper;
+}
+/*-----------------------------------------------------------------------------------*/
+/**
+ * Queue 'p' for sending (the caller keeps its reference). A packet that does
+ * not fit is dropped like on a congested link: this returns ERR_OK anyway.
+ */
+err_t
+shaper_output(struct shaper *shaper, struct pbuf *p)
+{
+  struct shaper_queue *q;
+  struct shaper_queue_stats *stats;
+  struct pbuf *drop = NULL;
+  u8_t index;
+
+  q = shaper_classify(shaper, p, &index);
+  stats = &shaper->stats.queue[index];
+
+  pthread_mutex_lock(&shaper->lock);
+  if (q->count == shaper->config.limit) {
+    stats->dropped++;
+    LINK_STATS_INC(link.drop);
+    if (!shaper->config.drop_head) {
+      pthread_mutex_unlock(&shaper->lock);
+      LWIP_DEBUGF(SHAPER_DEBUG, ("shaper: queue %d full, drop\n", index));
+      return ERR_OK;
+    }
+    drop = shaper_dequeue(shaper, q, index).p;
+  }
+  pbuf_ref(p);
+  q->pkt[(q->first + q->count) % shaper->config.limit].p = p;
+  q->pkt[(q->first + q->count) % shaper->config.limit].queued_us = shaper_now_us();
+  q->count++;
+  stats->enqueued++;
+  if (++stats->backlog > stats->max_backlog) {
+    stats->max_backlog = stats->backlog;
+  }
+  if (shaper->backlog++ == 0) {
+    pthread_cond_signal(&shaper->cond);
+  }
+  pthread_mutex_unlock(&shaper->lock);
+
+  if (drop != NULL) {
+    LWIP_DEBUGF(SHAPER_DEBUG, ("shaper: queue %d full, drop oldest\n", index));
+    pbuf_free(drop);
+  }
+  return ERR_OK;
+}
+/*-----------------------------------------------------------------------------------*/
+/** Copy the statistics to 'stats', then zero them if 'reset' is set */
+void
+shaper_get_stats(struct shaper *shaper, struct shaper_stats *stats, u8_t reset)
+{
+  int i;
+
+  pthread_mutex_lock(&shaper->lock);
+  *stats = shaper->stats;
+  if (reset) {
+    for (i = 0; i < shaper->config.queues; i++) {
+      u32_t backlog = shaper->stats.queue[i].backlog;
+      memset(&shaper->stats.queue[i], 0, sizeof(struct shaper_queue_stats));
+      shaper->stats.queue[i].backlog = backlog;
+      shaper->stats.queue[i].max_backlog = backlog;
+    }
+  }
+  pthread_mutex_unlock(&shaper->lock);
+}
+
+#endif /* !NO_SYS */
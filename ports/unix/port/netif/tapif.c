@@ -31,6 +31,7 @@
  */
 
 #include <fcntl.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -47,20 +48,30 @@
 #include "lwip/debug.h"
 #include "lwip/def.h"
 #include "lwip/ip.h"
+#include "lwip/inet_chksum.h"
 #include "lwip/mem.h"
 #include "lwip/stats.h"
 #include "lwip/snmp.h"
 #include "lwip/pbuf.h"
 #include "lwip/sys.h"
 #include "lwip/timeouts.h"
+#include "lwip/prot/tcp.h"
 #include "netif/etharp.h"
 #include "lwip/ethip6.h"
+#if !NO_SYS
+#include "lwip/tcpip.h"
+#endif /* !NO_SYS */
 
 #if defined(LWIP_DEBUG) && defined(LWIP_TCPDUMP)
 #include "netif/tcpdump.h"
 #endif /* LWIP_DEBUG && LWIP_TCPDUMP */
 
 #include "netif/tapif.h"
+#include "arch/perf.h"
+#include "arch/trace.h"
+#if NO_SYS
+#include "arch/evloop.h"
+#endif /* NO_SYS */
 
 #define IFCONFIG_BIN "/sbin/ifconfig "
 
@@ -102,18 +113,334 @@
 #define TAPIF_DEBUG LWIP_DBG_OFF
 #endif
 
+/** Biggest frame read from the tap device (a VLAN tagged 1500 byte frame) */
+#ifndef TAPIF_FRAME_SIZE
+#define TAPIF_FRAME_SIZE (1500 + SIZEOF_ETH_HDR - ETH_PAD_SIZE + SIZEOF_VLAN_HDR)
+#endif
+
+/** Maximum number of pbufs of a chain passed to readv()/writev(); longer
+ * TX chains are copied into a contiguous buffer first */
+#ifndef TAPIF_MAX_IOV
+#define TAPIF_MAX_IOV 16
+#endif
+
+/** Maximum number of frames read per wakeup. If netif->input is
+ * tcpip_input, the whole burst is passed to tcpip_thread with a single
+ * message instead of one message per frame. */
+#ifndef TAPIF_RX_BATCH
+#define TAPIF_RX_BATCH 32
+#endif
+
+/** Define TAPIF_TX_BATCH to 1 to write frames from a separate thread: frames
+ * sent during one iteration of tcpip_thread are queued (holding a reference)
+ * and the TX thread is woken once for all of them when tcpip_thread gets to
+ * process the callback posted for the first one. Up to TAPIF_TX_QUEUE frames
+ * are queued; while the queue is full, low_level_output() returns ERR_MEM so
+ * frames are never written out of order. */
+#ifndef TAPIF_TX_BATCH
+#define TAPIF_TX_BATCH 0
+#endif
+#ifndef TAPIF_TX_QUEUE
+#define TAPIF_TX_QUEUE 64
+#endif
+
+#if TAPIF_TX_BATCH && NO_SYS
+#error "TAPIF_TX_BATCH needs NO_SYS=0"
+#endif
+
+/** Maximum number of queues of a multi-queue tap device (IFF_MULTI_QUEUE).
+ * The number of queues opened is set at runtime with the environment variable
+ * TAPIF_QUEUES (default 1). Each queue has its own RX thread, named
+ * "tapif_thread<n>" so it can be pinned to a core with LWIP_THREAD_AFFINITY,
+ * and sent frames are spread over the queues by a hash of their flow. A
+ * preconfigured tap must have been created with "multi_queue". */
+#ifndef TAPIF_MAX_QUEUES
+#ifdef LWIP_UNIX_LINUX
+#define TAPIF_MAX_QUEUES 8
+#else
+#define TAPIF_MAX_QUEUES 1
+#endif
+#endif
+
+/** Define TAPIF_IOURING to 1 to read frames (and, unless TAPIF_TX_BATCH is
+ * used, write them) with io_uring, see netif/iouring.h. Each queue keeps
+ * TAPIF_IOURING_RX_BUFS buffers posted, frames written from tcpip_thread are
+ * submitted together once per iteration of tcpip_thread (with NO_SYS, by the
+ * next tapif_select(), which also waits for the next timeout in the same
+ * system call). If io_uring is not available (or LWIP_IOURING=0 is set in
+ * the environment), read() and writev() are used. */
+#ifndef TAPIF_IOURING
+#ifdef LWIP_UNIX_LINUX
+#define TAPIF_IOURING 1
+#else
+#define TAPIF_IOURING 0
+#endif
+#endif
+#ifndef TAPIF_IOURING_RX_BUFS
+#define TAPIF_IOURING_RX_BUFS 64
+#endif
+#ifndef TAPIF_IOURING_TX_SLOTS
+#define TAPIF_IOURING_TX_SLOTS 64
+#endif
+/** Interval at which tcpip_thread reaps writes that completed after they
+ * were submitted, so their pbufs are freed while the link is idle */
+#ifndef TAPIF_IOURING_REAP_MS
+#define TAPIF_IOURING_REAP_MS 1
+#endif
+
+#if TAPIF_IOURING
+#ifndef LWIP_UNIX_LINUX
+#error "TAPIF_IOURING is only supported on Linux"
+#endif
+#include "netif/iouring.h"
+#endif /* TAPIF_IOURING */
+
+#define TAPIF_GET16(buf, off) ((u16_t)(((buf)[off] << 8) | (buf)[(off) + 1]))
+#define TAPIF_GET32(buf, off) (((u32_t)TAPIF_GET16(buf, off) << 16) | TAPIF_GET16(buf, (off) + 2))
+
+/** Define TAPIF_OFFLOAD to 1 to support exchanging frames with a virtio-net
+ * header (IFF_VNET_HDR) with the kernel, which is enabled at runtime by
+ * setting the environment variable TAPIF_OFFLOAD to 1. The kernel then passes
+ * up TCP frames of up to 64KB (GRO/TSO) with the checksum left to complete,
+ * and, with LWIP_CHECKSUM_CTRL_PER_NETIF, the TCP checksum of sent frames is
+ * left to the kernel. With TAPIF_TX_BATCH, consecutive segments of a TCP
+ * flow written in one burst are merged into a single GSO frame. */
+#ifndef TAPIF_OFFLOAD
+#ifdef LWIP_UNIX_LINUX
+#define TAPIF_OFFLOAD 1
+#else
+#define TAPIF_OFFLOAD 0
+#endif
+#endif
+
+#if TAPIF_OFFLOAD
+#ifndef LWIP_UNIX_LINUX
+#error "TAPIF_OFFLOAD is only supported on Linux"
+#endif
+#include <linux/virtio_net.h>
+
+/** Biggest frame exchanged with the kernel in offload mode */
+#define TAPIF_GSO_FRAME_SIZE 0xffff
+/** Maximum number of TCP segments merged into one GSO frame */
+#ifndef TAPIF_GSO_MAX_SEGS
+#define TAPIF_GSO_MAX_SEGS 44
+#endif
+/** Maximum number of payload iovecs of one GSO frame */
+#define TAPIF_GSO_MAX_IOV (4 * TAPIF_GSO_MAX_SEGS)
+/** Bytes copied from the start of a frame to find the TCP/UDP header:
+ * Ethernet, VLAN tag, IPv4 and TCP headers with options */
+#define TAPIF_HDR_COPY (SIZEOF_ETH_HDR - ETH_PAD_SIZE + SIZEOF_VLAN_HDR + 60 + 60)
+
+#define TAPIF_PUT16(buf, off, val) do { (buf)[off] = (u8_t)((val) >> 8); (buf)[(off) + 1] = (u8_t)(val); } while(0)
+
+/* Headers of a TCP or UDP frame, see tapif_parse(). Offsets are relative to
+   the Ethernet header (i.e. without ETH_PAD_SIZE). */
+struct tapif_l4 {
+  u8_t hdr[TAPIF_HDR_COPY];
+  u16_t l3off;    /* IP header */
+  u16_t l4off;    /* TCP/UDP header */
+  u16_t hdrlen;   /* TCP/UDP payload */
+  u16_t l4len;    /* length of the TCP/UDP header and payload */
+  u8_t proto;
+  u8_t v6;
+};
+#endif /* TAPIF_OFFLOAD */
+
+/* One queue (file descriptor) of the tap device */
+struct tapif_queue {
+  struct netif *netif;
+  int fd;
+  /* PBUF_POOL chain of TAPIF_FRAME_SIZE bytes the next frame is read into */
+  struct pbuf *rx;
+#if TAPIF_OFFLOAD
+  /* receives the part of a GSO frame not fitting into 'rx' */
+  u8_t *rx_overflow;
+#endif /* TAPIF_OFFLOAD */
+#if TAPIF_IOURING
+  /* reads frames if io_uring is available */
+  struct iouring *ring;
+#endif /* TAPIF_IOURING */
+#if !NO_SYS && (TAPIF_RX_BATCH > 1)
+  /* frames read but not yet passed to tcpip_thread */
+  struct tapif_rx_batch *batch;
+#endif /* !NO_SYS && (TAPIF_RX_BATCH > 1) */
+  /* RX part of struct tapif_batch_stats, only written by this queue's thread */
+  u32_t rx_bursts;
+  u32_t rx_frames;
+  u32_t rx_gso;
+#if !NO_SYS
+  char thread_name[16];
+#endif /* !NO_SYS */
+};
+
 struct tapif {
   /* Add whatever per-interface state that is needed here. */
-  int fd;
+  struct tapif_queue queues[TAPIF_MAX_QUEUES];
+  u8_t nqueues;
+  /* TX part of the batch statistics */
+  struct tapif_batch_stats stats;
+#if TAPIF_OFFLOAD
+  /* frames are preceded by a struct virtio_net_hdr */
+  u8_t vnet;
+#endif /* TAPIF_OFFLOAD */
+#if TAPIF_TX_BATCH
+  sys_mutex_t tx_lock;
+  sys_sem_t tx_sem;
+  /* frames waiting for the TX thread, protected by tx_lock */
+  struct pbuf *tx_queue[TAPIF_TX_QUEUE];
+  u16_t tx_count;
+  /* a callback to wake the TX thread is pending in tcpip_thread */
+  u8_t tx_kick_posted;
+#endif /* TAPIF_TX_BATCH */
+#if TAPIF_IOURING
+  /* writes frames if io_uring is available (not with TAPIF_TX_BATCH) */
+  struct iouring *tx_ring;
+#if !NO_SYS
+  /* a callback to submit the queued writes is pending in tcpip_thread */
+  u8_t tx_submit_posted;
+  /* the timeout reaping completed writes is armed */
+  u8_t tx_reap_armed;
+#endif /* !NO_SYS */
+#endif /* TAPIF_IOURING */
+};
+
+#if !NO_SYS && (TAPIF_RX_BATCH > 1)
+/* A burst of frames passed to tcpip_thread with one message */
+struct tapif_rx_batch {
+  struct netif *netif;
+  u16_t count;
+  struct pbuf *p[TAPIF_RX_BATCH];
 };
+#endif /* !NO_SYS && (TAPIF_RX_BATCH > 1) */
 
 /* Forward declarations. */
-static void tapif_input(struct netif *netif);
+static void tapif_input(struct tapif_queue *q);
+#if TAPIF_IOURING
+static void tapif_iouring_input(void *arg, struct pbuf *p, const void *prefix);
+#endif /* TAPIF_IOURING */
 #if !NO_SYS
 static void tapif_thread(void *arg);
 #endif /* !NO_SYS */
+#if TAPIF_TX_BATCH
+static void tapif_tx_thread(void *arg);
+#endif /* TAPIF_TX_BATCH */
 
 /*-----------------------------------------------------------------------------------*/
+/* Open the tap device 'ifname' (or the default one if NULL) for the queue 'q' */
+static void
+tapif_open_queue(struct tapif *tapif, struct tapif_queue *q, const char *ifname)
+{
+  q->fd = open(DEVTAP, O_RDWR);
+  LWIP_DEBUGF(TAPIF_DEBUG, ("tapif_init: fd %d\n", q->fd));
+  if (q->fd == -1) {
+#ifdef LWIP_UNIX_LINUX
+    perror("tapif_init: try running \"modprobe tun\" or rebuilding your kernel with CONFIG_TUN; cannot open "DEVTAP);
+#else /* LWIP_UNIX_LINUX */
+    perror("tapif_init: cannot open "DEVTAP);
+#endif /* LWIP_UNIX_LINUX */
+    exit(1);
+  }
+  /* tapif_input() reads until the device is drained */
+  fcntl(q->fd, F_SETFL, fcntl(q->fd, F_GETFL) | O_NONBLOCK);
+
+#ifdef LWIP_UNIX_LINUX
+  {
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+
+    if (ifname) {
+      strncpy(ifr.ifr_name, ifname, sizeof(ifr.ifr_name));
+    } else {
+      strncpy(ifr.ifr_name, DEVTAP_DEFAULT_IF, sizeof(ifr.ifr_name));
+    }
+    ifr.ifr_name[sizeof(ifr.ifr_name)-1] = 0; /* ensure \0 termination */
+
+    ifr.ifr_flags = IFF_TAP|IFF_NO_PI;
+    if (tapif->nqueues > 1) {
+      ifr.ifr_flags |= IFF_MULTI_QUEUE;
+    }
+#if TAPIF_OFFLOAD
+    if (tapif->vnet) {
+      ifr.ifr_flags |= IFF_VNET_HDR;
+    }
+#endif /* TAPIF_OFFLOAD */
+    if (ioctl(q->fd, TUNSETIFF, (void *) &ifr) < 0) {
+      perror("tapif_init: "DEVTAP" ioctl TUNSETIFF");
+      exit(1);
+    }
+#if TAPIF_OFFLOAD
+    if (tapif->vnet) {
+      int hdrsz = sizeof(struct virtio_net_hdr);
+      /* we take partially checksummed and TSO frames */
+      if ((ioctl(q->fd, TUNSETVNETHDRSZ, &hdrsz) < 0) ||
+          (ioctl(q->fd, TUNSETOFFLOAD, TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6) < 0)) {
+        perror("tapif_init: "DEVTAP" ioctl TUNSETOFFLOAD");
+        exit(1);
+      }
+      q->rx_overflow = (u8_t *)malloc(TAPIF_GSO_FRAME_SIZE);
+      if (q->rx_overflow == NULL) {
+        perror("tapif_init: cannot allocate GSO buffer");
+        exit(1);
+      }
+    }
+#endif /* TAPIF_OFFLOAD */
+  }
+#else /* LWIP_UNIX_LINUX */
+  LWIP_UNUSED_ARG(tapif);
+  LWIP_UNUSED_ARG(ifname);
+#endif /* LWIP_UNIX_LINUX */
+}
+
+#if TAPIF_IOURING
+/* Read (and write) frames with io_uring if possible, a queue whose ring
+   cannot be set up keeps using read() */
+static void
+tapif_iouring_init(struct tapif *tapif)
+{
+  u16_t frame_size = TAPIF_FRAME_SIZE;
+  u16_t prefix_len = 0;
+  int flags;
+  u8_t i;
+
+#if NO_SYS
+  if (tapif->nqueues > 1) {
+    /* tapif_select() waits for a single ring */
+    return;
+  }
+#endif /* NO_SYS */
+#if TAPIF_OFFLOAD
+  if (tapif->vnet) {
+    frame_size = TAPIF_GSO_FRAME_SIZE - ETH_PAD_SIZE;
+    prefix_len = sizeof(struct virtio_net_hdr);
+  }
+#endif /* TAPIF_OFFLOAD */
+
+  for (i = 0; i < tapif->nqueues; i++) {
+    struct tapif_queue *q = &tapif->queues[i];
+    /* with NO_SYS, the ring also writes */
+    q->ring = iouring_new(TAPIF_IOURING_RX_BUFS, NO_SYS ? TAPIF_IOURING_TX_SLOTS : 0);
+    if (q->ring == NULL) {
+      continue;
+    }
+    /* reads must wait in the kernel instead of failing with EAGAIN */
+    flags = fcntl(q->fd, F_GETFL);
+    fcntl(q->fd, F_SETFL, flags & ~O_NONBLOCK);
+    if (iouring_rx_start(q->ring, q->fd, frame_size, prefix_len, ETH_PAD_SIZE,
+                         tapif_iouring_input, q) != ERR_OK) {
+      fcntl(q->fd, F_SETFL, flags);
+      iouring_free(q->ring);
+      q->ring = NULL;
+    }
+  }
+#if NO_SYS
+  tapif->tx_ring = tapif->queues[0].ring;
+#elif !TAPIF_TX_BATCH
+  tapif->tx_ring = iouring_new(0, TAPIF_IOURING_TX_SLOTS);
+#endif /* NO_SYS */
+  LWIP_DEBUGF(TAPIF_DEBUG, ("tapif_init: io_uring %s\n", (tapif->queues[0].ring != NULL) ? "enabled" : "not available"));
+}
+#endif /* TAPIF_IOURING */
+
 static void
 low_level_init(struct netif *netif)
 {
@@ -123,7 +450,8 @@ low_level_init(struct netif *netif)
   char buf[1024];
 #endif /* LWIP_IPV4 */
   char *preconfigured_tapif = getenv("PRECONFIGURED_TAPIF");
-  
+  u8_t i;
+
   tapif = (struct tapif *)netif->state;
 
   /* Obtain MAC address from network interface. */
@@ -140,36 +468,31 @@ low_level_init(struct netif *netif)
   /* device capabilities */
   netif->flags = NETIF_FLAG_BROADCAST | NETIF_FLAG_ETHARP | NETIF_FLAG_IGMP;
 
-  tapif->fd = open(DEVTAP, O_RDWR);
-  LWIP_DEBUGF(TAPIF_DEBUG, ("tapif_init: fd %d\n", tapif->fd));
-  if (tapif->fd == -1) {
-#ifdef LWIP_UNIX_LINUX
-    perror("tapif_init: try running \"modprobe tun\" or rebuilding your kernel with CONFIG_TUN; cannot open "DEVTAP);
-#else /* LWIP_UNIX_LINUX */
-    perror("tapif_init: cannot open "DEVTAP);
-#endif /* LWIP_UNIX_LINUX */
-    exit(1);
+#if TAPIF_MAX_QUEUES > 1
+  {
+    const char *queues = getenv("TAPIF_QUEUES");
+    int n = (queues != NULL) ? atoi(queues) : 1;
+    tapif->nqueues = (u8_t)LWIP_MAX(1, LWIP_MIN(n, TAPIF_MAX_QUEUES));
   }
-
-#ifdef LWIP_UNIX_LINUX
+#else /* TAPIF_MAX_QUEUES > 1 */
+  tapif->nqueues = 1;
+#endif /* TAPIF_MAX_QUEUES > 1 */
+#if TAPIF_OFFLOAD
   {
-    struct ifreq ifr;
-    memset(&ifr, 0, sizeof(ifr));
-
-    if (preconfigured_tapif) {
-      strncpy(ifr.ifr_name, preconfigured_tapif, sizeof(ifr.ifr_name));
-    } else {
-      strncpy(ifr.ifr_name, DEVTAP_DEFAULT_IF, sizeof(ifr.ifr_name));
-    } 
-    ifr.ifr_name[sizeof(ifr.ifr_name)-1] = 0; /* ensure \0 termination */
-
-    ifr.ifr_flags = IFF_TAP|IFF_NO_PI;
-    if (ioctl(tapif->fd, TUNSETIFF, (void *) &ifr) < 0) {
-      perror("tapif_init: "DEVTAP" ioctl TUNSETIFF");
-      exit(1);
+    const char *offload = getenv("TAPIF_OFFLOAD");
+    if ((offload != NULL) && (atoi(offload) != 0)) {
+      tapif->vnet = 1;
+      /* the kernel checksums TCP for us; UDP, ICMP and IP are left to lwIP */
+      NETIF_SET_CHECKSUM_CTRL(netif, NETIF_CHECKSUM_ENABLE_ALL &
+                              ~(NETIF_CHECKSUM_GEN_TCP | NETIF_CHECKSUM_CHECK_TCP));
     }
   }
-#endif /* LWIP_UNIX_LINUX */
+#endif /* TAPIF_OFFLOAD */
+
+  for (i = 0; i < tapif->nqueues; i++) {
+    tapif->queues[i].netif = netif;
+    tapif_open_queue(tapif, &tapif->queues[i], preconfigured_tapif);
+  }
 
   netif_set_link_up(netif);
 
@@ -204,8 +527,30 @@ low_level_init(struct netif *netif)
 #endif /* LWIP_IPV4 */
   }
 
+#if TAPIF_IOURING
+  tapif_iouring_init(tapif);
+#endif /* TAPIF_IOURING */
+
+#if TAPIF_TX_BATCH
+  if ((sys_mutex_new(&tapif->tx_lock) != ERR_OK) ||
+      (sys_sem_new(&tapif->tx_sem, 0) != ERR_OK)) {
+    perror("tapif_init: cannot create TX queue");
+    exit(1);
+  }
+  tapif->tx_count = 0;
+  tapif->tx_kick_posted = 0;
+  sys_thread_new("tapif_tx_thread", tapif_tx_thread, netif, DEFAULT_THREAD_STACKSIZE, DEFAULT_THREAD_PRIO);
+#endif /* TAPIF_TX_BATCH */
 #if !NO_SYS
-  sys_thread_new("tapif_thread", tapif_thread, netif, DEFAULT_THREAD_STACKSIZE, DEFAULT_THREAD_PRIO);
+  for (i = 0; i < tapif->nqueues; i++) {
+    struct tapif_queue *q = &tapif->queues[i];
+    if (tapif->nqueues == 1) {
+      strcpy(q->thread_name, "tapif_thread");
+    } else {
+      snprintf(q->thread_name, sizeof(q->thread_name), "tapif_thread%d", i);
+    }
+    sys_thread_new(q->thread_name, tapif_thread, q, DEFAULT_THREAD_STACKSIZE, DEFAULT_THREAD_PRIO);
+  }
 #endif /* !NO_SYS */
 }
 /*-----------------------------------------------------------------------------------*/
@@ -219,34 +564,648 @@ low_level_init(struct netif *netif)
  */
 /*-----------------------------------------------------------------------------------*/
 
+/* Fill 'iov' with the 'len' bytes at 'offset' of the chain 'p' (skipping
+   empty pbufs), returns the number of entries used or -1 if more than 'max'
+   would be needed */
+static int
+tapif_fill_iov(struct pbuf *p, u16_t offset, u16_t len, struct iovec *iov, int max)
+{
+  int n = 0;
+
+  for (; (p != NULL) && (len > 0); p = p->next) {
+    u16_t chunk;
+    if (offset >= p->len) {
+      offset = (u16_t)(offset - p->len);
+      continue;
+    }
+    if (n == max) {
+      return -1;
+    }
+    chunk = LWIP_MIN(len, (u16_t)(p->len - offset));
+    iov[n].iov_base = (u8_t *)p->payload + offset;
+    iov[n].iov_len = chunk;
+    len = (u16_t)(len - chunk);
+    offset = 0;
+    n++;
+  }
+  return n;
+}
+
+#if TAPIF_OFFLOAD
+/* Find the TCP or UDP header of the (unfragmented) IPv4 or IPv6 frame 'p'.
+   Returns 0 if 'p' is something else. */
+static int
+tapif_parse(const struct pbuf *p, struct tapif_l4 *l4)
+{
+  u16_t len, type, off;
+
+  len = pbuf_copy_partial(p, l4->hdr, sizeof(l4->hdr), ETH_PAD_SIZE);
+  off = SIZEOF_ETH_HDR - ETH_PAD_SIZE;
+  if (len < off + 20) {
+    return 0;
+  }
+  type = TAPIF_GET16(l4->hdr, off - 2);
+  if (type == ETHTYPE_VLAN) {
+    type = TAPIF_GET16(l4->hdr, off + 2);
+    off += SIZEOF_VLAN_HDR;
+  }
+  l4->l3off = off;
+
+  if ((type == ETHTYPE_IP) && ((l4->hdr[off] >> 4) == 4)) {
+    u16_t ihl = (u16_t)((l4->hdr[off] & 0x0f) * 4);
+    u16_t tot = TAPIF_GET16(l4->hdr, off + 2);
+    if ((ihl < 20) || (tot < ihl) || (off + ihl > len) ||
+        ((TAPIF_GET16(l4->hdr, off + 6) & 0x3fff) != 0)) {
+      /* broken header or fragment */
+      return 0;
+    }
+    l4->v6 = 0;
+    l4->proto = l4->hdr[off + 9];
+    l4->l4off = (u16_t)(off + ihl);
+    l4->l4len = (u16_t)(tot - ihl);
+  } else if ((type == ETHTYPE_IPV6) && ((l4->hdr[off] >> 4) == 6) && (off + 40 <= len)) {
+    /* extension headers are not followed */
+    l4->v6 = 1;
+    l4->proto = l4->hdr[off + 6];
+    l4->l4off = (u16_t)(off + 40);
+    l4->l4len = TAPIF_GET16(l4->hdr, off + 4);
+  } else {
+    return 0;
+  }
+  if (ETH_PAD_SIZE + l4->l4off + l4->l4len > p->tot_len) {
+    return 0;
+  }
+
+  if (l4->proto == IP_PROTO_TCP) {
+    u16_t doff;
+    if (l4->l4off + 20 > len) {
+      return 0;
+    }
+    doff = (u16_t)((l4->hdr[l4->l4off + 12] >> 4) * 4);
+    if ((doff < 20) || (doff > l4->l4len) || (l4->l4off + doff > len)) {
+      return 0;
+    }
+    l4->hdrlen = (u16_t)(l4->l4off + doff);
+  } else if ((l4->proto == IP_PROTO_UDP) && (l4->l4len >= 8)) {
+    l4->hdrlen = (u16_t)(l4->l4off + 8);
+  } else {
+    return 0;
+  }
+  return 1;
+}
+
+/* Add the 'len' bytes at 'offset' of the chain 'p' to the checksum
+   accumulator 'acc' (like inet_chksum_pbuf() does for the whole chain) */
+static u32_t
+tapif_chksum_add(const struct pbuf *p, u16_t offset, u16_t len, u32_t acc)
+{
+  int swapped = 0;
+
+  for (; (p != NULL) && (len > 0); p = p->next) {
+    u16_t chunk;
+    if (offset >= p->len) {
+      offset = (u16_t)(offset - p->len);
+      continue;
+    }
+    chunk = LWIP_MIN(len, (u16_t)(p->len - offset));
+    acc += LWIP_CHKSUM((const u8_t *)p->payload + offset, chunk);
+    acc = FOLD_U32T(acc);
+    if (chunk % 2 != 0) {
+      swapped = !swapped;
+      acc = SWAP_BYTES_IN_WORD(acc);
+    }
+    len = (u16_t)(len - chunk);
+    offset = 0;
+  }
+  if (swapped) {
+    acc = SWAP_BYTES_IN_WORD(acc);
+  }
+  return acc;
+}
+
+/* Checksum accumulator of the pseudo header for 'l4len' bytes of TCP/UDP */
+static u32_t
+tapif_pseudo_sum(const struct tapif_l4 *l4, u16_t l4len)
+{
+  u32_t acc;
+
+  if (l4->v6) {
+    acc = LWIP_CHKSUM(&l4->hdr[l4->l3off + 8], 32);
+  } else {
+    acc = LWIP_CHKSUM(&l4->hdr[l4->l3off + 12], 8);
+  }
+  acc += (u32_t)lwip_htons((u16_t)l4->proto);
+  acc += (u32_t)lwip_htons(l4len);
+  return acc;
+}
+
+static u16_t
+tapif_fold(u32_t acc)
+{
+  acc = FOLD_U32T(acc);
+  acc = FOLD_U32T(acc);
+  return (u16_t)acc;
+}
+
+/* Check or complete the checksum of the frame 'p' received with the
+   virtio-net header 'vh', returns 0 if the frame must be dropped */
+static int
+tapif_rx_offload(struct netif *netif, struct pbuf *p, const struct virtio_net_hdr *vh)
+{
+  u16_t sum;
+#if LWIP_CHECKSUM_CTRL_PER_NETIF
+  struct tapif_l4 l4;
+  int valid = tapif_parse(p, &l4);
+#else /* LWIP_CHECKSUM_CTRL_PER_NETIF */
+  LWIP_UNUSED_ARG(netif);
+#endif /* LWIP_CHECKSUM_CTRL_PER_NETIF */
+
+  if (vh->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) {
+    /* the frame never left the host: the checksum field only holds the
+       pseudo header sum */
+    if ((u32_t)ETH_PAD_SIZE + vh->csum_start + vh->csum_offset + 2 > p->tot_len) {
+      return 0;
+    }
+#if LWIP_CHECKSUM_CTRL_PER_NETIF
+    if (valid && (l4.proto == IP_PROTO_TCP) && (vh->csum_start == l4.l4off) &&
+        !(netif->chksum_flags & NETIF_CHECKSUM_CHECK_TCP)) {
+      /* lwIP does not check it */
+      return 1;
+    }
+#endif /* LWIP_CHECKSUM_CTRL_PER_NETIF */
+    sum = (u16_t)~tapif_fold(tapif_chksum_add(p, (u16_t)(ETH_PAD_SIZE + vh->csum_start),
+                                              (u16_t)(p->tot_len - ETH_PAD_SIZE - vh->csum_start), 0));
+    pbuf_take_at(p, &sum, sizeof(sum), (u16_t)(ETH_PAD_SIZE + vh->csum_start + vh->csum_offset));
+    return 1;
+  }
+
+#if LWIP_CHECKSUM_CTRL_PER_NETIF
+  if (valid && (l4.proto == IP_PROTO_TCP) && !(vh->flags & VIRTIO_NET_HDR_F_DATA_VALID) &&
+      !(netif->chksum_flags & NETIF_CHECKSUM_CHECK_TCP)) {
+    /* from the wire and unchecked so far: lwIP won't check it either */
+    sum = tapif_fold(tapif_chksum_add(p, (u16_t)(ETH_PAD_SIZE + l4.l4off), l4.l4len,
+                                      tapif_pseudo_sum(&l4, l4.l4len)));
+    if (sum != 0xffff) {
+      LWIP_DEBUGF(TAPIF_DEBUG, ("tapif_input: TCP checksum error\n"));
+      return 0;
+    }
+  }
+#endif /* LWIP_CHECKSUM_CTRL_PER_NETIF */
+  return 1;
+}
+
+/* Fill in the virtio-net header for sending the frame 'p': with TCP checksum
+   generation disabled for the netif, the kernel completes the checksum */
+static void
+tapif_tx_offload(struct netif *netif, struct pbuf *p, struct virtio_net_hdr *vh)
+{
+  memset(vh, 0, sizeof(*vh));
+  vh->gso_type = VIRTIO_NET_HDR_GSO_NONE;
+#if LWIP_CHECKSUM_CTRL_PER_NETIF
+  if (!(netif->chksum_flags & NETIF_CHECKSUM_GEN_TCP)) {
+    struct tapif_l4 l4;
+    if (tapif_parse(p, &l4) && (l4.proto == IP_PROTO_TCP)) {
+      u16_t sum = tapif_fold(tapif_pseudo_sum(&l4, l4.l4len));
+      pbuf_take_at(p, &sum, sizeof(sum), (u16_t)(ETH_PAD_SIZE + l4.l4off + 16));
+      vh->flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+      vh->csum_start = l4.l4off;
+      vh->csum_offset = 16;
+    }
+  }
+#else /* LWIP_CHECKSUM_CTRL_PER_NETIF */
+  LWIP_UNUSED_ARG(netif);
+  LWIP_UNUSED_ARG(p);
+#endif /* LWIP_CHECKSUM_CTRL_PER_NETIF */
+}
+#endif /* TAPIF_OFFLOAD */
+
+/* Pick the queue to send the frame 'p' on: by a hash of its IP addresses
+   and TCP/UDP ports that is the same for both directions of a flow.
+   Everything else goes to the first queue. */
+static struct tapif_queue *
+tapif_tx_queue(struct tapif *tapif, const struct pbuf *p)
+{
+#if TAPIF_MAX_QUEUES > 1
+  u8_t hdr[SIZEOF_ETH_HDR - ETH_PAD_SIZE + SIZEOF_VLAN_HDR + 60 + 4];
+  u16_t len, off, type, l4off = 0;
+  u32_t hash = 0;
+  u8_t proto = 0;
+  int i;
+
+  if (tapif->nqueues == 1) {
+    return &tapif->queues[0];
+  }
+  len = pbuf_copy_partial(p, hdr, sizeof(hdr), ETH_PAD_SIZE);
+  off = SIZEOF_ETH_HDR - ETH_PAD_SIZE;
+  if (len < off + SIZEOF_VLAN_HDR) {
+    return &tapif->queues[0];
+  }
+  type = TAPIF_GET16(hdr, off - 2);
+  if (type == ETHTYPE_VLAN) {
+    type = TAPIF_GET16(hdr, off + 2);
+    off += SIZEOF_VLAN_HDR;
+  }
+  if ((type == ETHTYPE_IP) && (len >= off + 20)) {
+    /* the sum of source and destination is symmetric */
+    hash = TAPIF_GET32(hdr, off + 12) + TAPIF_GET32(hdr, off + 16);
+    if ((TAPIF_GET16(hdr, off + 6) & 0x3fff) == 0) {
+      /* not a fragment */
+      proto = hdr[off + 9];
+      l4off = (u16_t)(off + (hdr[off] & 0x0f) * 4);
+    }
+  } else if ((type == ETHTYPE_IPV6) && (len >= off + 40)) {
+    for (i = 8; i < 40; i += 4) {
+      hash += TAPIF_GET32(hdr, off + i);
+    }
+    proto = hdr[off + 6];
+    l4off = (u16_t)(off + 40);
+  } else {
+    return &tapif->queues[0];
+  }
+  if (((proto == IP_PROTO_TCP) || (proto == IP_PROTO_UDP)) && (len >= l4off + 4)) {
+    hash += (u32_t)TAPIF_GET16(hdr, l4off) + TAPIF_GET16(hdr, l4off + 2);
+  }
+  hash ^= proto;
+  /* mix the bits (murmur3 finalizer) */
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6bUL;
+  hash ^= hash >> 13;
+  hash *= 0xc2b2ae35UL;
+  hash ^= hash >> 16;
+  return &tapif->queues[hash % tapif->nqueues];
+#else /* TAPIF_MAX_QUEUES > 1 */
+  LWIP_UNUSED_ARG(p);
+  return &tapif->queues[0];
+#endif /* TAPIF_MAX_QUEUES > 1 */
+}
+
+#if TAPIF_IOURING && !NO_SYS
+static void tapif_iouring_reap(void *arg);
+
+/* Submit the queued writes and reap the completed ones; nothing waits for
+   the TX ring, so poll it while writes are in flight */
+static void
+tapif_iouring_flush(struct netif *netif)
+{
+  struct tapif *tapif = (struct tapif *)netif->state;
+
+  iouring_submit(tapif->tx_ring);
+  if (!tapif->tx_reap_armed && (iouring_tx_pending(tapif->tx_ring) > 0)) {
+    tapif->tx_reap_armed = 1;
+    sys_timeout(TAPIF_IOURING_REAP_MS, tapif_iouring_reap, netif);
+  }
+}
+
+static void
+tapif_iouring_reap(void *arg)
+{
+  struct netif *netif = (struct netif *)arg;
+  struct tapif *tapif = (struct tapif *)netif->state;
+
+  tapif->tx_reap_armed = 0;
+  tapif_iouring_flush(netif);
+}
+
+/* Called in tcpip_thread after the messages that were queued before the first
+   frame written with io_uring: submit all frames written since then */
+static void
+tapif_iouring_submit(void *arg)
+{
+  struct netif *netif = (struct netif *)arg;
+  struct tapif *tapif = (struct tapif *)netif->state;
+
+  tapif->tx_submit_posted = 0;
+  tapif_iouring_flush(netif);
+}
+#endif /* TAPIF_IOURING && !NO_SYS */
+
+/* Write one frame to the tap device */
 static err_t
-low_level_output(struct netif *netif, struct pbuf *p)
+tapif_write(struct netif *netif, struct pbuf *p)
 {
   struct tapif *tapif = (struct tapif *)netif->state;
-  char buf[1514];
+  struct iovec iov[1 + TAPIF_MAX_IOV];
   ssize_t written;
+  int iovcnt;
+  int vnet = 0;
+  int fd = tapif_tx_queue(tapif, p)->fd;
+#if TAPIF_OFFLOAD
+  struct virtio_net_hdr vh;
 
-#if 0
-  if (((double)rand()/(double)RAND_MAX) < 0.2) {
-    printf("drop output\n");
-    return ERR_OK;
+  if (tapif->vnet) {
+    tapif_tx_offload(netif, p, &vh);
+    iov[0].iov_base = &vh;
+    iov[0].iov_len = sizeof(vh);
+    vnet = 1;
   }
+#endif /* TAPIF_OFFLOAD */
+
+#if ETH_PAD_SIZE
+  pbuf_remove_header(p, ETH_PAD_SIZE); /* drop the padding word */
 #endif
 
+#if TAPIF_IOURING
+  if ((tapif->tx_ring != NULL) &&
+      (iouring_send(tapif->tx_ring, fd, vnet ? iov[0].iov_base : NULL,
+                    (u16_t)(vnet ? iov[0].iov_len : 0), p) == ERR_OK)) {
+    /* written asynchronously, 'p' is freed when done */
+    MIB2_STATS_NETIF_ADD(netif, ifoutoctets, p->tot_len);
+#if ETH_PAD_SIZE
+    pbuf_add_header(p, ETH_PAD_SIZE); /* reclaim the padding word */
+#endif
+#if !NO_SYS
+    if (!tapif->tx_submit_posted) {
+      tapif->tx_submit_posted = 1;
+      if (tcpip_try_callback(tapif_iouring_submit, netif) != ERR_OK) {
+        tapif_iouring_submit(netif);
+      }
+    }
+#endif /* !NO_SYS */
+    return ERR_OK;
+  }
+  /* no free slot: write it now */
+#endif /* TAPIF_IOURING */
+
   /* initiate transfer(); */
-  pbuf_copy_partial(p, buf, p->tot_len, 0);
+  iovcnt = tapif_fill_iov(p, 0, p->tot_len, &iov[vnet], TAPIF_MAX_IOV);
 
   /* signal that packet should be sent(); */
-  written = write(tapif->fd, buf, p->tot_len);
+  if (iovcnt >= 0) {
+    /* hand the pbuf payloads to the kernel directly */
+    written = writev(fd, iov, vnet + iovcnt);
+  } else {
+    /* too many pbufs in the chain: send a contiguous copy */
+    char buf[TAPIF_FRAME_SIZE];
+    if (p->tot_len > sizeof(buf)) {
+#if ETH_PAD_SIZE
+      pbuf_add_header(p, ETH_PAD_SIZE); /* reclaim the padding word */
+#endif
+      MIB2_STATS_NETIF_INC(netif, ifoutdiscards);
+      LWIP_DEBUGF(TAPIF_DEBUG, ("tapif: frame of %d bytes too long\n", p->tot_len));
+      return ERR_BUF;
+    }
+    pbuf_copy_partial(p, buf, p->tot_len, 0);
+    iov[vnet].iov_base = buf;
+    iov[vnet].iov_len = p->tot_len;
+    written = writev(fd, iov, vnet + 1);
+  }
+
+#if ETH_PAD_SIZE
+  pbuf_add_header(p, ETH_PAD_SIZE); /* reclaim the padding word */
+#endif
+
   if (written == -1) {
     MIB2_STATS_NETIF_INC(netif, ifoutdiscards);
     perror("tapif: write");
   }
   else {
-    MIB2_STATS_NETIF_ADD(netif, ifoutoctets, written);
+    MIB2_STATS_NETIF_ADD(netif, ifoutoctets, written - (vnet ? (ssize_t)iov[0].iov_len : 0));
   }
   return ERR_OK;
 }
+
+#if TAPIF_OFFLOAD && TAPIF_TX_BATCH
+/* Clear the header fields that differ between the segments merged into one
+   GSO frame: IPv4 total length, ID and checksum or IPv6 payload length, TCP
+   sequence number, flags and checksum */
+static void
+tapif_gso_mask(struct tapif_l4 *l4)
+{
+  if (l4->v6) {
+    memset(&l4->hdr[l4->l3off + 4], 0, 2);
+  } else {
+    memset(&l4->hdr[l4->l3off + 2], 0, 4);
+    memset(&l4->hdr[l4->l3off + 10], 0, 2);
+  }
+  memset(&l4->hdr[l4->l4off + 4], 0, 4);
+  l4->hdr[l4->l4off + 13] = 0;
+  memset(&l4->hdr[l4->l4off + 16], 0, 2);
+}
+
+/* Write as many of the 'count' frames at 'burst' as possible as one GSO frame
+   if they are consecutive full-sized segments of one TCP flow, only differing
+   in sequence number and IP ID (and PSH set on the last one). Returns the
+   number of frames written, 0 if nothing was merged. */
+static u16_t
+tapif_write_gso(struct netif *netif, struct pbuf **burst, u16_t count)
+{
+  struct tapif *tapif = (struct tapif *)netif->state;
+  struct tapif_l4 first, next;
+  struct virtio_net_hdr vh;
+  struct iovec iov[2 + TAPIF_GSO_MAX_IOV];
+  u16_t n, l3off, l4off, hdrlen, gso_size, paylen, total, id, sum;
+  u32_t seq;
+  u8_t flags, nflags;
+  int iovcnt, k;
+  ssize_t written;
+
+  if ((count < 2) || !tapif_parse(burst[0], &first) || (first.proto != IP_PROTO_TCP)) {
+    return 0;
+  }
+  l3off = first.l3off;
+  l4off = first.l4off;
+  hdrlen = first.hdrlen;
+  gso_size = (u16_t)(l4off + first.l4len - hdrlen);
+  flags = first.hdr[l4off + 13];
+  if ((gso_size == 0) || (flags != TCP_ACK)) {
+    return 0;
+  }
+  seq = TAPIF_GET32(first.hdr, l4off + 4);
+  id = TAPIF_GET16(first.hdr, l3off + 4);
+  iovcnt = tapif_fill_iov(burst[0], (u16_t)(ETH_PAD_SIZE + hdrlen), gso_size, &iov[2], TAPIF_GSO_MAX_IOV);
+  if (iovcnt < 0) {
+    return 0;
+  }
+  tapif_gso_mask(&first);
+
+  total = gso_size;
+  for (n = 1; (n < count) && (n < TAPIF_GSO_MAX_SEGS); n++) {
+    if (!tapif_parse(burst[n], &next) || (next.proto != IP_PROTO_TCP) ||
+        (next.l4off != l4off) || (next.hdrlen != hdrlen) ||
+        (TAPIF_GET32(next.hdr, l4off + 4) != seq + total)) {
+      break;
+    }
+    paylen = (u16_t)(l4off + next.l4len - hdrlen);
+    nflags = next.hdr[l4off + 13];
+    if ((paylen == 0) || (paylen > gso_size) || ((nflags & ~TCP_PSH) != TCP_ACK) ||
+        ((u32_t)hdrlen + total + paylen > TAPIF_GSO_FRAME_SIZE)) {
+      break;
+    }
+    tapif_gso_mask(&next);
+    if (memcmp(first.hdr, next.hdr, hdrlen) != 0) {
+      break;
+    }
+    k = tapif_fill_iov(burst[n], (u16_t)(ETH_PAD_SIZE + hdrlen), paylen,
+                       &iov[2 + iovcnt], TAPIF_GSO_MAX_IOV - iovcnt);
+    if (k < 0) {
+      break;
+    }
+    iovcnt += k;
+    total = (u16_t)(total + paylen);
+    flags = nflags;
+    if ((paylen < gso_size) || (flags & TCP_PSH)) {
+      /* this ends the run */
+      n++;
+      break;
+    }
+  }
+  if (n < 2) {
+    return 0;
+  }
+
+  /* one header for the whole frame */
+  if (first.v6) {
+    TAPIF_PUT16(first.hdr, l3off + 4, hdrlen - l4off + total);
+  } else {
+    TAPIF_PUT16(first.hdr, l3off + 2, hdrlen - l3off + total);
+    TAPIF_PUT16(first.hdr, l3off + 4, id);
+    sum = (u16_t)~tapif_fold(LWIP_CHKSUM(&first.hdr[l3off], l4off - l3off));
+    memcpy(&first.hdr[l3off + 10], &sum, sizeof(sum));
+  }
+  TAPIF_PUT16(first.hdr, l4off + 4, seq >> 16);
+  TAPIF_PUT16(first.hdr, l4off + 6, seq);
+  first.hdr[l4off + 13] = flags;
+  sum = tapif_fold(tapif_pseudo_sum(&first, (u16_t)(hdrlen - l4off + total)));
+  memcpy(&first.hdr[l4off + 16], &sum, sizeof(sum));
+
+  memset(&vh, 0, sizeof(vh));
+  vh.flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+  vh.gso_type = first.v6 ? VIRTIO_NET_HDR_GSO_TCPV6 : VIRTIO_NET_HDR_GSO_TCPV4;
+  vh.hdr_len = hdrlen;
+  vh.gso_size = gso_size;
+  vh.csum_start = l4off;
+  vh.csum_offset = 16;
+  iov[0].iov_base = &vh;
+  iov[0].iov_len = sizeof(vh);
+  iov[1].iov_base = first.hdr;
+  iov[1].iov_len = hdrlen;
+
+  written = writev(tapif_tx_queue(tapif, burst[0])->fd, iov, 2 + iovcnt);
+  if (written == -1) {
+    MIB2_STATS_NETIF_ADD(netif, ifoutdiscards, n);
+    perror("tapif: write");
+  } else {
+    MIB2_STATS_NETIF_ADD(netif, ifoutoctets, written - (ssize_t)sizeof(vh));
+    tapif->stats.tx_gso++;
+  }
+  LWIP_DEBUGF(TAPIF_DEBUG, ("tapif: %d segments sent as GSO frame of %d bytes\n", n, hdrlen + total));
+  return n;
+}
+#endif /* TAPIF_OFFLOAD && TAPIF_TX_BATCH */
+
+#if TAPIF_TX_BATCH
+/* Called in tcpip_thread after the messages that were queued before the first
+   frame of the burst: hand the burst to the TX thread */
+static void
+tapif_tx_kick(void *arg)
+{
+  struct netif *netif = (struct netif *)arg;
+  struct tapif *tapif = (struct tapif *)netif->state;
+
+  sys_mutex_lock(&tapif->tx_lock);
+  tapif->tx_kick_posted = 0;
+  sys_mutex_unlock(&tapif->tx_lock);
+  sys_sem_signal(&tapif->tx_sem);
+}
+
+static void
+tapif_tx_thread(void *arg)
+{
+  struct netif *netif = (struct netif *)arg;
+  struct tapif *tapif = (struct tapif *)netif->state;
+  struct pbuf *burst[TAPIF_TX_QUEUE];
+  u16_t i, n, count;
+
+  while (1) {
+    sys_arch_sem_wait(&tapif->tx_sem, 0);
+
+    sys_mutex_lock(&tapif->tx_lock);
+    count = tapif->tx_count;
+    memcpy(burst, tapif->tx_queue, count * sizeof(struct pbuf *));
+    tapif->tx_count = 0;
+    sys_mutex_unlock(&tapif->tx_lock);
+
+    if (count > 0) {
+      PERF_START;
+      for (i = 0; i < count; i += n) {
+        n = 0;
+#if TAPIF_OFFLOAD
+        if (tapif->vnet) {
+          n = tapif_write_gso(netif, &burst[i], (u16_t)(count - i));
+        }
+#endif /* TAPIF_OFFLOAD */
+        if (n == 0) {
+          tapif_write(netif, burst[i]);
+          n = 1;
+        }
+      }
+      PERF_STOP("tapif_tx_burst");
+      for (i = 0; i < count; i++) {
+        TRACE_TX_DONE(burst[i]);
+        pbuf_free(burst[i]);
+      }
+      tapif->stats.tx_bursts++;
+      tapif->stats.tx_frames += count;
+    }
+  }
+}
+#endif /* TAPIF_TX_BATCH */
+
+static err_t
+low_level_output(struct netif *netif, struct pbuf *p)
+{
+  struct tapif *tapif = (struct tapif *)netif->state;
+#if TAPIF_TX_BATCH
+  u8_t kick = 0;
+#endif /* TAPIF_TX_BATCH */
+
+#if 0
+  if (((double)rand()/(double)RAND_MAX) < 0.2) {
+    printf("drop output\n");
+    return ERR_OK;
+  }
+#endif
+
+  TRACE_TX(p);
+
+#if TAPIF_TX_BATCH
+  sys_mutex_lock(&tapif->tx_lock);
+  if (tapif->tx_count < TAPIF_TX_QUEUE) {
+    /* the TX thread frees the frame after writing it */
+    pbuf_ref(p);
+    tapif->tx_queue[tapif->tx_count++] = p;
+    if (!tapif->tx_kick_posted) {
+      tapif->tx_kick_posted = 1;
+      kick = 1;
+    }
+    sys_mutex_unlock(&tapif->tx_lock);
+
+    if (kick && (tcpip_try_callback(tapif_tx_kick, netif) != ERR_OK)) {
+      /* tcpip_thread's mailbox is full: wake the TX thread right away */
+      tapif_tx_kick(netif);
+    }
+    return ERR_OK;
+  }
+  sys_mutex_unlock(&tapif->tx_lock);
+  /* queue full: writing it here would pass the queued frames */
+  sys_sem_signal(&tapif->tx_sem);
+  LINK_STATS_INC(link.memerr);
+  TRACE_TX_DONE(p);
+  return ERR_MEM;
+#else /* TAPIF_TX_BATCH */
+
+  tapif->stats.tx_bursts++;
+  tapif->stats.tx_frames++;
+  {
+    err_t err;
+    PERF_START;
+    err = tapif_write(netif, p);
+    PERF_STOP("tapif_write");
+    TRACE_TX_DONE(p);
+    return err;
+  }
+#endif /* TAPIF_TX_BATCH */
+}
 /*-----------------------------------------------------------------------------------*/
 /*
  * low_level_input():
@@ -257,20 +1216,76 @@ low_level_output(struct netif *netif, struct pbuf *p)
  */
 /*-----------------------------------------------------------------------------------*/
 static struct pbuf *
-low_level_input(struct netif *netif)
+low_level_input(struct tapif_queue *q)
 {
+  struct netif *netif = q->netif;
   struct pbuf *p;
-  u16_t len;
-  char buf[1514];
+  ssize_t len, cap;
+  struct iovec iov[2 + TAPIF_MAX_IOV];
+  int iovcnt, i;
+  int vnet = 0;
+#if TAPIF_OFFLOAD
   struct tapif *tapif = (struct tapif *)netif->state;
+  struct virtio_net_hdr vh;
+#endif /* TAPIF_OFFLOAD */
+
+  /* The frame is read straight into the payload of a pbuf chain from the
+     pool, which is then handed to the stack without copying. */
+  if (q->rx == NULL) {
+    q->rx = pbuf_alloc(PBUF_RAW, TAPIF_FRAME_SIZE + ETH_PAD_SIZE, PBUF_POOL);
+  }
+  p = q->rx;
+  if (p == NULL) {
+    char discard;
+    /* drop packet(); a short read discards the rest of the frame */
+    if (read(q->fd, &discard, sizeof(discard)) != -1) {
+      MIB2_STATS_NETIF_INC(netif, ifindiscards);
+    }
+    LWIP_DEBUGF(NETIF_DEBUG, ("tapif_input: could not allocate pbuf\n"));
+    return NULL;
+  }
+
+#if TAPIF_OFFLOAD
+  if (tapif->vnet) {
+    iov[0].iov_base = &vh;
+    iov[0].iov_len = sizeof(vh);
+    vnet = 1;
+  }
+#endif /* TAPIF_OFFLOAD */
+  iovcnt = tapif_fill_iov(p, ETH_PAD_SIZE, (u16_t)(p->tot_len - ETH_PAD_SIZE), &iov[vnet], TAPIF_MAX_IOV);
+  if (iovcnt < 0) {
+    /* more pbufs than TAPIF_MAX_IOV: read what fits */
+    iovcnt = TAPIF_MAX_IOV;
+  }
+  cap = 0;
+  for (i = vnet; i < vnet + iovcnt; i++) {
+    cap += (ssize_t)iov[i].iov_len;
+  }
+  iovcnt += vnet;
+#if TAPIF_OFFLOAD
+  if (tapif->vnet) {
+    /* the rest of a GSO frame goes to the overflow buffer */
+    iov[iovcnt].iov_base = q->rx_overflow;
+    iov[iovcnt].iov_len = (size_t)(TAPIF_GSO_FRAME_SIZE - ETH_PAD_SIZE - cap);
+    iovcnt++;
+  }
+#endif /* TAPIF_OFFLOAD */
 
   /* Obtain the size of the packet and put it into the "len"
      variable. */
-  len = read(tapif->fd, buf, sizeof(buf));
-  if (len == (u16_t)-1) {
+  len = readv(q->fd, iov, iovcnt);
+  if (len == -1) {
+    if ((errno == EINTR) || (errno == EAGAIN)) {
+      return NULL;
+    }
     perror("read returned -1");
     exit(1);
   }
+  len -= vnet ? (ssize_t)iov[0].iov_len : 0;
+  if (len < 0) {
+    MIB2_STATS_NETIF_INC(netif, ifinerrors);
+    return NULL;
+  }
 
   MIB2_STATS_NETIF_ADD(netif, ifinoctets, len);
 
@@ -281,16 +1296,35 @@ low_level_input(struct netif *netif)
   }
 #endif
 
-  /* We allocate a pbuf chain of pbufs from the pool. */
-  p = pbuf_alloc(PBUF_RAW, len, PBUF_POOL);
-  if (p != NULL) {
-    pbuf_take(p, buf, len);
-    /* acknowledge that packet has been read(); */
-  } else {
-    /* drop packet(); */
-    MIB2_STATS_NETIF_INC(netif, ifindiscards);
-    LWIP_DEBUGF(NETIF_DEBUG, ("tapif_input: could not allocate pbuf\n"));
+  /* acknowledge that packet has been read(); trim the chain to the frame,
+     returning the unused pbufs to the pool. */
+  if (len <= cap) {
+    pbuf_realloc(p, (u16_t)(len + ETH_PAD_SIZE));
+  }
+#if TAPIF_OFFLOAD
+  else {
+    /* append the overflow of a GSO frame */
+    struct pbuf *tail = pbuf_alloc(PBUF_RAW, (u16_t)(len - cap), PBUF_POOL);
+    if (tail == NULL) {
+      MIB2_STATS_NETIF_INC(netif, ifindiscards);
+      LWIP_DEBUGF(NETIF_DEBUG, ("tapif_input: could not allocate pbuf\n"));
+      return NULL;
+    }
+    pbuf_take(tail, q->rx_overflow, (u16_t)(len - cap));
+    pbuf_realloc(p, (u16_t)(cap + ETH_PAD_SIZE));
+    pbuf_cat(p, tail);
+    q->rx_gso++;
   }
+#endif /* TAPIF_OFFLOAD */
+  q->rx = NULL;
+
+#if TAPIF_OFFLOAD
+  if (tapif->vnet && !tapif_rx_offload(netif, p, &vh)) {
+    MIB2_STATS_NETIF_INC(netif, ifinerrors);
+    pbuf_free(p);
+    return NULL;
+  }
+#endif /* TAPIF_OFFLOAD */
 
   return p;
 }
@@ -306,24 +1340,149 @@ low_level_input(struct netif *netif)
  *
  */
 /*-----------------------------------------------------------------------------------*/
+#if !NO_SYS && (TAPIF_RX_BATCH > 1)
+/* Runs in tcpip_thread: pass a burst of frames to the stack */
 static void
-tapif_input(struct netif *netif)
+tapif_input_batch(void *arg)
 {
-  struct pbuf *p = low_level_input(netif);
+  struct tapif_rx_batch *batch = (struct tapif_rx_batch *)arg;
+  u16_t i;
 
-  if (p == NULL) {
+  for (i = 0; i < batch->count; i++) {
+    err_t err;
+    TRACE_INPUT(batch->p[i]);
+    PERF_START;
+    err = ethernet_input(batch->p[i], batch->netif);
+    PERF_STOP("tapif_ethernet_input");
+    if (err != ERR_OK) {
+      LWIP_DEBUGF(NETIF_DEBUG, ("tapif_input: netif input error\n"));
+      pbuf_free(batch->p[i]);
+    }
+  }
+  mem_free(batch);
+}
+#endif /* !NO_SYS && (TAPIF_RX_BATCH > 1) */
+
+/* Pass up all frames collected by tapif_rx_frame() */
+static void
+tapif_rx_flush(struct tapif_queue *q)
+{
+#if !NO_SYS && (TAPIF_RX_BATCH > 1)
+  struct tapif_rx_batch *batch = q->batch;
+
+  if (batch == NULL) {
+    return;
+  }
+  q->batch = NULL;
+  if (tcpip_try_callback(tapif_input_batch, batch) != ERR_OK) {
+    LWIP_DEBUGF(NETIF_DEBUG, ("tapif_input: tcpip mbox full, dropping %d frames\n", batch->count));
+    while (batch->count > 0) {
+      pbuf_free(batch->p[--batch->count]);
+      MIB2_STATS_NETIF_INC(batch->netif, ifindiscards);
+    }
+    mem_free(batch);
+  }
+#else /* !NO_SYS && (TAPIF_RX_BATCH > 1) */
+  LWIP_UNUSED_ARG(q);
+#endif /* !NO_SYS && (TAPIF_RX_BATCH > 1) */
+}
+
+/* Pass up one frame read by queue 'q' */
+static void
+tapif_rx_frame(struct tapif_queue *q, struct pbuf *p)
+{
+  struct netif *netif = q->netif;
+
+  TRACE_RX(p);
+  q->rx_frames++;
+#if !NO_SYS && (TAPIF_RX_BATCH > 1)
+  if (netif->input == tcpip_input) {
+    /* ethernet_input() is what tcpip_input() would call for this netif,
+       call it for the whole burst from a single tcpip_thread message */
+    if (q->batch == NULL) {
+      q->batch = (struct tapif_rx_batch *)mem_malloc(sizeof(struct tapif_rx_batch));
+      if (q->batch != NULL) {
+        q->batch->netif = netif;
+        q->batch->count = 0;
+      }
+    }
+    if (q->batch != NULL) {
+      q->batch->p[q->batch->count++] = p;
+      if (q->batch->count == TAPIF_RX_BATCH) {
+        tapif_rx_flush(q);
+      }
+      return;
+    }
+  }
+#endif /* !NO_SYS && (TAPIF_RX_BATCH > 1) */
+
+  if (netif->input(p, netif) != ERR_OK) {
+    LWIP_DEBUGF(NETIF_DEBUG, ("tapif_input: netif input error\n"));
+    pbuf_free(p);
+  }
+}
+
+static void
+tapif_input(struct tapif_queue *q)
+{
+  struct pbuf *p;
+  u16_t count = 0;
+
+  while ((count < TAPIF_RX_BATCH) && ((p = low_level_input(q)) != NULL)) {
+    tapif_rx_frame(q, p);
+    count++;
+  }
+  tapif_rx_flush(q);
+
+  if (count == 0) {
 #if LINK_STATS
     LINK_STATS_INC(link.recv);
 #endif /* LINK_STATS */
     LWIP_DEBUGF(TAPIF_DEBUG, ("tapif_input: low_level_input returned NULL\n"));
     return;
   }
+  q->rx_bursts++;
+}
 
-  if (netif->input(p, netif) != ERR_OK) {
-    LWIP_DEBUGF(NETIF_DEBUG, ("tapif_input: netif input error\n"));
-    pbuf_free(p);
+#if TAPIF_IOURING
+/* Called by iouring_wait() for every frame read by the queue 'arg', and with
+   p == NULL after the last one of a burst */
+static void
+tapif_iouring_input(void *arg, struct pbuf *p, const void *prefix)
+{
+  struct tapif_queue *q = (struct tapif_queue *)arg;
+  struct netif *netif = q->netif;
+#if TAPIF_OFFLOAD
+  struct tapif *tapif = (struct tapif *)netif->state;
+  struct virtio_net_hdr vh;
+#endif /* TAPIF_OFFLOAD */
+
+  if (p == NULL) {
+    tapif_rx_flush(q);
+    q->rx_bursts++;
+    return;
   }
+  MIB2_STATS_NETIF_ADD(netif, ifinoctets, p->tot_len - ETH_PAD_SIZE);
+
+#if TAPIF_OFFLOAD
+  if (tapif->vnet) {
+    memcpy(&vh, prefix, sizeof(vh));
+    if (p->tot_len > TAPIF_FRAME_SIZE + ETH_PAD_SIZE) {
+      q->rx_gso++;
+    }
+    if (!tapif_rx_offload(netif, p, &vh)) {
+      MIB2_STATS_NETIF_INC(netif, ifinerrors);
+      pbuf_free(p);
+      return;
+    }
+  }
+#else /* TAPIF_OFFLOAD */
+  LWIP_UNUSED_ARG(prefix);
+#endif /* TAPIF_OFFLOAD */
+
+  tapif_rx_frame(q, p);
 }
+#endif /* TAPIF_IOURING */
 /*-----------------------------------------------------------------------------------*/
 /*
  * tapif_init():
@@ -343,6 +1502,7 @@ tapif_init(struct netif *netif)
     LWIP_DEBUGF(NETIF_DEBUG, ("tapif_init: out of memory for tapif\n"));
     return ERR_MEM;
   }
+  memset(tapif, 0, sizeof(struct tapif));
   netif->state = tapif;
   MIB2_INIT_NETIF(netif, snmp_ifType_other, 100000000);
 
@@ -362,6 +1522,28 @@ tapif_init(struct netif *netif)
   return ERR_OK;
 }
 
+/*-----------------------------------------------------------------------------------*/
+/*
+ * tapif_get_batch_stats():
+ *
+ * Get the number of frames and bursts read and written so far, the average
+ * batch size is frames / bursts.
+ *
+ */
+/*-----------------------------------------------------------------------------------*/
+void
+tapif_get_batch_stats(struct netif *netif, struct tapif_batch_stats *stats)
+{
+  struct tapif *tapif = (struct tapif *)netif->state;
+  u8_t i;
+
+  *stats = tapif->stats;
+  for (i = 0; i < tapif->nqueues; i++) {
+    stats->rx_bursts += tapif->queues[i].rx_bursts;
+    stats->rx_frames += tapif->queues[i].rx_frames;
+    stats->rx_gso += tapif->queues[i].rx_gso;
+  }
+}
 
 /*-----------------------------------------------------------------------------------*/
 #if NO_SYS
@@ -370,49 +1552,117 @@ int
 tapif_select(struct netif *netif)
 {
   fd_set fdset;
-  int ret;
+  int ret, maxfd = -1;
   struct timeval tv;
   struct tapif *tapif;
   u32_t msecs = sys_timeouts_sleeptime();
+  u8_t i;
 
   tapif = (struct tapif *)netif->state;
 
+#if TAPIF_IOURING
+  if (tapif->queues[0].ring != NULL) {
+    /* SYS_TIMEOUTS_SLEEPTIME_INFINITE is IOURING_WAIT_FOREVER */
+    return iouring_wait(tapif->queues[0].ring, msecs);
+  }
+#endif /* TAPIF_IOURING */
+
   tv.tv_sec = msecs / 1000;
   tv.tv_usec = (msecs % 1000) * 1000;
 
   FD_ZERO(&fdset);
-  FD_SET(tapif->fd, &fdset);
+  for (i = 0; i < tapif->nqueues; i++) {
+    FD_SET(tapif->queues[i].fd, &fdset);
+    maxfd = LWIP_MAX(maxfd, tapif->queues[i].fd);
+  }
 
-  ret = select(tapif->fd + 1, &fdset, NULL, NULL, &tv);
+  ret = select(maxfd + 1, &fdset, NULL, NULL, &tv);
   if (ret > 0) {
-    tapif_input(netif);
+    for (i = 0; i < tapif->nqueues; i++) {
+      if (FD_ISSET(tapif->queues[i].fd, &fdset)) {
+        tapif_input(&tapif->queues[i]);
+      }
+    }
   }
   return ret;
 }
 
+#ifdef LWIP_UNIX_LINUX
+/* evloop input function of a queue read with read() */
+static int
+tapif_evloop_input(void *arg)
+{
+  struct tapif_queue *q = (struct tapif_queue *)arg;
+  u32_t frames = q->rx_frames;
+
+  tapif_input(q);
+  return (int)(q->rx_frames - frames);
+}
+
+#if TAPIF_IOURING
+/* evloop input and flush functions of a queue read with io_uring */
+static int
+tapif_evloop_ring_input(void *arg)
+{
+  return iouring_wait((struct iouring *)arg, 0);
+}
+
+static void
+tapif_evloop_ring_flush(void *arg)
+{
+  iouring_submit((struct iouring *)arg);
+}
+#endif /* TAPIF_IOURING */
+
+/* Let evloop_run() read the queues of 'netif' instead of tapif_select() */
+err_t
+tapif_evloop_add(struct netif *netif)
+{
+  struct tapif *tapif = (struct tapif *)netif->state;
+  err_t err = ERR_OK;
+  u8_t i;
+
+  for (i = 0; (i < tapif->nqueues) && (err == ERR_OK); i++) {
+    struct tapif_queue *q = &tapif->queues[i];
+#if TAPIF_IOURING
+    if (q->ring != NULL) {
+      err = evloop_add(iouring_fd(q->ring), tapif_evloop_ring_input, tapif_evloop_ring_flush, q->ring);
+      continue;
+    }
+#endif /* TAPIF_IOURING */
+    err = evloop_add(q->fd, tapif_evloop_input, NULL, q);
+  }
+  return err;
+}
+#endif /* LWIP_UNIX_LINUX */
+
 #else /* NO_SYS */
 
 static void
 tapif_thread(void *arg)
 {
-  struct netif *netif;
-  struct tapif *tapif;
+  struct tapif_queue *q;
   fd_set fdset;
   int ret;
 
-  netif = (struct netif *)arg;
-  tapif = (struct tapif *)netif->state;
+  q = (struct tapif_queue *)arg;
+
+#if TAPIF_IOURING
+  while (q->ring != NULL) {
+    iouring_wait(q->ring, IOURING_WAIT_FOREVER);
+  }
+#endif /* TAPIF_IOURING */
 
   while(1) {
     FD_ZERO(&fdset);
-    FD_SET(tapif->fd, &fdset);
+    FD_SET(q->fd, &fdset);
 
     /* Wait for a packet to arrive. */
-    ret = select(tapif->fd + 1, &fdset, NULL, NULL, NULL);
+    ret = select(q->fd + 1, &fdset, NULL, NULL, NULL);
 
     if(ret == 1) {
       /* Handle incoming packet. */
-      tapif_input(netif);
+      tapif_input(q);
     } else if(ret == -1) {
       perror("tapif_thread: select");
     }
@@ -30,187 +30,1120 @@
  *
  */
 
-#include <stdio.h>
+/*
+ * Packet capture into pcapng files (readable by wireshark, tcpdump -r etc.).
+ *
+ * tcpdump_packet() copies the packet (up to the snap length) with a
+ * timestamp into a record ring owned by the calling thread, so capturing
+ * takes no lock and no system call. A background thread drains the rings
+ * every TCPDUMP_FLUSH_MS and writes one enhanced packet block per record.
+ * Records that do not fit into the ring of their thread are counted as
+ * dropped instead of blocking the caller.
+ *
+ * Configured with TCPDUMP in the environment, e.g.
+ * "file=/tmp/lwip.pcapng,snaplen=128,rotate=10M,files=4" (rotate starts a
+ * new file path.1, path.2, ... after that many bytes, files=n reuses the
+ * first n names), "off" initializes the writer with capturing disabled.
+ * TCPDUMP_FILTER holds a filter expression in the style of tcpdump:
+ * "tcp port 80 and not host 10.0.0.1", "udp or icmp6", "src net fe80::/10",
+ * "arp or (ip and not dst port 53)".
+ */
 
 #include "lwip/opt.h"
 
-#if (LWIP_IPV4 || LWIP_IPV6) && LWIP_TCP /* @todo: fix IPv6 */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
 
-#include <string.h> /* memcpy */
 #include "netif/tcpdump.h"
 #include "lwip/pbuf.h"
 #include "lwip/netif.h"
-#include "lwip/ip.h"
-#include "lwip/ip4.h"
-#include "lwip/ip6.h"
 #include "lwip/ip_addr.h"
-#include "lwip/priv/tcp_priv.h"
-#include "lwip/udp.h"
-#include "lwip/inet.h"
-#include "lwip/inet_chksum.h"
+#include "lwip/def.h"
+
+#include "arch/opts.h"
 
 #ifndef TCPDUMP_DEBUG
 #define TCPDUMP_DEBUG LWIP_DBG_OFF
 #endif
 
-static FILE *file = NULL;
+/** File written when TCPDUMP does not name one */
+#ifndef TCPDUMP_FNAME
+#define TCPDUMP_FNAME "/tmp/tcpdump.pcapng"
+#endif
+
+/** Bytes of the record ring of each capturing thread (power of 2) */
+#ifndef TCPDUMP_RING_SIZE
+#define TCPDUMP_RING_SIZE (1024 * 1024)
+#endif
+
+/** Interval in which the background thread writes the records (ms) */
+#ifndef TCPDUMP_FLUSH_MS
+#define TCPDUMP_FLUSH_MS 10
+#endif
+
+/** Default number of bytes captured per packet */
+#ifndef TCPDUMP_SNAPLEN
+#define TCPDUMP_SNAPLEN 65535
+#endif
+
+/** Netifs that packets can be captured on */
+#ifndef TCPDUMP_MAX_IFS
+#define TCPDUMP_MAX_IFS 16
+#endif
+
+/** Nodes (primitives and operators) of a compiled filter */
+#ifndef TCPDUMP_FILTER_NODES
+#define TCPDUMP_FILTER_NODES 64
+#endif
+
+#ifndef TCPDUMP_CACHELINE
+#define TCPDUMP_CACHELINE 64
+#endif
+
+#if TCPDUMP_RING_SIZE & (TCPDUMP_RING_SIZE - 1)
+#error "TCPDUMP_RING_SIZE must be a power of 2"
+#endif
+
+/* Bytes of a packet the filter looks at */
+#define TCPDUMP_FILTER_BYTES 128
+
+#define TCPDUMP_LINKTYPE_ETHERNET 1
+#define TCPDUMP_LINKTYPE_RAW      101
+
+#define TCPDUMP_BT_SHB  0x0A0D0D0AUL
+#define TCPDUMP_BT_IDB  0x00000001UL
+#define TCPDUMP_BT_EPB  0x00000006UL
+#define TCPDUMP_BOM     0x1A2B3C4DUL
+
+struct tcpdump_if {
+  struct netif *netif;
+  u16_t linktype;
+  char name[8];
+  /* the functions replaced by tcpdump_attach() */
+  netif_input_fn input;
+  netif_linkoutput_fn linkoutput;
+#if LWIP_IPV4
+  netif_output_fn output;
+#endif
+#if LWIP_IPV6
+  netif_output_ip6_fn output_ip6;
+#endif
+};
+
+/* Header of a record in a thread's ring, followed by the packet data. A
+   record of size 0 marks the unused rest of the ring before it wraps. */
+struct tcpdump_rec {
+  u32_t size;
+  u16_t ifid;
+  u8_t dir;
+  u8_t pad;
+  u32_t caplen;
+  u32_t origlen;
+  u64_t ts_us;
+};
+
+/* Single producer (the thread that owns it), single consumer (the writer) */
+struct tcpdump_ring {
+  u32_t head;
+  u8_t pad0[TCPDUMP_CACHELINE - sizeof(u32_t)];
+  u32_t tail;
+  u8_t pad1[TCPDUMP_CACHELINE - sizeof(u32_t)];
+  struct tcpdump_ring *next;
+  u8_t data[TCPDUMP_RING_SIZE];
+};
+
+#define TCPDUMP_SRC 1
+#define TCPDUMP_DST 2
+
+#define TCPDUMP_L3_ARP 1
+#define TCPDUMP_L3_IP4 4
+#define TCPDUMP_L3_IP6 6
+
+enum tcpdump_op {
+  TCPDUMP_F_L3,     /* ip, ip6, arp */
+  TCPDUMP_F_L4,     /* tcp, udp, icmp, icmp6, sctp */
+  TCPDUMP_F_NET,    /* host, net */
+  TCPDUMP_F_PORT,
+  TCPDUMP_F_NOT,
+  TCPDUMP_F_AND,
+  TCPDUMP_F_OR
+};
+
+struct tcpdump_node {
+  u8_t op;
+  u8_t dir;         /* TCPDUMP_SRC and/or TCPDUMP_DST */
+  u8_t proto;       /* F_L3, F_L4 */
+  u8_t alen;        /* F_NET: 4 or 16 */
+  u8_t prefix;      /* F_NET: bits */
+  u8_t a, b;        /* operands of F_NOT, F_AND, F_OR */
+  u16_t port;
+  u8_t addr[16];
+};
+
+struct tcpdump_filter {
+  int root;
+  int nodes;
+  struct tcpdump_node node[TCPDUMP_FILTER_NODES];
+};
+
+/* What the filter needs to know about a packet */
+struct tcpdump_pkt {
+  u8_t l3;
+  u8_t l4;
+  u8_t alen;
+  u8_t ports;
+  u16_t sport, dport;
+  const u8_t *src, *dst;
+};
+
+struct tcpdump_parser {
+  const char *s;
+  char tok[64];
+  struct tcpdump_filter *f;
+};
+
+static u8_t tcpdump_initialized;
+static u8_t tcpdump_enabled;
+static u32_t tcpdump_snaplen = TCPDUMP_SNAPLEN;
+static struct tcpdump_filter *tcpdump_filter;
+
+/* Registration of netifs and rings */
+static pthread_mutex_t tcpdump_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct tcpdump_if tcpdump_ifs[TCPDUMP_MAX_IFS];
+static int tcpdump_num_ifs;
+static struct tcpdump_ring *tcpdump_rings;
+static __thread struct tcpdump_ring *tcpdump_my_ring;
+static pthread_once_t tcpdump_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t tcpdump_key;
+
+/* Owned by the writer (tcpdump_write_mutex) */
+static pthread_mutex_t tcpdump_write_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t tcpdump_wake_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t tcpdump_wake = PTHREAD_COND_INITIALIZER;
+static FILE *tcpdump_file;
+static char tcpdump_fname[256] = TCPDUMP_FNAME;
+static u64_t tcpdump_rotate;
+static u32_t tcpdump_max_files;
+static u32_t tcpdump_file_index;
+static u64_t tcpdump_file_bytes;
+static int tcpdump_file_ifid[TCPDUMP_MAX_IFS];
+static u32_t tcpdump_file_ifs;
+static struct tcpdump_stats tcpdump_stats;
 
 /*-----------------------------------------------------------------------------------*/
-void
-tcpdump_init(void)
+/* Find the index of a netif, registering it on first use */
+static int
+tcpdump_if_lookup(struct netif *netif)
 {
-#define TCPDUMP_FNAME "/tmp/tcpdump"
-  file = fopen(TCPDUMP_FNAME, "w");
-  if (file == NULL) {
-    perror("tcpdump_init: cannot open \""TCPDUMP_FNAME"\" for writing");
+  int i, n;
+  struct tcpdump_if *ifc;
+
+  n = __atomic_load_n(&tcpdump_num_ifs, __ATOMIC_ACQUIRE);
+  for (i = 0; i < n; i++) {
+    if (tcpdump_ifs[i].netif == netif) {
+      return i;
+    }
+  }
+
+  pthread_mutex_lock(&tcpdump_mutex);
+  n = tcpdump_num_ifs;
+  for (; i < n; i++) {
+    if (tcpdump_ifs[i].netif == netif) {
+      break;
+    }
+  }
+  if ((i == n) && (n < TCPDUMP_MAX_IFS)) {
+    ifc = &tcpdump_ifs[n];
+    memset(ifc, 0, sizeof(*ifc));
+    ifc->netif = netif;
+    ifc->linktype = (netif->flags & (NETIF_FLAG_ETHARP | NETIF_FLAG_ETHERNET)) ?
+                    TCPDUMP_LINKTYPE_ETHERNET : TCPDUMP_LINKTYPE_RAW;
+    snprintf(ifc->name, sizeof(ifc->name), "%c%c%u", netif->name[0], netif->name[1], netif->num);
+    __atomic_store_n(&tcpdump_num_ifs, n + 1, __ATOMIC_RELEASE);
+    LWIP_DEBUGF(TCPDUMP_DEBUG, ("tcpdump: interface %d is %s\n", i, ifc->name));
+  } else if (i == n) {
+    i = -1;
   }
-  LWIP_DEBUGF(TCPDUMP_DEBUG, ("tcpdump: file %s\n", TCPDUMP_FNAME));
+  pthread_mutex_unlock(&tcpdump_mutex);
+  return i;
 }
 /*-----------------------------------------------------------------------------------*/
-void
-tcpdump(struct pbuf *p, struct netif* netif)
+static void tcpdump_drain(struct tcpdump_ring *ring);
+
+/* Write the records of an exiting thread and free its ring. The writer
+   walks the rings holding tcpdump_write_mutex, so it is safe to unlink
+   one while holding it. */
+static void
+tcpdump_thread_exit(void *arg)
 {
-#if LWIP_IPV4
-  ip_addr_t src, dst;
-  struct ip_hdr *iphdr;
-#if LWIP_UDP
-  struct udp_hdr *udphdr;
-#endif
-#if LWIP_TCP
-  struct tcp_hdr *tcphdr;
-  char flags[5];
-  int i;
-  int len;
-  int offset;
-#endif
+  struct tcpdump_ring *ring = (struct tcpdump_ring *)arg;
+  struct tcpdump_ring **p;
 
-  LWIP_UNUSED_ARG(netif); /* in case IPv6 is disabled */
-  
-  if (file == NULL) {
-    return;
+  pthread_mutex_lock(&tcpdump_write_mutex);
+  tcpdump_drain(ring);
+  pthread_mutex_lock(&tcpdump_mutex);
+  for (p = &tcpdump_rings; *p != NULL; p = &(*p)->next) {
+    if (*p == ring) {
+      __atomic_store_n(p, ring->next, __ATOMIC_RELEASE);
+      break;
+    }
   }
-  iphdr = (struct ip_hdr *)p->payload;
-  
-#if LWIP_IPV6
-  if(IPH_V(iphdr) == 6) {
-    struct ip6_hdr *ip6hdr = (struct ip6_hdr*)iphdr;
+  pthread_mutex_unlock(&tcpdump_mutex);
+  pthread_mutex_unlock(&tcpdump_write_mutex);
+  tcpdump_my_ring = NULL;
+  free(ring);
+}
 
-    /* create aligned copies if IPv6 src/dest addr */    
-    ip6_addr_copy_from_packed(*ip_2_ip6(&src), ip6hdr->src);
-    ip6_addr_assign_zone(ip_2_ip6(&src), IP6_UNKNOWN, netif);
-    IP_SET_TYPE_VAL(src, IPADDR_TYPE_V6);
+static void
+tcpdump_key_init(void)
+{
+  pthread_key_create(&tcpdump_key, tcpdump_thread_exit);
+}
+
+/* The ring of the calling thread, created on first use */
+static struct tcpdump_ring *
+tcpdump_thread_ring(void)
+{
+  struct tcpdump_ring *ring = tcpdump_my_ring;
 
-    ip6_addr_copy_from_packed(*ip_2_ip6(&dst), ip6hdr->dest);
-    ip6_addr_assign_zone(ip_2_ip6(&dst), IP6_UNKNOWN, netif);
-    IP_SET_TYPE_VAL(dst, IPADDR_TYPE_V6);
-
-    fprintf(file, "%s > %s: (IPv6, unsupported) ",
-            ip_ntoa(&src),
-            ip_ntoa(&dst));
-    return; /* not supported */
+  if (ring == NULL) {
+    ring = (struct tcpdump_ring *)calloc(1, sizeof(struct tcpdump_ring));
+    if (ring == NULL) {
+      return NULL;
+    }
+    pthread_once(&tcpdump_key_once, tcpdump_key_init);
+    pthread_setspecific(tcpdump_key, ring);
+    pthread_mutex_lock(&tcpdump_mutex);
+    ring->next = tcpdump_rings;
+    __atomic_store_n(&tcpdump_rings, ring, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&tcpdump_mutex);
+    tcpdump_my_ring = ring;
   }
-#endif
+  return ring;
+}
+/*-----------------------------------------------------------------------------------*/
+/* Filter */
+/*-----------------------------------------------------------------------------------*/
+static void
+tcpdump_parse_pkt(struct tcpdump_pkt *pkt, const u8_t *d, u32_t len, u16_t linktype)
+{
+  u32_t off = 0, l4 = 0;
+  u16_t type = 0;
+  u8_t next = 0, ports = 0;
+  int ext;
+
+  memset(pkt, 0, sizeof(*pkt));
+  if (linktype == TCPDUMP_LINKTYPE_ETHERNET) {
+    if (len < 14) {
+      return;
+    }
+    type = (u16_t)((d[12] << 8) | d[13]);
+    off = 14;
+    if ((type == 0x8100) && (len >= 18)) {
+      type = (u16_t)((d[16] << 8) | d[17]);
+      off = 18;
+    }
+  } else if (len > 0) {
+    type = ((d[0] >> 4) == 6) ? 0x86dd : 0x0800;
+  }
+
+  switch (type) {
+    case 0x0806:
+      if (len >= off + 28) {
+        pkt->l3 = TCPDUMP_L3_ARP;
+        pkt->alen = 4;
+        pkt->src = d + off + 14;
+        pkt->dst = d + off + 24;
+      }
+      return;
+    case 0x0800:
+      if ((len < off + 20) || ((d[off] >> 4) != 4)) {
+        return;
+      }
+      pkt->l3 = TCPDUMP_L3_IP4;
+      pkt->alen = 4;
+      pkt->src = d + off + 12;
+      pkt->dst = d + off + 16;
+      next = d[off + 9];
+      l4 = off + (u32_t)(d[off] & 0x0f) * 4;
+      /* only the first fragment has the ports */
+      ports = (((d[off + 6] & 0x1f) | d[off + 7]) == 0);
+      break;
+    case 0x86dd:
+      if ((len < off + 40) || ((d[off] >> 4) != 6)) {
+        return;
+      }
+      pkt->l3 = TCPDUMP_L3_IP6;
+      pkt->alen = 16;
+      pkt->src = d + off + 8;
+      pkt->dst = d + off + 24;
+      next = d[off + 6];
+      l4 = off + 40;
+      ports = 1;
+      /* skip hop-by-hop, routing, fragment and destination options headers */
+      for (ext = 0; ext < 4; ext++) {
+        if ((next != 0) && (next != 43) && (next != 44) && (next != 60)) {
+          break;
+        }
+        if (len < l4 + 8) {
+          return;
+        }
+        if (next == 44) {
+          ports = ((d[l4 + 2] | (d[l4 + 3] & 0xf8)) == 0);
+          next = d[l4];
+          l4 += 8;
+        } else {
+          next = d[l4];
+          l4 += 8 + (u32_t)d[l4 + 1] * 8;
+        }
+      }
+      break;
+    default:
+      return;
+  }
+
+  pkt->l4 = next;
+  if (ports && ((next == 6) || (next == 17) || (next == 132)) && (len >= l4 + 4)) {
+    pkt->ports = 1;
+    pkt->sport = (u16_t)((d[l4] << 8) | d[l4 + 1]);
+    pkt->dport = (u16_t)((d[l4 + 2] << 8) | d[l4 + 3]);
+  }
+}
+/*-----------------------------------------------------------------------------------*/
+static int
+tcpdump_net_match(const struct tcpdump_node *n, const u8_t *addr)
+{
+  u8_t bytes = n->prefix / 8, bits = n->prefix % 8;
 
-  if(IPH_V(iphdr) == 4) {
-    ip_addr_copy_from_ip4(src, iphdr->src);
-    ip_addr_copy_from_ip4(dst, iphdr->dest);
+  if (memcmp(addr, n->addr, bytes) != 0) {
+    return 0;
   }
-  
-  switch (IPH_PROTO(iphdr)) {
-#if LWIP_TCP
-  case IP_PROTO_TCP:
-    tcphdr = (struct tcp_hdr *)((char *)iphdr + IPH_HL(iphdr));
+  return (bits == 0) || (((addr[bytes] ^ n->addr[bytes]) & (0xff << (8 - bits))) == 0);
+}
+/*-----------------------------------------------------------------------------------*/
+static int
+tcpdump_match(const struct tcpdump_filter *f, int i, const struct tcpdump_pkt *pkt)
+{
+  const struct tcpdump_node *n = &f->node[i];
 
-    pbuf_header(p, -IP_HLEN);
-    if (ip_chksum_pseudo(p, IP_PROTO_TCP, p->tot_len, &src, &dst) != 0) {
-      LWIP_DEBUGF(TCPDUMP_DEBUG, ("tcpdump: IP checksum failed!\n"));
-      /*
-      fprintf(file, "chksum 0x%lx ", tcphdr->chksum);
-      tcphdr->chksum = 0;
-      fprintf(file, "should be 0x%lx ", inet_chksum_pseudo(p, (ip_addr_t *)&(iphdr->src),
-              (ip_addr_t *)&(iphdr->dest), IP_PROTO_TCP, p->tot_len));*/
-      fprintf(file, "!chksum ");
+  switch (n->op) {
+    case TCPDUMP_F_L3:
+      return pkt->l3 == n->proto;
+    case TCPDUMP_F_L4:
+      return ((pkt->l3 == TCPDUMP_L3_IP4) || (pkt->l3 == TCPDUMP_L3_IP6)) && (pkt->l4 == n->proto);
+    case TCPDUMP_F_NET:
+      if (pkt->alen != n->alen) {
+        return 0;
+      }
+      return ((n->dir & TCPDUMP_SRC) && tcpdump_net_match(n, pkt->src)) ||
+             ((n->dir & TCPDUMP_DST) && tcpdump_net_match(n, pkt->dst));
+    case TCPDUMP_F_PORT:
+      return pkt->ports &&
+             (((n->dir & TCPDUMP_SRC) && (pkt->sport == n->port)) ||
+              ((n->dir & TCPDUMP_DST) && (pkt->dport == n->port)));
+    case TCPDUMP_F_NOT:
+      return !tcpdump_match(f, n->a, pkt);
+    case TCPDUMP_F_AND:
+      return tcpdump_match(f, n->a, pkt) && tcpdump_match(f, n->b, pkt);
+    case TCPDUMP_F_OR:
+      return tcpdump_match(f, n->a, pkt) || tcpdump_match(f, n->b, pkt);
+    default:
+      return 0;
+  }
+}
+/*-----------------------------------------------------------------------------------*/
+/* Read the next token into ps->tok ("" at the end of the expression) */
+static void
+tcpdump_advance(struct tcpdump_parser *ps)
+{
+  const char *s = ps->s;
+  size_t len = 0;
+
+  while (*s == ' ' || *s == '\t') {
+    s++;
+  }
+  if ((*s == '(') || (*s == ')') || (*s == '!')) {
+    len = 1;
+  } else if (((s[0] == '&') && (s[1] == '&')) || ((s[0] == '|') && (s[1] == '|'))) {
+    len = 2;
+  } else {
+    while (s[len] && !strchr(" \t()!&|", s[len])) {
+      len++;
     }
+  }
+  if (len >= sizeof(ps->tok)) {
+    len = sizeof(ps->tok) - 1;
+  }
+  memcpy(ps->tok, s, len);
+  ps->tok[len] = 0;
+  ps->s = s + len;
+}
+/*-----------------------------------------------------------------------------------*/
+static int
+tcpdump_is(const struct tcpdump_parser *ps, const char *a, const char *b)
+{
+  return !strcmp(ps->tok, a) || ((b != NULL) && !strcmp(ps->tok, b));
+}
+/*-----------------------------------------------------------------------------------*/
+static int
+tcpdump_node(struct tcpdump_parser *ps, u8_t op, int a, int b)
+{
+  struct tcpdump_node *n;
+
+  if ((ps->f->nodes >= TCPDUMP_FILTER_NODES) || (a < -1) || (b < -1)) {
+    return -2;
+  }
+  n = &ps->f->node[ps->f->nodes];
+  memset(n, 0, sizeof(*n));
+  n->op = op;
+  n->a = (u8_t)a;
+  n->b = (u8_t)b;
+  return ps->f->nodes++;
+}
+/*-----------------------------------------------------------------------------------*/
+/* host ADDR, net ADDR/LEN */
+static int
+tcpdump_parse_addr(struct tcpdump_parser *ps, u8_t dir, int net)
+{
+  char buf[sizeof(ps->tok)];
+  char *slash;
+  unsigned long prefix;
+  struct tcpdump_node *n;
+  int i;
+#if LWIP_IPV4
+  ip4_addr_t a4;
+#endif
+#if LWIP_IPV6
+  ip6_addr_t a6;
+#endif
 
-    i = 0;
-    if (TCPH_FLAGS(tcphdr) & TCP_SYN) {
-      flags[i++] = 'S';
+  strcpy(buf, ps->tok);
+  slash = strchr(buf, '/');
+  if (slash != NULL) {
+    if (!net) {
+      return -2;
     }
-    if (TCPH_FLAGS(tcphdr) & TCP_PSH) {
-      flags[i++] = 'P';
+    *slash++ = 0;
+  }
+  i = tcpdump_node(ps, TCPDUMP_F_NET, -1, -1);
+  if (i < 0) {
+    return i;
+  }
+  n = &ps->f->node[i];
+  n->dir = dir;
+#if LWIP_IPV4
+  if (ip4addr_aton(buf, &a4)) {
+    n->alen = 4;
+    memcpy(n->addr, &a4.addr, 4);
+  } else
+#endif
+#if LWIP_IPV6
+  if (ip6addr_aton(buf, &a6)) {
+    n->alen = 16;
+    memcpy(n->addr, a6.addr, 16);
+  } else
+#endif
+  {
+    return -2;
+  }
+  prefix = n->alen * 8;
+  if (slash != NULL) {
+    char *end;
+    prefix = strtoul(slash, &end, 10);
+    if ((*end != 0) || (end == slash) || (prefix > (unsigned long)n->alen * 8)) {
+      return -2;
     }
-    if (TCPH_FLAGS(tcphdr) & TCP_FIN) {
-      flags[i++] = 'F';
+  }
+  n->prefix = (u8_t)prefix;
+  tcpdump_advance(ps);
+  return i;
+}
+/*-----------------------------------------------------------------------------------*/
+static int tcpdump_parse_or(struct tcpdump_parser *ps);
+
+static int
+tcpdump_parse_primary(struct tcpdump_parser *ps)
+{
+  static const struct {
+    const char *name;
+    u8_t op, proto;
+  } protos[] = {
+    {"ip", TCPDUMP_F_L3, TCPDUMP_L3_IP4}, {"ip6", TCPDUMP_F_L3, TCPDUMP_L3_IP6},
+    {"arp", TCPDUMP_F_L3, TCPDUMP_L3_ARP}, {"tcp", TCPDUMP_F_L4, 6},
+    {"udp", TCPDUMP_F_L4, 17}, {"icmp", TCPDUMP_F_L4, 1},
+    {"icmp6", TCPDUMP_F_L4, 58}, {"sctp", TCPDUMP_F_L4, 132}
+  };
+  u8_t dir = TCPDUMP_SRC | TCPDUMP_DST;
+  size_t k;
+  int i;
+
+  if (tcpdump_is(ps, "not", "!")) {
+    tcpdump_advance(ps);
+    return tcpdump_node(ps, TCPDUMP_F_NOT, tcpdump_parse_primary(ps), -1);
+  }
+  if (tcpdump_is(ps, "(", NULL)) {
+    tcpdump_advance(ps);
+    i = tcpdump_parse_or(ps);
+    if (!tcpdump_is(ps, ")", NULL)) {
+      return -2;
     }
-    if (TCPH_FLAGS(tcphdr) & TCP_RST) {
-      flags[i++] = 'R';
+    tcpdump_advance(ps);
+    return i;
+  }
+  if (tcpdump_is(ps, "src", "dst")) {
+    dir = (ps->tok[0] == 's') ? TCPDUMP_SRC : TCPDUMP_DST;
+    tcpdump_advance(ps);
+  }
+  if (tcpdump_is(ps, "host", "net")) {
+    int net = (ps->tok[0] == 'n');
+    tcpdump_advance(ps);
+    return tcpdump_parse_addr(ps, dir, net);
+  }
+  if (tcpdump_is(ps, "port", NULL)) {
+    char *end;
+    unsigned long port;
+    tcpdump_advance(ps);
+    port = strtoul(ps->tok, &end, 10);
+    if ((end == ps->tok) || (*end != 0) || (port > 0xffff)) {
+      return -2;
     }
-    if (i == 0) {
-      flags[i++] = '.';
+    i = tcpdump_node(ps, TCPDUMP_F_PORT, -1, -1);
+    if (i >= 0) {
+      ps->f->node[i].dir = dir;
+      ps->f->node[i].port = (u16_t)port;
+      tcpdump_advance(ps);
     }
-    flags[i++] = 0;
+    return i;
+  }
+  if (dir != (TCPDUMP_SRC | TCPDUMP_DST)) {
+    return -2;
+  }
+  for (k = 0; k < LWIP_ARRAYSIZE(protos); k++) {
+    if (tcpdump_is(ps, protos[k].name, NULL)) {
+      i = tcpdump_node(ps, protos[k].op, -1, -1);
+      if (i >= 0) {
+        ps->f->node[i].proto = protos[k].proto;
+        tcpdump_advance(ps);
+      }
+      return i;
+    }
+  }
+  return -2;
+}
+/*-----------------------------------------------------------------------------------*/
+/* Primitives that follow each other without an operator are and'ed, as in
+   "tcp port 80" */
+static int
+tcpdump_parse_and(struct tcpdump_parser *ps)
+{
+  int a = tcpdump_parse_primary(ps);
 
-    fprintf(file, "%s.%u > %s.%u: ",
-            ip_ntoa(&src),
-            lwip_ntohs(tcphdr->src),
-            ip_ntoa(&dst),
-            lwip_ntohs(tcphdr->dest));
-    offset = TCPH_HDRLEN(tcphdr);
+  while ((a >= 0) && ps->tok[0] && !tcpdump_is(ps, "or", "||") && !tcpdump_is(ps, ")", NULL)) {
+    if (tcpdump_is(ps, "and", "&&")) {
+      tcpdump_advance(ps);
+    }
+    a = tcpdump_node(ps, TCPDUMP_F_AND, a, tcpdump_parse_primary(ps));
+  }
+  return a;
+}
+/*-----------------------------------------------------------------------------------*/
+static int
+tcpdump_parse_or(struct tcpdump_parser *ps)
+{
+  int a = tcpdump_parse_and(ps);
 
-    len = lwip_ntohs(IPH_LEN(iphdr)) - offset * 4 - IP_HLEN;
-    if (len != 0 || flags[0] != '.') {
-      fprintf(file, "%s %u:%u(%u) ", flags, lwip_ntohl(tcphdr->seqno),
-              lwip_ntohl(tcphdr->seqno) + len, len);
+  while ((a >= 0) && tcpdump_is(ps, "or", "||")) {
+    tcpdump_advance(ps);
+    a = tcpdump_node(ps, TCPDUMP_F_OR, a, tcpdump_parse_and(ps));
+  }
+  return a;
+}
+/*-----------------------------------------------------------------------------------*/
+/**
+ * Set the filter packets must match to be captured (NULL or "" captures
+ * all packets).
+ *
+ * @return 0 on success, -1 if the expression is invalid
+ */
+int
+tcpdump_set_filter(const char *expr)
+{
+  struct tcpdump_parser ps;
+  struct tcpdump_filter *f = NULL;
+
+  if ((expr != NULL) && (expr[0] != 0)) {
+    f = (struct tcpdump_filter *)calloc(1, sizeof(struct tcpdump_filter));
+    if (f == NULL) {
+      return -1;
+    }
+    ps.s = expr;
+    ps.f = f;
+    tcpdump_advance(&ps);
+    f->root = tcpdump_parse_or(&ps);
+    if ((f->root < 0) || (ps.tok[0] != 0)) {
+      fprintf(stderr, "tcpdump: invalid filter \"%s\" near \"%s\"\n", expr, ps.tok);
+      free(f);
+      return -1;
     }
-    if (TCPH_FLAGS(tcphdr) & TCP_ACK) {
-      fprintf(file, "ack %u ", lwip_ntohl(tcphdr->ackno));
+  }
+  /* Threads capturing right now may still be matching against the old
+     filter, so it is not freed. Filters are replaced rarely. */
+  __atomic_store_n(&tcpdump_filter, f, __ATOMIC_RELEASE);
+  LWIP_DEBUGF(TCPDUMP_DEBUG, ("tcpdump: filter \"%s\"\n", f ? expr : ""));
+  return 0;
+}
+/*-----------------------------------------------------------------------------------*/
+/* Writer */
+/*-----------------------------------------------------------------------------------*/
+static void
+tcpdump_write(const void *data, size_t len)
+{
+  if (fwrite(data, 1, len, tcpdump_file) != len) {
+    perror("tcpdump: write");
+  }
+  tcpdump_file_bytes += len;
+  tcpdump_stats.bytes += len;
+}
+/*-----------------------------------------------------------------------------------*/
+/* Close the current file and open the next one with a section header */
+static void
+tcpdump_open_file(void)
+{
+  char name[sizeof(tcpdump_fname) + 12];
+  u32_t shb[7];
+  int i;
+
+  if (tcpdump_file != NULL) {
+    fclose(tcpdump_file);
+    tcpdump_file_index++;
+    if ((tcpdump_max_files > 0) && (tcpdump_file_index >= tcpdump_max_files)) {
+      tcpdump_file_index = 0;
     }
-    fprintf(file, "wnd %u\n", lwip_ntohs(tcphdr->wnd));
+  }
+  if (tcpdump_file_index == 0) {
+    snprintf(name, sizeof(name), "%s", tcpdump_fname);
+  } else {
+    snprintf(name, sizeof(name), "%s.%"U32_F, tcpdump_fname, tcpdump_file_index);
+  }
+  tcpdump_file = fopen(name, "wb");
+  if (tcpdump_file == NULL) {
+    fprintf(stderr, "tcpdump: cannot open \"%s\" for writing: ", name);
+    perror(NULL);
+    return;
+  }
+  setvbuf(tcpdump_file, NULL, _IOFBF, 256 * 1024);
+  LWIP_DEBUGF(TCPDUMP_DEBUG, ("tcpdump: file %s\n", name));
 
-    fflush(file);
+  tcpdump_file_bytes = 0;
+  tcpdump_file_ifs = 0;
+  for (i = 0; i < TCPDUMP_MAX_IFS; i++) {
+    tcpdump_file_ifid[i] = -1;
+  }
+  tcpdump_stats.files++;
 
-    pbuf_header(p, IP_HLEN);
-    break;
-#endif /* LWIP_TCP */
+  /* section header: byte order magic, version 1.0, unknown section length */
+  shb[0] = TCPDUMP_BT_SHB;
+  shb[1] = sizeof(shb);
+  shb[2] = TCPDUMP_BOM;
+#if BYTE_ORDER == BIG_ENDIAN
+  shb[3] = 1UL << 16;
+#else
+  shb[3] = 1;
+#endif
+  shb[4] = 0xffffffffUL;
+  shb[5] = 0xffffffffUL;
+  shb[6] = sizeof(shb);
+  tcpdump_write(shb, sizeof(shb));
+}
+/*-----------------------------------------------------------------------------------*/
+/* Interface description block, numbered in the order they appear in a file */
+static int
+tcpdump_file_if(u16_t ifid)
+{
+  const struct tcpdump_if *ifc = &tcpdump_ifs[ifid];
+  u32_t idb[4], opt, total;
+  size_t namelen = strlen(ifc->name), padded = (namelen + 3) & ~3U;
+  static const u8_t zero[4] = {0, 0, 0, 0};
 
-#if LWIP_UDP
-  case IP_PROTO_UDP:
-    udphdr = (struct udp_hdr *)((char *)iphdr + IPH_HL(iphdr));
+  if (tcpdump_file_ifid[ifid] < 0) {
+    total = sizeof(idb) + 4 + (u32_t)padded + 4 + 4;
+    idb[0] = TCPDUMP_BT_IDB;
+    idb[1] = total;
+#if BYTE_ORDER == BIG_ENDIAN
+    idb[2] = (u32_t)ifc->linktype << 16;
+#else
+    idb[2] = ifc->linktype;
+#endif
+    idb[3] = 0; /* snap length: not limited, it can change at runtime */
+    tcpdump_write(idb, sizeof(idb));
+    /* if_name */
+#if BYTE_ORDER == BIG_ENDIAN
+    opt = (2UL << 16) | (u32_t)namelen;
+#else
+    opt = 2 | ((u32_t)namelen << 16);
+#endif
+    tcpdump_write(&opt, 4);
+    tcpdump_write(ifc->name, namelen);
+    tcpdump_write(zero, padded - namelen);
+    opt = 0;
+    tcpdump_write(&opt, 4);
+    tcpdump_write(&total, 4);
+    tcpdump_file_ifid[ifid] = (int)tcpdump_file_ifs++;
+  }
+  return tcpdump_file_ifid[ifid];
+}
+/*-----------------------------------------------------------------------------------*/
+/* Enhanced packet block */
+static void
+tcpdump_write_rec(const struct tcpdump_rec *rec)
+{
+  u32_t epb[7], opt[3], total;
+  u32_t pad = (4 - (rec->caplen & 3)) & 3;
+  u32_t optlen = (rec->dir != TCPDUMP_DIR_UNKNOWN) ? sizeof(opt) : 0;
+  static const u8_t zero[4] = {0, 0, 0, 0};
 
-    pbuf_header(p, -IP_HLEN);
-    if (ip_chksum_pseudo(p, IP_PROTO_UDP, p->tot_len, &src, &dst) != 0) {
-      LWIP_DEBUGF(TCPDUMP_DEBUG, ("tcpdump: IP checksum failed!\n"));
-      /*
-      fprintf(file, "chksum 0x%lx ", tcphdr->chksum);
-      tcphdr->chksum = 0;
-      fprintf(file, "should be 0x%lx ", ip_chksum_pseudo(p, &src, &dst, IP_PROTO_TCP, p->tot_len));*/
-      fprintf(file, "!chksum ");
+  if ((tcpdump_rotate > 0) && (tcpdump_file_bytes >= tcpdump_rotate)) {
+    tcpdump_open_file();
+  }
+  if (tcpdump_file == NULL) {
+    return;
+  }
+  total = sizeof(epb) + rec->caplen + pad + optlen + 4;
+  epb[0] = TCPDUMP_BT_EPB;
+  epb[1] = total;
+  epb[2] = (u32_t)tcpdump_file_if(rec->ifid);
+  epb[3] = (u32_t)(rec->ts_us >> 32);
+  epb[4] = (u32_t)rec->ts_us;
+  epb[5] = rec->caplen;
+  epb[6] = rec->origlen;
+  tcpdump_write(epb, sizeof(epb));
+  tcpdump_write(rec + 1, rec->caplen);
+  tcpdump_write(zero, pad);
+  if (optlen) {
+    /* epb_flags: inbound 1, outbound 2 */
+#if BYTE_ORDER == BIG_ENDIAN
+    opt[0] = (2UL << 16) | 4;
+#else
+    opt[0] = 2 | (4UL << 16);
+#endif
+    opt[1] = rec->dir;
+    opt[2] = 0;
+    tcpdump_write(opt, sizeof(opt));
+  }
+  tcpdump_write(&total, 4);
+  tcpdump_stats.captured++;
+}
+/*-----------------------------------------------------------------------------------*/
+static void
+tcpdump_drain(struct tcpdump_ring *ring)
+{
+  u32_t head = ring->head;
+  u32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+  u32_t off;
+  const struct tcpdump_rec *rec;
+
+  while (head != tail) {
+    off = head & (TCPDUMP_RING_SIZE - 1);
+    rec = (const struct tcpdump_rec *)&ring->data[off];
+    if (rec->size == 0) {
+      head += TCPDUMP_RING_SIZE - off;
+      continue;
     }
+    tcpdump_write_rec(rec);
+    head += rec->size;
+  }
+  __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+}
+/*-----------------------------------------------------------------------------------*/
+/** Write all records captured so far to the file */
+void
+tcpdump_flush(void)
+{
+  struct tcpdump_ring *ring;
 
-    fprintf(file, "%s.%u > %s.%u: ",
-            ip_ntoa(&src),
-            lwip_ntohs(udphdr->src),
-            ip_ntoa(&dst),
-            lwip_ntohs(udphdr->dest));
-    fprintf(file, "U ");
-    len = lwip_ntohs(IPH_LEN(iphdr)) - sizeof(struct udp_hdr) - IP_HLEN;
-    fprintf(file, " %d\n", len);
+  if (!tcpdump_initialized) {
+    return;
+  }
+  pthread_mutex_lock(&tcpdump_write_mutex);
+  for (ring = __atomic_load_n(&tcpdump_rings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next) {
+    tcpdump_drain(ring);
+  }
+  if (tcpdump_file != NULL) {
+    fflush(tcpdump_file);
+  }
+  pthread_mutex_unlock(&tcpdump_write_mutex);
+}
+/*-----------------------------------------------------------------------------------*/
+/* Writes the records every TCPDUMP_FLUSH_MS, or earlier when a ring is
+   half full */
+static void *
+tcpdump_thread(void *arg)
+{
+  struct timespec ts;
 
-    fflush(file);
+  LWIP_UNUSED_ARG(arg);
+  for (;;) {
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += (TCPDUMP_FLUSH_MS % 1000) * 1000000L;
+    ts.tv_sec += TCPDUMP_FLUSH_MS / 1000 + ts.tv_nsec / 1000000000L;
+    ts.tv_nsec %= 1000000000L;
+    pthread_mutex_lock(&tcpdump_wake_mutex);
+    pthread_cond_timedwait(&tcpdump_wake, &tcpdump_wake_mutex, &ts);
+    pthread_mutex_unlock(&tcpdump_wake_mutex);
+    tcpdump_flush();
+  }
+  return NULL;
+}
+/*-----------------------------------------------------------------------------------*/
+/* Capture */
+/*-----------------------------------------------------------------------------------*/
+/**
+ * Capture a packet sent (TCPDUMP_DIR_OUT) or received (TCPDUMP_DIR_IN) on a
+ * netif: the link header for netifs with NETIF_FLAG_ETHARP or
+ * NETIF_FLAG_ETHERNET, else the IP header is expected at p->payload.
+ * Does nothing while capturing is disabled.
+ */
+void
+tcpdump_packet(struct pbuf *p, struct netif *netif, u8_t dir)
+{
+  struct tcpdump_filter *filter;
+  struct tcpdump_ring *ring;
+  struct tcpdump_rec *rec;
+  struct timespec ts;
+  u32_t caplen, size, head, tail, off, space;
+  int ifid;
 
-    pbuf_header(p, IP_HLEN);
-    break;
-#endif /* LWIP_UDP */
-  default:
-    LWIP_DEBUGF(TCPDUMP_DEBUG, ("unhandled IP protocol: %d\n", (int)IPH_PROTO(iphdr)));
-    break;
+  if (!__atomic_load_n(&tcpdump_enabled, __ATOMIC_RELAXED) || (p == NULL)) {
+    return;
   }
-#else
-  LWIP_UNUSED_ARG(p);
-  LWIP_UNUSED_ARG(netif);
-#endif
+  ifid = tcpdump_if_lookup(netif);
+  ring = tcpdump_thread_ring();
+  if ((ifid < 0) || (ring == NULL)) {
+    __atomic_add_fetch(&tcpdump_stats.dropped, 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  filter = __atomic_load_n(&tcpdump_filter, __ATOMIC_ACQUIRE);
+  if (filter != NULL) {
+    u8_t hdr[TCPDUMP_FILTER_BYTES];
+    struct tcpdump_pkt pkt;
+    u16_t len = pbuf_copy_partial(p, hdr, sizeof(hdr), 0);
+
+    tcpdump_parse_pkt(&pkt, hdr, len, tcpdump_ifs[ifid].linktype);
+    if (!tcpdump_match(filter, filter->root, &pkt)) {
+      __atomic_add_fetch(&tcpdump_stats.filtered, 1, __ATOMIC_RELAXED);
+      return;
+    }
+  }
+
+  caplen = LWIP_MIN(p->tot_len, __atomic_load_n(&tcpdump_snaplen, __ATOMIC_RELAXED));
+  size = (u32_t)(sizeof(struct tcpdump_rec) + caplen + 7) & ~7UL;
+  tail = ring->tail;
+  head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  off = tail & (TCPDUMP_RING_SIZE - 1);
+  space = TCPDUMP_RING_SIZE - (tail - head);
+  if ((size > TCPDUMP_RING_SIZE - off) ? (space < TCPDUMP_RING_SIZE - off + size) : (space < size)) {
+    __atomic_add_fetch(&tcpdump_stats.dropped, 1, __ATOMIC_RELAXED);
+    return;
+  }
+  if (size > TCPDUMP_RING_SIZE - off) {
+    /* no room before the end of the ring, continue at the start */
+    ((struct tcpdump_rec *)&ring->data[off])->size = 0;
+    tail += TCPDUMP_RING_SIZE - off;
+    off = 0;
+  }
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  rec = (struct tcpdump_rec *)&ring->data[off];
+  rec->size = size;
+  rec->ifid = (u16_t)ifid;
+  rec->dir = dir;
+  rec->caplen = caplen;
+  rec->origlen = p->tot_len;
+  rec->ts_us = (u64_t)ts.tv_sec * 1000000 + (u64_t)ts.tv_nsec / 1000;
+  pbuf_copy_partial(p, rec + 1, (u16_t)caplen, 0);
+  __atomic_store_n(&ring->tail, tail + size, __ATOMIC_RELEASE);
+
+  /* wake the writer once when the ring gets half full */
+  if ((space > TCPDUMP_RING_SIZE / 2) && (tail + size - head >= TCPDUMP_RING_SIZE / 2)) {
+    pthread_cond_signal(&tcpdump_wake);
+  }
+}
+/*-----------------------------------------------------------------------------------*/
+/** Capture a packet of unknown direction */
+void
+tcpdump(struct pbuf *p, struct netif *netif)
+{
+  tcpdump_packet(p, netif, TCPDUMP_DIR_UNKNOWN);
 }
+/*-----------------------------------------------------------------------------------*/
+static err_t
+tcpdump_input(struct pbuf *p, struct netif *netif)
+{
+  tcpdump_packet(p, netif, TCPDUMP_DIR_IN);
+  return tcpdump_ifs[tcpdump_if_lookup(netif)].input(p, netif);
+}
+/*-----------------------------------------------------------------------------------*/
+static err_t
+tcpdump_linkoutput(struct netif *netif, struct pbuf *p)
+{
+  tcpdump_packet(p, netif, TCPDUMP_DIR_OUT);
+  return tcpdump_ifs[tcpdump_if_lookup(netif)].linkoutput(netif, p);
+}
+/*-----------------------------------------------------------------------------------*/
+#if LWIP_IPV4
+static err_t
+tcpdump_output(struct netif *netif, struct pbuf *p, const ip4_addr_t *ipaddr)
+{
+  tcpdump_packet(p, netif, TCPDUMP_DIR_OUT);
+  return tcpdump_ifs[tcpdump_if_lookup(netif)].output(netif, p, ipaddr);
+}
+#endif /* LWIP_IPV4 */
+/*-----------------------------------------------------------------------------------*/
+#if LWIP_IPV6
+static err_t
+tcpdump_output_ip6(struct netif *netif, struct pbuf *p, const ip6_addr_t *ipaddr)
+{
+  tcpdump_packet(p, netif, TCPDUMP_DIR_OUT);
+  return tcpdump_ifs[tcpdump_if_lookup(netif)].output_ip6(netif, p, ipaddr);
+}
+#endif /* LWIP_IPV6 */
+/*-----------------------------------------------------------------------------------*/
+/**
+ * Capture all packets a netif receives and sends, for netifs that do not
+ * call tcpdump_packet() themselves: hooks netif->input and netif->linkoutput
+ * (Ethernet netifs) or netif->output/output_ip6. Call it after netif_add()
+ * and before traffic flows on the netif.
+ */
+err_t
+tcpdump_attach(struct netif *netif)
+{
+  struct tcpdump_if *ifc;
+  int i;
 
-#endif /* LWIP_IPV4 && LWIP_TCP */
+  if (netif->input == tcpdump_input) {
+    return ERR_OK;
+  }
+  i = tcpdump_if_lookup(netif);
+  if (i < 0) {
+    return ERR_MEM;
+  }
+  ifc = &tcpdump_ifs[i];
+  ifc->input = netif->input;
+  netif->input = tcpdump_input;
+  if (ifc->linktype == TCPDUMP_LINKTYPE_ETHERNET) {
+    ifc->linkoutput = netif->linkoutput;
+    netif->linkoutput = tcpdump_linkoutput;
+  } else {
+#if LWIP_IPV4
+    ifc->output = netif->output;
+    netif->output = tcpdump_output;
+#endif
+#if LWIP_IPV6
+    ifc->output_ip6 = netif->output_ip6;
+    netif->output_ip6 = tcpdump_output_ip6;
+#endif
+  }
+  return ERR_OK;
+}
+/*-----------------------------------------------------------------------------------*/
+/** Set the number of bytes captured per packet */
+void
+tcpdump_set_snaplen(u32_t snaplen)
+{
+  if (snaplen == 0 || snaplen > 0xffff) {
+    snaplen = 0xffff;
+  }
+  __atomic_store_n(&tcpdump_snaplen, snaplen, __ATOMIC_RELAXED);
+}
+/*-----------------------------------------------------------------------------------*/
+/** Start (initializing the writer on first use) or stop capturing */
+void
+tcpdump_enable(u8_t enable)
+{
+  if (enable && !tcpdump_initialized) {
+    tcpdump_init();
+  }
+  __atomic_store_n(&tcpdump_enabled, enable ? 1 : 0, __ATOMIC_RELAXED);
+}
+/*-----------------------------------------------------------------------------------*/
+void
+tcpdump_get_stats(struct tcpdump_stats *stats)
+{
+  pthread_mutex_lock(&tcpdump_write_mutex);
+  *stats = tcpdump_stats;
+  pthread_mutex_unlock(&tcpdump_write_mutex);
+  stats->filtered = __atomic_load_n(&tcpdump_stats.filtered, __ATOMIC_RELAXED);
+  stats->dropped = __atomic_load_n(&tcpdump_stats.dropped, __ATOMIC_RELAXED);
+}
+/*-----------------------------------------------------------------------------------*/
+static int
+tcpdump_config_item(void *arg, const char *key, char *value)
+{
+  double n;
 
+  LWIP_UNUSED_ARG(arg);
+  if (!strcmp(key, "off") && (value == NULL)) {
+    tcpdump_enabled = 0;
+    return 0;
+  }
+  if (value == NULL) {
+    return -1;
+  }
+  if (!strcmp(key, "file")) {
+    snprintf(tcpdump_fname, sizeof(tcpdump_fname), "%s", value);
+    return 0;
+  }
+  if (port_parse_size(value, &n) != 0) {
+    return -1;
+  }
+  if (!strcmp(key, "snaplen")) {
+    tcpdump_set_snaplen((u32_t)LWIP_MIN(n, 0xffff));
+  } else if (!strcmp(key, "rotate")) {
+    tcpdump_rotate = (u64_t)n;
+  } else if (!strcmp(key, "files") && (n <= 0xffffffffUL)) {
+    tcpdump_max_files = (u32_t)n;
+  } else {
+    return -1;
+  }
+  return 0;
+}
 /*-----------------------------------------------------------------------------------*/
+/**
+ * Open the capture file (TCPDUMP, TCPDUMP_FILTER in the environment) and
+ * start the writer thread. Capturing is enabled unless TCPDUMP has "off".
+ */
+void
+tcpdump_init(void)
+{
+  pthread_t thread;
+  const char *env;
+
+  pthread_mutex_lock(&tcpdump_write_mutex);
+  if (tcpdump_initialized) {
+    pthread_mutex_unlock(&tcpdump_write_mutex);
+    return;
+  }
+  tcpdump_enabled = 1;
+  env = getenv("TCPDUMP");
+  if (env != NULL) {
+    port_parse_opts("tcpdump", env, tcpdump_config_item, NULL);
+  }
+  env = getenv("TCPDUMP_FILTER");
+  if (env != NULL) {
+    tcpdump_set_filter(env);
+  }
+  tcpdump_open_file();
+  tcpdump_initialized = 1;
+  pthread_mutex_unlock(&tcpdump_write_mutex);
+
+  if (pthread_create(&thread, NULL, tcpdump_thread, NULL) == 0) {
+    pthread_detach(thread);
+  } else {
+    perror("tcpdump_init: pthread_create");
+  }
+  atexit(tcpdump_flush);
+}
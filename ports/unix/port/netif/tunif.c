@@ -32,12 +32,14 @@
 
 #include "netif/tunif.h"
 
+#include <errno.h>
 #include <fcntl.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/time.h>
 #include <sys/uio.h>
 #include <sys/socket.h>
 
@@ -50,10 +52,37 @@
 #include "lwip/mem.h"
 #include "lwip/netif.h"
 #include "lwip/pbuf.h"
+#include "lwip/snmp.h"
 #include "lwip/sys.h"
-
-#if LWIP_IPV4 /* @todo: IPv6 */
+#include "lwip/timeouts.h"
 #if !NO_SYS
+#include "lwip/tcpip.h"
+#else /* !NO_SYS */
+#include "arch/evloop.h"
+#endif /* !NO_SYS */
+
+#if defined(LWIP_UNIX_LINUX)
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <linux/if.h>
+#include <linux/if_tun.h>
+/*
+ * The tun interface is created and configured through /dev/net/tun and
+ * ioctl()s on a socket (this needs CAP_NET_ADMIN): the host end gets the
+ * gateway address of the netif, the peer is the netif's address. If
+ * PRECONFIGURED_TUNIF is set in the environment, that (existing, already
+ * configured) interface is attached to instead.
+ */
+#ifndef DEVTUN_DEFAULT_IF
+#define DEVTUN_DEFAULT_IF "tun0"
+#endif
+#ifndef DEVTUN
+#define DEVTUN "/dev/net/tun"
+#endif
+#else /* others */
+#define DEVTUN "/dev/tun0"
+#define IFCONFIG_CALL "/sbin/ifconfig tun0 inet %d.%d.%d.%d %d.%d.%d.%d"
+#endif
 
 #define IFNAME0 't'
 #define IFNAME1 'n'
@@ -62,26 +91,205 @@
 #define TUNIF_DEBUG LWIP_DBG_OFF
 #endif
 
-#define IFCONFIG_CALL "/sbin/ifconfig tun0 inet %d.%d.%d.%d %d.%d.%d.%d"
+/** Biggest packet read from the tun device */
+#ifndef TUNIF_MTU
+#define TUNIF_MTU 1500
+#endif
+
+/** Maximum number of pbufs of a chain passed to readv()/writev(); longer
+ * TX chains are copied into a contiguous buffer first */
+#ifndef TUNIF_MAX_IOV
+#define TUNIF_MAX_IOV 16
+#endif
+
+/** Maximum number of packets read per wakeup. If netif->input is
+ * tcpip_input, the whole burst is passed to tcpip_thread with a single
+ * message instead of one message per packet. */
+#ifndef TUNIF_RX_BATCH
+#define TUNIF_RX_BATCH 32
+#endif
+
+/** Define TUNIF_IOURING to 1 to read and write packets with io_uring if the
+ * kernel supports it, see netif/iouring.h and TAPIF_IOURING in tapif.c */
+#ifndef TUNIF_IOURING
+#ifdef LWIP_UNIX_LINUX
+#define TUNIF_IOURING 1
+#else
+#define TUNIF_IOURING 0
+#endif
+#endif
+#ifndef TUNIF_IOURING_RX_BUFS
+#define TUNIF_IOURING_RX_BUFS 64
+#endif
+#ifndef TUNIF_IOURING_TX_SLOTS
+#define TUNIF_IOURING_TX_SLOTS 64
+#endif
+/** See TAPIF_IOURING_REAP_MS */
+#ifndef TUNIF_IOURING_REAP_MS
+#define TUNIF_IOURING_REAP_MS 1
+#endif
+
+#if TUNIF_IOURING
+#include "netif/iouring.h"
+#endif /* TUNIF_IOURING */
 
 struct tunif {
   /* Add whatever per-interface state that is needed here. */
   int fd;
+  /* pbuf chain the next packet is read into */
+  struct pbuf *rx;
+#if !NO_SYS && (TUNIF_RX_BATCH > 1)
+  /* packets read but not yet passed to tcpip_thread */
+  struct tunif_rx_batch *batch;
+#endif /* !NO_SYS && (TUNIF_RX_BATCH > 1) */
+#if TUNIF_IOURING
+  /* NULL if io_uring is not available; with NO_SYS, both are the same ring */
+  struct iouring *rx_ring;
+  struct iouring *tx_ring;
+#if !NO_SYS
+  /* a callback to submit the queued writes is pending in tcpip_thread */
+  u8_t tx_submit_posted;
+  /* the timeout reaping completed writes is armed */
+  u8_t tx_reap_armed;
+#endif /* !NO_SYS */
+#endif /* TUNIF_IOURING */
 };
 
+#if !NO_SYS && (TUNIF_RX_BATCH > 1)
+/* A burst of packets passed to tcpip_thread with one message */
+struct tunif_rx_batch {
+  struct netif *netif;
+  u16_t count;
+  struct pbuf *p[TUNIF_RX_BATCH];
+};
+#endif /* !NO_SYS && (TUNIF_RX_BATCH > 1) */
+
 /* Forward declarations. */
 static void  tunif_input(struct netif *netif);
+#if LWIP_IPV4
 static err_t tunif_output(struct netif *netif, struct pbuf *p,
                           const ip4_addr_t *ipaddr);
+#endif /* LWIP_IPV4 */
+#if LWIP_IPV6
+static err_t tunif_output_ip6(struct netif *netif, struct pbuf *p,
+                              const ip6_addr_t *ipaddr);
+#endif /* LWIP_IPV6 */
 
+#if !NO_SYS
 static void tunif_thread(void *data);
+#endif /* !NO_SYS */
+#if TUNIF_IOURING
+static void tunif_iouring_input(void *arg, struct pbuf *p, const void *prefix);
+#endif /* TUNIF_IOURING */
 
 /*-----------------------------------------------------------------------------------*/
+#if defined(LWIP_UNIX_LINUX)
+/* Set an IPv4 address of the interface 'ifname' with the ioctl 'req' */
+static int
+tunif_set_addr(int s, const char *ifname, unsigned long req, const ip4_addr_t *addr)
+{
+  struct ifreq ifr;
+  struct sockaddr_in sin;
+
+  memset(&ifr, 0, sizeof(ifr));
+  strncpy(ifr.ifr_name, ifname, sizeof(ifr.ifr_name) - 1);
+  memset(&sin, 0, sizeof(sin));
+  sin.sin_family = AF_INET;
+  sin.sin_addr.s_addr = ip4_addr_get_u32(addr);
+  memcpy(&ifr.ifr_addr, &sin, sizeof(sin));
+  return ioctl(s, req, &ifr);
+}
+
+/* Configure the host end of the interface 'ifname' and bring it up */
+static void
+tunif_configure(struct netif *netif, const char *ifname)
+{
+  struct ifreq ifr;
+  int s = socket(AF_INET, SOCK_DGRAM, 0);
+
+  if (s == -1) {
+    perror("tunif_init: socket");
+    exit(1);
+  }
+#if LWIP_IPV4
+  /* same as "ifconfig tun0 inet <gw> <ipaddr>" */
+  if ((tunif_set_addr(s, ifname, SIOCSIFADDR, netif_ip4_gw(netif)) < 0) ||
+      (tunif_set_addr(s, ifname, SIOCSIFDSTADDR, netif_ip4_addr(netif)) < 0)) {
+    perror("tunif_init: cannot set address");
+    exit(1);
+  }
+#endif /* LWIP_IPV4 */
+
+  memset(&ifr, 0, sizeof(ifr));
+  strncpy(ifr.ifr_name, ifname, sizeof(ifr.ifr_name) - 1);
+  ifr.ifr_mtu = netif->mtu;
+  if (ioctl(s, SIOCSIFMTU, &ifr) < 0) {
+    perror("tunif_init: cannot set MTU");
+  }
+  if (ioctl(s, SIOCGIFFLAGS, &ifr) < 0) {
+    perror("tunif_init: SIOCGIFFLAGS");
+    exit(1);
+  }
+  ifr.ifr_flags |= IFF_UP | IFF_RUNNING;
+  if (ioctl(s, SIOCSIFFLAGS, &ifr) < 0) {
+    perror("tunif_init: cannot bring interface up");
+    exit(1);
+  }
+  close(s);
+
+#if LWIP_IPV6
+  {
+    /* IPv6 address of the host end, e.g. TUNIF_HOST_IP6=fd00::1/64 */
+    const char *host_ip6 = getenv("TUNIF_HOST_IP6");
+    struct in6_ifreq {
+      struct in6_addr ifr6_addr;
+      u32_t ifr6_prefixlen;
+      int ifr6_ifindex;
+    } ifr6;
+    ip6_addr_t addr;
+    char buf[64];
+    char *prefix;
+
+    if (host_ip6 == NULL) {
+      return;
+    }
+    strncpy(buf, host_ip6, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = 0;
+    prefix = strchr(buf, '/');
+    if (prefix != NULL) {
+      *prefix++ = 0;
+    }
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, ifname, sizeof(ifr.ifr_name) - 1);
+    s = socket(AF_INET6, SOCK_DGRAM, 0);
+    if ((s == -1) || !ip6addr_aton(buf, &addr) || (ioctl(s, SIOCGIFINDEX, &ifr) < 0)) {
+      perror("tunif_init: TUNIF_HOST_IP6");
+      exit(1);
+    }
+    memset(&ifr6, 0, sizeof(ifr6));
+    memcpy(&ifr6.ifr6_addr, addr.addr, sizeof(ifr6.ifr6_addr));
+    ifr6.ifr6_prefixlen = (prefix != NULL) ? (u32_t)atoi(prefix) : 64;
+    ifr6.ifr6_ifindex = ifr.ifr_ifindex;
+    if (ioctl(s, SIOCSIFADDR, &ifr6) < 0) {
+      perror("tunif_init: cannot set IPv6 address");
+      exit(1);
+    }
+    close(s);
+  }
+#endif /* LWIP_IPV6 */
+}
+#endif /* LWIP_UNIX_LINUX */
+
 static void
 low_level_init(struct netif *netif)
 {
   struct tunif *tunif;
+#if defined(LWIP_UNIX_LINUX)
+  const char *preconfigured_tunif = getenv("PRECONFIGURED_TUNIF");
+  struct ifreq ifr;
+#else /* LWIP_UNIX_LINUX */
   char buf[sizeof(IFCONFIG_CALL) + 50];
+#endif /* LWIP_UNIX_LINUX */
 
   tunif = (struct tunif *)netif->state;
 
@@ -89,12 +297,28 @@ low_level_init(struct netif *netif)
 
   /* Do whatever else is needed to initialize interface. */
 
-  tunif->fd = open("/dev/tun0", O_RDWR);
+  tunif->fd = open(DEVTUN, O_RDWR);
   LWIP_DEBUGF(TUNIF_DEBUG, ("tunif_init: fd %d\n", tunif->fd));
   if (tunif->fd == -1) {
-    perror("tunif_init");
+    perror("tunif_init: cannot open "DEVTUN);
     exit(1);
   }
+  /* tunif_input() reads until the device is drained */
+  fcntl(tunif->fd, F_SETFL, fcntl(tunif->fd, F_GETFL) | O_NONBLOCK);
+
+#if defined(LWIP_UNIX_LINUX)
+  memset(&ifr, 0, sizeof(ifr));
+  strncpy(ifr.ifr_name, (preconfigured_tunif != NULL) ? preconfigured_tunif : DEVTUN_DEFAULT_IF,
+          sizeof(ifr.ifr_name) - 1);
+  ifr.ifr_flags = IFF_TUN | IFF_NO_PI;
+  if (ioctl(tunif->fd, TUNSETIFF, (void *)&ifr) < 0) {
+    perror("tunif_init: "DEVTUN" ioctl TUNSETIFF");
+    exit(1);
+  }
+  if (preconfigured_tunif == NULL) {
+    tunif_configure(netif, ifr.ifr_name);
+  }
+#else /* LWIP_UNIX_LINUX */
   sprintf(buf, IFCONFIG_CALL,
            ip4_addr1(netif_ip4_gw(netif)),
            ip4_addr2(netif_ip4_gw(netif)),
@@ -104,11 +328,38 @@ low_level_init(struct netif *netif)
            ip4_addr2(netif_ip4_addr(netif)),
            ip4_addr3(netif_ip4_addr(netif)),
            ip4_addr4(netif_ip4_addr(netif)));
-
   LWIP_DEBUGF(TUNIF_DEBUG, ("tunif_init: system(\"%s\");\n", buf));
-  if (system(buf) == 0) {
-    sys_thread_new("tunif_thread", tunif_thread, netif, DEFAULT_THREAD_STACKSIZE, DEFAULT_THREAD_PRIO);
+  if (system(buf) != 0) {
+    perror("tunif_init: ifconfig failed");
+    exit(1);
+  }
+#endif /* LWIP_UNIX_LINUX */
+
+  netif_set_link_up(netif);
+
+#if TUNIF_IOURING
+  tunif->rx_ring = iouring_new(TUNIF_IOURING_RX_BUFS, NO_SYS ? TUNIF_IOURING_TX_SLOTS : 0);
+  if (tunif->rx_ring != NULL) {
+    /* reads must wait in the kernel instead of failing with EAGAIN */
+    int flags = fcntl(tunif->fd, F_GETFL);
+    fcntl(tunif->fd, F_SETFL, flags & ~O_NONBLOCK);
+    if (iouring_rx_start(tunif->rx_ring, tunif->fd, TUNIF_MTU, 0, 0, tunif_iouring_input, netif) != ERR_OK) {
+      fcntl(tunif->fd, F_SETFL, flags);
+      iouring_free(tunif->rx_ring);
+      tunif->rx_ring = NULL;
+    }
   }
+#if NO_SYS
+  tunif->tx_ring = tunif->rx_ring;
+#else /* NO_SYS */
+  tunif->tx_ring = iouring_new(0, TUNIF_IOURING_TX_SLOTS);
+  tunif->tx_submit_posted = 0;
+#endif /* NO_SYS */
+#endif /* TUNIF_IOURING */
+
+#if !NO_SYS
+  sys_thread_new("tunif_thread", tunif_thread, netif, DEFAULT_THREAD_STACKSIZE, DEFAULT_THREAD_PRIO);
+#endif /* !NO_SYS */
 }
 /*-----------------------------------------------------------------------------------*/
 /*
@@ -121,25 +372,112 @@ low_level_init(struct netif *netif)
  */
 /*-----------------------------------------------------------------------------------*/
 
-static err_t
-low_level_output(struct tunif *tunif, struct pbuf *p)
+/* Fill 'iov' with the chain 'p' (skipping empty pbufs), returns the number of
+   entries used or -1 if more than 'max' would be needed */
+static int
+tunif_fill_iov(struct pbuf *p, struct iovec *iov, int max)
 {
-  char buf[1500];
-  int rnd_val;
+  int n = 0;
 
-  /* initiate transfer(); */
+  for (; p != NULL; p = p->next) {
+    if (p->len == 0) {
+      continue;
+    }
+    if (n == max) {
+      return -1;
+    }
+    iov[n].iov_base = p->payload;
+    iov[n].iov_len = p->len;
+    n++;
+  }
+  return n;
+}
+
+#if TUNIF_IOURING && !NO_SYS
+static void tunif_iouring_reap(void *arg);
+
+/* Submit the queued writes and reap the completed ones, polling the TX ring
+   while writes are in flight (see tapif_iouring_flush()) */
+static void
+tunif_iouring_flush(struct tunif *tunif)
+{
+  iouring_submit(tunif->tx_ring);
+  if (!tunif->tx_reap_armed && (iouring_tx_pending(tunif->tx_ring) > 0)) {
+    tunif->tx_reap_armed = 1;
+    sys_timeout(TUNIF_IOURING_REAP_MS, tunif_iouring_reap, tunif);
+  }
+}
+
+static void
+tunif_iouring_reap(void *arg)
+{
+  struct tunif *tunif = (struct tunif *)arg;
+
+  tunif->tx_reap_armed = 0;
+  tunif_iouring_flush(tunif);
+}
+
+/* Called in tcpip_thread after the messages that were queued before the first
+   packet written with io_uring: submit all packets written since then */
+static void
+tunif_iouring_submit(void *arg)
+{
+  struct tunif *tunif = (struct tunif *)arg;
 
-  rnd_val = rand();
-  if (((double)rnd_val/(double)RAND_MAX) < 0.4) {
-    printf("drop\n");
+  tunif->tx_submit_posted = 0;
+  tunif_iouring_flush(tunif);
+}
+#endif /* TUNIF_IOURING && !NO_SYS */
+
+static err_t
+low_level_output(struct netif *netif, struct pbuf *p)
+{
+  struct tunif *tunif = (struct tunif *)netif->state;
+  struct iovec iov[TUNIF_MAX_IOV];
+  ssize_t written;
+  int iovcnt;
+
+#if TUNIF_IOURING
+  if ((tunif->tx_ring != NULL) && (iouring_send(tunif->tx_ring, tunif->fd, NULL, 0, p) == ERR_OK)) {
+    /* written asynchronously, 'p' is freed when done */
+    MIB2_STATS_NETIF_ADD(netif, ifoutoctets, p->tot_len);
+#if !NO_SYS
+    if (!tunif->tx_submit_posted) {
+      tunif->tx_submit_posted = 1;
+      if (tcpip_try_callback(tunif_iouring_submit, tunif) != ERR_OK) {
+        tunif_iouring_submit(tunif);
+      }
+    }
+#endif /* !NO_SYS */
     return ERR_OK;
   }
+  /* no free slot: write it now */
+#endif /* TUNIF_IOURING */
 
-  pbuf_copy_partial(p, buf, p->tot_len, 0);
+  /* initiate transfer(); */
+  iovcnt = tunif_fill_iov(p, iov, TUNIF_MAX_IOV);
 
   /* signal that packet should be sent(); */
-  if (write(tunif->fd, buf, p->tot_len) == -1) {
+  if (iovcnt >= 0) {
+    /* hand the pbuf payloads to the kernel directly */
+    written = writev(tunif->fd, iov, iovcnt);
+  } else {
+    /* too many pbufs in the chain: send a contiguous copy */
+    char buf[TUNIF_MTU];
+    if (p->tot_len > sizeof(buf)) {
+      MIB2_STATS_NETIF_INC(netif, ifoutdiscards);
+      LWIP_DEBUGF(TUNIF_DEBUG, ("tunif: packet of %d bytes too long\n", p->tot_len));
+      return ERR_BUF;
+    }
+    pbuf_copy_partial(p, buf, p->tot_len, 0);
+    written = write(tunif->fd, buf, p->tot_len);
+  }
+
+  if (written == -1) {
+    MIB2_STATS_NETIF_INC(netif, ifoutdiscards);
     perror("tunif: write");
+  } else {
+    MIB2_STATS_NETIF_ADD(netif, ifoutoctets, written);
   }
   return ERR_OK;
 }
@@ -153,38 +491,56 @@ low_level_output(struct tunif *tunif, struct pbuf *p)
  */
 /*-----------------------------------------------------------------------------------*/
 static struct pbuf *
-low_level_input(struct tunif *tunif)
+low_level_input(struct netif *netif)
 {
+  struct tunif *tunif = (struct tunif *)netif->state;
   struct pbuf *p;
+  struct iovec iov[TUNIF_MAX_IOV];
   ssize_t len;
-  char buf[1500];
+  int iovcnt;
 
-  /* Obtain the size of the packet and put it into the "len"
-     variable. */
-  len = read(tunif->fd, buf, sizeof(buf));
-  if((len <= 0) || (len > 0xffff)) {
-    return NULL;
+  /* The packet is read straight into the payload of a pbuf chain from the
+     pool, which is then handed to the stack without copying. */
+  if (tunif->rx == NULL) {
+    tunif->rx = pbuf_alloc(PBUF_RAW, TUNIF_MTU, PBUF_POOL);
   }
-
-  /*  if (((double)rand()/(double)RAND_MAX) < 0.1) {
-    printf("drop\n");
+  p = tunif->rx;
+  if (p == NULL) {
+    char discard;
+    /* drop packet(); a short read discards the rest of the packet */
+    if (read(tunif->fd, &discard, sizeof(discard)) != -1) {
+      MIB2_STATS_NETIF_INC(netif, ifindiscards);
+    }
+    LWIP_DEBUGF(NETIF_DEBUG, ("tunif_input: could not allocate pbuf\n"));
     return NULL;
-    }*/
+  }
 
-  /* We allocate a pbuf chain of pbufs from the pool. */
-  p = pbuf_alloc(PBUF_LINK, (u16_t)len, PBUF_POOL);
+  iovcnt = tunif_fill_iov(p, iov, TUNIF_MAX_IOV);
+  if (iovcnt < 0) {
+    /* more pbufs than TUNIF_MAX_IOV: read what fits */
+    iovcnt = TUNIF_MAX_IOV;
+  }
 
-  if (p != NULL) {
-    pbuf_take(p, buf, (u16_t)len);
-    /* acknowledge that packet has been read(); */
-  } else {
-    /* drop packet(); */
+  /* Obtain the size of the packet and put it into the "len"
+     variable. */
+  len = readv(tunif->fd, iov, iovcnt);
+  if (len <= 0) {
+    if ((len == -1) && (errno != EINTR) && (errno != EAGAIN)) {
+      perror("tunif: read");
+    }
+    return NULL;
   }
+  MIB2_STATS_NETIF_ADD(netif, ifinoctets, len);
 
+  /* acknowledge that packet has been read(); trim the chain to the packet,
+     returning the unused pbufs to the pool. */
+  pbuf_realloc(p, (u16_t)len);
+  tunif->rx = NULL;
   return p;
 }
 /*-----------------------------------------------------------------------------------*/
-static void 
+#if !NO_SYS
+static void
 tunif_thread(void *arg)
 {
   struct netif *netif;
@@ -195,6 +551,12 @@ tunif_thread(void *arg)
   netif = (struct netif *)arg;
   tunif = (struct tunif *)netif->state;
 
+#if TUNIF_IOURING
+  while (tunif->rx_ring != NULL) {
+    iouring_wait(tunif->rx_ring, IOURING_WAIT_FOREVER);
+  }
+#endif /* TUNIF_IOURING */
+
   while (1) {
     FD_ZERO(&fdset);
     FD_SET(tunif->fd, &fdset);
@@ -203,13 +565,14 @@ tunif_thread(void *arg)
     ret = select(tunif->fd + 1, &fdset, NULL, NULL, NULL);
 
     if (ret == 1) {
-      /* Handle incoming packet. */
+      /* Handle incoming packets. */
       tunif_input(netif);
     } else if (ret == -1) {
       perror("tunif_thread: select");
     }
   }
 }
+#endif /* !NO_SYS */
 /*-----------------------------------------------------------------------------------*/
 /*
  * tunif_output():
@@ -220,18 +583,27 @@ tunif_thread(void *arg)
  *
  */
 /*-----------------------------------------------------------------------------------*/
+#if LWIP_IPV4
 static err_t
 tunif_output(struct netif *netif, struct pbuf *p,
              const ip4_addr_t *ipaddr)
 {
-  struct tunif *tunif;
   LWIP_UNUSED_ARG(ipaddr);
 
-  tunif = (struct tunif *)netif->state;
+  return low_level_output(netif, p);
+}
+#endif /* LWIP_IPV4 */
 
-  return low_level_output(tunif, p);
+#if LWIP_IPV6
+static err_t
+tunif_output_ip6(struct netif *netif, struct pbuf *p,
+                 const ip6_addr_t *ipaddr)
+{
+  LWIP_UNUSED_ARG(ipaddr);
 
+  return low_level_output(netif, p);
 }
+#endif /* LWIP_IPV6 */
 /*-----------------------------------------------------------------------------------*/
 /*
  * tunif_input():
@@ -243,31 +615,115 @@ tunif_output(struct netif *netif, struct pbuf *p,
  *
  */
 /*-----------------------------------------------------------------------------------*/
+#if !NO_SYS && (TUNIF_RX_BATCH > 1)
+/* Runs in tcpip_thread: pass a burst of packets to the stack */
+static void
+tunif_input_batch(void *arg)
+{
+  struct tunif_rx_batch *batch = (struct tunif_rx_batch *)arg;
+  u16_t i;
+
+  for (i = 0; i < batch->count; i++) {
+    if (ip_input(batch->p[i], batch->netif) != ERR_OK) {
+      LWIP_DEBUGF(NETIF_DEBUG, ("tunif_input: netif input error\n"));
+      pbuf_free(batch->p[i]);
+    }
+  }
+  mem_free(batch);
+}
+#endif /* !NO_SYS && (TUNIF_RX_BATCH > 1) */
+
+/* Pass up the packets collected by tunif_rx_packet() */
+static void
+tunif_rx_flush(struct netif *netif)
+{
+#if !NO_SYS && (TUNIF_RX_BATCH > 1)
+  struct tunif *tunif = (struct tunif *)netif->state;
+  struct tunif_rx_batch *batch = tunif->batch;
+
+  if (batch == NULL) {
+    return;
+  }
+  tunif->batch = NULL;
+  if (tcpip_try_callback(tunif_input_batch, batch) != ERR_OK) {
+    LWIP_DEBUGF(NETIF_DEBUG, ("tunif_input: tcpip mbox full, dropping %d packets\n", batch->count));
+    while (batch->count > 0) {
+      pbuf_free(batch->p[--batch->count]);
+      MIB2_STATS_NETIF_INC(netif, ifindiscards);
+    }
+    mem_free(batch);
+  }
+#else /* !NO_SYS && (TUNIF_RX_BATCH > 1) */
+  LWIP_UNUSED_ARG(netif);
+#endif /* !NO_SYS && (TUNIF_RX_BATCH > 1) */
+}
+
+static void
+tunif_rx_packet(struct netif *netif, struct pbuf *p)
+{
+#if !NO_SYS && (TUNIF_RX_BATCH > 1)
+  struct tunif *tunif = (struct tunif *)netif->state;
+
+  if (netif->input == tcpip_input) {
+    /* ip_input() is what tcpip_input() would call for this netif, call it
+       for the whole burst from a single tcpip_thread message */
+    if (tunif->batch == NULL) {
+      tunif->batch = (struct tunif_rx_batch *)mem_malloc(sizeof(struct tunif_rx_batch));
+      if (tunif->batch != NULL) {
+        tunif->batch->netif = netif;
+        tunif->batch->count = 0;
+      }
+    }
+    if (tunif->batch != NULL) {
+      tunif->batch->p[tunif->batch->count++] = p;
+      if (tunif->batch->count == TUNIF_RX_BATCH) {
+        tunif_rx_flush(netif);
+      }
+      return;
+    }
+  }
+#endif /* !NO_SYS && (TUNIF_RX_BATCH > 1) */
+
+  if (netif->input(p, netif) != ERR_OK) {
+    LWIP_DEBUGF(NETIF_DEBUG, ("tunif_input: netif input error\n"));
+    pbuf_free(p);
+  }
+}
+
 static void
 tunif_input(struct netif *netif)
 {
-  struct tunif *tunif;
   struct pbuf *p;
+  u16_t count = 0;
 
+  while ((count < TUNIF_RX_BATCH) && ((p = low_level_input(netif)) != NULL)) {
+    tunif_rx_packet(netif, p);
+    count++;
+  }
+  tunif_rx_flush(netif);
 
-  tunif = (struct tunif *)netif->state;
+  if (count == 0) {
+    LWIP_DEBUGF(TUNIF_DEBUG, ("tunif_input: low_level_input returned NULL\n"));
+  }
+}
 
-  p = low_level_input(tunif);
+#if TUNIF_IOURING
+/* Called by iouring_wait() for every packet read, and with p == NULL after
+   the last one of a burst */
+static void
+tunif_iouring_input(void *arg, struct pbuf *p, const void *prefix)
+{
+  struct netif *netif = (struct netif *)arg;
 
+  LWIP_UNUSED_ARG(prefix);
   if (p == NULL) {
-    LWIP_DEBUGF(TUNIF_DEBUG, ("tunif_input: low_level_input returned NULL\n"));
+    tunif_rx_flush(netif);
     return;
   }
-
-#if 0
-/* CS: ip_lookup() was removed */
-  if (ip_lookup(p->payload, netif)) {
-#endif
-    netif->input(p, netif);
-#if 0
-  }
-#endif
+  MIB2_STATS_NETIF_ADD(netif, ifinoctets, p->tot_len);
+  tunif_rx_packet(netif, p);
 }
+#endif /* TUNIF_IOURING */
 /*-----------------------------------------------------------------------------------*/
 /*
  * tunif_init():
@@ -287,16 +743,93 @@ tunif_init(struct netif *netif)
   if (!tunif) {
     return ERR_MEM;
   }
+  memset(tunif, 0, sizeof(struct tunif));
   netif->state = tunif;
+  MIB2_INIT_NETIF(netif, snmp_ifType_other, 100000000);
+
   netif->name[0] = IFNAME0;
   netif->name[1] = IFNAME1;
+#if LWIP_IPV4
   netif->output = tunif_output;
-
+#endif /* LWIP_IPV4 */
+#if LWIP_IPV6
+  netif->output_ip6 = tunif_output_ip6;
+#endif /* LWIP_IPV6 */
+  netif->mtu = TUNIF_MTU;
 
   low_level_init(netif);
   return ERR_OK;
 }
 /*-----------------------------------------------------------------------------------*/
+#if NO_SYS
 
-#endif /* !NO_SYS */
-#endif /* LWIP_IPV4 */
+int
+tunif_select(struct netif *netif)
+{
+  fd_set fdset;
+  int ret;
+  struct timeval tv;
+  struct tunif *tunif = (struct tunif *)netif->state;
+  u32_t msecs = sys_timeouts_sleeptime();
+
+#if TUNIF_IOURING
+  if (tunif->rx_ring != NULL) {
+    /* SYS_TIMEOUTS_SLEEPTIME_INFINITE is IOURING_WAIT_FOREVER */
+    return iouring_wait(tunif->rx_ring, msecs);
+  }
+#endif /* TUNIF_IOURING */
+
+  tv.tv_sec = msecs / 1000;
+  tv.tv_usec = (msecs % 1000) * 1000;
+
+  FD_ZERO(&fdset);
+  FD_SET(tunif->fd, &fdset);
+
+  ret = select(tunif->fd + 1, &fdset, NULL, NULL, &tv);
+  if (ret > 0) {
+    tunif_input(netif);
+  }
+  return ret;
+}
+
+#ifdef LWIP_UNIX_LINUX
+/* evloop input function when reading with read() */
+static int
+tunif_evloop_input(void *arg)
+{
+  tunif_input((struct netif *)arg);
+  return 0;
+}
+
+#if TUNIF_IOURING
+/* evloop input and flush functions when reading with io_uring */
+static int
+tunif_evloop_ring_input(void *arg)
+{
+  return iouring_wait((struct iouring *)arg, 0);
+}
+
+static void
+tunif_evloop_ring_flush(void *arg)
+{
+  iouring_submit((struct iouring *)arg);
+}
+#endif /* TUNIF_IOURING */
+
+/* Let evloop_run() read 'netif' instead of tunif_select() */
+err_t
+tunif_evloop_add(struct netif *netif)
+{
+  struct tunif *tunif = (struct tunif *)netif->state;
+
+#if TUNIF_IOURING
+  if (tunif->rx_ring != NULL) {
+    return evloop_add(iouring_fd(tunif->rx_ring), tunif_evloop_ring_input, tunif_evloop_ring_flush,
+                      tunif->rx_ring);
+  }
+#endif /* TUNIF_IOURING */
+  return evloop_add(tunif->fd, tunif_evloop_input, NULL, netif);
+}
+#endif /* LWIP_UNIX_LINUX */
+
+#endif /* NO_SYS */
@@ -30,17 +30,34 @@
  *
  */
 
+/*
+ * unixif connects two lwIP processes (simrouter and simnode) through shared
+ * memory: the server creates a memory region with one single producer/single
+ * consumer packet ring per direction and hands it, together with two doorbell
+ * descriptors (eventfd on Linux, pipes elsewhere), to the client over the
+ * Unix domain socket /tmp/unixif. Packets are copied into and out of the
+ * rings without system calls; a doorbell is only rung when the receiving
+ * side has run out of packets and announced that it is going to sleep.
+ */
+/* for memfd_create() */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include "lwip/debug.h"
 
 #include <fcntl.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/uio.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/select.h>
 /*#include <netinet/in.h> */
 /*#include <arpa/inet.h> */
 
@@ -50,8 +67,8 @@
 #include "lwip/def.h"
 #include "lwip/mem.h"
 #include "lwip/pbuf.h"
-#include "netif/list.h"
 #include "netif/unixif.h"
+#include "netif/shaper.h"
 #include "lwip/sys.h"
 #include "lwip/timeouts.h"
 
@@ -60,28 +77,93 @@
 
 #include "netif/tcpdump.h"
 
-#define UNIXIF_BPS 512000
+#if defined(LWIP_UNIX_LINUX)
+#include <sys/eventfd.h>
+#define UNIXIF_EVENTFD 1
+#else
+#define UNIXIF_EVENTFD 0
+#endif
+
+/** If > 0, emulate a link of that many bits per second: packets are queued
+ * (UNIXIF_QUEUELEN at most) and written to the ring by a shaper, see
+ * netif/shaper.h. 0 writes packets to the ring right away. Setting
+ * UNIXIF_SHAPER in the environment (e.g. "rate=2M,queues=4,mode=drr", see
+ * shaper_config_parse()) overrides this at runtime. */
+#ifndef UNIXIF_BPS
+#define UNIXIF_BPS 0
+#endif
+#ifndef UNIXIF_QUEUELEN
 #define UNIXIF_QUEUELEN 6
+#endif
 /*#define UNIXIF_DROP_FIRST      */
 
+/** Number of packets each ring holds, must be a power of 2 */
+#ifndef UNIXIF_RING_SLOTS
+#define UNIXIF_RING_SLOTS 256
+#endif
+/** Biggest packet carried */
+#ifndef UNIXIF_MTU
+#define UNIXIF_MTU 1500
+#endif
+
+#if (UNIXIF_RING_SLOTS & (UNIXIF_RING_SLOTS - 1)) != 0
+#error "UNIXIF_RING_SLOTS must be a power of 2"
+#endif
+
 #ifndef UNIXIF_DEBUG
 #define UNIXIF_DEBUG LWIP_DBG_OFF
 #endif
 
-struct unixif_buf {
-  struct pbuf *p;
-  unsigned short len, tot_len;
-  void *payload;
+#define UNIXIF_MAGIC     0x6c775531UL
+#define UNIXIF_CACHELINE 64
+
+struct unixif_slot {
+  u32_t len;
+  u8_t data[UNIXIF_MTU];
+};
+
+/* One direction. The indexes run freely and are only written by one side
+   each: head by the consumer, tail by the producer. */
+struct unixif_ring {
+  u32_t head;
+  u8_t pad0[UNIXIF_CACHELINE - sizeof(u32_t)];
+  u32_t tail;
+  u8_t pad1[UNIXIF_CACHELINE - sizeof(u32_t)];
+  /* set by the consumer before it waits for the doorbell */
+  u32_t sleeping;
+  u8_t pad2[UNIXIF_CACHELINE - sizeof(u32_t)];
+  struct unixif_slot slot[UNIXIF_RING_SLOTS];
 };
 
+/* The shared memory region: ring[0] carries packets from the server to the
+   client, ring[1] from the client to the server */
+struct unixif_shm {
+  u32_t magic;
+  u32_t slots;
+  u32_t mtu;
+  u8_t pad[UNIXIF_CACHELINE - 3 * sizeof(u32_t)];
+  struct unixif_ring ring[2];
+};
+
+/* Descriptors passed from the server to the client: the memory region and
+   read/write ends of the doorbell of each ring (the same eventfd twice) */
+#define UNIXIF_FD_SHM   0
+#define UNIXIF_FD_BELL  1
+#define UNIXIF_NUM_FDS  5
+
 struct unixif {
+  /* the connection the rings were set up over, used to notice the peer
+     going away */
   int fd;
-  sys_sem_t sem;
-  struct list *q;
+  struct unixif_shm *shm;
+  struct unixif_ring *rx, *tx;
+  /* wait on rx_bell for packets in rx, ring tx_bell after adding to tx */
+  int rx_bell, tx_bell;
+  /* NULL if packets are written to the ring right away */
+  struct shaper *shaper;
 };
 
 static void unixif_thread(void *arg);
-static void unixif_thread2(void *arg);
 
 /*-----------------------------------------------------------------------------------*/
 static int
@@ -188,238 +270,311 @@ unix_socket_server(const char *name)
   return(fd);
 }
 /*-----------------------------------------------------------------------------------*/
-static void
-unixif_input_handler(void *data)
+/* Create the shared memory region and the doorbells, fds[] as passed to the
+   client */
+static struct unixif_shm *
+unixif_shm_create(int *fds)
 {
-  struct netif *netif;
-  struct unixif *unixif;
-  char buf[1532];
-  int len, plen;
-  struct pbuf *p;
-
-  netif = (struct netif *)data;
-  unixif = (struct unixif *)netif->state;
+  struct unixif_shm *shm;
+  int i;
+#if !defined(LWIP_UNIX_LINUX)
+  char name[] = "/tmp/unixif-XXXXXX";
+#endif
 
-  len = read(unixif->fd, &plen, sizeof(int));
-  if (len == -1) {
-    perror("unixif_irq_handler: read");
-    abort();
+#if defined(LWIP_UNIX_LINUX)
+  fds[UNIXIF_FD_SHM] = memfd_create("unixif", MFD_CLOEXEC);
+#else
+  /* an unlinked file does as well, the descriptor is all that is passed */
+  fds[UNIXIF_FD_SHM] = mkstemp(name);
+  if (fds[UNIXIF_FD_SHM] != -1) {
+    unlink(name);
   }
-
-  LWIP_DEBUGF(UNIXIF_DEBUG, ("unixif_irq_handler: len == %d plen == %d bytes\n", len, plen));  
-  if (len == sizeof(int)) {
-
-    if (plen < 20 || plen > 1500) {
-      LWIP_DEBUGF(UNIXIF_DEBUG, ("plen %d!\n", plen));
-      return;
+#endif
+  if ((fds[UNIXIF_FD_SHM] == -1) ||
+      (ftruncate(fds[UNIXIF_FD_SHM], sizeof(struct unixif_shm)) == -1)) {
+    perror("unixif: shared memory");
+    return NULL;
+  }
+  shm = (struct unixif_shm *)mmap(NULL, sizeof(struct unixif_shm), PROT_READ | PROT_WRITE,
+                                  MAP_SHARED, fds[UNIXIF_FD_SHM], 0);
+  if (shm == MAP_FAILED) {
+    perror("unixif: mmap");
+    return NULL;
+  }
+  /* the file is zero filled: both rings are empty */
+  shm->magic = UNIXIF_MAGIC;
+  shm->slots = UNIXIF_RING_SLOTS;
+  shm->mtu = UNIXIF_MTU;
+
+  for (i = 0; i < 2; i++) {
+#if UNIXIF_EVENTFD
+    int bell = eventfd(0, EFD_CLOEXEC);
+    if (bell == -1) {
+      perror("unixif: eventfd");
+      return NULL;
     }
-
-    len = read(unixif->fd, buf, plen);
-    if (len == -1) {
-      perror("unixif_irq_handler: read");
-      abort();
+    fds[UNIXIF_FD_BELL + 2 * i] = bell;
+    fds[UNIXIF_FD_BELL + 2 * i + 1] = bell;
+#else
+    if (pipe(&fds[UNIXIF_FD_BELL + 2 * i]) == -1) {
+      perror("unixif: pipe");
+      return NULL;
     }
-    LWIP_DEBUGF(UNIXIF_DEBUG, ("unixif_irq_handler: read %d bytes\n", len));
-    p = pbuf_alloc(PBUF_LINK, len, PBUF_POOL);
-
-    if (p != NULL) {
-      pbuf_take(p, buf, len);
-      pbuf_realloc(p, len);
-      LINK_STATS_INC(link.recv);
-#if LWIP_IPV4 && LWIP_TCP
-      tcpdump(p, netif);
 #endif
-      netif->input(p, netif);
-    } else {
-      LWIP_DEBUGF(UNIXIF_DEBUG, ("unixif_irq_handler: could not allocate pbuf\n"));
-    }
-
-
   }
+  return shm;
 }
 /*-----------------------------------------------------------------------------------*/
-static void 
-unixif_thread(void *arg)
+/* Pass the descriptors over the connection to the client */
+static int
+unixif_send_fds(int fd, const int *fds)
 {
-  struct netif *netif;
-  struct unixif *unixif;
-
-  LWIP_DEBUGF(UNIXIF_DEBUG, ("unixif_thread: started.\n"));
-
-  netif = (struct netif *)arg;
-  unixif = (struct unixif *)netif->state;
-
-
-  while (1) {
-    sys_sem_wait(&unixif->sem);
-    unixif_input_handler(netif);
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(UNIXIF_NUM_FDS * sizeof(int))];
+  } control;
+  char c = 0;
+
+  memset(&msg, 0, sizeof(msg));
+  memset(&control, 0, sizeof(control));
+  iov.iov_base = &c;
+  iov.iov_len = 1;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(UNIXIF_NUM_FDS * sizeof(int));
+  memcpy(CMSG_DATA(cmsg), fds, UNIXIF_NUM_FDS * sizeof(int));
+
+  return (sendmsg(fd, &msg, 0) == 1) ? 0 : -1;
+}
+/*-----------------------------------------------------------------------------------*/
+/* Receive the descriptors sent by unixif_send_fds() */
+static int
+unixif_recv_fds(int fd, int *fds)
+{
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(UNIXIF_NUM_FDS * sizeof(int))];
+  } control;
+  char c;
+
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base = &c;
+  iov.iov_len = 1;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+
+  if (recvmsg(fd, &msg, 0) != 1) {
+    return -1;
   }
-
+  cmsg = CMSG_FIRSTHDR(&msg);
+  if ((cmsg == NULL) || (cmsg->cmsg_level != SOL_SOCKET) || (cmsg->cmsg_type != SCM_RIGHTS) ||
+      (cmsg->cmsg_len != CMSG_LEN(UNIXIF_NUM_FDS * sizeof(int)))) {
+    return -1;
+  }
+  memcpy(fds, CMSG_DATA(cmsg), UNIXIF_NUM_FDS * sizeof(int));
+  return 0;
 }
 /*-----------------------------------------------------------------------------------*/
-static void 
-unixif_thread2(void *arg)
+/* Copy 'p' into the next free slot of the tx ring */
+static err_t
+unixif_ring_put(struct netif *netif, struct pbuf *p)
 {
-  struct netif *netif;
-  struct unixif *unixif;
+  struct unixif *unixif = (struct unixif *)netif->state;
+  struct unixif_ring *ring = unixif->tx;
+  struct unixif_slot *slot;
+  u32_t tail;
+
+  if (p->tot_len > UNIXIF_MTU) {
+    LWIP_DEBUGF(UNIXIF_DEBUG, ("unixif_output: packet of %d bytes too long\n", p->tot_len));
+    LINK_STATS_INC(link.lenerr);
+    return ERR_BUF;
+  }
+  tail = ring->tail;
+  if (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == UNIXIF_RING_SLOTS) {
+    LWIP_DEBUGF(UNIXIF_DEBUG, ("unixif_output: ring full, drop\n"));
+    LINK_STATS_INC(link.drop);
+    return ERR_MEM;
+  }
+  slot = &ring->slot[tail & (UNIXIF_RING_SLOTS - 1)];
+  pbuf_copy_partial(p, slot->data, p->tot_len, 0);
+  slot->len = p->tot_len;
+  __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+
+  /* pairs with the fence in unixif_ring_wait(): either the consumer sees the
+     new tail or we see it sleeping */
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&ring->sleeping, __ATOMIC_RELAXED) &&
+      __atomic_exchange_n(&ring->sleeping, 0, __ATOMIC_RELAXED)) {
+    u64_t one = 1;
+    if (write(unixif->tx_bell, &one, sizeof(one)) == -1) {
+      perror("unixif_output: doorbell");
+    }
+  }
+  tcpdump_packet(p, netif, TCPDUMP_DIR_OUT);
+  LINK_STATS_INC(link.xmit);
+  return ERR_OK;
+}
+/*-----------------------------------------------------------------------------------*/
+/* Sleep until the peer has put something into the rx ring. Returns -1 if the
+   peer has gone away. */
+static int
+unixif_ring_wait(struct unixif *unixif)
+{
+  struct unixif_ring *ring = unixif->rx;
   fd_set fdset;
+  int ret = 0;
 
-  LWIP_DEBUGF(UNIXIF_DEBUG, ("unixif_thread2: started.\n"));
-
-  netif = (struct netif *)arg;
-  unixif = (struct unixif *)netif->state;
-
-  while (1) {
+  __atomic_store_n(&ring->sleeping, 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&ring->tail, __ATOMIC_RELAXED) == ring->head) {
     FD_ZERO(&fdset);
+    FD_SET(unixif->rx_bell, &fdset);
     FD_SET(unixif->fd, &fdset);
-
-    if (select(unixif->fd + 1, &fdset, NULL, NULL, NULL) > 0) {
-      sys_sem_signal(&unixif->sem);
+    if (select(LWIP_MAX(unixif->rx_bell, unixif->fd) + 1, &fdset, NULL, NULL, NULL) > 0) {
+      if (FD_ISSET(unixif->rx_bell, &fdset)) {
+        u64_t count;
+        if (read(unixif->rx_bell, &count, sizeof(count)) == -1) {
+          perror("unixif_thread: doorbell");
+        }
+      }
+      if (FD_ISSET(unixif->fd, &fdset)) {
+        /* nothing is sent over the connection after the setup, this is
+           the peer closing it */
+        ret = -1;
+      }
     }
   }
+  __atomic_store_n(&ring->sleeping, 0, __ATOMIC_RELAXED);
+  return ret;
 }
 /*-----------------------------------------------------------------------------------*/
-static void unixif_output_timeout(void *arg);
-
-static err_t
-unixif_output(struct netif *netif, struct pbuf *p, const ip4_addr_t *ipaddr)
+/* Pass all packets in the rx ring to the stack */
+static void
+unixif_input_handler(struct netif *netif)
 {
-  struct unixif *unixif;
-  struct unixif_buf *buf;
-  LWIP_UNUSED_ARG(ipaddr);
-
-  unixif = (struct unixif *)netif->state;
-
-  buf = (struct unixif_buf *)malloc(sizeof(struct unixif_buf));
-  buf->p = p;
-  buf->len = p->len;
-  buf->tot_len = p->tot_len;
-  buf->payload = p->payload;
-
-  if (list_elems(unixif->q) == 0) {
-    pbuf_ref(p);
-    list_push(unixif->q, buf);
-    sys_timeout((double)p->tot_len * 8000.0 / UNIXIF_BPS, unixif_output_timeout,
-                netif);
-
-    LWIP_DEBUGF(UNIXIF_DEBUG, ("unixif_output: first on list\n"));
-
-  } else {
-    pbuf_ref(p);
-    if (list_push(unixif->q, buf) == 0) {
-#ifdef UNIXIF_DROP_FIRST
-      struct unixif_buf *buf2;
-
-      buf2 = list_pop(unixif->q);
-      pbuf_free(buf2->p);
-      free(buf2);
-      list_push(unixif->q, buf);
-#else
-      free(buf);
-      pbuf_free(p);
+  struct unixif *unixif = (struct unixif *)netif->state;
+  struct unixif_ring *ring = unixif->rx;
+  struct unixif_slot *slot;
+  struct pbuf *p;
+  u32_t head, tail;
+  u16_t len;
 
-      LWIP_DEBUGF(UNIXIF_DEBUG, ("unixif_output: drop\n"));
+  head = ring->head;
+  tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+  for (; head != tail; head++) {
+    slot = &ring->slot[head & (UNIXIF_RING_SLOTS - 1)];
+    len = (u16_t)LWIP_MIN(slot->len, UNIXIF_MTU);
+    LWIP_DEBUGF(UNIXIF_DEBUG, ("unixif_input_handler: %d bytes\n", len));
 
-#endif /* UNIXIF_DROP_FIRST */
-      LINK_STATS_INC(link.drop);
+    p = pbuf_alloc(PBUF_LINK, len, PBUF_POOL);
+    if (p != NULL) {
+      pbuf_take(p, slot->data, len);
+    }
+    /* the slot may be reused from here on */
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
 
+    if (p != NULL) {
+      LINK_STATS_INC(link.recv);
+      tcpdump_packet(p, netif, TCPDUMP_DIR_IN);
+      if (netif->input(p, netif) != ERR_OK) {
+        pbuf_free(p);
+      }
     } else {
-      LWIP_DEBUGF(UNIXIF_DEBUG, ("unixif_output: on list\n"));
+      LWIP_DEBUGF(UNIXIF_DEBUG, ("unixif_input_handler: could not allocate pbuf\n"));
+      LINK_STATS_INC(link.memerr);
+      LINK_STATS_INC(link.drop);
     }
-
   }
-  return ERR_OK;
 }
 /*-----------------------------------------------------------------------------------*/
 static void
-unixif_output_timeout(void *arg)
+unixif_thread(void *arg)
 {
-  struct pbuf *p, *q;
-  int i, j, len;
-  unsigned short plen, ptot_len;
-  struct unixif_buf *buf;
-  void *payload;
   struct netif *netif;
   struct unixif *unixif;
-  char *data;
+
+  LWIP_DEBUGF(UNIXIF_DEBUG, ("unixif_thread: started.\n"));
 
   netif = (struct netif *)arg;
   unixif = (struct unixif *)netif->state;
 
-  LWIP_DEBUGF(UNIXIF_DEBUG, ("unixif_output_timeout\n"));
-
-  /*  buf = unixif->q[0];
-  unixif->q[0] = unixif->q[1];
-  unixif->q[1] = NULL;*/
-  buf = (struct unixif_buf *)list_pop(unixif->q);
-
-  p = buf->p;
-
-  plen = p->len;
-  ptot_len = p->tot_len;
-  payload = p->payload;
-
-  p->len = buf->len;
-  p->tot_len = buf->tot_len;
-  p->payload = buf->payload;
-
-
-  if (p->tot_len == 0) {
+  do {
+    unixif_input_handler(netif);
+  } while (unixif_ring_wait(unixif) == 0);
 
-    LWIP_DEBUGF(UNIXIF_DEBUG, ("p->len!\n"));
-    abort();
-  }
-  data = (char *)malloc(p->tot_len);
+  LWIP_DEBUGF(UNIXIF_DEBUG, ("unixif_thread: peer closed the connection\n"));
+  printf("unixif: peer has gone away\n");
+}
+/*-----------------------------------------------------------------------------------*/
+static err_t
+unixif_output(struct netif *netif, struct pbuf *p, const ip4_addr_t *ipaddr)
+{
+  struct unixif *unixif = (struct unixif *)netif->state;
+  LWIP_UNUSED_ARG(ipaddr);
 
-  i = 0;
-  for(q = p; q != NULL; q = q->next) {
-    for(j = 0; j < q->len; j++) {
-      data[i] = ((char *)q->payload)[j];
-      i++;
-    }
+  if (unixif->shaper != NULL) {
+    return shaper_output(unixif->shaper, p);
   }
+  /* a full ring is a lost packet, not an error of the caller */
+  unixif_ring_put(netif, p);
+  return ERR_OK;
+}
+/*-----------------------------------------------------------------------------------*/
+static err_t
+unixif_init(struct netif *netif, struct unixif *unixif)
+{
+  struct shaper_config config;
+  const char *shaper_str;
 
-  LWIP_DEBUGF(UNIXIF_DEBUG, ("unixif_output: sending %d (%d) bytes\n",
-              p->len, p->tot_len));
-
-  len = p->tot_len;
-  if (write(unixif->fd, &len, sizeof(int)) == -1) {
-    perror("unixif_output: write");
-    abort();
-  }
+  netif->state = unixif;
+  netif->name[0] = 'u';
+  netif->name[1] = 'n';
+  netif->output = unixif_output;
+  netif->mtu = UNIXIF_MTU;
 
-  if (write(unixif->fd, data, p->tot_len) == -1) {
-    perror("unixif_output: write");
+  unixif->shaper = NULL;
+  shaper_config_init(&config);
+  config.rate = UNIXIF_BPS;
+  config.burst = UNIXIF_MTU;
+  config.limit = UNIXIF_QUEUELEN;
+#ifdef UNIXIF_DROP_FIRST
+  config.drop_head = 1;
+#endif /* UNIXIF_DROP_FIRST */
+  shaper_str = getenv("UNIXIF_SHAPER");
+  if ((shaper_str != NULL) && (shaper_config_parse(&config, shaper_str) != 0)) {
+    fprintf(stderr, "unixif_init: invalid UNIXIF_SHAPER\n");
     abort();
   }
-#if LWIP_IPV4 && LWIP_TCP
-  tcpdump(p, netif);
-#endif
-  LINK_STATS_INC(link.xmit);
-
-  free(data);
-  free(buf);
-  p->len = plen;
-  p->tot_len = ptot_len;
-  p->payload = payload;
-
-  pbuf_free(p);
-
-  /*  if (unixif->q[0] != NULL) {
-    sys_timeout(unixif->q[0]->tot_len * 8000 / UNIXIF_BPS,
-    unixif_output_timeout, netif);
-    }*/
-  if (list_elems(unixif->q) > 0) {
-    sys_timeout(((struct unixif_buf *)list_first(unixif->q))->tot_len *
-                8000.0 / UNIXIF_BPS,
-                unixif_output_timeout, netif);
+  if ((shaper_str != NULL) || (UNIXIF_BPS > 0)) {
+    /* all packets go through the shaper thread: the tx ring still has a
+       single producer */
+    unixif->shaper = shaper_new(&config, unixif_ring_put, netif);
+    if (unixif->shaper == NULL) {
+      return ERR_MEM;
+    }
   }
+  sys_thread_new("unixif_thread", unixif_thread, netif, DEFAULT_THREAD_STACKSIZE, DEFAULT_THREAD_PRIO);
+  return ERR_OK;
 }
 /*-----------------------------------------------------------------------------------*/
 err_t
 unixif_init_server(struct netif *netif)
 {
   int fd, fd2;
+  int fds[UNIXIF_NUM_FDS];
   struct sockaddr_un addr;
   socklen_t len;
   struct unixif *unixif;
@@ -436,11 +591,10 @@ unixif_init_server(struct netif *netif)
   if (!unixif) {
     return ERR_MEM;
   }
-  netif->state = unixif;
-  netif->name[0] = 'u';
-  netif->name[1] = 'n';
-  netif->output = unixif_output;
-  unixif->q = list_new(UNIXIF_QUEUELEN);
+  unixif->shm = unixif_shm_create(fds);
+  if (unixif->shm == NULL) {
+    abort();
+  }
 
   printf("Now run ./simnode.\n");
   len = sizeof(addr);
@@ -453,40 +607,77 @@ unixif_init_server(struct netif *netif)
 
   LWIP_DEBUGF(UNIXIF_DEBUG, ("unixif_accept: %d\n", fd2));
 
-  unixif->fd = fd2;
-  if(sys_sem_new(&unixif->sem, 0) != ERR_OK) {
-    LWIP_ASSERT("Failed to create semaphore", 0);
+  if (unixif_send_fds(fd2, fds) == -1) {
+    perror("unixif_server: sendmsg");
+    abort();
   }
-  sys_thread_new("unixif_thread", unixif_thread, netif, DEFAULT_THREAD_STACKSIZE, DEFAULT_THREAD_PRIO);
-  sys_thread_new("unixif_thread2", unixif_thread2, netif, DEFAULT_THREAD_STACKSIZE, DEFAULT_THREAD_PRIO);
-  return ERR_OK;
+  close(fd);
+
+  unixif->fd = fd2;
+  unixif->tx = &unixif->shm->ring[0];
+  unixif->rx = &unixif->shm->ring[1];
+  unixif->tx_bell = fds[UNIXIF_FD_BELL + 1];
+  unixif->rx_bell = fds[UNIXIF_FD_BELL + 2];
+  /* the other ends are the client's */
+#if !UNIXIF_EVENTFD
+  close(fds[UNIXIF_FD_BELL]);
+  close(fds[UNIXIF_FD_BELL + 3]);
+#endif
+  close(fds[UNIXIF_FD_SHM]);
+
+  return unixif_init(netif, unixif);
 }
 /*-----------------------------------------------------------------------------------*/
 err_t
 unixif_init_client(struct netif *netif)
 {
   struct unixif *unixif;
+  int fds[UNIXIF_NUM_FDS];
+
   unixif = (struct unixif *)malloc(sizeof(struct unixif));
   if (!unixif) {
     return ERR_MEM;
   }
-  netif->state = unixif;
-  netif->name[0] = 'u';
-  netif->name[1] = 'n';
-  netif->output = unixif_output;
 
   unixif->fd = unix_socket_client("/tmp/unixif");
   if (unixif->fd == -1) {
     perror("unixif_init");
     abort();
   }
-  unixif->q = list_new(UNIXIF_QUEUELEN);
-  if(sys_sem_new(&unixif->sem, 0) != ERR_OK) {
-    LWIP_ASSERT("Failed to create semaphore", 0);
+  if (unixif_recv_fds(unixif->fd, fds) == -1) {
+    perror("unixif_init: recvmsg");
+    abort();
   }
-  sys_thread_new("unixif_thread", unixif_thread, netif, DEFAULT_THREAD_STACKSIZE, DEFAULT_THREAD_PRIO);
-  sys_thread_new("unixif_thread2", unixif_thread2, netif, DEFAULT_THREAD_STACKSIZE, DEFAULT_THREAD_PRIO);
-  return ERR_OK;
+  unixif->shm = (struct unixif_shm *)mmap(NULL, sizeof(struct unixif_shm), PROT_READ | PROT_WRITE,
+                                          MAP_SHARED, fds[UNIXIF_FD_SHM], 0);
+  if (unixif->shm == MAP_FAILED) {
+    perror("unixif_init: mmap");
+    abort();
+  }
+  close(fds[UNIXIF_FD_SHM]);
+  if ((unixif->shm->magic != UNIXIF_MAGIC) || (unixif->shm->slots != UNIXIF_RING_SLOTS) ||
+      (unixif->shm->mtu != UNIXIF_MTU)) {
+    fprintf(stderr, "unixif_init: server uses a different UNIXIF_RING_SLOTS or UNIXIF_MTU\n");
+    abort();
+  }
+
+  unixif->rx = &unixif->shm->ring[0];
+  unixif->tx = &unixif->shm->ring[1];
+  unixif->rx_bell = fds[UNIXIF_FD_BELL];
+  unixif->tx_bell = fds[UNIXIF_FD_BELL + 3];
+#if !UNIXIF_EVENTFD
+  close(fds[UNIXIF_FD_BELL + 1]);
+  close(fds[UNIXIF_FD_BELL + 2]);
+#endif
+
+  return unixif_init(netif, unixif);
+}
+/*-----------------------------------------------------------------------------------*/
+/** The shaper of 'netif' (for its statistics), NULL if it has none */
+struct shaper *
+unixif_get_shaper(struct netif *netif)
+{
+  return ((struct unixif *)netif->state)->shaper;
 }
 /*-----------------------------------------------------------------------------------*/
 
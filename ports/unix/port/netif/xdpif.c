@@ -0,0 +1,874 @@
+/*
+ * Copyright (c) 2001-2003 Swedish Institute of Computer Science.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+ * SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ *
+ * This file is part of the lwIP TCP/IP stack.
+ *
+ */
+
+/*
+ * xdpif: Ethernet netif on top of an AF_XDP socket bound to one queue of a
+ * host interface. It works in copy mode, so any interface with XDP support
+ * (like veth) can be used:
+ *
+ * - The frames live in the UMEM, a region shared with the kernel. Its first
+ *   part holds the receive frames, which are handed to the kernel through
+ *   the fill ring. A received frame is passed up in a custom pbuf pointing
+ *   into the UMEM and given back to the fill ring once the stack frees the
+ *   pbuf. At most half of the receive frames are lent to the stack that way,
+ *   beyond that frames are copied into PBUF_POOL pbufs.
+ * - Sent frames are copied from the pbuf chain into a transmit frame of the
+ *   UMEM. The TX ring is kicked once for all frames sent during one iteration
+ *   of tcpip_thread (with NO_SYS, by the next xdpif_select()). The completion
+ *   ring returns the frames.
+ *
+ * The XDP program redirecting the queue to the socket is loaded with the
+ * bpf() system call directly, libbpf/libxdp are not needed. It is attached
+ * through a BPF link, so it goes away with the process. lwIP has its own MAC
+ * address: the program redirects every frame of the queue, no matter where
+ * it is sent to.
+ */
+
+#include "lwip/opt.h"
+
+#include "lwip/debug.h"
+#include "lwip/def.h"
+#include "lwip/mem.h"
+#include "lwip/stats.h"
+#include "lwip/snmp.h"
+#include "lwip/pbuf.h"
+#include "lwip/sys.h"
+#include "lwip/timeouts.h"
+#include "netif/etharp.h"
+#include "lwip/ethip6.h"
+#if !NO_SYS
+#include "lwip/tcpip.h"
+#endif /* !NO_SYS */
+
+#include "netif/xdpif.h"
+#if NO_SYS
+#include "arch/evloop.h"
+#endif /* NO_SYS */
+
+#ifdef LWIP_UNIX_LINUX
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <net/if.h>
+#include <linux/bpf.h>
+#include <linux/if_xdp.h>
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+/* Define those to better describe your network interface. */
+#define IFNAME0 'x'
+#define IFNAME1 'd'
+
+#ifndef XDPIF_DEBUG
+#define XDPIF_DEBUG LWIP_DBG_OFF
+#endif
+
+/** Host interface used if XDPIF_IFNAME is not set */
+#ifndef XDPIF_DEFAULT_IF
+#define XDPIF_DEFAULT_IF "veth0"
+#endif
+
+/** Size of a UMEM frame (a power of two, at least 2048) */
+#ifndef XDPIF_FRAME_SIZE
+#define XDPIF_FRAME_SIZE 2048
+#endif
+/** Number of receive and transmit frames (powers of two), they are also the
+ * sizes of the fill and RX rings and of the TX and completion rings */
+#ifndef XDPIF_RX_FRAMES
+#define XDPIF_RX_FRAMES 1024
+#endif
+#ifndef XDPIF_TX_FRAMES
+#define XDPIF_TX_FRAMES 512
+#endif
+
+/** Maximum number of frames passed to tcpip_thread with one message, if
+ * netif->input is tcpip_input */
+#ifndef XDPIF_RX_BATCH
+#define XDPIF_RX_BATCH 64
+#endif
+
+#if (XDPIF_RX_FRAMES & (XDPIF_RX_FRAMES - 1)) || (XDPIF_TX_FRAMES & (XDPIF_TX_FRAMES - 1))
+#error "XDPIF_RX_FRAMES and XDPIF_TX_FRAMES must be powers of two"
+#endif
+
+/* end of the free lists */
+#define XDPIF_NONE 0xffff
+
+/* A ring shared with the kernel */
+struct xdpif_ring {
+  u32_t *producer;
+  u32_t *consumer;
+  u32_t *flags;
+  void *descs;
+  u32_t mask;
+  void *map;
+  size_t map_size;
+};
+
+/* A receive frame */
+struct xdpif_rx_frame {
+#if LWIP_SUPPORT_CUSTOM_PBUF
+  /* must be first: the frame lent to the stack */
+  struct pbuf_custom pc;
+#endif /* LWIP_SUPPORT_CUSTOM_PBUF */
+  struct xdpif *xdpif;
+  u16_t index;
+  u16_t next;
+};
+
+struct xdpif {
+  int fd;
+  /* the XDP program, its map and the link attaching it */
+  int map_fd;
+  int prog_fd;
+  int link_fd;
+  u8_t *umem;
+  struct xdpif_ring fill;
+  struct xdpif_ring comp;
+  struct xdpif_ring rx;
+  struct xdpif_ring tx;
+
+  struct xdpif_rx_frame rx_frames[XDPIF_RX_FRAMES];
+  /* frames freed by the stack, to give back to the fill ring */
+  u16_t rx_returned;
+  /* frames lent to the stack */
+  u16_t rx_held;
+
+  /* free transmit frames */
+  u16_t tx_free[XDPIF_TX_FRAMES];
+  u16_t tx_nfree;
+  /* the TX ring holds frames the kernel has not taken yet */
+  u8_t tx_pending;
+#if !NO_SYS
+  /* a callback to kick the TX ring is pending in tcpip_thread */
+  u8_t tx_kick_posted;
+#if XDPIF_RX_BATCH > 1
+  /* frames read but not yet passed to tcpip_thread */
+  struct xdpif_rx_batch *batch;
+#endif /* XDPIF_RX_BATCH > 1 */
+#endif /* !NO_SYS */
+};
+
+#if !NO_SYS && (XDPIF_RX_BATCH > 1)
+/* A burst of frames passed to tcpip_thread with one message */
+struct xdpif_rx_batch {
+  struct netif *netif;
+  u16_t count;
+  struct pbuf *p[XDPIF_RX_BATCH];
+};
+#endif /* !NO_SYS && (XDPIF_RX_BATCH > 1) */
+
+/* UMEM address of a frame */
+#define XDPIF_RX_ADDR(index) ((u64_t)(index) * XDPIF_FRAME_SIZE)
+#define XDPIF_TX_ADDR(index) ((u64_t)(XDPIF_RX_FRAMES + (index)) * XDPIF_FRAME_SIZE)
+
+/* Forward declarations. */
+#if !NO_SYS
+static void xdpif_thread(void *arg);
+#endif /* !NO_SYS */
+
+/*-----------------------------------------------------------------------------------*/
+static int
+xdpif_bpf(int cmd, union bpf_attr *attr)
+{
+  return (int)syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+/* Load and attach the XDP program redirecting the frames of 'queue' to the
+   socket, returns 0 on success */
+static int
+xdpif_attach(struct xdpif *xdpif, int ifindex, u32_t queue)
+{
+  /* return bpf_redirect_map(&xsks, ctx->rx_queue_index, XDP_PASS); */
+  struct bpf_insn prog[] = {
+    { BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_1, offsetof(struct xdp_md, rx_queue_index), 0 },
+    { BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, 0 },
+    { 0, 0, 0, 0, 0 },
+    { BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, XDP_PASS },
+    { BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map },
+    { BPF_JMP | BPF_EXIT, 0, 0, 0, 0 }
+  };
+  static const char license[] = "Dual BSD/GPL";
+  union bpf_attr attr;
+  u32_t value = (u32_t)xdpif->fd;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.map_type = BPF_MAP_TYPE_XSKMAP;
+  attr.key_size = sizeof(u32_t);
+  attr.value_size = sizeof(u32_t);
+  attr.max_entries = queue + 1;
+  xdpif->map_fd = xdpif_bpf(BPF_MAP_CREATE, &attr);
+  if (xdpif->map_fd < 0) {
+    perror("xdpif_init: BPF_MAP_CREATE");
+    return -1;
+  }
+  memset(&attr, 0, sizeof(attr));
+  attr.map_fd = (u32_t)xdpif->map_fd;
+  attr.key = (u64_t)(uintptr_t)&queue;
+  attr.value = (u64_t)(uintptr_t)&value;
+  if (xdpif_bpf(BPF_MAP_UPDATE_ELEM, &attr) < 0) {
+    perror("xdpif_init: BPF_MAP_UPDATE_ELEM");
+    return -1;
+  }
+
+  prog[1].imm = xdpif->map_fd;
+  memset(&attr, 0, sizeof(attr));
+  attr.prog_type = BPF_PROG_TYPE_XDP;
+  attr.insn_cnt = LWIP_ARRAYSIZE(prog);
+  attr.insns = (u64_t)(uintptr_t)prog;
+  attr.license = (u64_t)(uintptr_t)license;
+  xdpif->prog_fd = xdpif_bpf(BPF_PROG_LOAD, &attr);
+  if (xdpif->prog_fd < 0) {
+    perror("xdpif_init: BPF_PROG_LOAD");
+    return -1;
+  }
+
+  memset(&attr, 0, sizeof(attr));
+  attr.link_create.prog_fd = (u32_t)xdpif->prog_fd;
+  attr.link_create.target_ifindex = (u32_t)ifindex;
+  attr.link_create.attach_type = BPF_XDP;
+  xdpif->link_fd = xdpif_bpf(BPF_LINK_CREATE, &attr);
+  if (xdpif->link_fd < 0) {
+    perror("xdpif_init: BPF_LINK_CREATE (is another XDP program attached?)");
+    return -1;
+  }
+  return 0;
+}
+
+/* Map one of the rings of the socket */
+static int
+xdpif_ring_map(struct xdpif *xdpif, struct xdpif_ring *ring, const struct xdp_ring_offset *off,
+               off_t pgoff, u32_t entries, size_t desc_size)
+{
+  u8_t *map;
+
+  ring->map_size = off->desc + entries * desc_size;
+  map = (u8_t *)mmap(NULL, ring->map_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, xdpif->fd, pgoff);
+  if (map == MAP_FAILED) {
+    perror("xdpif_init: mmap ring");
+    return -1;
+  }
+  ring->map = map;
+  ring->producer = (u32_t *)(void *)(map + off->producer);
+  ring->consumer = (u32_t *)(void *)(map + off->consumer);
+  ring->flags = (u32_t *)(void *)(map + off->flags);
+  ring->descs = map + off->desc;
+  ring->mask = entries - 1;
+  return 0;
+}
+
+/* Give the receive frames freed by the stack back to the fill ring */
+static void
+xdpif_rx_refill(struct xdpif *xdpif)
+{
+  u64_t *addrs = (u64_t *)xdpif->fill.descs;
+  u32_t prod = *xdpif->fill.producer;
+  u16_t index;
+  SYS_ARCH_DECL_PROTECT(lev);
+
+  SYS_ARCH_PROTECT(lev);
+  index = xdpif->rx_returned;
+  xdpif->rx_returned = XDPIF_NONE;
+  SYS_ARCH_UNPROTECT(lev);
+
+  if (index == XDPIF_NONE) {
+    return;
+  }
+  /* the fill ring holds all receive frames, so there is room */
+  while (index != XDPIF_NONE) {
+    addrs[prod++ & xdpif->fill.mask] = XDPIF_RX_ADDR(index);
+    index = xdpif->rx_frames[index].next;
+  }
+  __atomic_store_n(xdpif->fill.producer, prod, __ATOMIC_RELEASE);
+}
+
+/* Give one receive frame back to the fill ring right away */
+static void
+xdpif_rx_return(struct xdpif *xdpif, u16_t index)
+{
+  SYS_ARCH_DECL_PROTECT(lev);
+
+  SYS_ARCH_PROTECT(lev);
+  xdpif->rx_frames[index].next = xdpif->rx_returned;
+  xdpif->rx_returned = index;
+  SYS_ARCH_UNPROTECT(lev);
+}
+
+#if LWIP_SUPPORT_CUSTOM_PBUF
+/* Custom free function of the pbufs lent to the stack, called by any thread */
+static void
+xdpif_rx_free(struct pbuf *p)
+{
+  struct xdpif_rx_frame *frame = (struct xdpif_rx_frame *)p;
+  struct xdpif *xdpif = frame->xdpif;
+  SYS_ARCH_DECL_PROTECT(lev);
+
+  SYS_ARCH_PROTECT(lev);
+  frame->next = xdpif->rx_returned;
+  xdpif->rx_returned = frame->index;
+  xdpif->rx_held--;
+  SYS_ARCH_UNPROTECT(lev);
+}
+#endif /* LWIP_SUPPORT_CUSTOM_PBUF */
+
+/*-----------------------------------------------------------------------------------*/
+static void
+low_level_init(struct netif *netif)
+{
+  struct xdpif *xdpif = (struct xdpif *)netif->state;
+  const char *ifname = getenv("XDPIF_IFNAME");
+  const char *queue_str = getenv("XDPIF_QUEUE");
+  struct xdp_umem_reg reg;
+  struct xdp_mmap_offsets off;
+  struct sockaddr_xdp sxdp;
+  socklen_t optlen;
+  u32_t queue = 0;
+  u32_t i;
+  int ifindex, size;
+
+  if (ifname == NULL) {
+    ifname = XDPIF_DEFAULT_IF;
+  }
+  if (queue_str != NULL) {
+    queue = (u32_t)atoi(queue_str);
+  }
+
+  /* Obtain MAC address from network interface. */
+
+  /* (We just fake an address...) */
+  netif->hwaddr[0] = 0x02;
+  netif->hwaddr[1] = 0x12;
+  netif->hwaddr[2] = 0x34;
+  netif->hwaddr[3] = 0x56;
+  netif->hwaddr[4] = 0x78;
+  netif->hwaddr[5] = 0xad;
+  netif->hwaddr_len = 6;
+
+  /* device capabilities */
+  netif->flags = NETIF_FLAG_BROADCAST | NETIF_FLAG_ETHARP | NETIF_FLAG_IGMP;
+
+  ifindex = (int)if_nametoindex(ifname);
+  if (ifindex == 0) {
+    fprintf(stderr, "xdpif_init: no interface %s\n", ifname);
+    exit(1);
+  }
+  xdpif->fd = socket(AF_XDP, SOCK_RAW, 0);
+  LWIP_DEBUGF(XDPIF_DEBUG, ("xdpif_init: fd %d\n", xdpif->fd));
+  if (xdpif->fd == -1) {
+    perror("xdpif_init: socket");
+    exit(1);
+  }
+
+  /* the UMEM: receive frames followed by transmit frames */
+  xdpif->umem = (u8_t *)mmap(NULL, (size_t)(XDPIF_RX_FRAMES + XDPIF_TX_FRAMES) * XDPIF_FRAME_SIZE,
+                             PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  if (xdpif->umem == MAP_FAILED) {
+    perror("xdpif_init: mmap UMEM");
+    exit(1);
+  }
+  memset(&reg, 0, sizeof(reg));
+  reg.addr = (u64_t)(uintptr_t)xdpif->umem;
+  reg.len = (u64_t)(XDPIF_RX_FRAMES + XDPIF_TX_FRAMES) * XDPIF_FRAME_SIZE;
+  reg.chunk_size = XDPIF_FRAME_SIZE;
+  /* room for ETH_PAD_SIZE in front of received frames */
+  reg.headroom = ETH_PAD_SIZE;
+  if (setsockopt(xdpif->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) < 0) {
+    perror("xdpif_init: XDP_UMEM_REG");
+    exit(1);
+  }
+
+  /* the rings */
+  size = XDPIF_RX_FRAMES;
+  if ((setsockopt(xdpif->fd, SOL_XDP, XDP_UMEM_FILL_RING, &size, sizeof(size)) < 0) ||
+      (setsockopt(xdpif->fd, SOL_XDP, XDP_RX_RING, &size, sizeof(size)) < 0)) {
+    perror("xdpif_init: XDP_RX_RING");
+    exit(1);
+  }
+  size = XDPIF_TX_FRAMES;
+  if ((setsockopt(xdpif->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &size, sizeof(size)) < 0) ||
+      (setsockopt(xdpif->fd, SOL_XDP, XDP_TX_RING, &size, sizeof(size)) < 0)) {
+    perror("xdpif_init: XDP_TX_RING");
+    exit(1);
+  }
+  optlen = sizeof(off);
+  if (getsockopt(xdpif->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) < 0) {
+    perror("xdpif_init: XDP_MMAP_OFFSETS");
+    exit(1);
+  }
+  if ((xdpif_ring_map(xdpif, &xdpif->fill, &off.fr, (off_t)XDP_UMEM_PGOFF_FILL_RING,
+                      XDPIF_RX_FRAMES, sizeof(u64_t)) < 0) ||
+      (xdpif_ring_map(xdpif, &xdpif->comp, &off.cr, (off_t)XDP_UMEM_PGOFF_COMPLETION_RING,
+                      XDPIF_TX_FRAMES, sizeof(u64_t)) < 0) ||
+      (xdpif_ring_map(xdpif, &xdpif->rx, &off.rx, XDP_PGOFF_RX_RING,
+                      XDPIF_RX_FRAMES, sizeof(struct xdp_desc)) < 0) ||
+      (xdpif_ring_map(xdpif, &xdpif->tx, &off.tx, XDP_PGOFF_TX_RING,
+                      XDPIF_TX_FRAMES, sizeof(struct xdp_desc)) < 0)) {
+    exit(1);
+  }
+
+  /* all receive frames go to the fill ring, all transmit frames are free */
+  xdpif->rx_returned = XDPIF_NONE;
+  for (i = 0; i < XDPIF_RX_FRAMES; i++) {
+#if LWIP_SUPPORT_CUSTOM_PBUF
+    xdpif->rx_frames[i].pc.custom_free_function = xdpif_rx_free;
+#endif /* LWIP_SUPPORT_CUSTOM_PBUF */
+    xdpif->rx_frames[i].xdpif = xdpif;
+    xdpif->rx_frames[i].index = (u16_t)i;
+    xdpif_rx_return(xdpif, (u16_t)i);
+  }
+  xdpif_rx_refill(xdpif);
+  for (i = 0; i < XDPIF_TX_FRAMES; i++) {
+    xdpif->tx_free[i] = (u16_t)i;
+  }
+  xdpif->tx_nfree = XDPIF_TX_FRAMES;
+
+  memset(&sxdp, 0, sizeof(sxdp));
+  sxdp.sxdp_family = AF_XDP;
+  sxdp.sxdp_flags = XDP_COPY;
+  sxdp.sxdp_ifindex = (u32_t)ifindex;
+  sxdp.sxdp_queue_id = queue;
+  if (bind(xdpif->fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) < 0) {
+    perror("xdpif_init: bind");
+    exit(1);
+  }
+  if (xdpif_attach(xdpif, ifindex, queue) < 0) {
+    exit(1);
+  }
+
+  netif_set_link_up(netif);
+
+#if !NO_SYS
+  sys_thread_new("xdpif_thread", xdpif_thread, netif, DEFAULT_THREAD_STACKSIZE, DEFAULT_THREAD_PRIO);
+#endif /* !NO_SYS */
+}
+/*-----------------------------------------------------------------------------------*/
+/*
+ * low_level_output():
+ *
+ * Should do the actual transmission of the packet. The packet is
+ * contained in the pbuf that is passed to the function. This pbuf
+ * might be chained.
+ *
+ */
+/*-----------------------------------------------------------------------------------*/
+
+/* Take back the transmit frames the kernel is done with */
+static void
+xdpif_tx_complete(struct xdpif *xdpif)
+{
+  const u64_t *addrs = (const u64_t *)xdpif->comp.descs;
+  u32_t cons = *xdpif->comp.consumer;
+  u32_t prod = __atomic_load_n(xdpif->comp.producer, __ATOMIC_ACQUIRE);
+
+  while (cons != prod) {
+    u64_t addr = addrs[cons++ & xdpif->comp.mask];
+    xdpif->tx_free[xdpif->tx_nfree++] = (u16_t)(addr / XDPIF_FRAME_SIZE - XDPIF_RX_FRAMES);
+  }
+  __atomic_store_n(xdpif->comp.consumer, cons, __ATOMIC_RELEASE);
+}
+
+/* Make the kernel send the frames put into the TX ring. In copy mode, it
+   only takes a few of them per call. */
+static void
+xdpif_tx_kick(struct xdpif *xdpif)
+{
+  while (xdpif->tx_pending) {
+    if ((sendto(xdpif->fd, NULL, 0, MSG_DONTWAIT, NULL, 0) == -1) && (errno != EAGAIN)) {
+      if ((errno != EBUSY) && (errno != ENOBUFS)) {
+        perror("xdpif: sendto");
+      }
+      /* try again with the next kick */
+      break;
+    }
+    if (__atomic_load_n(xdpif->tx.consumer, __ATOMIC_ACQUIRE) == *xdpif->tx.producer) {
+      xdpif->tx_pending = 0;
+    }
+  }
+  xdpif_tx_complete(xdpif);
+}
+
+#if !NO_SYS
+/* Called in tcpip_thread after the messages that were queued before the first
+   frame of the burst: kick the whole burst */
+static void
+xdpif_tx_kick_callback(void *arg)
+{
+  struct netif *netif = (struct netif *)arg;
+  struct xdpif *xdpif = (struct xdpif *)netif->state;
+
+  xdpif->tx_kick_posted = 0;
+  xdpif_tx_kick(xdpif);
+}
+#endif /* !NO_SYS */
+
+static err_t
+low_level_output(struct netif *netif, struct pbuf *p)
+{
+  struct xdpif *xdpif = (struct xdpif *)netif->state;
+  struct xdp_desc *desc;
+  u32_t prod;
+  u16_t index;
+  u16_t len = (u16_t)(p->tot_len - ETH_PAD_SIZE);
+
+  if (len > XDPIF_FRAME_SIZE) {
+    MIB2_STATS_NETIF_INC(netif, ifoutdiscards);
+    LWIP_DEBUGF(XDPIF_DEBUG, ("xdpif: frame of %d bytes too long\n", len));
+    return ERR_BUF;
+  }
+  if (xdpif->tx_nfree == 0) {
+    /* all frames in flight: send what is queued and look again */
+    xdpif_tx_kick(xdpif);
+    if (xdpif->tx_nfree == 0) {
+      MIB2_STATS_NETIF_INC(netif, ifoutdiscards);
+      LWIP_DEBUGF(XDPIF_DEBUG, ("xdpif: no free frame\n"));
+      return ERR_MEM;
+    }
+  }
+
+  /* initiate transfer(); */
+  index = xdpif->tx_free[--xdpif->tx_nfree];
+  pbuf_copy_partial(p, xdpif->umem + XDPIF_TX_ADDR(index), len, ETH_PAD_SIZE);
+  /* the TX ring is as big as the number of frames, so there is room */
+  prod = *xdpif->tx.producer;
+  desc = &((struct xdp_desc *)xdpif->tx.descs)[prod & xdpif->tx.mask];
+  desc->addr = XDPIF_TX_ADDR(index);
+  desc->len = len;
+  desc->options = 0;
+  __atomic_store_n(xdpif->tx.producer, prod + 1, __ATOMIC_RELEASE);
+  xdpif->tx_pending = 1;
+  MIB2_STATS_NETIF_ADD(netif, ifoutoctets, len);
+
+  /* signal that packet should be sent(); */
+#if !NO_SYS
+  if (!xdpif->tx_kick_posted) {
+    xdpif->tx_kick_posted = 1;
+    if (tcpip_try_callback(xdpif_tx_kick_callback, netif) != ERR_OK) {
+      /* tcpip_thread's mailbox is full: kick right away */
+      xdpif_tx_kick_callback(netif);
+    }
+  }
+#endif /* !NO_SYS */
+  return ERR_OK;
+}
+/*-----------------------------------------------------------------------------------*/
+/*
+ * low_level_input():
+ *
+ * Should allocate a pbuf and transfer the bytes of the incoming
+ * packet from the interface into the pbuf.
+ *
+ */
+/*-----------------------------------------------------------------------------------*/
+static struct pbuf *
+low_level_input(struct netif *netif, const struct xdp_desc *desc)
+{
+  struct xdpif *xdpif = (struct xdpif *)netif->state;
+  /* the frame is at some offset into its chunk */
+  u16_t index = (u16_t)(desc->addr / XDPIF_FRAME_SIZE);
+  u8_t *mem = xdpif->umem + desc->addr - ETH_PAD_SIZE;
+  u16_t len = (u16_t)(desc->len + ETH_PAD_SIZE);
+  struct pbuf *p = NULL;
+#if LWIP_SUPPORT_CUSTOM_PBUF
+  u8_t lend = 0;
+  SYS_ARCH_DECL_PROTECT(lev);
+
+  SYS_ARCH_PROTECT(lev);
+  if (xdpif->rx_held < XDPIF_RX_FRAMES / 2) {
+    xdpif->rx_held++;
+    lend = 1;
+  }
+  SYS_ARCH_UNPROTECT(lev);
+  if (lend) {
+    p = pbuf_alloced_custom(PBUF_RAW, len, PBUF_REF, &xdpif->rx_frames[index].pc, mem, len);
+  }
+#endif /* LWIP_SUPPORT_CUSTOM_PBUF */
+  if (p == NULL) {
+    /* We allocate a pbuf chain of pbufs from the pool. */
+    p = pbuf_alloc(PBUF_RAW, len, PBUF_POOL);
+    if (p != NULL) {
+      pbuf_take(p, mem, len);
+    }
+    xdpif_rx_return(xdpif, index);
+  }
+  if (p == NULL) {
+    MIB2_STATS_NETIF_INC(netif, ifindiscards);
+    LWIP_DEBUGF(NETIF_DEBUG, ("xdpif_input: could not allocate pbuf\n"));
+    return NULL;
+  }
+  MIB2_STATS_NETIF_ADD(netif, ifinoctets, desc->len);
+  return p;
+}
+
+/*-----------------------------------------------------------------------------------*/
+/*
+ * xdpif_input():
+ *
+ * This function should be called when a packet is ready to be read
+ * from the interface. It uses the function low_level_input() that
+ * should handle the actual reception of bytes from the network
+ * interface.
+ *
+ */
+/*-----------------------------------------------------------------------------------*/
+#if !NO_SYS && (XDPIF_RX_BATCH > 1)
+/* Runs in tcpip_thread: pass a burst of frames to the stack */
+static void
+xdpif_input_batch(void *arg)
+{
+  struct xdpif_rx_batch *batch = (struct xdpif_rx_batch *)arg;
+  u16_t i;
+
+  for (i = 0; i < batch->count; i++) {
+    if (ethernet_input(batch->p[i], batch->netif) != ERR_OK) {
+      LWIP_DEBUGF(NETIF_DEBUG, ("xdpif_input: netif input error\n"));
+      pbuf_free(batch->p[i]);
+    }
+  }
+  mem_free(batch);
+}
+#endif /* !NO_SYS && (XDPIF_RX_BATCH > 1) */
+
+/* Pass up the frames collected by xdpif_input_frame() */
+static void
+xdpif_input_flush(struct netif *netif)
+{
+#if !NO_SYS && (XDPIF_RX_BATCH > 1)
+  struct xdpif *xdpif = (struct xdpif *)netif->state;
+  struct xdpif_rx_batch *batch = xdpif->batch;
+
+  if (batch == NULL) {
+    return;
+  }
+  xdpif->batch = NULL;
+  if (tcpip_try_callback(xdpif_input_batch, batch) != ERR_OK) {
+    LWIP_DEBUGF(NETIF_DEBUG, ("xdpif_input: tcpip mbox full, dropping %d frames\n", batch->count));
+    while (batch->count > 0) {
+      pbuf_free(batch->p[--batch->count]);
+      MIB2_STATS_NETIF_INC(netif, ifindiscards);
+    }
+    mem_free(batch);
+  }
+#else /* !NO_SYS && (XDPIF_RX_BATCH > 1) */
+  LWIP_UNUSED_ARG(netif);
+#endif /* !NO_SYS && (XDPIF_RX_BATCH > 1) */
+}
+
+static void
+xdpif_input_frame(struct netif *netif, struct pbuf *p)
+{
+#if !NO_SYS && (XDPIF_RX_BATCH > 1)
+  struct xdpif *xdpif = (struct xdpif *)netif->state;
+
+  if (netif->input == tcpip_input) {
+    /* ethernet_input() is what tcpip_input() would call for this netif,
+       call it for the whole burst from a single tcpip_thread message */
+    if (xdpif->batch == NULL) {
+      xdpif->batch = (struct xdpif_rx_batch *)mem_malloc(sizeof(struct xdpif_rx_batch));
+      if (xdpif->batch != NULL) {
+        xdpif->batch->netif = netif;
+        xdpif->batch->count = 0;
+      }
+    }
+    if (xdpif->batch != NULL) {
+      xdpif->batch->p[xdpif->batch->count++] = p;
+      if (xdpif->batch->count == XDPIF_RX_BATCH) {
+        xdpif_input_flush(netif);
+      }
+      return;
+    }
+  }
+#endif /* !NO_SYS && (XDPIF_RX_BATCH > 1) */
+
+  if (netif->input(p, netif) != ERR_OK) {
+    LWIP_DEBUGF(NETIF_DEBUG, ("xdpif_input: netif input error\n"));
+    pbuf_free(p);
+  }
+}
+
+/* Pass up the frames in the RX ring and refill the fill ring, returns the
+   number of frames */
+static int
+xdpif_input(struct netif *netif)
+{
+  struct xdpif *xdpif = (struct xdpif *)netif->state;
+  const struct xdp_desc *descs = (const struct xdp_desc *)xdpif->rx.descs;
+  u32_t cons = *xdpif->rx.consumer;
+  u32_t prod = __atomic_load_n(xdpif->rx.producer, __ATOMIC_ACQUIRE);
+  struct pbuf *p;
+  int count = 0;
+
+  while (cons != prod) {
+    p = low_level_input(netif, &descs[cons++ & xdpif->rx.mask]);
+    if (p != NULL) {
+      xdpif_input_frame(netif, p);
+      count++;
+    }
+  }
+  /* acknowledge that the packets have been read(); */
+  __atomic_store_n(xdpif->rx.consumer, cons, __ATOMIC_RELEASE);
+  xdpif_input_flush(netif);
+  xdpif_rx_refill(xdpif);
+
+  if (count == 0) {
+    LWIP_DEBUGF(XDPIF_DEBUG, ("xdpif_input: no frames\n"));
+  }
+  return count;
+}
+/*-----------------------------------------------------------------------------------*/
+/*
+ * xdpif_init():
+ *
+ * Should be called at the beginning of the program to set up the
+ * network interface. It calls the function low_level_init() to do the
+ * actual setup of the hardware.
+ *
+ */
+/*-----------------------------------------------------------------------------------*/
+err_t
+xdpif_init(struct netif *netif)
+{
+  /* too big for the lwIP heap with all its frame descriptors */
+  struct xdpif *xdpif = (struct xdpif *)calloc(1, sizeof(struct xdpif));
+
+  if (xdpif == NULL) {
+    LWIP_DEBUGF(NETIF_DEBUG, ("xdpif_init: out of memory for xdpif\n"));
+    return ERR_MEM;
+  }
+  netif->state = xdpif;
+  MIB2_INIT_NETIF(netif, snmp_ifType_ethernet_csmacd, 100000000);
+
+  netif->name[0] = IFNAME0;
+  netif->name[1] = IFNAME1;
+#if LWIP_IPV4
+  netif->output = etharp_output;
+#endif /* LWIP_IPV4 */
+#if LWIP_IPV6
+  netif->output_ip6 = ethip6_output;
+#endif /* LWIP_IPV6 */
+  netif->linkoutput = low_level_output;
+  netif->mtu = 1500;
+
+  low_level_init(netif);
+
+  return ERR_OK;
+}
+
+/*-----------------------------------------------------------------------------------*/
+#if NO_SYS
+
+int
+xdpif_select(struct netif *netif)
+{
+  struct xdpif *xdpif = (struct xdpif *)netif->state;
+  struct pollfd pfd;
+  u32_t msecs = sys_timeouts_sleeptime();
+  int ret;
+
+  /* frames sent since the last call */
+  xdpif_tx_kick(xdpif);
+
+  ret = xdpif_input(netif);
+  if (ret == 0) {
+    pfd.fd = xdpif->fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, (int)LWIP_MIN(msecs, INT_MAX)) > 0) {
+      ret = xdpif_input(netif);
+    }
+  }
+  /* replies to what was read */
+  xdpif_tx_kick(xdpif);
+  return ret;
+}
+
+/* evloop input and flush functions */
+static int
+xdpif_evloop_input(void *arg)
+{
+  return xdpif_input((struct netif *)arg);
+}
+
+static void
+xdpif_evloop_flush(void *arg)
+{
+  struct netif *netif = (struct netif *)arg;
+  struct xdpif *xdpif = (struct xdpif *)netif->state;
+
+  xdpif_tx_kick(xdpif);
+}
+
+/* Let evloop_run() serve 'netif' instead of xdpif_select() */
+err_t
+xdpif_evloop_add(struct netif *netif)
+{
+  struct xdpif *xdpif = (struct xdpif *)netif->state;
+
+  return evloop_add(xdpif->fd, xdpif_evloop_input, xdpif_evloop_flush, netif);
+}
+
+#else /* NO_SYS */
+
+static void
+xdpif_thread(void *arg)
+{
+  struct netif *netif = (struct netif *)arg;
+  struct xdpif *xdpif = (struct xdpif *)netif->state;
+  struct pollfd pfd;
+
+  while (1) {
+    if (xdpif_input(netif) == 0) {
+      /* Wait for a frame to arrive. */
+      pfd.fd = xdpif->fd;
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+      if ((poll(&pfd, 1, -1) == -1) && (errno != EINTR)) {
+        perror("xdpif_thread: poll");
+      }
+    }
+  }
+}
+
+#endif /* NO_SYS */
+
+#endif /* LWIP_UNIX_LINUX */
@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2001-2003 Swedish Institute of Computer Science.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+ * SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ *
+ * This file is part of the lwIP TCP/IP stack.
+ *
+ */
+
+/*
+ * Parser of the option strings of the Unix port, see arch/opts.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lwip/opt.h"
+
+#include "arch/opts.h"
+
+/** Longest option string port_parse_opts() takes */
+#ifndef PORT_OPTS_MAX_LEN
+#define PORT_OPTS_MAX_LEN 512
+#endif
+
+/**
+ * Split 'str' into its items and pass each to 'fn'. An item 'fn' rejects is
+ * reported on stderr, prefixed with 'who' ("missing value of 'key'" if it
+ * had none), and the remaining items are still passed on.
+ *
+ * Returns 0 if all items were taken, -1 otherwise.
+ */
+int
+port_parse_opts(const char *who, const char *str, port_opt_fn fn, void *arg)
+{
+  char buf[PORT_OPTS_MAX_LEN];
+  char *item, *value, *save = NULL;
+  int ret = 0;
+
+  if (strlen(str) >= sizeof(buf)) {
+    fprintf(stderr, "%s: options too long: \"%s\"\n", who, str);
+    return -1;
+  }
+  strcpy(buf, str);
+  for (item = strtok_r(buf, ", ", &save); item != NULL; item = strtok_r(NULL, ", ", &save)) {
+    value = strchr(item, '=');
+    if (value != NULL) {
+      *value++ = 0;
+    }
+    if (fn(arg, item, value) == 0) {
+      continue;
+    }
+    if (value == NULL) {
+      fprintf(stderr, "%s: missing value of '%s'\n", who, item);
+    } else {
+      fprintf(stderr, "%s: invalid %s=%s\n", who, item, value);
+    }
+    ret = -1;
+  }
+  return ret;
+}
+
+/**
+ * Parse a non-negative number with an optional k, M or G suffix (1000
+ * based), e.g. a rate of "2.5M" bits/s or a size of "100k" bytes.
+ *
+ * Returns 0 on success, -1 if 'value' is not such a number.
+ */
+int
+port_parse_size(const char *value, double *n)
+{
+  char *end;
+
+  *n = strtod(value, &end);
+  if (end == value) {
+    return -1;
+  }
+  switch (*end) {
+    case 'k': case 'K': *n *= 1e3; end++; break;
+    case 'm': case 'M': *n *= 1e6; end++; break;
+    case 'g': case 'G': *n *= 1e9; end++; break;
+    default: break;
+  }
+  return ((*end == 0) && (*n >= 0)) ? 0 : -1;
+}
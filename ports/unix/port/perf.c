@@ -30,36 +30,530 @@
  *
  */
 
+/*
+ * Histograms of the probe points declared with PERF_START/PERF_STOP
+ * (arch/perf.h).
+ *
+ * Histograms have 16 linear buckets per power of 2 of nanoseconds (values
+ * are exact below 16 ns, within 6.25% above), up to 2^PERF_HIST_MAX_BITS
+ * ns. Each thread allocates its own histogram of a probe when it first
+ * records into it, so recording needs no lock; perf_dump() reads them
+ * while they are updated (relaxed atomic accesses), a dump may thus see a
+ * sample in the count but not yet in the buckets. When a thread exits, its
+ * histograms are folded into those of all exited threads and its record is
+ * freed.
+ *
+ * perf_init() reads PERF from the environment, e.g. "interval=1000" to dump
+ * every second (default: only on exit and perf_dump()), "clock=monotonic"
+ * not to use the TSC, "off" to start with recording disabled. Dumps are one
+ * JSON object per line.
+ */
+
+#include "lwip/opt.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#include "arch/opts.h"
 #include "arch/perf.h"
 
-#include <stdio.h>
+/** Number of distinct probe names */
+#ifndef PERF_MAX_PROBES
+#define PERF_MAX_PROBES 64
+#endif
+
+/** Values up to 2^PERF_HIST_MAX_BITS ns are told apart (~18 minutes) */
+#ifndef PERF_HIST_MAX_BITS
+#define PERF_HIST_MAX_BITS 40
+#endif
+
+#define PERF_SUB_BITS    4
+#define PERF_SUB         (1 << PERF_SUB_BITS)
+#define PERF_BUCKETS     ((PERF_HIST_MAX_BITS - PERF_SUB_BITS + 1) * PERF_SUB)
+
+struct perf_hist {
+  u64_t count;
+  u64_t sum_ns;
+  u64_t min_ns;
+  u64_t max_ns;
+  u32_t bucket[PERF_BUCKETS];
+};
+
+struct perf_thread {
+  struct perf_thread *next;
+  struct perf_hist *hist[PERF_MAX_PROBES];
+};
+
+struct perf_probe {
+  const char *name;
+  int id;
+};
+
+u8_t perf_enabled;
+
+static u8_t perf_source = PERF_CLOCK;
+static u64_t perf_tsc_mult;   /* ns per TSC tick << 32 */
+static FILE *perf_file;
+static u32_t perf_interval;
+
+static pthread_mutex_t perf_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct perf_probe perf_probes[PERF_MAX_PROBES];
+static int perf_num_probes;
+static struct perf_thread *perf_threads;
+/* histograms of the threads that have exited */
+static struct perf_thread perf_exited;
+static __thread struct perf_thread *perf_self;
+static pthread_once_t perf_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t perf_key;
+
+/*-----------------------------------------------------------------------------------*/
+u64_t
+perf_clock(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (u64_t)ts.tv_sec * 1000000000ULL + (u64_t)ts.tv_nsec;
+}
+/*-----------------------------------------------------------------------------------*/
+static u64_t
+perf_ticks_to_ns(u64_t ticks)
+{
+  if (perf_source != PERF_TSC) {
+    return ticks;
+  }
+  return (ticks >> 32) * perf_tsc_mult + (((ticks & 0xffffffffULL) * perf_tsc_mult) >> 32);
+}
+/*-----------------------------------------------------------------------------------*/
+/* Use the TSC if it runs at a constant rate in all power states: measure
+   its frequency against CLOCK_MONOTONIC */
+static void
+perf_calibrate(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  unsigned int eax, ebx, ecx, edx;
+  struct timespec ts = {0, 20000000L};
+  u64_t c0, c1, t0, t1;
+
+  if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) || !(edx & (1U << 8))) {
+    return;
+  }
+  t0 = perf_clock();
+  c0 = __builtin_ia32_rdtsc();
+  nanosleep(&ts, NULL);
+  t1 = perf_clock();
+  c1 = __builtin_ia32_rdtsc();
+  if ((c1 <= c0) || (t1 <= t0)) {
+    return;
+  }
+  perf_tsc_mult = (u64_t)(((double)(t1 - t0) / (double)(c1 - c0)) * 4294967296.0);
+  perf_source = PERF_TSC;
+#endif
+}
+/*-----------------------------------------------------------------------------------*/
+static int
+perf_bucket(u64_t ns)
+{
+  int bits;
+
+  if (ns < PERF_SUB) {
+    return (int)ns;
+  }
+  bits = 63 - __builtin_clzll(ns);
+  if (bits >= PERF_HIST_MAX_BITS) {
+    return PERF_BUCKETS - 1;
+  }
+  return (bits - PERF_SUB_BITS + 1) * PERF_SUB + (int)((ns >> (bits - PERF_SUB_BITS)) & (PERF_SUB - 1));
+}
+/*-----------------------------------------------------------------------------------*/
+/* Smallest value that falls into a bucket */
+static u64_t
+perf_bucket_low(int b)
+{
+  int bits;
 
-static FILE *f;
+  if (b < PERF_SUB) {
+    return (u64_t)b;
+  }
+  bits = b / PERF_SUB + PERF_SUB_BITS - 1;
+  return (u64_t)(PERF_SUB + b % PERF_SUB) << (bits - PERF_SUB_BITS);
+}
+/*-----------------------------------------------------------------------------------*/
+/** Find or create the probe of a name (the name is not copied) */
+struct perf_probe *
+perf_probe_get(const char *name)
+{
+  struct perf_probe *probe = NULL;
+  int i;
 
+  pthread_mutex_lock(&perf_mutex);
+  for (i = 0; i < perf_num_probes; i++) {
+    if (!strcmp(perf_probes[i].name, name)) {
+      probe = &perf_probes[i];
+      break;
+    }
+  }
+  if ((probe == NULL) && (perf_num_probes < PERF_MAX_PROBES)) {
+    probe = &perf_probes[perf_num_probes];
+    probe->name = name;
+    probe->id = perf_num_probes;
+    __atomic_store_n(&perf_num_probes, perf_num_probes + 1, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&perf_mutex);
+  return probe;
+}
+/*-----------------------------------------------------------------------------------*/
+/* Add the histogram 'h' to 'm' */
+static void
+perf_hist_add(struct perf_hist *m, const struct perf_hist *h)
+{
+  int b;
+
+  m->count += h->count;
+  m->sum_ns += h->sum_ns;
+  m->min_ns = LWIP_MIN(m->min_ns, h->min_ns);
+  m->max_ns = LWIP_MAX(m->max_ns, h->max_ns);
+  for (b = 0; b < PERF_BUCKETS; b++) {
+    m->bucket[b] += h->bucket[b];
+  }
+}
+/*-----------------------------------------------------------------------------------*/
+/* pthread key destructor: fold the histograms of an exiting thread into
+   perf_exited and free its record */
+static void
+perf_thread_exit(void *arg)
+{
+  struct perf_thread *t = (struct perf_thread *)arg;
+  struct perf_thread **pt;
+  int i;
+
+  pthread_mutex_lock(&perf_mutex);
+  for (pt = &perf_threads; *pt != NULL; pt = &(*pt)->next) {
+    if (*pt == t) {
+      *pt = t->next;
+      break;
+    }
+  }
+  for (i = 0; i < PERF_MAX_PROBES; i++) {
+    if (t->hist[i] == NULL) {
+      continue;
+    }
+    if (perf_exited.hist[i] == NULL) {
+      perf_exited.hist[i] = t->hist[i];
+    } else {
+      perf_hist_add(perf_exited.hist[i], t->hist[i]);
+      free(t->hist[i]);
+    }
+  }
+  pthread_mutex_unlock(&perf_mutex);
+  /* a later probe of this thread starts a new record */
+  perf_self = NULL;
+  free(t);
+}
+
+static void
+perf_key_init(void)
+{
+  pthread_key_create(&perf_key, perf_thread_exit);
+}
+/*-----------------------------------------------------------------------------------*/
+/* The calling thread's histogram of a probe */
+static struct perf_hist *
+perf_hist_get(struct perf_probe *probe)
+{
+  struct perf_thread *t = perf_self;
+  struct perf_hist *h;
+
+  if (t == NULL) {
+    t = (struct perf_thread *)calloc(1, sizeof(struct perf_thread));
+    if (t == NULL) {
+      return NULL;
+    }
+    pthread_once(&perf_key_once, perf_key_init);
+    pthread_mutex_lock(&perf_mutex);
+    t->next = perf_threads;
+    perf_threads = t;
+    pthread_mutex_unlock(&perf_mutex);
+    pthread_setspecific(perf_key, t);
+    perf_self = t;
+  }
+  h = t->hist[probe->id];
+  if (h == NULL) {
+    h = (struct perf_hist *)calloc(1, sizeof(struct perf_hist));
+    if (h != NULL) {
+      h->min_ns = ~0ULL;
+      __atomic_store_n(&t->hist[probe->id], h, __ATOMIC_RELEASE);
+    }
+  }
+  return h;
+}
+/*-----------------------------------------------------------------------------------*/
+/** Add a value measured by other means to a probe's histogram */
+void
+perf_record(struct perf_probe *probe, u64_t ns)
+{
+  struct perf_hist *h;
+  int b;
+
+  if ((probe == NULL) || !__atomic_load_n(&perf_enabled, __ATOMIC_RELAXED)) {
+    return;
+  }
+  h = perf_hist_get(probe);
+  if (h == NULL) {
+    return;
+  }
+  /* only this thread writes h, the atomics keep perf_dump()'s reads whole */
+  b = perf_bucket(ns);
+  __atomic_store_n(&h->bucket[b], h->bucket[b] + 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&h->sum_ns, h->sum_ns + ns, __ATOMIC_RELAXED);
+  if (ns < h->min_ns) {
+    __atomic_store_n(&h->min_ns, ns, __ATOMIC_RELAXED);
+  }
+  if (ns > h->max_ns) {
+    __atomic_store_n(&h->max_ns, ns, __ATOMIC_RELAXED);
+  }
+  __atomic_store_n(&h->count, h->count + 1, __ATOMIC_RELAXED);
+}
+/*-----------------------------------------------------------------------------------*/
+/** End of a probe started at 'start' (PERF_STOP), *probe caches the lookup */
 void
-perf_print(unsigned long c1l, unsigned long c1h,
-	   unsigned long c2l, unsigned long c2h,
-	   char *key)
+perf_stop(struct perf_probe **probe, const char *name, u64_t start)
 {
-  unsigned long sub_ms, sub_ls;
-  
-  sub_ms = c2h - c1h;
-  sub_ls = c2l - c1l;
-  if (c2l < c1l) sub_ms--;
-  fprintf(f, "%s: %.8lu%.8lu\n", key, sub_ms, sub_ls);
-  fflush(NULL);
+  struct perf_probe *pr = __atomic_load_n(probe, __ATOMIC_ACQUIRE);
+  u64_t now = PERF_TICKS(perf_source);
+
+  if (pr == NULL) {
+    pr = perf_probe_get(name);
+    __atomic_store_n(probe, pr, __ATOMIC_RELEASE);
+  }
+  perf_record(pr, (now > start) ? perf_ticks_to_ns(now - start) : 0);
 }
+/*-----------------------------------------------------------------------------------*/
+/* Merge the histograms of all threads, running and exited. perf_mutex keeps
+   exiting threads from freeing their records meanwhile */
+static void
+perf_merge(int id, struct perf_hist *m)
+{
+  struct perf_thread *t;
+  struct perf_hist *h;
+  u64_t v;
+  int b;
 
+  memset(m, 0, sizeof(*m));
+  m->min_ns = ~0ULL;
+  pthread_mutex_lock(&perf_mutex);
+  if (perf_exited.hist[id] != NULL) {
+    perf_hist_add(m, perf_exited.hist[id]);
+  }
+  for (t = perf_threads; t != NULL; t = t->next) {
+    h = __atomic_load_n(&t->hist[id], __ATOMIC_ACQUIRE);
+    if (h == NULL) {
+      continue;
+    }
+    m->count += __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+    m->sum_ns += __atomic_load_n(&h->sum_ns, __ATOMIC_RELAXED);
+    v = __atomic_load_n(&h->min_ns, __ATOMIC_RELAXED);
+    m->min_ns = LWIP_MIN(m->min_ns, v);
+    v = __atomic_load_n(&h->max_ns, __ATOMIC_RELAXED);
+    m->max_ns = LWIP_MAX(m->max_ns, v);
+    for (b = 0; b < PERF_BUCKETS; b++) {
+      m->bucket[b] += __atomic_load_n(&h->bucket[b], __ATOMIC_RELAXED);
+    }
+  }
+  pthread_mutex_unlock(&perf_mutex);
+}
+/*-----------------------------------------------------------------------------------*/
+static u64_t
+perf_percentile(const struct perf_hist *m, u64_t total, double q)
+{
+  u64_t rank = (u64_t)((double)total * q), seen = 0;
+  int b;
+
+  for (b = 0; b < PERF_BUCKETS; b++) {
+    seen += m->bucket[b];
+    if ((seen > rank) && (seen > 0)) {
+      return LWIP_MIN(LWIP_MAX(perf_bucket_low(b), m->min_ns), m->max_ns);
+    }
+  }
+  return m->max_ns;
+}
+/*-----------------------------------------------------------------------------------*/
+static void
+perf_summarize(const struct perf_hist *m, const char *name, struct perf_summary *s)
+{
+  u64_t total = 0;
+  int b;
+
+  for (b = 0; b < PERF_BUCKETS; b++) {
+    total += m->bucket[b];
+  }
+  memset(s, 0, sizeof(*s));
+  s->name = name;
+  s->count = m->count;
+  s->sum_ns = m->sum_ns;
+  if (total > 0) {
+    s->min_ns = m->min_ns;
+    s->max_ns = m->max_ns;
+    s->p50_ns = perf_percentile(m, total, 0.5);
+    s->p90_ns = perf_percentile(m, total, 0.9);
+    s->p99_ns = perf_percentile(m, total, 0.99);
+    s->p999_ns = perf_percentile(m, total, 0.999);
+  }
+}
+/*-----------------------------------------------------------------------------------*/
+/**
+ * Summary of a probe over all threads.
+ * @return 0 on success, -1 if there is no probe of that name
+ */
+int
+perf_summary(const char *name, struct perf_summary *summary)
+{
+  struct perf_hist *m;
+  int i, n = __atomic_load_n(&perf_num_probes, __ATOMIC_ACQUIRE);
+
+  for (i = 0; i < n; i++) {
+    if (!strcmp(perf_probes[i].name, name)) {
+      m = (struct perf_hist *)malloc(sizeof(struct perf_hist));
+      if (m == NULL) {
+        return -1;
+      }
+      perf_merge(i, m);
+      perf_summarize(m, perf_probes[i].name, summary);
+      free(m);
+      return 0;
+    }
+  }
+  return -1;
+}
+/*-----------------------------------------------------------------------------------*/
+/**
+ * Write all probes as one line of JSON: count, sum, min, max, percentiles
+ * and the non-empty buckets as [lowest ns, count] pairs.
+ */
 void
-perf_print_times(struct tms *start, struct tms *end, char *key)
+perf_dump(FILE *f)
+{
+  struct perf_summary s;
+  struct perf_hist *m;
+  int i, b, first, n = __atomic_load_n(&perf_num_probes, __ATOMIC_ACQUIRE);
+
+  if ((f == NULL) || (n == 0)) {
+    return;
+  }
+  m = (struct perf_hist *)malloc(sizeof(struct perf_hist));
+  if (m == NULL) {
+    return;
+  }
+  fprintf(f, "{\"time_ns\":%llu,\"clock\":\"%s\",\"probes\":[",
+          (unsigned long long)perf_clock(), (perf_source == PERF_TSC) ? "tsc" : "monotonic");
+  for (i = 0; i < n; i++) {
+    perf_merge(i, m);
+    perf_summarize(m, perf_probes[i].name, &s);
+    fprintf(f, "%s{\"name\":\"%s\",\"count\":%llu,\"sum_ns\":%llu,\"min_ns\":%llu,\"max_ns\":%llu,"
+            "\"p50_ns\":%llu,\"p90_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu,\"buckets\":[",
+            i ? "," : "", s.name, (unsigned long long)s.count, (unsigned long long)s.sum_ns,
+            (unsigned long long)s.min_ns, (unsigned long long)s.max_ns,
+            (unsigned long long)s.p50_ns, (unsigned long long)s.p90_ns,
+            (unsigned long long)s.p99_ns, (unsigned long long)s.p999_ns);
+    for (b = 0, first = 1; b < PERF_BUCKETS; b++) {
+      if (m->bucket[b] != 0) {
+        fprintf(f, "%s[%llu,%u]", first ? "" : ",", (unsigned long long)perf_bucket_low(b), m->bucket[b]);
+        first = 0;
+      }
+    }
+    fprintf(f, "]}");
+  }
+  fprintf(f, "]}\n");
+  fflush(f);
+  free(m);
+}
+/*-----------------------------------------------------------------------------------*/
+/** Start or stop recording (the time source is chosen by perf_init()) */
+void
+perf_enable(u8_t enable)
+{
+  __atomic_store_n(&perf_enabled, enable ? perf_source : PERF_OFF, __ATOMIC_RELAXED);
+}
+/*-----------------------------------------------------------------------------------*/
+static void
+perf_dump_file(void)
 {
-  fprintf(f, "%s: %lu\n", key, end->tms_stime - start->tms_stime);
-  fflush(NULL);  
+  perf_dump(perf_file);
 }
+/*-----------------------------------------------------------------------------------*/
+static void *
+perf_thread(void *arg)
+{
+  struct timespec ts;
+
+  LWIP_UNUSED_ARG(arg);
+  ts.tv_sec = perf_interval / 1000;
+  ts.tv_nsec = (long)(perf_interval % 1000) * 1000000L;
+  for (;;) {
+    nanosleep(&ts, NULL);
+    perf_dump(perf_file);
+  }
+  return NULL;
+}
+/*-----------------------------------------------------------------------------------*/
+/* Options of perf_init() */
+struct perf_opts {
+  u8_t enable;
+  u8_t tsc;
+};
+
+static int
+perf_opt(void *arg, const char *key, char *value)
+{
+  struct perf_opts *opts = (struct perf_opts *)arg;
+  char *end;
 
+  if (value == NULL) {
+    if (strcmp(key, "off")) {
+      return -1;
+    }
+    opts->enable = 0;
+  } else if (!strcmp(key, "clock") && (!strcmp(value, "tsc") || !strcmp(value, "monotonic"))) {
+    opts->tsc = (value[0] == 't');
+  } else if (!strcmp(key, "interval")) {
+    unsigned long interval = strtoul(value, &end, 10);
+    if ((end == value) || (*end != 0) || (interval > 0xffffffffUL)) {
+      return -1;
+    }
+    perf_interval = (u32_t)interval;
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+/** Choose the time source, open the dump file and start recording */
 void
-perf_init(char *fname)
+perf_init(const char *fname)
 {
-  f = fopen(fname, "w");  
+  struct perf_opts opts = { 1, 1 };
+  const char *env = getenv("PERF");
+  pthread_t thread;
+
+  if (env != NULL) {
+    port_parse_opts("perf", env, perf_opt, &opts);
+  }
+  if (opts.tsc) {
+    perf_calibrate();
+  }
+
+  perf_file = fopen(fname, "w");
+  if (perf_file == NULL) {
+    fprintf(stderr, "perf_init: cannot open \"%s\" for writing\n", fname);
+    return;
+  }
+  atexit(perf_dump_file);
+  if ((perf_interval > 0) && (pthread_create(&thread, NULL, perf_thread, NULL) == 0)) {
+    pthread_detach(thread);
+  }
+  perf_enable(opts.enable);
 }
-	
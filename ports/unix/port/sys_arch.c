@@ -44,14 +44,22 @@
  *    will block until there is more room instead of just
  *    leaking messages.
  */
+/* for pthread_setname_np(), pthread_attr_setaffinity_np() and CPU_SET() */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include "lwip/debug.h"
 
 #include <string.h>
+#include <stdio.h>
+#include <limits.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <sched.h>
 #include <errno.h>
 
 #include "lwip/def.h"
@@ -64,6 +72,30 @@
 #include "lwip/sys.h"
 #include "lwip/opt.h"
 #include "lwip/stats.h"
+#include "arch/trace.h"
+
+/** Define SYS_SEM_FUTEX to 1 to implement semaphores and mutexes directly on
+ * Linux futexes instead of pthread mutexes and condition variables: signalling
+ * a semaphore nobody waits on and taking/releasing an uncontended mutex never
+ * enter the kernel, and timed waits sleep until an absolute CLOCK_MONOTONIC
+ * deadline. Enabled by default on Linux; the pthread implementation is used
+ * everywhere else.
+ */
+#ifndef SYS_SEM_FUTEX
+#if defined(LWIP_UNIX_LINUX) && !NO_SYS
+#define SYS_SEM_FUTEX 1
+#else
+#define SYS_SEM_FUTEX 0
+#endif
+#endif
+
+#if SYS_SEM_FUTEX
+#ifndef LWIP_UNIX_LINUX
+#error "SYS_SEM_FUTEX is only supported on Linux"
+#endif
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif /* SYS_SEM_FUTEX */
 
 static void
 get_monotonic_time(struct timespec *ts)
@@ -93,53 +125,995 @@ struct sys_mbox_msg {
   void *msg;
 };
 
+#if SYS_ARCH_TELEMETRY
+/* Mailboxes, semaphores and mutexes reported by sys_telemetry_foreach() are
+   linked into a list through this */
+struct sys_telemetry_node {
+  struct sys_telemetry_node *next;
+  struct sys_telemetry_node *prev;
+  void *obj;
+  u8_t type;
+  char owner[SYS_TELEMETRY_NAME_LEN];
+};
+#endif /* SYS_ARCH_TELEMETRY */
+
+/** Mailboxes are allocated with the size passed to sys_mbox_new(), rounded up
+ * to a power of two and clamped to [SYS_MBOX_SIZE_MIN, SYS_MBOX_SIZE_MAX].
+ * SYS_MBOX_SIZE is used when lwIP passes a size of 0 (e.g. TCPIP_MBOX_SIZE or
+ * one of the DEFAULT_*_RECVMBOX_SIZE options is not set).
+ */
+#ifndef SYS_MBOX_SIZE
 #define SYS_MBOX_SIZE 128
+#endif
+#ifndef SYS_MBOX_SIZE_MIN
+#define SYS_MBOX_SIZE_MIN 8
+#endif
+#ifndef SYS_MBOX_SIZE_MAX
+#define SYS_MBOX_SIZE_MAX 4096
+#endif
+
+#if ((SYS_MBOX_SIZE_MIN & (SYS_MBOX_SIZE_MIN - 1)) != 0) || ((SYS_MBOX_SIZE_MAX & (SYS_MBOX_SIZE_MAX - 1)) != 0)
+#error "SYS_MBOX_SIZE_MIN and SYS_MBOX_SIZE_MAX must be powers of two"
+#endif
+#if SYS_MBOX_SIZE_MIN > SYS_MBOX_SIZE_MAX
+#error "SYS_MBOX_SIZE_MIN must not be bigger than SYS_MBOX_SIZE_MAX"
+#endif
+
+/** Define SYS_MBOX_LOCKFREE to 1 to implement mailboxes as a lock-free ring:
+ * posting reserves a slot with a single compare-and-swap and fetching never
+ * takes a lock. The internal semaphores are only used to put a blocked reader
+ * (or blocked posters) to sleep, and are only signalled when somebody actually
+ * announced that it is waiting.
+ * Any number of threads may post to a mailbox, but only one thread may block
+ * in sys_arch_mbox_fetch() on a given mailbox at a time (which is the way lwIP
+ * uses its mailboxes).
+ */
+#ifndef SYS_MBOX_LOCKFREE
+#define SYS_MBOX_LOCKFREE 0
+#endif
+
+#if SYS_MBOX_LOCKFREE
+
+/* keep the posters' and the reader's index on different cache lines */
+#define SYS_MBOX_CACHE_LINE 64
+
+struct sys_mbox_slot {
+  /* sequence number: == position when free to post to,
+     == position + 1 when holding a message for that position */
+  u32_t seq;
+  void *msg;
+#if SYS_ARCH_TELEMETRY
+  u64_t posted;
+#endif /* SYS_ARCH_TELEMETRY */
+};
+
+struct sys_mbox {
+  u32_t head;
+  u8_t pad_head[SYS_MBOX_CACHE_LINE - sizeof(u32_t)];
+  u32_t tail;
+  u8_t pad_tail[SYS_MBOX_CACHE_LINE - sizeof(u32_t)];
+  int wait_fetch;
+  int wait_send;
+  struct sys_sem *not_empty;
+  struct sys_sem *not_full;
+  u32_t size;
+#if SYS_STATS
+  u32_t max;
+  u32_t overflow;
+#endif /* SYS_STATS */
+  struct sys_mbox_slot *slots;
+#if SYS_ARCH_TELEMETRY
+  struct sys_telemetry_node node;
+  struct sys_mbox_stats tel;
+#endif /* SYS_ARCH_TELEMETRY */
+};
+#define SYS_MBOX_RING_ELEM_SIZE sizeof(struct sys_mbox_slot)
+
+#else /* SYS_MBOX_LOCKFREE */
 
 struct sys_mbox {
-  int first, last;
-  void *msgs[SYS_MBOX_SIZE];
+  u32_t first, last;
+  u32_t size;
+#if SYS_STATS
+  u32_t max;
+  u32_t overflow;
+#endif /* SYS_STATS */
+  void **msgs;
   struct sys_sem *not_empty;
   struct sys_sem *not_full;
   struct sys_sem *mutex;
   int wait_send;
+#if SYS_ARCH_TELEMETRY
+  /* post time of each message, stored behind msgs */
+  u64_t *stamps;
+  struct sys_telemetry_node node;
+  struct sys_mbox_stats tel;
+#endif /* SYS_ARCH_TELEMETRY */
 };
+#if SYS_ARCH_TELEMETRY
+#define SYS_MBOX_RING_ELEM_SIZE (sizeof(void *) + sizeof(u64_t))
+#else /* SYS_ARCH_TELEMETRY */
+#define SYS_MBOX_RING_ELEM_SIZE sizeof(void *)
+#endif /* SYS_ARCH_TELEMETRY */
+
+#endif /* SYS_MBOX_LOCKFREE */
+
+#if SYS_SEM_FUTEX
+
+struct sys_sem {
+  /* the futex word: number of available tokens (0 or 1 after the first signal) */
+  u32_t c;
+  /* number of threads that are (about to go) asleep on 'c' */
+  u32_t waiters;
+#if SYS_ARCH_TELEMETRY
+  struct sys_telemetry_node node;
+  struct sys_sem_stats tel;
+#endif /* SYS_ARCH_TELEMETRY */
+};
+
+struct sys_mutex {
+  /* the futex word: 0 unlocked, 1 locked, 2 locked and maybe contended */
+  u32_t state;
+#if SYS_ARCH_TELEMETRY
+  struct sys_telemetry_node node;
+  struct sys_mutex_stats tel;
+#endif /* SYS_ARCH_TELEMETRY */
+};
+
+#else /* SYS_SEM_FUTEX */
 
 struct sys_sem {
   unsigned int c;
   pthread_condattr_t condattr;
   pthread_cond_t cond;
   pthread_mutex_t mutex;
+#if SYS_ARCH_TELEMETRY
+  struct sys_telemetry_node node;
+  struct sys_sem_stats tel;
+#endif /* SYS_ARCH_TELEMETRY */
 };
 
 struct sys_mutex {
   pthread_mutex_t mutex;
+#if SYS_ARCH_TELEMETRY
+  struct sys_telemetry_node node;
+  struct sys_mutex_stats tel;
+#endif /* SYS_ARCH_TELEMETRY */
 };
 
+#endif /* SYS_SEM_FUTEX */
+
 struct sys_thread {
   struct sys_thread *next;
   pthread_t pthread;
 };
 
 #if SYS_LIGHTWEIGHT_PROT
+/** Define SYS_LWPROT_SPINLOCK to 1 to implement sys_arch_protect() with a
+ * spinlock (test-and-test-and-set with exponential backoff, yielding the CPU
+ * after SYS_LWPROT_SPIN_MAX iterations) instead of a pthread mutex. The
+ * critical regions protected by it (memp/pbuf alloc and free) are only a few
+ * instructions long, so spinning is cheaper than sleeping in the kernel.
+ */
+#ifndef SYS_LWPROT_SPINLOCK
+#define SYS_LWPROT_SPINLOCK 0
+#endif
+#ifndef SYS_LWPROT_SPIN_MAX
+#define SYS_LWPROT_SPIN_MAX 1024
+#endif
+
+#if SYS_LWPROT_SPINLOCK
+static u32_t lwprot_lock = 0;
+#else /* SYS_LWPROT_SPINLOCK */
 static pthread_mutex_t lwprot_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_t lwprot_thread = (pthread_t)0xDEAD;
-static int lwprot_count = 0;
+#endif /* SYS_LWPROT_SPINLOCK */
+/* nesting depth of sys_arch_protect() in the current thread: being per
+   thread, it tells whether we already own the lock without looking at
+   shared state */
+static __thread int lwprot_count = 0;
 #endif /* SYS_LIGHTWEIGHT_PROT */
 
 static struct sys_sem *sys_sem_new_internal(u8_t count);
 static void sys_sem_free_internal(struct sys_sem *sem);
+static u32_t sys_sem_wait_internal(struct sys_sem *sem, u32_t timeout);
 
+#if !SYS_SEM_FUTEX
 static u32_t cond_wait(pthread_cond_t * cond, pthread_mutex_t * mutex,
                        u32_t timeout);
+#endif /* !SYS_SEM_FUTEX */
+
+/*-----------------------------------------------------------------------------------*/
+/* Object pools */
+/** Define SYS_ARCH_POOLS to 1 to allocate semaphores, mutexes, mailboxes (and
+ * their ring storage) and thread records from object pools instead of
+ * calling malloc()/free() for every object: each thread keeps a small cache
+ * per pool that is refilled from (and flushed to) a shared free list in
+ * batches of up to SYS_POOL_BATCH objects, so creating and deleting objects
+ * usually takes no lock at all. The shared free list of a pool keeps up to
+ * SYS_POOL_KEEP bytes of objects, more are returned to libc.
+ * Set it to 0 to get plain malloc()/free() (e.g. for valgrind or ASan).
+ */
+#ifndef SYS_ARCH_POOLS
+#define SYS_ARCH_POOLS 1
+#endif
+/** Maximum number of objects moved between a thread's cache and the shared
+ * free list (or allocated from libc) at once */
+#ifndef SYS_POOL_BATCH
+#define SYS_POOL_BATCH 16
+#endif
+/** Upper limit for the size of one batch; pools of objects bigger than
+ * this move one object at a time */
+#ifndef SYS_POOL_CHUNK_SIZE
+#define SYS_POOL_CHUNK_SIZE 4096
+#endif
+/** High-water mark of the shared free list of each pool in bytes (at least
+ * one batch is kept); objects freed beyond it go back to libc */
+#ifndef SYS_POOL_KEEP
+#define SYS_POOL_KEEP (64 * 1024)
+#endif
+
+#if SYS_ARCH_POOLS
+
+#define SYS_POOL_SEM      0
+#define SYS_POOL_MUTEX    1
+#define SYS_POOL_MBOX     2
+#define SYS_POOL_THREAD   3
+/* one pool per mailbox ring size (SYS_MBOX_SIZE_MIN << n) */
+#define SYS_POOL_RING(n)  (4 + (n))
+#define SYS_POOL_RING_CLASSES 16
+#define SYS_POOL_COUNT    SYS_POOL_RING(SYS_POOL_RING_CLASSES)
+
+#if (SYS_MBOX_SIZE_MAX / SYS_MBOX_SIZE_MIN) >= (1 << SYS_POOL_RING_CLASSES)
+#error "SYS_MBOX_SIZE_MAX / SYS_MBOX_SIZE_MIN too big for SYS_POOL_RING_CLASSES"
+#endif
+
+struct sys_pool_obj {
+  struct sys_pool_obj *next;
+};
+
+struct sys_pool {
+  size_t size;
+  u32_t batch;
+  u32_t keep;
+  pthread_mutex_t mutex;
+  struct sys_pool_obj *free;
+  u32_t free_count;
+#if SYS_STATS
+  /* objects handed out, now and at most */
+  u32_t used;
+  u32_t max;
+#endif /* SYS_STATS */
+};
+
+struct sys_pool_cache {
+  struct sys_pool_obj *head;
+  u32_t count;
+};
+
+static struct sys_pool sys_pools[SYS_POOL_COUNT];
+static pthread_once_t sys_pool_once = PTHREAD_ONCE_INIT;
+static pthread_key_t sys_pool_key;
+static __thread struct sys_pool_cache sys_pool_caches[SYS_POOL_COUNT];
+
+#define SYS_POOL_THREAD_NEW     0
+#define SYS_POOL_THREAD_CACHED  1
+#define SYS_POOL_THREAD_EXITED  2
+static __thread u8_t sys_pool_thread_state;
+
+#if SYS_STATS
+static void
+sys_pool_stats_alloc(struct sys_pool *pool)
+{
+  u32_t used = __atomic_add_fetch(&pool->used, 1, __ATOMIC_RELAXED);
+  u32_t max = __atomic_load_n(&pool->max, __ATOMIC_RELAXED);
+
+  while (used > max) {
+    if (__atomic_compare_exchange_n(&pool->max, &max, used, 1,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+      break;
+    }
+  }
+}
+#define SYS_POOL_STATS_ALLOC(pool) sys_pool_stats_alloc(pool)
+#define SYS_POOL_STATS_FREE(pool)  __atomic_sub_fetch(&(pool)->used, 1, __ATOMIC_RELAXED)
+#else /* SYS_STATS */
+#define SYS_POOL_STATS_ALLOC(pool)
+#define SYS_POOL_STATS_FREE(pool)
+#endif /* SYS_STATS */
+
+/* Put a NULL terminated list of objects on the shared free list, objects
+   beyond the pool's high-water mark go back to libc */
+static void
+sys_pool_release(struct sys_pool *pool, struct sys_pool_obj *obj)
+{
+  struct sys_pool_obj *excess = NULL, *next;
+
+  pthread_mutex_lock(&pool->mutex);
+  for (; obj != NULL; obj = next) {
+    next = obj->next;
+    if (pool->free_count < pool->keep) {
+      obj->next = pool->free;
+      pool->free = obj;
+      pool->free_count++;
+    } else {
+      obj->next = excess;
+      excess = obj;
+    }
+  }
+  pthread_mutex_unlock(&pool->mutex);
+
+  for (; excess != NULL; excess = next) {
+    next = excess->next;
+    free(excess);
+  }
+}
+
+/* Return all objects cached by an exiting thread to the shared free lists.
+   Objects the thread frees after this (e.g. from later TLS destructors)
+   bypass the cache. */
+static void
+sys_pool_thread_exit(void *arg)
+{
+  struct sys_pool_cache *caches = (struct sys_pool_cache *)arg;
+  int i;
+
+  for (i = 0; i < SYS_POOL_COUNT; i++) {
+    sys_pool_release(&sys_pools[i], caches[i].head);
+    caches[i].head = NULL;
+    caches[i].count = 0;
+  }
+  sys_pool_thread_state = SYS_POOL_THREAD_EXITED;
+}
+
+static void
+sys_pool_init_pool(int id, size_t size)
+{
+  struct sys_pool *pool = &sys_pools[id];
+
+  size = LWIP_MAX(size, sizeof(struct sys_pool_obj));
+  pool->size = size;
+  pool->batch = (u32_t)LWIP_MIN(LWIP_MAX(SYS_POOL_CHUNK_SIZE / size, 1), SYS_POOL_BATCH);
+  pool->keep = (u32_t)LWIP_MAX(SYS_POOL_KEEP / size, pool->batch);
+  pthread_mutex_init(&pool->mutex, NULL);
+  pool->free = NULL;
+  pool->free_count = 0;
+}
+
+static void
+sys_pool_init(void)
+{
+  int i;
+
+  sys_pool_init_pool(SYS_POOL_SEM, sizeof(struct sys_sem));
+  sys_pool_init_pool(SYS_POOL_MUTEX, sizeof(struct sys_mutex));
+  sys_pool_init_pool(SYS_POOL_MBOX, sizeof(struct sys_mbox));
+  sys_pool_init_pool(SYS_POOL_THREAD, sizeof(struct sys_thread));
+  for (i = 0; i < SYS_POOL_RING_CLASSES; i++) {
+    sys_pool_init_pool(SYS_POOL_RING(i), ((size_t)SYS_MBOX_SIZE_MIN << i) * SYS_MBOX_RING_ELEM_SIZE);
+  }
+  pthread_key_create(&sys_pool_key, sys_pool_thread_exit);
+}
+
+/* Get the calling thread's caches, making sure they are flushed when the
+   thread exits; NULL once they were flushed */
+static struct sys_pool_cache *
+sys_pool_thread_caches(void)
+{
+  if (sys_pool_thread_state == SYS_POOL_THREAD_NEW) {
+    pthread_once(&sys_pool_once, sys_pool_init);
+    pthread_setspecific(sys_pool_key, sys_pool_caches);
+    sys_pool_thread_state = SYS_POOL_THREAD_CACHED;
+  } else if (sys_pool_thread_state == SYS_POOL_THREAD_EXITED) {
+    return NULL;
+  }
+  return sys_pool_caches;
+}
+
+/* Move up to 'max' objects from the shared free list to 'head', returns
+   the number moved */
+static u32_t
+sys_pool_take(struct sys_pool *pool, struct sys_pool_obj **head, u32_t max)
+{
+  struct sys_pool_obj *obj;
+  u32_t n = 0;
+
+  pthread_mutex_lock(&pool->mutex);
+  while ((n < max) && (pool->free != NULL)) {
+    obj = pool->free;
+    pool->free = obj->next;
+    obj->next = *head;
+    *head = obj;
+    n++;
+  }
+  pool->free_count -= n;
+  pthread_mutex_unlock(&pool->mutex);
+  return n;
+}
+
+/* Refill an empty thread cache from the shared free list or from libc */
+static void
+sys_pool_refill(struct sys_pool *pool, struct sys_pool_cache *cache)
+{
+  struct sys_pool_obj *obj;
+  u32_t n = sys_pool_take(pool, &cache->head, pool->batch);
+
+  if (n == 0) {
+    for (; n < pool->batch; n++) {
+      obj = (struct sys_pool_obj *)malloc(pool->size);
+      if (obj == NULL) {
+        break;
+      }
+      obj->next = cache->head;
+      cache->head = obj;
+    }
+  }
+  cache->count += n;
+}
+
+static void *
+sys_pool_alloc(int id)
+{
+  struct sys_pool_cache *caches = sys_pool_thread_caches();
+  struct sys_pool_cache *cache;
+  struct sys_pool_obj *obj = NULL;
+
+  if (caches == NULL) {
+    /* the thread is exiting */
+    if (sys_pool_take(&sys_pools[id], &obj, 1) == 0) {
+      obj = (struct sys_pool_obj *)malloc(sys_pools[id].size);
+    }
+  } else {
+    cache = &caches[id];
+    if (cache->head == NULL) {
+      sys_pool_refill(&sys_pools[id], cache);
+    }
+    obj = cache->head;
+    if (obj != NULL) {
+      cache->head = obj->next;
+      cache->count--;
+    }
+  }
+  if (obj != NULL) {
+    SYS_POOL_STATS_ALLOC(&sys_pools[id]);
+  }
+  return obj;
+}
+
+static void
+sys_pool_free(int id, void *mem)
+{
+  struct sys_pool_cache *caches = sys_pool_thread_caches();
+  struct sys_pool_cache *cache;
+  struct sys_pool *pool = &sys_pools[id];
+  struct sys_pool_obj *obj = (struct sys_pool_obj *)mem;
+
+  SYS_POOL_STATS_FREE(pool);
+  if (caches == NULL) {
+    /* the thread is exiting */
+    obj->next = NULL;
+    sys_pool_release(pool, obj);
+    return;
+  }
+  cache = &caches[id];
+  obj->next = cache->head;
+  cache->head = obj;
+  cache->count++;
+
+  if (cache->count >= 2 * pool->batch) {
+    /* keep one batch, return the other one */
+    struct sys_pool_obj *first = cache->head;
+    struct sys_pool_obj *last = first;
+    u32_t n;
+    for (n = 1; n < pool->batch; n++) {
+      last = last->next;
+    }
+    cache->head = last->next;
+    cache->count -= pool->batch;
+    last->next = NULL;
+    sys_pool_release(pool, first);
+  }
+}
+
+/* Pool holding the ring storage of a mailbox with capacity 'size' */
+static int
+sys_pool_ring(u32_t size)
+{
+  int n = 0;
+
+  while (((u32_t)SYS_MBOX_SIZE_MIN << n) < size) {
+    n++;
+  }
+  return SYS_POOL_RING(n);
+}
+
+#define SYS_POOL_ALLOC(pool, size)      sys_pool_alloc(pool)
+#define SYS_POOL_FREE(pool, mem)        sys_pool_free(pool, mem)
+#define SYS_POOL_ALLOC_RING(size)       sys_pool_alloc(sys_pool_ring(size))
+#define SYS_POOL_FREE_RING(size, mem)   sys_pool_free(sys_pool_ring(size), mem)
+
+/** Occupancy of pool number 'index' (counting from 0), returns -1 if there
+ * is no such pool */
+int
+sys_pool_get_stats(int index, struct sys_pool_stats *stats)
+{
+  static const char *const names[SYS_POOL_RING(0)] = { "sem", "mutex", "mbox", "thread" };
+  struct sys_pool *pool;
+
+  if ((index < 0) || (index >= SYS_POOL_COUNT)) {
+    return -1;
+  }
+  pthread_once(&sys_pool_once, sys_pool_init);
+  pool = &sys_pools[index];
+  if (index < SYS_POOL_RING(0)) {
+    snprintf(stats->name, sizeof(stats->name), "%s", names[index]);
+  } else {
+    snprintf(stats->name, sizeof(stats->name), "ring%lu",
+             (unsigned long)SYS_MBOX_SIZE_MIN << (index - SYS_POOL_RING(0)));
+  }
+  stats->size = (u32_t)pool->size;
+#if SYS_STATS
+  stats->used = __atomic_load_n(&pool->used, __ATOMIC_RELAXED);
+  stats->max = __atomic_load_n(&pool->max, __ATOMIC_RELAXED);
+#else /* SYS_STATS */
+  stats->used = 0;
+  stats->max = 0;
+#endif /* SYS_STATS */
+  pthread_mutex_lock(&pool->mutex);
+  stats->free = pool->free_count;
+  pthread_mutex_unlock(&pool->mutex);
+  return 0;
+}
+
+#else /* SYS_ARCH_POOLS */
+
+#define SYS_POOL_ALLOC(pool, size)      malloc(size)
+#define SYS_POOL_FREE(pool, mem)        free(mem)
+#define SYS_POOL_ALLOC_RING(size)       malloc((size) * SYS_MBOX_RING_ELEM_SIZE)
+#define SYS_POOL_FREE_RING(size, mem)   free(mem)
+
+int
+sys_pool_get_stats(int index, struct sys_pool_stats *stats)
+{
+  LWIP_UNUSED_ARG(index);
+  LWIP_UNUSED_ARG(stats);
+  return -1;
+}
+
+#endif /* SYS_ARCH_POOLS */
+
+/** Write the pools that were used as text, one line each (for the shell's
+ * stat command, next to the SYS_STATS counters of lwip_stats.sys) */
+void
+sys_pool_stats_print(sys_write_fn write, void *ctx)
+{
+  struct sys_pool_stats s;
+  char line[128];
+  int i;
+
+  for (i = 0; sys_pool_get_stats(i, &s) == 0; i++) {
+    if ((s.max == 0) && (s.free == 0)) {
+      continue;
+    }
+    snprintf(line, sizeof(line), "pool   %-10s size %6"U32_F" used %"U32_F" max %"U32_F" free %"U32_F"\n",
+             s.name, s.size, s.used, s.max, s.free);
+    write(ctx, line);
+  }
+}
+
+/*-----------------------------------------------------------------------------------*/
+/* Telemetry */
+#if SYS_ARCH_TELEMETRY
+
+/* Per-thread record, created on the thread's first use of sys_arch. When
+   the thread exits its counts are added to telemetry_exited and the record
+   is freed. */
+struct sys_telemetry_thread {
+  struct sys_telemetry_thread *next;
+  u64_t start_us;
+  u64_t end_us;
+  struct sys_thread_stats stats;
+};
+
+#define SYS_TELEMETRY_FETCH 0
+#define SYS_TELEMETRY_POST  1
+#define SYS_TELEMETRY_SEM   2
+#define SYS_TELEMETRY_LOCK  3
+
+static struct sys_telemetry_node telemetry_objects = {
+  &telemetry_objects, &telemetry_objects, NULL, 0, ""
+};
+static u32_t telemetry_count;
+static struct sys_telemetry_thread *telemetry_threads;
+static u32_t telemetry_thread_count;
+static struct sys_telemetry_thread telemetry_unknown = {
+  NULL, 0, 0, {"?", 1, 0, 0, 0, 0, 0, {0}, {0}, {0}, {0}}
+};
+/* Sum of the threads that exited, end_us is the sum of their lifetimes */
+static struct sys_telemetry_thread telemetry_exited = {
+  NULL, 0, 0, {"(exited)", 0, 0, 0, 0, 0, 0, {0}, {0}, {0}, {0}}
+};
+static u32_t telemetry_exited_count;
+static pthread_mutex_t telemetry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t telemetry_once = PTHREAD_ONCE_INIT;
+static pthread_key_t telemetry_key;
+static __thread struct sys_telemetry_thread *telemetry_self;
+
+#define SYS_TELEMETRY_INC(x)    __atomic_add_fetch(&(x), 1, __ATOMIC_RELAXED)
+#define SYS_TELEMETRY_ADD(x, n) __atomic_add_fetch(&(x), (n), __ATOMIC_RELAXED)
+#define SYS_TELEMETRY_GET(x)    __atomic_load_n(&(x), __ATOMIC_RELAXED)
+
+static u64_t
+sys_telemetry_now(void)
+{
+  struct timespec ts;
+
+  get_monotonic_time(&ts);
+  return (u64_t)ts.tv_sec * 1000000 + (u64_t)ts.tv_nsec / 1000;
+}
+
+static void
+sys_hist_add(u32_t *hist, u64_t us)
+{
+  int i = 0;
+
+  while ((i < SYS_HIST_BUCKETS - 1) && (us >= ((u64_t)1 << i))) {
+    i++;
+  }
+  SYS_TELEMETRY_INC(hist[i]);
+}
+
+static void
+sys_hist_copy(u32_t *dst, u32_t *src)
+{
+  int i;
+
+  for (i = 0; i < SYS_HIST_BUCKETS; i++) {
+    dst[i] = SYS_TELEMETRY_GET(src[i]);
+  }
+}
+
+static void
+sys_hist_fold(u32_t *dst, u32_t *src)
+{
+  int i;
+
+  for (i = 0; i < SYS_HIST_BUCKETS; i++) {
+    SYS_TELEMETRY_ADD(dst[i], SYS_TELEMETRY_GET(src[i]));
+  }
+}
+
+/* Retire the record of an exiting thread into telemetry_exited */
+static void
+sys_telemetry_thread_exit(void *arg)
+{
+  struct sys_telemetry_thread *t = (struct sys_telemetry_thread *)arg;
+  struct sys_thread_stats *sum = &telemetry_exited.stats;
+  struct sys_telemetry_thread **p;
+
+  pthread_mutex_lock(&telemetry_mutex);
+  for (p = &telemetry_threads; *p != NULL; p = &(*p)->next) {
+    if (*p == t) {
+      *p = t->next;
+      telemetry_thread_count--;
+      break;
+    }
+  }
+  telemetry_exited_count++;
+  pthread_mutex_unlock(&telemetry_mutex);
+
+  SYS_TELEMETRY_ADD(telemetry_exited.end_us, sys_telemetry_now() - t->start_us);
+  SYS_TELEMETRY_ADD(sum->posts, SYS_TELEMETRY_GET(t->stats.posts));
+  SYS_TELEMETRY_ADD(sum->fetches, SYS_TELEMETRY_GET(t->stats.fetches));
+  SYS_TELEMETRY_ADD(sum->idle_us, SYS_TELEMETRY_GET(t->stats.idle_us));
+  SYS_TELEMETRY_ADD(sum->blocked_us, SYS_TELEMETRY_GET(t->stats.blocked_us));
+  sys_hist_fold(sum->fetch_wait_us, t->stats.fetch_wait_us);
+  sys_hist_fold(sum->post_wait_us, t->stats.post_wait_us);
+  sys_hist_fold(sum->sem_wait_us, t->stats.sem_wait_us);
+  sys_hist_fold(sum->mutex_wait_us, t->stats.mutex_wait_us);
+  /* later destructors of the thread may still use sys_arch */
+  telemetry_self = &telemetry_exited;
+  free(t);
+}
+
+static void
+sys_telemetry_key_init(void)
+{
+  pthread_key_create(&telemetry_key, sys_telemetry_thread_exit);
+}
+
+/* The calling thread's record. 'name' is passed by threads created with
+   sys_thread_new(), other threads are named by their first use. */
+static struct sys_telemetry_thread *
+sys_telemetry_thread(const char *name)
+{
+  struct sys_telemetry_thread *t = telemetry_self;
+
+  if (t != NULL) {
+    return t;
+  }
+  t = (struct sys_telemetry_thread *)calloc(1, sizeof(struct sys_telemetry_thread));
+  if (t == NULL) {
+    return &telemetry_unknown;
+  }
+  t->start_us = sys_telemetry_now();
+  t->stats.alive = 1;
+  if (name != NULL) {
+    strncpy(t->stats.name, name, SYS_TELEMETRY_NAME_LEN - 1);
+  } else {
+#ifdef LWIP_UNIX_LINUX
+    pthread_getname_np(pthread_self(), t->stats.name, SYS_TELEMETRY_NAME_LEN);
+#else /* LWIP_UNIX_LINUX */
+    strcpy(t->stats.name, "thread");
+#endif /* LWIP_UNIX_LINUX */
+  }
+  pthread_once(&telemetry_once, sys_telemetry_key_init);
+  pthread_setspecific(telemetry_key, t);
+
+  pthread_mutex_lock(&telemetry_mutex);
+  t->next = telemetry_threads;
+  telemetry_threads = t;
+  telemetry_thread_count++;
+  pthread_mutex_unlock(&telemetry_mutex);
+  telemetry_self = t;
+  return t;
+}
+
+/* Account time the calling thread spent blocked */
+static void
+sys_telemetry_blocked(int what, u64_t us)
+{
+  struct sys_thread_stats *stats = &sys_telemetry_thread(NULL)->stats;
+
+  switch (what) {
+    case SYS_TELEMETRY_FETCH:
+      sys_hist_add(stats->fetch_wait_us, us);
+      SYS_TELEMETRY_ADD(stats->idle_us, us);
+      return;
+    case SYS_TELEMETRY_POST:
+      sys_hist_add(stats->post_wait_us, us);
+      break;
+    case SYS_TELEMETRY_SEM:
+      sys_hist_add(stats->sem_wait_us, us);
+      break;
+    default:
+      sys_hist_add(stats->mutex_wait_us, us);
+      break;
+  }
+  SYS_TELEMETRY_ADD(stats->blocked_us, us);
+}
+
+static void
+sys_telemetry_register(struct sys_telemetry_node *node, u8_t type, void *obj)
+{
+  struct sys_telemetry_thread *t = sys_telemetry_thread(NULL);
+
+  node->type = type;
+  node->obj = obj;
+  memcpy(node->owner, t->stats.name, SYS_TELEMETRY_NAME_LEN);
+
+  pthread_mutex_lock(&telemetry_mutex);
+  node->next = telemetry_objects.next;
+  node->prev = &telemetry_objects;
+  telemetry_objects.next->prev = node;
+  telemetry_objects.next = node;
+  telemetry_count++;
+  pthread_mutex_unlock(&telemetry_mutex);
+}
+
+static void
+sys_telemetry_unregister(struct sys_telemetry_node *node)
+{
+  pthread_mutex_lock(&telemetry_mutex);
+  node->prev->next = node->next;
+  node->next->prev = node->prev;
+  telemetry_count--;
+  pthread_mutex_unlock(&telemetry_mutex);
+}
+
+/* Start of a wait, t is 0 while not waiting yet */
+#define SYS_TELEMETRY_WAIT(t) do { if ((t) == 0) { (t) = sys_telemetry_now(); } } while (0)
+/* End of a wait: account it to the object's histogram and the thread */
+#define SYS_TELEMETRY_WAITED(t, hist, what) do { if ((t) != 0) { \
+    u64_t waited_ = sys_telemetry_now() - (t); \
+    sys_hist_add(hist, waited_); \
+    sys_telemetry_blocked(what, waited_); } } while (0)
+
+/* A message was posted, leaving 'depth' queued */
+static void
+sys_mbox_telemetry_post(struct sys_mbox *mbox, u32_t depth)
+{
+  SYS_TELEMETRY_INC(mbox->tel.posts);
+  SYS_TELEMETRY_ADD(mbox->tel.depth_sum, depth);
+  SYS_TELEMETRY_INC(sys_telemetry_thread(NULL)->stats.posts);
+}
+
+/* A message posted at 'posted' was fetched */
+static void
+sys_mbox_telemetry_fetch(struct sys_mbox *mbox, u64_t posted)
+{
+  u64_t now = sys_telemetry_now();
+
+  SYS_TELEMETRY_INC(mbox->tel.fetches);
+  sys_hist_add(mbox->tel.latency_us, (now > posted) ? now - posted : 0);
+  SYS_TELEMETRY_INC(sys_telemetry_thread(NULL)->stats.fetches);
+}
+
+#else /* SYS_ARCH_TELEMETRY */
+
+#define SYS_TELEMETRY_WAIT(t)
+#define SYS_TELEMETRY_WAITED(t, hist, what)
+
+#endif /* SYS_ARCH_TELEMETRY */
 
 /*-----------------------------------------------------------------------------------*/
 /* Threads */
+/** Scheduling policy for threads created by sys_thread_new(). With a real-time
+ * policy (SCHED_FIFO, SCHED_RR) the 'prio' argument is used as the thread's
+ * static priority (clamped to the policy's range), threads created with
+ * prio <= 0 keep the default policy. If the process may not use the policy,
+ * threads are created with the default one.
+ */
+#ifndef SYS_THREAD_SCHED_POLICY
+#define SYS_THREAD_SCHED_POLICY SCHED_OTHER
+#endif
+
+/** Define SYS_THREAD_AFFINITY to 1 to pin threads created by sys_thread_new()
+ * to CPUs by their name. The table is read from the environment variable
+ * SYS_THREAD_AFFINITY_ENV (or SYS_THREAD_AFFINITY_DEFAULT if that is not set)
+ * and looks like this:
+ *   tcpip_thread=2;tapif_thread=3;unixif_thread=3;*=4-7,9
+ * '*' matches threads not listed by name; threads matching no entry may run
+ * on any CPU.
+ */
+#ifndef SYS_THREAD_AFFINITY
+#ifdef LWIP_UNIX_LINUX
+#define SYS_THREAD_AFFINITY 1
+#else
+#define SYS_THREAD_AFFINITY 0
+#endif
+#endif
+#ifndef SYS_THREAD_AFFINITY_ENV
+#define SYS_THREAD_AFFINITY_ENV "LWIP_THREAD_AFFINITY"
+#endif
+#ifndef SYS_THREAD_AFFINITY_DEFAULT
+#define SYS_THREAD_AFFINITY_DEFAULT NULL
+#endif
+
+#if SYS_THREAD_AFFINITY
+#ifndef LWIP_UNIX_LINUX
+#error "SYS_THREAD_AFFINITY is only supported on Linux"
+#endif
+
+/* Parse a CPU list like "0-3,6" of 'len' characters into 'set' */
+static int
+sys_thread_parse_cpus(const char *list, size_t len, cpu_set_t *set)
+{
+  const char *end = list + len;
+
+  CPU_ZERO(set);
+  while (list < end) {
+    char *next;
+    long first, last;
+
+    first = last = strtol(list, &next, 10);
+    if ((next == list) || (first < 0)) {
+      return -1;
+    }
+    if ((next < end) && (*next == '-')) {
+      list = next + 1;
+      last = strtol(list, &next, 10);
+      if ((next == list) || (last < first)) {
+        return -1;
+      }
+    }
+    if (last >= CPU_SETSIZE) {
+      return -1;
+    }
+    for (; first <= last; first++) {
+      CPU_SET((int)first, set);
+    }
+    if ((next < end) && (*next != ',')) {
+      return -1;
+    }
+    list = next + 1;
+  }
+  return CPU_COUNT(set) > 0 ? 0 : -1;
+}
+
+/* Look up the CPUs for the thread 'name' in the affinity table */
+static int
+sys_thread_affinity(const char *name, cpu_set_t *set)
+{
+  const char *table = getenv(SYS_THREAD_AFFINITY_ENV);
+  const char *entry, *wildcard = NULL;
+  size_t name_len = (name != NULL) ? strlen(name) : 0;
+
+  if (table == NULL) {
+    table = SYS_THREAD_AFFINITY_DEFAULT;
+    if (table == NULL) {
+      return -1;
+    }
+  }
+
+  for (entry = table; *entry != 0; ) {
+    const char *eq = strchr(entry, '=');
+    const char *end = strchr(entry, ';');
+    if (end == NULL) {
+      end = entry + strlen(entry);
+    }
+    if ((eq != NULL) && (eq < end)) {
+      size_t len = (size_t)(eq - entry);
+      if ((name_len == len) && (memcmp(entry, name, len) == 0)) {
+        return sys_thread_parse_cpus(eq + 1, (size_t)(end - eq - 1), set);
+      }
+      if ((len == 1) && (*entry == '*')) {
+        wildcard = eq + 1;
+      }
+    }
+    entry = (*end == ';') ? end + 1 : end;
+  }
+  if (wildcard != NULL) {
+    const char *end = strchr(wildcard, ';');
+    return sys_thread_parse_cpus(wildcard, (end != NULL) ? (size_t)(end - wildcard) : strlen(wildcard), set);
+  }
+  return -1;
+}
+#endif /* SYS_THREAD_AFFINITY */
+
+/* Set up the attributes of a new thread from the sys_thread_new() arguments */
+static void
+sys_thread_attr_init(pthread_attr_t *attr, const char *name, int stacksize, int prio)
+{
+#if SYS_THREAD_AFFINITY
+  cpu_set_t cpus;
+#endif /* SYS_THREAD_AFFINITY */
+
+  pthread_attr_init(attr);
+
+  if (stacksize > 0) {
+    size_t size = (size_t)stacksize;
+    if (size < (size_t)PTHREAD_STACK_MIN) {
+      size = (size_t)PTHREAD_STACK_MIN;
+    }
+    pthread_attr_setstacksize(attr, size);
+  }
+
+  if ((SYS_THREAD_SCHED_POLICY != SCHED_OTHER) && (prio > 0)) {
+    struct sched_param param;
+    int min = sched_get_priority_min(SYS_THREAD_SCHED_POLICY);
+    int max = sched_get_priority_max(SYS_THREAD_SCHED_POLICY);
+
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = LWIP_MIN(LWIP_MAX(prio, min), max);
+    pthread_attr_setinheritsched(attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(attr, SYS_THREAD_SCHED_POLICY);
+    pthread_attr_setschedparam(attr, &param);
+  }
+
+#if SYS_THREAD_AFFINITY
+  if (sys_thread_affinity(name, &cpus) == 0) {
+    cpu_set_t allowed;
+    /* ignore CPUs we may not run on, pthread_create() would fail */
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+      CPU_AND(&cpus, &cpus, &allowed);
+    }
+    if (CPU_COUNT(&cpus) > 0) {
+      pthread_attr_setaffinity_np(attr, sizeof(cpus), &cpus);
+    } else {
+      LWIP_DEBUGF(SYS_DEBUG, ("sys_thread_new: no usable CPU for \"%s\" in "SYS_THREAD_AFFINITY_ENV"\n", name != NULL ? name : ""));
+    }
+  }
+#else /* SYS_THREAD_AFFINITY */
+  LWIP_UNUSED_ARG(name);
+#endif /* SYS_THREAD_AFFINITY */
+}
+
 static struct sys_thread * 
 introduce_thread(pthread_t id)
 {
   struct sys_thread *thread;
 
-  thread = (struct sys_thread *)malloc(sizeof(struct sys_thread));
+  thread = (struct sys_thread *)SYS_POOL_ALLOC(SYS_POOL_THREAD, sizeof(struct sys_thread));
 
   if (thread != NULL) {
     pthread_mutex_lock(&threads_mutex);
@@ -152,53 +1126,565 @@ introduce_thread(pthread_t id)
   return thread;
 }
 
+#if SYS_ARCH_TELEMETRY
+struct sys_thread_start {
+  lwip_thread_fn function;
+  void *arg;
+  char name[SYS_TELEMETRY_NAME_LEN];
+};
+
+/* Entry of threads created by sys_thread_new(): name the telemetry record
+   before the thread uses any mailbox */
+static void *
+sys_thread_start(void *arg)
+{
+  struct sys_thread_start start = *(struct sys_thread_start *)arg;
+
+  free(arg);
+  sys_telemetry_thread(start.name);
+  start.function(start.arg);
+  return NULL;
+}
+#endif /* SYS_ARCH_TELEMETRY */
+
 sys_thread_t
 sys_thread_new(const char *name, lwip_thread_fn function, void *arg, int stacksize, int prio)
 {
   int code;
   pthread_t tmp;
+  pthread_attr_t attr;
   struct sys_thread *st = NULL;
-  LWIP_UNUSED_ARG(name);
-  LWIP_UNUSED_ARG(stacksize);
-  LWIP_UNUSED_ARG(prio);
+  void *(*entry)(void *) = (void *(*)(void *))function;
+  void *entry_arg = arg;
+#if SYS_ARCH_TELEMETRY
+  struct sys_thread_start *start;
+
+  start = (struct sys_thread_start *)calloc(1, sizeof(struct sys_thread_start));
+  if (start != NULL) {
+    start->function = function;
+    start->arg = arg;
+    if (name != NULL) {
+      strncpy(start->name, name, SYS_TELEMETRY_NAME_LEN - 1);
+    }
+    entry = sys_thread_start;
+    entry_arg = start;
+  }
+#endif /* SYS_ARCH_TELEMETRY */
+
+  sys_thread_attr_init(&attr, name, stacksize, prio);
+  code = pthread_create(&tmp,
+                        &attr, 
+                        entry,
+                        entry_arg);
+  if ((code == EPERM) && (SYS_THREAD_SCHED_POLICY != SCHED_OTHER)) {
+    /* not allowed to use the real-time policy, fall back to the default */
+    LWIP_DEBUGF(SYS_DEBUG, ("sys_thread_new: no permission for SYS_THREAD_SCHED_POLICY, \"%s\" uses the default policy\n",
+                            name != NULL ? name : ""));
+    pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+    code = pthread_create(&tmp,
+                          &attr,
+                          entry,
+                          entry_arg);
+  }
+  pthread_attr_destroy(&attr);
+#if SYS_ARCH_TELEMETRY
+  if (code != 0) {
+    free(start);
+  }
+#endif /* SYS_ARCH_TELEMETRY */
+  
+  if (0 == code) {
+#ifdef LWIP_UNIX_LINUX
+    if (name != NULL) {
+      /* Linux limits thread names to 15 characters */
+      char tname[16];
+      strncpy(tname, name, sizeof(tname) - 1);
+      tname[sizeof(tname) - 1] = 0;
+      pthread_setname_np(tmp, tname);
+    }
+#endif /* LWIP_UNIX_LINUX */
+    st = introduce_thread(tmp);
+  }
+  
+  if (NULL == st) {
+    LWIP_DEBUGF(SYS_DEBUG, ("sys_thread_new: pthread_create %d, st = 0x%lx",
+                       code, (unsigned long)st));
+    abort();
+  }
+  return st;
+}
+
+/*-----------------------------------------------------------------------------------*/
+/* Mailbox */
+/* Number of messages a mailbox created with 'size' can hold */
+static u32_t
+sys_mbox_capacity(int size)
+{
+  u32_t capacity = SYS_MBOX_SIZE_MIN;
+
+  if (size <= 0) {
+    size = SYS_MBOX_SIZE;
+  }
+  while ((capacity < (u32_t)size) && (capacity < SYS_MBOX_SIZE_MAX)) {
+    capacity <<= 1;
+  }
+  return capacity;
+}
+
+void
+sys_mbox_get_stats(sys_mbox_t *mb, struct sys_mbox_stats *stats)
+{
+  struct sys_mbox *mbox;
+  LWIP_ASSERT("invalid mbox", (mb != NULL) && (*mb != NULL));
+  LWIP_ASSERT("invalid stats", stats != NULL);
+  mbox = *mb;
+
+  stats->size = mbox->size;
+#if SYS_STATS
+  stats->max = __atomic_load_n(&mbox->max, __ATOMIC_RELAXED);
+  stats->overflow = __atomic_load_n(&mbox->overflow, __ATOMIC_RELAXED);
+#else /* SYS_STATS */
+  stats->max = 0;
+  stats->overflow = 0;
+#endif /* SYS_STATS */
+#if SYS_ARCH_TELEMETRY
+  stats->posts = SYS_TELEMETRY_GET(mbox->tel.posts);
+  stats->fetches = SYS_TELEMETRY_GET(mbox->tel.fetches);
+#if SYS_MBOX_LOCKFREE
+  stats->depth = SYS_TELEMETRY_GET(mbox->head) - SYS_TELEMETRY_GET(mbox->tail);
+#else /* SYS_MBOX_LOCKFREE */
+  stats->depth = SYS_TELEMETRY_GET(mbox->last) - SYS_TELEMETRY_GET(mbox->first);
+#endif /* SYS_MBOX_LOCKFREE */
+  if (stats->depth > mbox->size) {
+    /* read while the indexes moved */
+    stats->depth = 0;
+  }
+  stats->depth_sum = SYS_TELEMETRY_GET(mbox->tel.depth_sum);
+  sys_hist_copy(stats->latency_us, mbox->tel.latency_us);
+  sys_hist_copy(stats->post_wait_us, mbox->tel.post_wait_us);
+  sys_hist_copy(stats->fetch_wait_us, mbox->tel.fetch_wait_us);
+#endif /* SYS_ARCH_TELEMETRY */
+}
+
+#if SYS_STATS
+/* Record that a post found the mailbox full */
+static void
+sys_mbox_stats_overflow(struct sys_mbox *mbox)
+{
+  __atomic_add_fetch(&mbox->overflow, 1, __ATOMIC_RELAXED);
+  SYS_STATS_INC(mbox.err);
+}
+
+/* Update the high water mark after a post left 'depth' messages queued */
+static void
+sys_mbox_stats_depth(struct sys_mbox *mbox, u32_t depth)
+{
+  u32_t max = __atomic_load_n(&mbox->max, __ATOMIC_RELAXED);
+
+  while (depth > max) {
+    if (__atomic_compare_exchange_n(&mbox->max, &max, depth, 1,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+      break;
+    }
+  }
+}
+#define SYS_MBOX_STATS_OVERFLOW(mbox)     sys_mbox_stats_overflow(mbox)
+#define SYS_MBOX_STATS_DEPTH(mbox, depth) sys_mbox_stats_depth(mbox, depth)
+#else /* SYS_STATS */
+#define SYS_MBOX_STATS_OVERFLOW(mbox)
+#define SYS_MBOX_STATS_DEPTH(mbox, depth)
+#endif /* SYS_STATS */
+
+#if SYS_MBOX_LOCKFREE
+/* Reserve a slot at the head of the ring and store msg in it.
+   Returns 0 if the ring is full. */
+static int
+sys_mbox_ring_put(struct sys_mbox *mbox, void *msg)
+{
+  struct sys_mbox_slot *slot;
+  u32_t pos;
+  s32_t dif;
+
+  pos = __atomic_load_n(&mbox->head, __ATOMIC_RELAXED);
+  for (;;) {
+    slot = &mbox->slots[pos & (mbox->size - 1)];
+    dif = (s32_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+    if (dif == 0) {
+      /* on failure, pos is updated to the current head */
+      if (__atomic_compare_exchange_n(&mbox->head, &pos, pos + 1, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        break;
+      }
+    } else if (dif < 0) {
+      /* the reader has not yet consumed this slot of the previous round */
+      return 0;
+    } else {
+      pos = __atomic_load_n(&mbox->head, __ATOMIC_RELAXED);
+    }
+  }
+
+  slot->msg = msg;
+#if SYS_ARCH_TELEMETRY
+  slot->posted = sys_telemetry_now();
+#endif /* SYS_ARCH_TELEMETRY */
+  __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+#if SYS_STATS || SYS_ARCH_TELEMETRY
+  {
+    /* consumers may already have moved past 'pos': depth is then 0 */
+    s32_t depth = (s32_t)(pos + 1 - __atomic_load_n(&mbox->tail, __ATOMIC_RELAXED));
+    if (depth > 0) {
+      SYS_MBOX_STATS_DEPTH(mbox, (u32_t)depth);
+    }
+#if SYS_ARCH_TELEMETRY
+    sys_mbox_telemetry_post(mbox, (depth > 0) ? (u32_t)depth : 0);
+#endif /* SYS_ARCH_TELEMETRY */
+  }
+#endif /* SYS_STATS || SYS_ARCH_TELEMETRY */
+  return 1;
+}
+
+/* Take the message at the tail of the ring. Returns 0 if the ring is empty.
+   The tail is advanced with a compare-and-swap so that a concurrent
+   sys_arch_mbox_tryfetch() (e.g. when draining a mailbox) is safe. */
+static int
+sys_mbox_ring_get(struct sys_mbox *mbox, void **msg)
+{
+  struct sys_mbox_slot *slot;
+  u32_t pos;
+  s32_t dif;
+
+  pos = __atomic_load_n(&mbox->tail, __ATOMIC_RELAXED);
+  for (;;) {
+    slot = &mbox->slots[pos & (mbox->size - 1)];
+    dif = (s32_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - (pos + 1));
+    if (dif == 0) {
+      if (__atomic_compare_exchange_n(&mbox->tail, &pos, pos + 1, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        break;
+      }
+    } else if (dif < 0) {
+      return 0;
+    } else {
+      pos = __atomic_load_n(&mbox->tail, __ATOMIC_RELAXED);
+    }
+  }
+
+  *msg = slot->msg;
+#if SYS_ARCH_TELEMETRY
+  {
+    u64_t posted = slot->posted;
+    /* hand the slot over to the posters of the next round */
+    __atomic_store_n(&slot->seq, pos + mbox->size, __ATOMIC_RELEASE);
+    sys_mbox_telemetry_fetch(mbox, posted);
+  }
+#else /* SYS_ARCH_TELEMETRY */
+  /* hand the slot over to the posters of the next round */
+  __atomic_store_n(&slot->seq, pos + mbox->size, __ATOMIC_RELEASE);
+#endif /* SYS_ARCH_TELEMETRY */
+  return 1;
+}
+
+/* Signal 'sem' if 'waiting' says that somebody is (about to go) asleep on it.
+   The full barrier pairs with the one in sys_mbox_announce_wait(): either the
+   waiter sees our ring update on its re-check, or we see its announcement. */
+static void
+sys_mbox_wake(int *waiting, struct sys_sem **sem)
+{
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(waiting, __ATOMIC_RELAXED) > 0) {
+    sys_sem_signal(sem);
+  }
+}
+
+static void
+sys_mbox_announce_wait(int *waiting)
+{
+  __atomic_add_fetch(waiting, 1, __ATOMIC_SEQ_CST);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static void
+sys_mbox_cancel_wait(int *waiting)
+{
+  __atomic_sub_fetch(waiting, 1, __ATOMIC_SEQ_CST);
+}
+
+err_t
+sys_mbox_new(struct sys_mbox **mb, int size)
+{
+  struct sys_mbox *mbox;
+  u32_t i;
+
+  mbox = (struct sys_mbox *)SYS_POOL_ALLOC(SYS_POOL_MBOX, sizeof(struct sys_mbox));
+  if (mbox == NULL) {
+    SYS_STATS_INC(mbox.err);
+    return ERR_MEM;
+  }
+  mbox->size = sys_mbox_capacity(size);
+  mbox->slots = (struct sys_mbox_slot *)SYS_POOL_ALLOC_RING(mbox->size);
+  if (mbox->slots == NULL) {
+    SYS_POOL_FREE(SYS_POOL_MBOX, mbox);
+    SYS_STATS_INC(mbox.err);
+    return ERR_MEM;
+  }
+  mbox->head = mbox->tail = 0;
+  for (i = 0; i < mbox->size; i++) {
+    mbox->slots[i].seq = i;
+    mbox->slots[i].msg = NULL;
+  }
+  mbox->wait_fetch = 0;
+  mbox->wait_send = 0;
+#if SYS_STATS
+  mbox->max = 0;
+  mbox->overflow = 0;
+#endif /* SYS_STATS */
+#if SYS_ARCH_TELEMETRY
+  memset(&mbox->tel, 0, sizeof(mbox->tel));
+#endif /* SYS_ARCH_TELEMETRY */
+  mbox->not_empty = sys_sem_new_internal(0);
+  mbox->not_full = sys_sem_new_internal(0);
+  if ((mbox->not_empty == NULL) || (mbox->not_full == NULL)) {
+    if (mbox->not_empty != NULL) {
+      sys_sem_free_internal(mbox->not_empty);
+    }
+    if (mbox->not_full != NULL) {
+      sys_sem_free_internal(mbox->not_full);
+    }
+    SYS_POOL_FREE_RING(mbox->size, mbox->slots);
+    SYS_POOL_FREE(SYS_POOL_MBOX, mbox);
+    SYS_STATS_INC(mbox.err);
+    return ERR_MEM;
+  }
+
+  SYS_STATS_INC_USED(mbox);
+#if SYS_ARCH_TELEMETRY
+  sys_telemetry_register(&mbox->node, SYS_TELEMETRY_MBOX, mbox);
+#endif /* SYS_ARCH_TELEMETRY */
+  *mb = mbox;
+  return ERR_OK;
+}
+
+void
+sys_mbox_free(struct sys_mbox **mb)
+{
+  if ((mb != NULL) && (*mb != SYS_MBOX_NULL)) {
+    struct sys_mbox *mbox = *mb;
+    SYS_STATS_DEC(mbox.used);
+#if SYS_ARCH_TELEMETRY
+    sys_telemetry_unregister(&mbox->node);
+#endif /* SYS_ARCH_TELEMETRY */
+
+    sys_sem_free_internal(mbox->not_empty);
+    sys_sem_free_internal(mbox->not_full);
+    mbox->not_empty = mbox->not_full = NULL;
+    /*  LWIP_DEBUGF("sys_mbox_free: mbox 0x%lx\n", mbox); */
+    SYS_POOL_FREE_RING(mbox->size, mbox->slots);
+    SYS_POOL_FREE(SYS_POOL_MBOX, mbox);
+  }
+}
+
+err_t
+sys_mbox_trypost(struct sys_mbox **mb, void *msg)
+{
+  struct sys_mbox *mbox;
+  LWIP_ASSERT("invalid mbox", (mb != NULL) && (*mb != NULL));
+  mbox = *mb;
+
+  LWIP_DEBUGF(SYS_DEBUG, ("sys_mbox_trypost: mbox %p msg %p\n",
+                          (void *)mbox, (void *)msg));
+
+  if (!sys_mbox_ring_put(mbox, msg)) {
+    SYS_MBOX_STATS_OVERFLOW(mbox);
+    return ERR_MEM;
+  }
+  /* traced once it is in: a rejected message must not leave an entry. A
+     reader faster than this leaves one that times out like a lost packet */
+  TRACE_MBOX_POST(msg);
+  sys_mbox_wake(&mbox->wait_fetch, &mbox->not_empty);
+
+  return ERR_OK;
+}
+
+void
+sys_mbox_post(struct sys_mbox **mb, void *msg)
+{
+  struct sys_mbox *mbox;
+#if SYS_ARCH_TELEMETRY
+  u64_t blocked = 0;
+#endif /* SYS_ARCH_TELEMETRY */
+  LWIP_ASSERT("invalid mbox", (mb != NULL) && (*mb != NULL));
+  mbox = *mb;
+
+  LWIP_DEBUGF(SYS_DEBUG, ("sys_mbox_post: mbox %p msg %p\n", (void *)mbox, (void *)msg));
+
+  TRACE_MBOX_POST(msg);
+  if (!sys_mbox_ring_put(mbox, msg)) {
+    /* count the full mailbox once per post, not once per wakeup */
+    SYS_MBOX_STATS_OVERFLOW(mbox);
+    SYS_TELEMETRY_WAIT(blocked);
+    for (;;) {
+      sys_mbox_announce_wait(&mbox->wait_send);
+      /* re-check: the reader may have made room before it saw us waiting */
+      if (sys_mbox_ring_put(mbox, msg)) {
+        sys_mbox_cancel_wait(&mbox->wait_send);
+        break;
+      }
+      sys_sem_wait_internal(mbox->not_full, 0);
+      sys_mbox_cancel_wait(&mbox->wait_send);
+    }
+  }
+  SYS_TELEMETRY_WAITED(blocked, mbox->tel.post_wait_us, SYS_TELEMETRY_POST);
+
+  sys_mbox_wake(&mbox->wait_fetch, &mbox->not_empty);
+}
+
+u32_t
+sys_arch_mbox_tryfetch(struct sys_mbox **mb, void **msg)
+{
+  struct sys_mbox *mbox;
+  void *m;
+  LWIP_ASSERT("invalid mbox", (mb != NULL) && (*mb != NULL));
+  mbox = *mb;
+
+  if (!sys_mbox_ring_get(mbox, &m)) {
+    return SYS_MBOX_EMPTY;
+  }
+  TRACE_MBOX_FETCH(m);
+
+  if (msg != NULL) {
+    LWIP_DEBUGF(SYS_DEBUG, ("sys_mbox_tryfetch: mbox %p msg %p\n", (void *)mbox, m));
+    *msg = m;
+  }
+  else{
+    LWIP_DEBUGF(SYS_DEBUG, ("sys_mbox_tryfetch: mbox %p, null msg\n", (void *)mbox));
+  }
+
+  sys_mbox_wake(&mbox->wait_send, &mbox->not_full);
+
+  return 0;
+}
+
+u32_t
+sys_arch_mbox_fetch(struct sys_mbox **mb, void **msg, u32_t timeout)
+{
+  u32_t time_needed = 0;
+  u32_t start = 0, ret;
+  struct sys_mbox *mbox;
+  void *m;
+#if SYS_ARCH_TELEMETRY
+  u64_t blocked = 0;
+#endif /* SYS_ARCH_TELEMETRY */
+  LWIP_ASSERT("invalid mbox", (mb != NULL) && (*mb != NULL));
+  mbox = *mb;
+
+  if (!sys_mbox_ring_get(mbox, &m)) {
+    SYS_TELEMETRY_WAIT(blocked);
+    if (timeout != 0) {
+      start = sys_now();
+    }
+    for (;;) {
+      sys_mbox_announce_wait(&mbox->wait_fetch);
+      /* re-check: a poster may have posted before it saw us waiting */
+      if (sys_mbox_ring_get(mbox, &m)) {
+        sys_mbox_cancel_wait(&mbox->wait_fetch);
+        break;
+      }
+
+      /* We block while waiting for a mail to arrive in the mailbox. We
+         must be prepared to timeout. */
+      if (timeout != 0) {
+        time_needed = sys_now() - start;
+        if (time_needed >= timeout) {
+          ret = SYS_ARCH_TIMEOUT;
+        } else {
+          ret = sys_sem_wait_internal(mbox->not_empty, timeout - time_needed);
+        }
+      } else {
+        ret = sys_sem_wait_internal(mbox->not_empty, 0);
+      }
+      sys_mbox_cancel_wait(&mbox->wait_fetch);
+
+      /* the semaphore may have been signalled for a message we already
+         fetched (it only remembers one signal), so always re-check */
+      if (sys_mbox_ring_get(mbox, &m)) {
+        break;
+      }
+      if (ret == SYS_ARCH_TIMEOUT) {
+        SYS_TELEMETRY_WAITED(blocked, mbox->tel.fetch_wait_us, SYS_TELEMETRY_FETCH);
+        return SYS_ARCH_TIMEOUT;
+      }
+    }
+    SYS_TELEMETRY_WAITED(blocked, mbox->tel.fetch_wait_us, SYS_TELEMETRY_FETCH);
+    if (timeout != 0) {
+      time_needed = sys_now() - start;
+    }
+  }
+  TRACE_MBOX_FETCH(m);
 
-  code = pthread_create(&tmp,
-                        NULL, 
-                        (void *(*)(void *)) 
-                        function, 
-                        arg);
-  
-  if (0 == code) {
-    st = introduce_thread(tmp);
+  if (msg != NULL) {
+    LWIP_DEBUGF(SYS_DEBUG, ("sys_mbox_fetch: mbox %p msg %p\n", (void *)mbox, m));
+    *msg = m;
   }
-  
-  if (NULL == st) {
-    LWIP_DEBUGF(SYS_DEBUG, ("sys_thread_new: pthread_create %d, st = 0x%lx",
-                       code, (unsigned long)st));
-    abort();
+  else{
+    LWIP_DEBUGF(SYS_DEBUG, ("sys_mbox_fetch: mbox %p, null msg\n", (void *)mbox));
   }
-  return st;
+
+  sys_mbox_wake(&mbox->wait_send, &mbox->not_full);
+
+  return time_needed;
 }
 
-/*-----------------------------------------------------------------------------------*/
-/* Mailbox */
+#else /* SYS_MBOX_LOCKFREE */
 err_t
 sys_mbox_new(struct sys_mbox **mb, int size)
 {
   struct sys_mbox *mbox;
-  LWIP_UNUSED_ARG(size);
 
-  mbox = (struct sys_mbox *)malloc(sizeof(struct sys_mbox));
+  mbox = (struct sys_mbox *)SYS_POOL_ALLOC(SYS_POOL_MBOX, sizeof(struct sys_mbox));
   if (mbox == NULL) {
+    SYS_STATS_INC(mbox.err);
+    return ERR_MEM;
+  }
+  mbox->size = sys_mbox_capacity(size);
+  mbox->msgs = (void **)SYS_POOL_ALLOC_RING(mbox->size);
+  if (mbox->msgs == NULL) {
+    SYS_POOL_FREE(SYS_POOL_MBOX, mbox);
+    SYS_STATS_INC(mbox.err);
     return ERR_MEM;
   }
   mbox->first = mbox->last = 0;
+#if SYS_STATS
+  mbox->max = 0;
+  mbox->overflow = 0;
+#endif /* SYS_STATS */
+#if SYS_ARCH_TELEMETRY
+  mbox->stamps = (u64_t *)(void *)(mbox->msgs + mbox->size);
+  memset(&mbox->tel, 0, sizeof(mbox->tel));
+#endif /* SYS_ARCH_TELEMETRY */
   mbox->not_empty = sys_sem_new_internal(0);
   mbox->not_full = sys_sem_new_internal(0);
   mbox->mutex = sys_sem_new_internal(1);
   mbox->wait_send = 0;
+  if ((mbox->not_empty == NULL) || (mbox->not_full == NULL) || (mbox->mutex == NULL)) {
+    if (mbox->not_empty != NULL) {
+      sys_sem_free_internal(mbox->not_empty);
+    }
+    if (mbox->not_full != NULL) {
+      sys_sem_free_internal(mbox->not_full);
+    }
+    if (mbox->mutex != NULL) {
+      sys_sem_free_internal(mbox->mutex);
+    }
+    SYS_POOL_FREE_RING(mbox->size, mbox->msgs);
+    SYS_POOL_FREE(SYS_POOL_MBOX, mbox);
+    SYS_STATS_INC(mbox.err);
+    return ERR_MEM;
+  }
 
   SYS_STATS_INC_USED(mbox);
+#if SYS_ARCH_TELEMETRY
+  sys_telemetry_register(&mbox->node, SYS_TELEMETRY_MBOX, mbox);
+#endif /* SYS_ARCH_TELEMETRY */
   *mb = mbox;
   return ERR_OK;
 }
@@ -209,14 +1695,18 @@ sys_mbox_free(struct sys_mbox **mb)
   if ((mb != NULL) && (*mb != SYS_MBOX_NULL)) {
     struct sys_mbox *mbox = *mb;
     SYS_STATS_DEC(mbox.used);
-    sys_arch_sem_wait(&mbox->mutex, 0);
+#if SYS_ARCH_TELEMETRY
+    sys_telemetry_unregister(&mbox->node);
+#endif /* SYS_ARCH_TELEMETRY */
+    sys_sem_wait_internal(mbox->mutex, 0);
     
     sys_sem_free_internal(mbox->not_empty);
     sys_sem_free_internal(mbox->not_full);
     sys_sem_free_internal(mbox->mutex);
     mbox->not_empty = mbox->not_full = mbox->mutex = NULL;
     /*  LWIP_DEBUGF("sys_mbox_free: mbox 0x%lx\n", mbox); */
-    free(mbox);
+    SYS_POOL_FREE_RING(mbox->size, mbox->msgs);
+    SYS_POOL_FREE(SYS_POOL_MBOX, mbox);
   }
 }
 
@@ -228,17 +1718,22 @@ sys_mbox_trypost(struct sys_mbox **mb, void *msg)
   LWIP_ASSERT("invalid mbox", (mb != NULL) && (*mb != NULL));
   mbox = *mb;
 
-  sys_arch_sem_wait(&mbox->mutex, 0);
+  sys_sem_wait_internal(mbox->mutex, 0);
 
   LWIP_DEBUGF(SYS_DEBUG, ("sys_mbox_trypost: mbox %p msg %p\n",
                           (void *)mbox, (void *)msg));
 
-  if ((mbox->last + 1) >= (mbox->first + SYS_MBOX_SIZE)) {
+  if ((mbox->last - mbox->first) >= mbox->size) {
+    SYS_MBOX_STATS_OVERFLOW(mbox);
     sys_sem_signal(&mbox->mutex);
     return ERR_MEM;
   }
 
-  mbox->msgs[mbox->last % SYS_MBOX_SIZE] = msg;
+  TRACE_MBOX_POST(msg);
+  mbox->msgs[mbox->last & (mbox->size - 1)] = msg;
+#if SYS_ARCH_TELEMETRY
+  mbox->stamps[mbox->last & (mbox->size - 1)] = sys_telemetry_now();
+#endif /* SYS_ARCH_TELEMETRY */
 
   if (mbox->last == mbox->first) {
     first = 1;
@@ -247,6 +1742,10 @@ sys_mbox_trypost(struct sys_mbox **mb, void *msg)
   }
 
   mbox->last++;
+  SYS_MBOX_STATS_DEPTH(mbox, mbox->last - mbox->first);
+#if SYS_ARCH_TELEMETRY
+  sys_mbox_telemetry_post(mbox, mbox->last - mbox->first);
+#endif /* SYS_ARCH_TELEMETRY */
 
   if (first) {
     sys_sem_signal(&mbox->not_empty);
@@ -262,22 +1761,35 @@ sys_mbox_post(struct sys_mbox **mb, void *msg)
 {
   u8_t first;
   struct sys_mbox *mbox;
+#if SYS_ARCH_TELEMETRY
+  u64_t blocked = 0;
+#endif /* SYS_ARCH_TELEMETRY */
   LWIP_ASSERT("invalid mbox", (mb != NULL) && (*mb != NULL));
   mbox = *mb;
 
-  sys_arch_sem_wait(&mbox->mutex, 0);
+  sys_sem_wait_internal(mbox->mutex, 0);
 
   LWIP_DEBUGF(SYS_DEBUG, ("sys_mbox_post: mbox %p msg %p\n", (void *)mbox, (void *)msg));
 
-  while ((mbox->last + 1) >= (mbox->first + SYS_MBOX_SIZE)) {
+  if ((mbox->last - mbox->first) >= mbox->size) {
+    /* count the full mailbox once per post, not once per wakeup */
+    SYS_MBOX_STATS_OVERFLOW(mbox);
+  }
+  while ((mbox->last - mbox->first) >= mbox->size) {
+    SYS_TELEMETRY_WAIT(blocked);
     mbox->wait_send++;
     sys_sem_signal(&mbox->mutex);
-    sys_arch_sem_wait(&mbox->not_full, 0);
-    sys_arch_sem_wait(&mbox->mutex, 0);
+    sys_sem_wait_internal(mbox->not_full, 0);
+    sys_sem_wait_internal(mbox->mutex, 0);
     mbox->wait_send--;
   }
+  SYS_TELEMETRY_WAITED(blocked, mbox->tel.post_wait_us, SYS_TELEMETRY_POST);
 
-  mbox->msgs[mbox->last % SYS_MBOX_SIZE] = msg;
+  TRACE_MBOX_POST(msg);
+  mbox->msgs[mbox->last & (mbox->size - 1)] = msg;
+#if SYS_ARCH_TELEMETRY
+  mbox->stamps[mbox->last & (mbox->size - 1)] = sys_telemetry_now();
+#endif /* SYS_ARCH_TELEMETRY */
 
   if (mbox->last == mbox->first) {
     first = 1;
@@ -286,6 +1798,10 @@ sys_mbox_post(struct sys_mbox **mb, void *msg)
   }
 
   mbox->last++;
+  SYS_MBOX_STATS_DEPTH(mbox, mbox->last - mbox->first);
+#if SYS_ARCH_TELEMETRY
+  sys_mbox_telemetry_post(mbox, mbox->last - mbox->first);
+#endif /* SYS_ARCH_TELEMETRY */
 
   if (first) {
     sys_sem_signal(&mbox->not_empty);
@@ -301,7 +1817,7 @@ sys_arch_mbox_tryfetch(struct sys_mbox **mb, void **msg)
   LWIP_ASSERT("invalid mbox", (mb != NULL) && (*mb != NULL));
   mbox = *mb;
 
-  sys_arch_sem_wait(&mbox->mutex, 0);
+  sys_sem_wait_internal(mbox->mutex, 0);
 
   if (mbox->first == mbox->last) {
     sys_sem_signal(&mbox->mutex);
@@ -310,12 +1826,16 @@ sys_arch_mbox_tryfetch(struct sys_mbox **mb, void **msg)
 
   if (msg != NULL) {
     LWIP_DEBUGF(SYS_DEBUG, ("sys_mbox_tryfetch: mbox %p msg %p\n", (void *)mbox, *msg));
-    *msg = mbox->msgs[mbox->first % SYS_MBOX_SIZE];
+    *msg = mbox->msgs[mbox->first & (mbox->size - 1)];
   }
   else{
     LWIP_DEBUGF(SYS_DEBUG, ("sys_mbox_tryfetch: mbox %p, null msg\n", (void *)mbox));
   }
 
+  TRACE_MBOX_FETCH(mbox->msgs[mbox->first & (mbox->size - 1)]);
+#if SYS_ARCH_TELEMETRY
+  sys_mbox_telemetry_fetch(mbox, mbox->stamps[mbox->first & (mbox->size - 1)]);
+#endif /* SYS_ARCH_TELEMETRY */
   mbox->first++;
 
   if (mbox->wait_send) {
@@ -332,39 +1852,49 @@ sys_arch_mbox_fetch(struct sys_mbox **mb, void **msg, u32_t timeout)
 {
   u32_t time_needed = 0;
   struct sys_mbox *mbox;
+#if SYS_ARCH_TELEMETRY
+  u64_t blocked = 0;
+#endif /* SYS_ARCH_TELEMETRY */
   LWIP_ASSERT("invalid mbox", (mb != NULL) && (*mb != NULL));
   mbox = *mb;
 
   /* The mutex lock is quick so we don't bother with the timeout
      stuff here. */
-  sys_arch_sem_wait(&mbox->mutex, 0);
+  sys_sem_wait_internal(mbox->mutex, 0);
 
   while (mbox->first == mbox->last) {
     sys_sem_signal(&mbox->mutex);
+    SYS_TELEMETRY_WAIT(blocked);
 
     /* We block while waiting for a mail to arrive in the mailbox. We
        must be prepared to timeout. */
     if (timeout != 0) {
-      time_needed = sys_arch_sem_wait(&mbox->not_empty, timeout);
+      time_needed = sys_sem_wait_internal(mbox->not_empty, timeout);
 
       if (time_needed == SYS_ARCH_TIMEOUT) {
+        SYS_TELEMETRY_WAITED(blocked, mbox->tel.fetch_wait_us, SYS_TELEMETRY_FETCH);
         return SYS_ARCH_TIMEOUT;
       }
     } else {
-      sys_arch_sem_wait(&mbox->not_empty, 0);
+      sys_sem_wait_internal(mbox->not_empty, 0);
     }
 
-    sys_arch_sem_wait(&mbox->mutex, 0);
+    sys_sem_wait_internal(mbox->mutex, 0);
   }
+  SYS_TELEMETRY_WAITED(blocked, mbox->tel.fetch_wait_us, SYS_TELEMETRY_FETCH);
 
   if (msg != NULL) {
     LWIP_DEBUGF(SYS_DEBUG, ("sys_mbox_fetch: mbox %p msg %p\n", (void *)mbox, *msg));
-    *msg = mbox->msgs[mbox->first % SYS_MBOX_SIZE];
+    *msg = mbox->msgs[mbox->first & (mbox->size - 1)];
   }
   else{
     LWIP_DEBUGF(SYS_DEBUG, ("sys_mbox_fetch: mbox %p, null msg\n", (void *)mbox));
   }
 
+  TRACE_MBOX_FETCH(mbox->msgs[mbox->first & (mbox->size - 1)]);
+#if SYS_ARCH_TELEMETRY
+  sys_mbox_telemetry_fetch(mbox, mbox->stamps[mbox->first & (mbox->size - 1)]);
+#endif /* SYS_ARCH_TELEMETRY */
   mbox->first++;
 
   if (mbox->wait_send) {
@@ -376,14 +1906,170 @@ sys_arch_mbox_fetch(struct sys_mbox **mb, void **msg, u32_t timeout)
   return time_needed;
 }
 
+#endif /* SYS_MBOX_LOCKFREE */
+
 /*-----------------------------------------------------------------------------------*/
 /* Semaphore */
+#if SYS_SEM_FUTEX
+static int
+sys_futex(u32_t *uaddr, int op, u32_t val, const struct timespec *abstime)
+{
+  /* FUTEX_WAIT_BITSET takes an absolute CLOCK_MONOTONIC timeout */
+  return (int)syscall(SYS_futex, uaddr, op | FUTEX_PRIVATE_FLAG, val, abstime,
+                      NULL, FUTEX_BITSET_MATCH_ANY);
+}
+
+static void
+sys_futex_wait(u32_t *uaddr, u32_t val, const struct timespec *abstime)
+{
+  sys_futex(uaddr, FUTEX_WAIT_BITSET, val, abstime);
+}
+
+static void
+sys_futex_wake(u32_t *uaddr)
+{
+  sys_futex(uaddr, FUTEX_WAKE, 1, NULL);
+}
+
+static struct sys_sem *
+sys_sem_new_internal(u8_t count)
+{
+  struct sys_sem *sem;
+
+  sem = (struct sys_sem *)SYS_POOL_ALLOC(SYS_POOL_SEM, sizeof(struct sys_sem));
+  if (sem != NULL) {
+    sem->c = count;
+    sem->waiters = 0;
+#if SYS_ARCH_TELEMETRY
+    memset(&sem->tel, 0, sizeof(sem->tel));
+#endif /* SYS_ARCH_TELEMETRY */
+  }
+  return sem;
+}
+
+err_t
+sys_sem_new(struct sys_sem **sem, u8_t count)
+{
+  *sem = sys_sem_new_internal(count);
+  if (*sem == NULL) {
+    SYS_STATS_INC(sem.err);
+    return ERR_MEM;
+  }
+  SYS_STATS_INC_USED(sem);
+#if SYS_ARCH_TELEMETRY
+  sys_telemetry_register(&(*sem)->node, SYS_TELEMETRY_SEM, *sem);
+#endif /* SYS_ARCH_TELEMETRY */
+  return ERR_OK;
+}
+
+/* Take a token if one is available, never blocks */
+static int
+sys_sem_trytake(struct sys_sem *sem)
+{
+  u32_t c = __atomic_load_n(&sem->c, __ATOMIC_RELAXED);
+
+  while (c > 0) {
+    if (__atomic_compare_exchange_n(&sem->c, &c, c - 1, 1,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static u32_t
+sys_sem_wait_internal(struct sys_sem *sem, u32_t timeout)
+{
+  struct timespec start, deadline, now;
+
+  if (sys_sem_trytake(sem)) {
+    return 0;
+  }
+
+  if (timeout > 0) {
+    get_monotonic_time(&start);
+    deadline.tv_sec = start.tv_sec + timeout / 1000L;
+    deadline.tv_nsec = start.tv_nsec + (timeout % 1000L) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+  }
+
+  do {
+    /* Announce the wait before sleeping: sys_sem_signal() only issues
+       FUTEX_WAKE if it sees waiters, and the kernel re-checks 'c' == 0
+       before putting us to sleep, so a signal cannot get lost. */
+    __atomic_add_fetch(&sem->waiters, 1, __ATOMIC_SEQ_CST);
+    sys_futex_wait(&sem->c, 0, (timeout > 0) ? &deadline : NULL);
+    __atomic_sub_fetch(&sem->waiters, 1, __ATOMIC_RELAXED);
+
+    if (sys_sem_trytake(sem)) {
+      break;
+    }
+    if (timeout > 0) {
+      get_monotonic_time(&now);
+      if ((now.tv_sec > deadline.tv_sec) ||
+          ((now.tv_sec == deadline.tv_sec) && (now.tv_nsec >= deadline.tv_nsec))) {
+        return SYS_ARCH_TIMEOUT;
+      }
+    }
+  } while (1);
+
+  if (timeout == 0) {
+    return 0;
+  }
+
+  /* Calculate for how long we waited for the semaphore. */
+  get_monotonic_time(&now);
+  now.tv_sec -= start.tv_sec;
+  now.tv_nsec -= start.tv_nsec;
+  if (now.tv_nsec < 0) {
+    now.tv_sec--;
+    now.tv_nsec += 1000000000L;
+  }
+  return (u32_t)(now.tv_sec * 1000L + now.tv_nsec / 1000000L);
+}
+
+void
+sys_sem_signal(struct sys_sem **s)
+{
+  struct sys_sem *sem;
+  LWIP_ASSERT("invalid sem", (s != NULL) && (*s != NULL));
+  sem = *s;
+
+  /* binary semaphore: the count saturates at 1, as in the pthread version */
+  if ((__atomic_exchange_n(&sem->c, 1, __ATOMIC_SEQ_CST) == 0) &&
+      (__atomic_load_n(&sem->waiters, __ATOMIC_SEQ_CST) > 0)) {
+    sys_futex_wake(&sem->c);
+  }
+}
+
+static void
+sys_sem_free_internal(struct sys_sem *sem)
+{
+  SYS_POOL_FREE(SYS_POOL_SEM, sem);
+}
+
+void
+sys_sem_free(struct sys_sem **sem)
+{
+  if ((sem != NULL) && (*sem != SYS_SEM_NULL)) {
+    SYS_STATS_DEC(sem.used);
+#if SYS_ARCH_TELEMETRY
+    sys_telemetry_unregister(&(*sem)->node);
+#endif /* SYS_ARCH_TELEMETRY */
+    sys_sem_free_internal(*sem);
+  }
+}
+
+#else /* SYS_SEM_FUTEX */
 static struct sys_sem *
 sys_sem_new_internal(u8_t count)
 {
   struct sys_sem *sem;
 
-  sem = (struct sys_sem *)malloc(sizeof(struct sys_sem));
+  sem = (struct sys_sem *)SYS_POOL_ALLOC(SYS_POOL_SEM, sizeof(struct sys_sem));
   if (sem != NULL) {
     sem->c = count;
     pthread_condattr_init(&(sem->condattr));
@@ -392,6 +2078,9 @@ sys_sem_new_internal(u8_t count)
 #endif
     pthread_cond_init(&(sem->cond), &(sem->condattr));
     pthread_mutex_init(&(sem->mutex), NULL);
+#if SYS_ARCH_TELEMETRY
+    memset(&sem->tel, 0, sizeof(sem->tel));
+#endif /* SYS_ARCH_TELEMETRY */
   }
   return sem;
 }
@@ -399,11 +2088,15 @@ sys_sem_new_internal(u8_t count)
 err_t
 sys_sem_new(struct sys_sem **sem, u8_t count)
 {
-  SYS_STATS_INC_USED(sem);
   *sem = sys_sem_new_internal(count);
   if (*sem == NULL) {
+    SYS_STATS_INC(sem.err);
     return ERR_MEM;
   }
+  SYS_STATS_INC_USED(sem);
+#if SYS_ARCH_TELEMETRY
+  sys_telemetry_register(&(*sem)->node, SYS_TELEMETRY_SEM, *sem);
+#endif /* SYS_ARCH_TELEMETRY */
   return ERR_OK;
 }
 
@@ -449,13 +2142,10 @@ cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex, u32_t timeout)
   return (u32_t)(ts.tv_sec * 1000L + ts.tv_nsec / 1000000L);
 }
 
-u32_t
-sys_arch_sem_wait(struct sys_sem **s, u32_t timeout)
+static u32_t
+sys_sem_wait_internal(struct sys_sem *sem, u32_t timeout)
 {
   u32_t time_needed = 0;
-  struct sys_sem *sem;
-  LWIP_ASSERT("invalid sem", (s != NULL) && (*s != NULL));
-  sem = *s;
 
   pthread_mutex_lock(&(sem->mutex));
   while (sem->c <= 0) {
@@ -501,7 +2191,7 @@ sys_sem_free_internal(struct sys_sem *sem)
   pthread_cond_destroy(&(sem->cond));
   pthread_condattr_destroy(&(sem->condattr));
   pthread_mutex_destroy(&(sem->mutex));
-  free(sem);
+  SYS_POOL_FREE(SYS_POOL_SEM, sem);
 }
 
 void
@@ -509,12 +2199,138 @@ sys_sem_free(struct sys_sem **sem)
 {
   if ((sem != NULL) && (*sem != SYS_SEM_NULL)) {
     SYS_STATS_DEC(sem.used);
+#if SYS_ARCH_TELEMETRY
+    sys_telemetry_unregister(&(*sem)->node);
+#endif /* SYS_ARCH_TELEMETRY */
     sys_sem_free_internal(*sem);
   }
 }
 
+#endif /* SYS_SEM_FUTEX */
+
+u32_t
+sys_arch_sem_wait(struct sys_sem **s, u32_t timeout)
+{
+#if SYS_ARCH_TELEMETRY
+  struct sys_sem *sem;
+  u64_t start;
+  u32_t ret;
+  LWIP_ASSERT("invalid sem", (s != NULL) && (*s != NULL));
+  sem = *s;
+
+  start = sys_telemetry_now();
+  ret = sys_sem_wait_internal(sem, timeout);
+  SYS_TELEMETRY_INC(sem->tel.waits);
+  if (ret == SYS_ARCH_TIMEOUT) {
+    SYS_TELEMETRY_INC(sem->tel.timeouts);
+  }
+  SYS_TELEMETRY_WAITED(start, sem->tel.wait_us, SYS_TELEMETRY_SEM);
+  return ret;
+#else /* SYS_ARCH_TELEMETRY */
+  LWIP_ASSERT("invalid sem", (s != NULL) && (*s != NULL));
+  return sys_sem_wait_internal(*s, timeout);
+#endif /* SYS_ARCH_TELEMETRY */
+}
+
+#if SYS_ARCH_TELEMETRY
+void
+sys_sem_get_stats(struct sys_sem **s, struct sys_sem_stats *stats)
+{
+  struct sys_sem *sem;
+  LWIP_ASSERT("invalid sem", (s != NULL) && (*s != NULL));
+  LWIP_ASSERT("invalid stats", stats != NULL);
+  sem = *s;
+
+  stats->waits = SYS_TELEMETRY_GET(sem->tel.waits);
+  stats->timeouts = SYS_TELEMETRY_GET(sem->tel.timeouts);
+  sys_hist_copy(stats->wait_us, sem->tel.wait_us);
+}
+#endif /* SYS_ARCH_TELEMETRY */
+
 /*-----------------------------------------------------------------------------------*/
 /* Mutex */
+#if SYS_SEM_FUTEX
+/** Create a new mutex
+ * @param mutex pointer to the mutex to create
+ * @return a new mutex */
+err_t
+sys_mutex_new(struct sys_mutex **mutex)
+{
+  struct sys_mutex *mtx;
+
+  mtx = (struct sys_mutex *)SYS_POOL_ALLOC(SYS_POOL_MUTEX, sizeof(struct sys_mutex));
+  if (mtx != NULL) {
+    mtx->state = 0;
+    SYS_STATS_INC_USED(mutex);
+#if SYS_ARCH_TELEMETRY
+    memset(&mtx->tel, 0, sizeof(mtx->tel));
+    sys_telemetry_register(&mtx->node, SYS_TELEMETRY_MUTEX, mtx);
+#endif /* SYS_ARCH_TELEMETRY */
+    *mutex = mtx;
+    return ERR_OK;
+  }
+  else {
+    SYS_STATS_INC(mutex.err);
+    return ERR_MEM;
+  }
+}
+
+/** Lock a mutex
+ * @param mutex the mutex to lock */
+void
+sys_mutex_lock(struct sys_mutex **mutex)
+{
+  struct sys_mutex *mtx = *mutex;
+  u32_t c = 0;
+
+  /* U. Drepper, "Futexes Are Tricky", mutex #3 */
+  if (!__atomic_compare_exchange_n(&mtx->state, &c, 1, 0,
+                                   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+#if SYS_ARCH_TELEMETRY
+    u64_t start = sys_telemetry_now();
+#endif /* SYS_ARCH_TELEMETRY */
+    if (c != 2) {
+      c = __atomic_exchange_n(&mtx->state, 2, __ATOMIC_ACQUIRE);
+    }
+    while (c != 0) {
+      sys_futex_wait(&mtx->state, 2, NULL);
+      c = __atomic_exchange_n(&mtx->state, 2, __ATOMIC_ACQUIRE);
+    }
+#if SYS_ARCH_TELEMETRY
+    SYS_TELEMETRY_INC(mtx->tel.contended);
+    SYS_TELEMETRY_WAITED(start, mtx->tel.wait_us, SYS_TELEMETRY_LOCK);
+#endif /* SYS_ARCH_TELEMETRY */
+  }
+#if SYS_ARCH_TELEMETRY
+  SYS_TELEMETRY_INC(mtx->tel.locks);
+#endif /* SYS_ARCH_TELEMETRY */
+}
+
+/** Unlock a mutex
+ * @param mutex the mutex to unlock */
+void
+sys_mutex_unlock(struct sys_mutex **mutex)
+{
+  struct sys_mutex *mtx = *mutex;
+
+  if (__atomic_exchange_n(&mtx->state, 0, __ATOMIC_RELEASE) == 2) {
+    sys_futex_wake(&mtx->state);
+  }
+}
+
+/** Delete a mutex
+ * @param mutex the mutex to delete */
+void
+sys_mutex_free(struct sys_mutex **mutex)
+{
+  SYS_STATS_DEC(mutex.used);
+#if SYS_ARCH_TELEMETRY
+  sys_telemetry_unregister(&(*mutex)->node);
+#endif /* SYS_ARCH_TELEMETRY */
+  SYS_POOL_FREE(SYS_POOL_MUTEX, *mutex);
+}
+
+#else /* SYS_SEM_FUTEX */
 /** Create a new mutex
  * @param mutex pointer to the mutex to create
  * @return a new mutex */
@@ -523,13 +2339,19 @@ sys_mutex_new(struct sys_mutex **mutex)
 {
   struct sys_mutex *mtx;
 
-  mtx = (struct sys_mutex *)malloc(sizeof(struct sys_mutex));
+  mtx = (struct sys_mutex *)SYS_POOL_ALLOC(SYS_POOL_MUTEX, sizeof(struct sys_mutex));
   if (mtx != NULL) {
     pthread_mutex_init(&(mtx->mutex), NULL);
+    SYS_STATS_INC_USED(mutex);
+#if SYS_ARCH_TELEMETRY
+    memset(&mtx->tel, 0, sizeof(mtx->tel));
+    sys_telemetry_register(&mtx->node, SYS_TELEMETRY_MUTEX, mtx);
+#endif /* SYS_ARCH_TELEMETRY */
     *mutex = mtx;
     return ERR_OK;
   }
   else {
+    SYS_STATS_INC(mutex.err);
     return ERR_MEM;
   }
 }
@@ -539,7 +2361,19 @@ sys_mutex_new(struct sys_mutex **mutex)
 void
 sys_mutex_lock(struct sys_mutex **mutex)
 {
+#if SYS_ARCH_TELEMETRY
+  struct sys_mutex *mtx = *mutex;
+
+  if (pthread_mutex_trylock(&mtx->mutex) != 0) {
+    u64_t start = sys_telemetry_now();
+    pthread_mutex_lock(&mtx->mutex);
+    SYS_TELEMETRY_INC(mtx->tel.contended);
+    SYS_TELEMETRY_WAITED(start, mtx->tel.wait_us, SYS_TELEMETRY_LOCK);
+  }
+  SYS_TELEMETRY_INC(mtx->tel.locks);
+#else /* SYS_ARCH_TELEMETRY */
   pthread_mutex_lock(&((*mutex)->mutex));
+#endif /* SYS_ARCH_TELEMETRY */
 }
 
 /** Unlock a mutex
@@ -555,9 +2389,210 @@ sys_mutex_unlock(struct sys_mutex **mutex)
 void
 sys_mutex_free(struct sys_mutex **mutex)
 {
+  SYS_STATS_DEC(mutex.used);
+#if SYS_ARCH_TELEMETRY
+  sys_telemetry_unregister(&(*mutex)->node);
+#endif /* SYS_ARCH_TELEMETRY */
   pthread_mutex_destroy(&((*mutex)->mutex));
-  free(*mutex);
+  SYS_POOL_FREE(SYS_POOL_MUTEX, *mutex);
+}
+
+#endif /* SYS_SEM_FUTEX */
+
+#if SYS_ARCH_TELEMETRY
+/*-----------------------------------------------------------------------------------*/
+/* Telemetry queries */
+void
+sys_mutex_get_stats(struct sys_mutex **mutex, struct sys_mutex_stats *stats)
+{
+  struct sys_mutex *mtx;
+  LWIP_ASSERT("invalid mutex", (mutex != NULL) && (*mutex != NULL));
+  LWIP_ASSERT("invalid stats", stats != NULL);
+  mtx = *mutex;
+
+  stats->locks = SYS_TELEMETRY_GET(mtx->tel.locks);
+  stats->contended = SYS_TELEMETRY_GET(mtx->tel.contended);
+  sys_hist_copy(stats->wait_us, mtx->tel.wait_us);
+}
+
+static void
+sys_telemetry_thread_copy(struct sys_thread_stats *dst, struct sys_telemetry_thread *t, u64_t now)
+{
+  struct sys_thread_stats *src = &t->stats;
+
+  memcpy(dst->name, src->name, SYS_TELEMETRY_NAME_LEN);
+  dst->alive = __atomic_load_n(&src->alive, __ATOMIC_ACQUIRE);
+  dst->posts = SYS_TELEMETRY_GET(src->posts);
+  dst->fetches = SYS_TELEMETRY_GET(src->fetches);
+  dst->lifetime_us = (dst->alive ? now : SYS_TELEMETRY_GET(t->end_us)) - t->start_us;
+  dst->idle_us = SYS_TELEMETRY_GET(src->idle_us);
+  dst->blocked_us = SYS_TELEMETRY_GET(src->blocked_us);
+  sys_hist_copy(dst->fetch_wait_us, src->fetch_wait_us);
+  sys_hist_copy(dst->post_wait_us, src->post_wait_us);
+  sys_hist_copy(dst->sem_wait_us, src->sem_wait_us);
+  sys_hist_copy(dst->mutex_wait_us, src->mutex_wait_us);
+}
+
+/** Call fn for every mailbox, semaphore and mutex created by lwIP (not the
+ * ones sys_arch uses internally) and for every thread. The statistics are
+ * collected first, fn is called without holding any lock; 'obj' only
+ * identifies an object that may have been freed since.
+ */
+void
+sys_telemetry_foreach(sys_telemetry_fn fn, void *arg)
+{
+  struct sys_telemetry *all, *t;
+  struct sys_telemetry_node *node;
+  struct sys_telemetry_thread *th;
+  u64_t now = sys_telemetry_now();
+  u32_t n = 0, i;
+
+  pthread_mutex_lock(&telemetry_mutex);
+  all = (struct sys_telemetry *)calloc(telemetry_count + telemetry_thread_count + 2,
+                                       sizeof(struct sys_telemetry));
+  if (all == NULL) {
+    pthread_mutex_unlock(&telemetry_mutex);
+    return;
+  }
+  for (node = telemetry_objects.next; node != &telemetry_objects; node = node->next) {
+    t = &all[n++];
+    t->type = node->type;
+    t->obj = node->obj;
+    memcpy(t->owner, node->owner, SYS_TELEMETRY_NAME_LEN);
+    if (node->type == SYS_TELEMETRY_MBOX) {
+      struct sys_mbox *mbox = (struct sys_mbox *)node->obj;
+      sys_mbox_get_stats(&mbox, &t->stats.mbox);
+    } else if (node->type == SYS_TELEMETRY_SEM) {
+      struct sys_sem *sem = (struct sys_sem *)node->obj;
+      sys_sem_get_stats(&sem, &t->stats.sem);
+    } else {
+      struct sys_mutex *mtx = (struct sys_mutex *)node->obj;
+      sys_mutex_get_stats(&mtx, &t->stats.mutex);
+    }
+  }
+  for (th = telemetry_threads; th != NULL; th = th->next) {
+    t = &all[n++];
+    t->type = SYS_TELEMETRY_THREAD;
+    memcpy(t->owner, th->stats.name, SYS_TELEMETRY_NAME_LEN);
+    sys_telemetry_thread_copy(&t->stats.thread, th, now);
+  }
+  if (telemetry_exited_count != 0) {
+    t = &all[n++];
+    t->type = SYS_TELEMETRY_THREAD;
+    memcpy(t->owner, telemetry_exited.stats.name, SYS_TELEMETRY_NAME_LEN);
+    sys_telemetry_thread_copy(&t->stats.thread, &telemetry_exited, now);
+  }
+  pthread_mutex_unlock(&telemetry_mutex);
+
+  for (i = 0; i < n; i++) {
+    fn(arg, &all[i]);
+  }
+  free(all);
+}
+
+/* Format the median and 99th percentile of a histogram as bucket limits */
+static const char *
+sys_hist_fmt(char *buf, size_t len, const u32_t *hist)
+{
+  u32_t count = 0, sum = 0;
+  int i, p50 = -1, p99 = -1;
+
+  for (i = 0; i < SYS_HIST_BUCKETS; i++) {
+    count += hist[i];
+  }
+  if (count == 0) {
+    return "-";
+  }
+  for (i = 0; i < SYS_HIST_BUCKETS; i++) {
+    sum += hist[i];
+    if ((p50 < 0) && ((u64_t)sum * 100 >= (u64_t)count * 50)) {
+      p50 = i;
+    }
+    if ((p99 < 0) && ((u64_t)sum * 100 >= (u64_t)count * 99)) {
+      p99 = i;
+    }
+  }
+  if (p99 == SYS_HIST_BUCKETS - 1) {
+    snprintf(buf, len, "n %"U32_F" p50 <%lu p99 >=%lu us", count, 1UL << p50, 1UL << (p99 - 1));
+  } else {
+    snprintf(buf, len, "n %"U32_F" p50 <%lu p99 <%lu us", count, 1UL << p50, 1UL << p99);
+  }
+  return buf;
+}
+
+struct sys_telemetry_print_ctx {
+  sys_write_fn write;
+  void *ctx;
+};
+
+static void
+sys_telemetry_print_one(void *arg, const struct sys_telemetry *t)
+{
+  struct sys_telemetry_print_ctx *p = (struct sys_telemetry_print_ctx *)arg;
+  char line[320], h1[48], h2[48], h3[48], h4[48];
+
+  switch (t->type) {
+    case SYS_TELEMETRY_MBOX: {
+      const struct sys_mbox_stats *s = &t->stats.mbox;
+      if (s->posts == 0) {
+        return;
+      }
+      snprintf(line, sizeof(line), "mbox   %-15s %p size %"U32_F" depth %"U32_F" avg %.1f max %"U32_F
+               " posts %"U32_F" fetches %"U32_F"\n"
+               "         queued %s, posters blocked %s, reader idle %s\n",
+               t->owner, t->obj, s->size, s->depth, (double)s->depth_sum / s->posts, s->max,
+               s->posts, s->fetches, sys_hist_fmt(h1, sizeof(h1), s->latency_us),
+               sys_hist_fmt(h2, sizeof(h2), s->post_wait_us), sys_hist_fmt(h3, sizeof(h3), s->fetch_wait_us));
+      break;
+    }
+    case SYS_TELEMETRY_SEM: {
+      const struct sys_sem_stats *s = &t->stats.sem;
+      if (s->waits == 0) {
+        return;
+      }
+      snprintf(line, sizeof(line), "sem    %-15s %p waits %"U32_F" timeouts %"U32_F" wait %s\n",
+               t->owner, t->obj, s->waits, s->timeouts, sys_hist_fmt(h1, sizeof(h1), s->wait_us));
+      break;
+    }
+    case SYS_TELEMETRY_MUTEX: {
+      const struct sys_mutex_stats *s = &t->stats.mutex;
+      if (s->locks == 0) {
+        return;
+      }
+      snprintf(line, sizeof(line), "mutex  %-15s %p locks %"U32_F" contended %"U32_F" wait %s\n",
+               t->owner, t->obj, s->locks, s->contended, sys_hist_fmt(h1, sizeof(h1), s->wait_us));
+      break;
+    }
+    default: {
+      const struct sys_thread_stats *s = &t->stats.thread;
+      double life = (s->lifetime_us > 0) ? (double)s->lifetime_us : 1.0;
+      double idle = 100.0 * (double)s->idle_us / life;
+      double blocked = 100.0 * (double)s->blocked_us / life;
+      snprintf(line, sizeof(line), "thread %-15s %s busy %.1f%% idle %.1f%% blocked %.1f%% posts %"U32_F" fetches %"U32_F"\n"
+               "         fetch %s, post %s\n         sem %s, mutex %s\n",
+               s->name, s->alive ? "running" : "exited", LWIP_MAX(100.0 - idle - blocked, 0.0), idle, blocked,
+               s->posts, s->fetches, sys_hist_fmt(h1, sizeof(h1), s->fetch_wait_us),
+               sys_hist_fmt(h2, sizeof(h2), s->post_wait_us), sys_hist_fmt(h3, sizeof(h3), s->sem_wait_us),
+               sys_hist_fmt(h4, sizeof(h4), s->mutex_wait_us));
+      break;
+    }
+  }
+  p->write(p->ctx, line);
+}
+
+/** Write the statistics of the objects that were used and of all threads as
+ * text (times are the limits of the histogram buckets holding the median and
+ * the 99th percentile) */
+void
+sys_telemetry_print(sys_write_fn write, void *ctx)
+{
+  struct sys_telemetry_print_ctx p;
+
+  p.write = write;
+  p.ctx = ctx;
+  sys_telemetry_foreach(sys_telemetry_print_one, &p);
 }
+#endif /* SYS_ARCH_TELEMETRY */
 
 #endif /* !NO_SYS */
 
@@ -606,23 +2641,55 @@ that case the return value indicates that it is already protected.
 sys_arch_protect() is only required if your port is supporting an operating
 system.
 */
+#if SYS_LWPROT_SPINLOCK
+#if defined(__i386__) || defined(__x86_64__)
+#define LWPROT_CPU_RELAX() __builtin_ia32_pause()
+#elif defined(__aarch64__) || defined(__arm__)
+#define LWPROT_CPU_RELAX() __asm__ __volatile__("yield" ::: "memory")
+#else
+#define LWPROT_CPU_RELAX()
+#endif
+
+static void
+lwprot_spin_lock(void)
+{
+  u32_t spins = 1;
+
+  while (__atomic_exchange_n(&lwprot_lock, 1, __ATOMIC_ACQUIRE) != 0) {
+    /* wait on plain loads so the cache line is not bounced between CPUs */
+    do {
+      if (spins < SYS_LWPROT_SPIN_MAX) {
+        u32_t i;
+        for (i = 0; i < spins; i++) {
+          LWPROT_CPU_RELAX();
+        }
+        spins <<= 1;
+      } else {
+        /* the owner is probably not running */
+        sched_yield();
+      }
+    } while (__atomic_load_n(&lwprot_lock, __ATOMIC_RELAXED) != 0);
+  }
+}
+#endif /* SYS_LWPROT_SPINLOCK */
+
 sys_prot_t
 sys_arch_protect(void)
 {
-    /* Note that for the UNIX port, we are using a lightweight mutex, and our
-     * own counter (which is locked by the mutex). The return code is not actually
-     * used. */
-    if (lwprot_thread != pthread_self())
+    /* Note that for the UNIX port, we are using a lightweight mutex (or a
+     * spinlock), and our own per-thread nesting counter. The return code is
+     * not actually used. */
+    if (lwprot_count == 0)
     {
-        /* We are locking the mutex where it has not been locked before *
-        * or is being locked by another thread */
+        /* We are not holding the lock yet */
+#if SYS_LWPROT_SPINLOCK
+        lwprot_spin_lock();
+#else /* SYS_LWPROT_SPINLOCK */
         pthread_mutex_lock(&lwprot_mutex);
-        lwprot_thread = pthread_self();
-        lwprot_count = 1;
+#endif /* SYS_LWPROT_SPINLOCK */
     }
-    else
-        /* It is already locked by THIS thread */
-        lwprot_count++;
+    /* else it is already locked by THIS thread */
+    lwprot_count++;
     return 0;
 }
 
@@ -637,12 +2704,15 @@ void
 sys_arch_unprotect(sys_prot_t pval)
 {
     LWIP_UNUSED_ARG(pval);
-    if (lwprot_thread == pthread_self())
+    if (lwprot_count > 0)
     {
         if (--lwprot_count == 0)
         {
-            lwprot_thread = (pthread_t) 0xDEAD;
+#if SYS_LWPROT_SPINLOCK
+            __atomic_store_n(&lwprot_lock, 0, __ATOMIC_RELEASE);
+#else /* SYS_LWPROT_SPINLOCK */
             pthread_mutex_unlock(&lwprot_mutex);
+#endif /* SYS_LWPROT_SPINLOCK */
         }
     }
 }
@@ -0,0 +1,407 @@
+/*
+ * Copyright (c) 2001-2003 Swedish Institute of Computer Science.
+ * All rights reserved. 
+ * 
+ * Redistribution and use in source and binary forms, with or without modification, 
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED 
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF 
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT 
+ * SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, 
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT 
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING 
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY 
+ * OF SUCH DAMAGE.
+ *
+ * This file is part of the lwIP TCP/IP stack.
+ * 
+ * Author: Adam Dunkels <adam@sics.se>
+ *
+ */
+
+/*
+ * Packet latency tracing (arch/trace.h).
+ *
+ * Traced pbufs and mailbox messages are kept in a small open addressing
+ * table keyed by their address, claimed and released with compare-and-swap
+ * so the hooks take no lock. A pbuf that is freed before its trace
+ * completes (dropped, consumed by the stack) leaves its entry behind: it is
+ * released when the pbuf is read into again (TRACE_RX) or after
+ * TRACE_TIMEOUT_MS. The stage latencies are recorded as perf probes
+ * ("trace_*", see perf.c), so they are written to the perf_init() file by
+ * perf_dump() and printed by trace_print() (e.g. from the shell's stat
+ * command).
+ *
+ * trace_init() reads TRACE from the environment: "sample=N" follows 1 in N
+ * packets and messages (default TRACE_SAMPLE), "off" starts with tracing
+ * disabled.
+ */
+
+#include "lwip/opt.h"
+
+#include "arch/trace.h"
+
+#if TRACE_PACKETS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lwip/pbuf.h"
+#include "lwip/netif.h"
+#include "arch/opts.h"
+#include "arch/perf.h"
+
+/** Entries of the table of traced pbufs and messages (power of 2) */
+#ifndef TRACE_SLOTS
+#define TRACE_SLOTS 1024
+#endif
+
+/** Slots searched for a key after its hash slot */
+#ifndef TRACE_PROBE
+#define TRACE_PROBE 8
+#endif
+
+/** Entries older than this may be reused (ms) */
+#ifndef TRACE_TIMEOUT_MS
+#define TRACE_TIMEOUT_MS 200
+#endif
+
+/** Follow 1 in TRACE_SAMPLE packets unless TRACE says otherwise */
+#ifndef TRACE_SAMPLE
+#define TRACE_SAMPLE 64
+#endif
+
+#if TRACE_SLOTS & (TRACE_SLOTS - 1)
+#error "TRACE_SLOTS must be a power of 2"
+#endif
+
+#define TRACE_KIND_RX  1
+#define TRACE_KIND_TX  2
+#define TRACE_KIND_MSG 3
+
+/* Timestamps of an entry */
+#define TRACE_T_START   0   /* read, linkoutput or mailbox post */
+#define TRACE_T_INPUT   1
+#define TRACE_T_DELIVER 2
+#define TRACE_T_NUM     3
+
+/* Histograms */
+#define TRACE_H_RX_INPUT      0
+#define TRACE_H_INPUT_DELIVER 1
+#define TRACE_H_DELIVER_RECV  2
+#define TRACE_H_RX_RECV       3
+#define TRACE_H_TX_WRITE      4
+#define TRACE_H_MBOX_WAIT     5
+#define TRACE_H_NUM           6
+
+struct trace_entry {
+  void *key;
+  u8_t kind;
+  u64_t t[TRACE_T_NUM];
+};
+
+u32_t trace_sample;
+u32_t trace_inflight;
+
+static struct trace_entry trace_table[TRACE_SLOTS];
+static struct perf_probe *trace_probes[TRACE_H_NUM];
+static const char *const trace_names[TRACE_H_NUM] = {
+  "trace_rx_input", "trace_input_deliver", "trace_deliver_recv",
+  "trace_rx_recv", "trace_tx_write", "trace_mbox_wait"
+};
+static __thread u32_t trace_pkt_count;
+static __thread u32_t trace_msg_count;
+
+/* Key of an entry while trace_claim() fills it in, matches no pbuf or message */
+#define TRACE_CLAIMING ((void *)trace_table)
+
+/*-----------------------------------------------------------------------------------*/
+static u32_t
+trace_hash(const void *key)
+{
+  return (((u32_t)((mem_ptr_t)key >> 4)) * 2654435761UL) >> 16;
+}
+/*-----------------------------------------------------------------------------------*/
+static int
+trace_sampled(u32_t *count)
+{
+  u32_t n = __atomic_load_n(&trace_sample, __ATOMIC_RELAXED);
+
+  if ((n == 0) || (++*count < n)) {
+    return 0;
+  }
+  *count = 0;
+  return 1;
+}
+/*-----------------------------------------------------------------------------------*/
+static struct trace_entry *
+trace_find(const void *key)
+{
+  struct trace_entry *e;
+  u32_t h = trace_hash(key), i;
+
+  if (key == NULL) {
+    return NULL;
+  }
+  for (i = 0; i < TRACE_PROBE; i++) {
+    e = &trace_table[(h + i) & (TRACE_SLOTS - 1)];
+    if (__atomic_load_n(&e->key, __ATOMIC_ACQUIRE) == key) {
+      return e;
+    }
+  }
+  return NULL;
+}
+/*-----------------------------------------------------------------------------------*/
+static void
+trace_release(struct trace_entry *e)
+{
+  __atomic_store_n(&e->t[TRACE_T_START], 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&e->key, NULL, __ATOMIC_RELEASE);
+  __atomic_sub_fetch(&trace_inflight, 1, __ATOMIC_RELAXED);
+}
+/*-----------------------------------------------------------------------------------*/
+/* Claim a free or timed out entry for key, NULL if there is none nearby.
+   The entry is reserved with TRACE_CLAIMING and filled in before key is
+   published, so trace_find() never sees the stamps of its previous use. */
+static struct trace_entry *
+trace_claim(void *key, u8_t kind, u64_t now)
+{
+  struct trace_entry *e;
+  void *old;
+  u64_t t0;
+  u32_t h = trace_hash(key), i;
+
+  for (i = 0; i < TRACE_PROBE; i++) {
+    e = &trace_table[(h + i) & (TRACE_SLOTS - 1)];
+    old = __atomic_load_n(&e->key, __ATOMIC_ACQUIRE);
+    if (old == NULL) {
+      if (__atomic_compare_exchange_n(&e->key, &old, TRACE_CLAIMING, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        __atomic_add_fetch(&trace_inflight, 1, __ATOMIC_RELAXED);
+        break;
+      }
+    } else if (old != TRACE_CLAIMING) {
+      t0 = __atomic_load_n(&e->t[TRACE_T_START], __ATOMIC_RELAXED);
+      if ((t0 != 0) && (now - t0 > (u64_t)TRACE_TIMEOUT_MS * 1000000ULL) &&
+          __atomic_compare_exchange_n(&e->key, &old, TRACE_CLAIMING, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        break;
+      }
+    }
+  }
+  if (i == TRACE_PROBE) {
+    return NULL;
+  }
+  e->kind = kind;
+  e->t[TRACE_T_INPUT] = 0;
+  e->t[TRACE_T_DELIVER] = 0;
+  __atomic_store_n(&e->t[TRACE_T_START], now, __ATOMIC_RELAXED);
+  __atomic_store_n(&e->key, key, __ATOMIC_RELEASE);
+  return e;
+}
+/*-----------------------------------------------------------------------------------*/
+static void
+trace_record(int h, u64_t from, u64_t to)
+{
+  perf_record(trace_probes[h], (to > from) ? to - from : 0);
+}
+/*-----------------------------------------------------------------------------------*/
+/** A driver read a frame into p */
+void
+trace_rx(struct pbuf *p)
+{
+  struct trace_entry *e;
+
+  if (TRACE_BUSY()) {
+    /* left behind by a pbuf that was freed before its trace completed */
+    e = trace_find(p);
+    if (e != NULL) {
+      trace_release(e);
+    }
+  }
+  if (trace_sampled(&trace_pkt_count)) {
+    trace_claim(p, TRACE_KIND_RX, perf_clock());
+  }
+}
+/*-----------------------------------------------------------------------------------*/
+/** tcpip_thread starts to process the received frame p */
+void
+trace_input(struct pbuf *p)
+{
+  struct trace_entry *e = trace_find(p);
+  u64_t now;
+
+  if ((e != NULL) && (e->kind == TRACE_KIND_RX) && (e->t[TRACE_T_INPUT] == 0)) {
+    now = perf_clock();
+    e->t[TRACE_T_INPUT] = now;
+    trace_record(TRACE_H_RX_INPUT, e->t[TRACE_T_START], now);
+  }
+}
+/*-----------------------------------------------------------------------------------*/
+/** For LWIP_HOOK_IP4_INPUT and LWIP_HOOK_IP6_INPUT: stamps the input of
+    netifs whose driver does not call TRACE_INPUT, never eats the packet */
+int
+trace_ip_input(struct pbuf *p, struct netif *inp)
+{
+  LWIP_UNUSED_ARG(inp);
+  TRACE_INPUT(p);
+  return 0;
+}
+/*-----------------------------------------------------------------------------------*/
+/** A netif is given p to send */
+void
+trace_tx(struct pbuf *p)
+{
+  struct trace_entry *e;
+
+  if (trace_sampled(&trace_pkt_count)) {
+    /* e.g. an ICMP echo reply reuses the request's pbuf */
+    e = trace_find(p);
+    if (e != NULL) {
+      trace_release(e);
+    }
+    trace_claim(p, TRACE_KIND_TX, perf_clock());
+  }
+}
+/*-----------------------------------------------------------------------------------*/
+/** The netif has written p */
+void
+trace_tx_done(struct pbuf *p)
+{
+  struct trace_entry *e = trace_find(p);
+
+  if ((e != NULL) && (e->kind == TRACE_KIND_TX)) {
+    trace_record(TRACE_H_TX_WRITE, e->t[TRACE_T_START], perf_clock());
+    trace_release(e);
+  }
+}
+/*-----------------------------------------------------------------------------------*/
+/** msg is posted to a mailbox: a traced pbuf is delivered to a recvmbox */
+void
+trace_mbox_post(void *msg)
+{
+  struct trace_entry *e;
+  u64_t now;
+
+  if (TRACE_BUSY()) {
+    e = trace_find(msg);
+    if (e != NULL) {
+      if ((e->kind == TRACE_KIND_RX) && (e->t[TRACE_T_DELIVER] == 0)) {
+        now = perf_clock();
+        e->t[TRACE_T_DELIVER] = now;
+        if (e->t[TRACE_T_INPUT] != 0) {
+          trace_record(TRACE_H_INPUT_DELIVER, e->t[TRACE_T_INPUT], now);
+        }
+      }
+      return;
+    }
+  }
+  if ((msg != NULL) && trace_sampled(&trace_msg_count)) {
+    trace_claim(msg, TRACE_KIND_MSG, perf_clock());
+  }
+}
+/*-----------------------------------------------------------------------------------*/
+/** msg is fetched from a mailbox */
+void
+trace_mbox_fetch(void *msg)
+{
+  struct trace_entry *e = trace_find(msg);
+  u64_t now;
+
+  if (e == NULL) {
+    return;
+  }
+  now = perf_clock();
+  if (e->kind == TRACE_KIND_MSG) {
+    trace_record(TRACE_H_MBOX_WAIT, e->t[TRACE_T_START], now);
+    trace_release(e);
+  } else if ((e->kind == TRACE_KIND_RX) && (e->t[TRACE_T_DELIVER] != 0)) {
+    trace_record(TRACE_H_DELIVER_RECV, e->t[TRACE_T_DELIVER], now);
+    trace_record(TRACE_H_RX_RECV, e->t[TRACE_T_START], now);
+    trace_release(e);
+  }
+}
+/*-----------------------------------------------------------------------------------*/
+/** Follow 1 in n packets and messages (0: stop tracing) */
+void
+trace_set_sample(u32_t n)
+{
+  __atomic_store_n(&trace_sample, n, __ATOMIC_RELAXED);
+}
+/*-----------------------------------------------------------------------------------*/
+/** Write the latency of each stage as text lines (median, 90th and 99th
+    percentile, maximum in microseconds) */
+void
+trace_print(trace_write_fn write, void *ctx)
+{
+  struct perf_summary s;
+  char buf[160];
+  int i;
+
+  for (i = 0; i < TRACE_H_NUM; i++) {
+    if ((perf_summary(trace_names[i], &s) != 0) || (s.count == 0)) {
+      continue;
+    }
+    snprintf(buf, sizeof(buf), "%-20s n %-8llu p50 %.1f p90 %.1f p99 %.1f max %.1f us\n",
+             trace_names[i], (unsigned long long)s.count, s.p50_ns / 1e3, s.p90_ns / 1e3,
+             s.p99_ns / 1e3, s.max_ns / 1e3);
+    write(ctx, buf);
+  }
+}
+/*-----------------------------------------------------------------------------------*/
+static int
+trace_opt(void *arg, const char *key, char *value)
+{
+  u32_t *n = (u32_t *)arg;
+  unsigned long sample;
+  char *end;
+
+  if (value == NULL) {
+    if (strcmp(key, "off")) {
+      return -1;
+    }
+    *n = 0;
+    return 0;
+  }
+  if (strcmp(key, "sample")) {
+    return -1;
+  }
+  sample = strtoul(value, &end, 10);
+  if ((end == value) || (*end != 0) || (sample > 0xffffffffUL)) {
+    return -1;
+  }
+  *n = (u32_t)sample;
+  return 0;
+}
+
+void
+trace_init(void)
+{
+  const char *env = getenv("TRACE");
+  u32_t n = TRACE_SAMPLE;
+  int i;
+
+  for (i = 0; i < TRACE_H_NUM; i++) {
+    trace_probes[i] = perf_probe_get(trace_names[i]);
+  }
+  if (env != NULL) {
+    port_parse_opts("trace", env, trace_opt, &n);
+  }
+  /* the stage histograms are perf probes, they record while perf is on */
+  if (!__atomic_load_n(&perf_enabled, __ATOMIC_RELAXED)) {
+    perf_enable(1);
+  }
+  trace_set_sample(n);
+}
+
+#endif /* TRACE_PACKETS */
@@ -265,6 +265,15 @@ extern void sntp_set_system_time(u32_t sec);
 #define LWIP_RAW                1
 #define RAW_TTL                 255
 
+/* ---------- Thread options ---------- */
+/* Mailbox sizes: the unix port rounds these up to a power of two
+ * (see SYS_MBOX_SIZE_MIN/SYS_MBOX_SIZE_MAX in sys_arch.c) */
+#define TCPIP_MBOX_SIZE                512
+#define DEFAULT_TCP_RECVMBOX_SIZE      32
+#define DEFAULT_UDP_RECVMBOX_SIZE      32
+#define DEFAULT_RAW_RECVMBOX_SIZE      16
+#define DEFAULT_ACCEPTMBOX_SIZE        8
+
 /* ---------- Statistics options ---------- */
 /* individual STATS options can be turned off by defining them to 0 
  * (e.g #define TCP_STATS 0). All of them are turned off if LWIP_STATS
@@ -371,4 +380,9 @@ extern void sntp_set_system_time(u32_t sec);
 
 #define LWIP_HTTPD_SSI          1
 
+/* netio, iperf3: report the CPU time of the process (clock() is process CPU time) */
+#include <time.h>
+#define NETIO_CPU_TIME()        ((u32_t)(clock() / (CLOCKS_PER_SEC / 1000)))
+#define IPERF3_CPU_TIME()       NETIO_CPU_TIME()
+
 #endif /* LWIP_LWIPOPTS_H */
@@ -60,6 +60,8 @@
 
 #include "netif/tapif.h"
 #include "netif/tunif.h"
+#include "netif/pktif.h"
+#include "netif/xdpif.h"
 
 #include "netif/unixif.h"
 #include "netif/dropif.h"
@@ -84,6 +86,7 @@
 
 #include "lwip/ip_addr.h"
 #include "arch/perf.h"
+#include "arch/trace.h"
 
 #include "lwip/apps/httpd.h"
 #include "apps/udpecho/udpecho.h"
@@ -91,6 +94,7 @@
 #include "apps/shell/shell.h"
 #include "apps/chargen/chargen.h"
 #include "apps/netio/netio.h"
+#include "apps/iperf3/iperf3.h"
 #include "apps/ping/ping.h"
 #include "lwip/apps/netbiosns.h"
 #include "lwip/apps/mdns.h"
@@ -135,6 +139,9 @@ static ip_addr_t ping_addr;
 /* nonstatic debug cmd option, exported in lwipopts.h */
 unsigned char debug_flags;
 
+/* netif cmd option: tap interface, AF_PACKET or AF_XDP socket */
+static netif_init_fn netif_init_func = tapif_init;
+
 /** @todo add options for selecting netif, starting DHCP client etc */
 static struct option longopts[] = {
   /* turn on debugging output (if build with LWIP_DEBUG) */
@@ -151,6 +158,11 @@ static struct option longopts[] = {
   /* ping destination */
   {"ping",   required_argument, NULL, 'p'},
 #endif /* LWIP_IPV4 */
+#ifdef LWIP_UNIX_LINUX
+  /* "tap" (default), "pkt" (AF_PACKET on PKTIF_IFNAME) or "xdp" (AF_XDP on
+     XDPIF_IFNAME) */
+  {"netif",  required_argument, NULL, 'n'},
+#endif /* LWIP_UNIX_LINUX */
   /* new command line options go here! */
   {NULL,   0,                 NULL,  0}
 };
@@ -523,9 +535,9 @@ init_netifs(void)
   IP_ADDR4(&ipaddr,  0,0,0,0);
   IP_ADDR4(&netmask, 0,0,0,0);
 #endif /* LWIP_DHCP */
-  netif_add(&netif, ip_2_ip4(&ipaddr), ip_2_ip4(&netmask), ip_2_ip4(&gw), NULL, tapif_init, tcpip_input);
+  netif_add(&netif, ip_2_ip4(&ipaddr), ip_2_ip4(&netmask), ip_2_ip4(&gw), NULL, netif_init_func, tcpip_input);
 #else /* LWIP_IPV4 */
-  netif_add(&netif, NULL, tapif_init, tcpip_input);
+  netif_add(&netif, NULL, netif_init_func, tcpip_input);
 #endif /* LWIP_IPV4 */
 #if LWIP_IPV6
   netif_create_ip6_linklocal_address(&netif, 1);
@@ -548,9 +560,19 @@ init_netifs(void)
 
 #if LWIP_TCP
   netio_init();
+  iperf3_server_start(IPERF3_PORT, NULL, NULL);
 #endif
 #if LWIP_TCP && LWIP_NETCONN
   tcpecho_init();
+#if TRACE_PACKETS
+  shell_add_stat(trace_print);
+#endif /* TRACE_PACKETS */
+#if SYS_STATS
+  shell_add_stat(sys_pool_stats_print);
+#endif /* SYS_STATS */
+#if SYS_ARCH_TELEMETRY
+  shell_add_stat(sys_telemetry_print);
+#endif /* SYS_ARCH_TELEMETRY */
   shell_init();
   httpd_init();
 #endif
@@ -622,7 +644,7 @@ main(int argc, char **argv)
   /* use debug flags defined by debug.h */
   debug_flags = LWIP_DBG_OFF;
   
-  while ((ch = getopt_long(argc, argv, "dhg:i:m:p:", longopts, NULL)) != -1) {
+  while ((ch = getopt_long(argc, argv, "dhg:i:m:n:p:", longopts, NULL)) != -1) {
     switch (ch) {
       case 'd':
         debug_flags |= (LWIP_DBG_ON|LWIP_DBG_TRACE|LWIP_DBG_STATE|LWIP_DBG_FRESH|LWIP_DBG_HALT);
@@ -642,6 +664,18 @@ main(int argc, char **argv)
         ipaddr_aton(optarg, &netmask);
         break;
 #endif /* LWIP_IPV4 */
+#ifdef LWIP_UNIX_LINUX
+      case 'n':
+        if (strcmp(optarg, "pkt") == 0) {
+          netif_init_func = pktif_init;
+        } else if (strcmp(optarg, "xdp") == 0) {
+          netif_init_func = xdpif_init;
+        } else if (strcmp(optarg, "tap") != 0) {
+          usage();
+          exit(1);
+        }
+        break;
+#endif /* LWIP_UNIX_LINUX */
       case 'p':
         ping_flag = !0;
         ipaddr_aton(optarg, &ping_addr);
@@ -660,6 +694,9 @@ main(int argc, char **argv)
 #ifdef PERF
   perf_init("/tmp/simhost.perf");
 #endif /* PERF */
+#if TRACE_PACKETS
+  trace_init();
+#endif /* TRACE_PACKETS */
 
   printf("System initialized.\n");
     
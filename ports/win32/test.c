@@ -69,6 +69,7 @@
 #include "lwip/apps/snmp.h"
 #include "apps/httpserver/httpserver-netconn.h"
 #include "apps/netio/netio.h"
+#include "apps/iperf3/iperf3.h"
 #include "apps/ping/ping.h"
 #include "apps/rtp/rtp.h"
 #include "apps/chargen/chargen.h"
@@ -571,6 +572,10 @@ apps_init(void)
   netio_init();
 #endif /* LWIP_NETIO_APP && LWIP_TCP */
 
+#if LWIP_IPERF3_APP && LWIP_TCP
+  iperf3_server_start(IPERF3_PORT, NULL, NULL);
+#endif /* LWIP_IPERF3_APP && LWIP_TCP */
+
 #if LWIP_RTP_APP && LWIP_SOCKET && LWIP_IGMP
   rtp_init();
 #endif /* LWIP_RTP_APP && LWIP_SOCKET && LWIP_IGMP */